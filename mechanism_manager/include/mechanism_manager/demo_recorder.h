@@ -0,0 +1,128 @@
+/**
+ * @file   demo_recorder.h
+ * @brief  Lock free recording of the demonstrations in the real time loop.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEMO_RECORDER_H
+#define DEMO_RECORDER_H
+
+////////// STD
+#include <vector>
+#include <atomic>
+#include <cassert>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+
+namespace mechanism_manager
+{
+
+/// Samples of a recorded demonstration, stored in chunks of chunk_size samples (the last one can be
+/// partially filled). The samples are contiguous in a chunk: sample i is at GetSample(i)[0..dim-1].
+class Demonstration
+{
+    friend class DemoRecorder;
+
+  public:
+    Demonstration():dim_(0),chunk_size_(0),n_samples_(0) {}
+
+    inline int GetDim() const {return dim_;}
+    inline long GetNbSamples() const {return n_samples_;}
+    inline bool IsEmpty() const {return n_samples_ == 0;}
+    inline const double* GetSample(const long i) const
+    {
+        assert(i >= 0 && i < n_samples_);
+        return &chunks_[i / chunk_size_][(i % chunk_size_) * dim_];
+    }
+
+    /// Copy the samples in a single matrix, one per row
+    void GetData(Eigen::MatrixXd& data) const;
+    void Clear();
+
+  private:
+    int dim_;
+    int chunk_size_;
+    long n_samples_;
+    std::vector<std::vector<double> > chunks_;
+};
+
+/// The real time loop appends the samples with Record, in chunks preallocated by Start.
+/// Record does not lock or allocate, once max_samples are recorded the others are dropped and counted.
+/// Stop moves the filled chunks into a Demonstration, the samples are never copied: the chunks are
+/// given to the caller and Start allocates new ones only to replace them.
+/// Record is called by one thread, Start and Stop by the others (not concurrently).
+class DemoRecorder
+{
+
+  public:
+    DemoRecorder(const int dim, const int chunk_size, const long max_samples);
+
+    /// Non real time methods
+    void Start(); // Restart if already recording, the previous samples are discarded
+    bool Stop(Demonstration& demo); // False if no samples were recorded
+
+    /// Real time method
+    inline void Record(const double* const sample)
+    {
+        // Dekker style handshake with Stop: either Stop sees in_record_ or Record sees !recording_
+        in_record_.store(true);
+        if(recording_.load())
+        {
+            const long n = n_samples_.load(std::memory_order_relaxed);
+            if(n < max_samples_)
+            {
+                double* const dst = &chunks_[n / chunk_size_][(n % chunk_size_) * dim_];
+                for(int j=0;j<dim_;j++)
+                    dst[j] = sample[j];
+                n_samples_.store(n + 1,std::memory_order_release);
+            }
+            else
+                n_dropped_.store(n_dropped_.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+        }
+        in_record_.store(false,std::memory_order_release);
+    }
+
+    inline bool IsRecording() const {return recording_.load(std::memory_order_relaxed);}
+    inline long GetNbSamples() const {return n_samples_.load(std::memory_order_relaxed);}
+    inline unsigned long GetNbDropped() const {return n_dropped_.load(std::memory_order_relaxed);}
+    inline long GetMaxSamples() const {return max_samples_;}
+
+  private:
+
+    DemoRecorder(const DemoRecorder&);
+    DemoRecorder& operator=(const DemoRecorder&);
+
+    /// Wait for the real time loop to leave Record, it only takes the copy of a sample
+    void Halt();
+
+    int dim_;
+    int chunk_size_;
+    long max_samples_;
+    std::vector<std::vector<double> > chunks_; // An empty chunk was given to a Demonstration
+    std::atomic<bool> recording_;
+    std::atomic<bool> in_record_;
+    std::atomic<long> n_samples_;
+    std::atomic<unsigned long> n_dropped_;
+};
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file   guides_cache.h
+ * @brief  Lazy guides of the libraries, built only when a robot gets close to them.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GUIDES_CACHE_H
+#define GUIDES_CACHE_H
+
+////////// Toolbox
+#include <toolbox/debug.h>
+#include <toolbox/library/library.h>
+
+////////// STD
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+
+////////// BOOST
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace mechanism_manager
+{
+
+/// Bounding box of the recorded states (one per row), enlarged by half of the longest segment
+/// since the guide can be between two recorded points
+void ComputeGuideBox(const Eigen::MatrixXd& states, Eigen::VectorXd& box_min, Eigen::VectorXd& box_max);
+
+/// Guide registered by a library, only what is needed to know when a robot gets close to it
+struct LazyGuide
+{
+  std::string name;
+  int lib_idx;
+  int record_idx;
+  Eigen::VectorXd box_min;
+  Eigen::VectorXd box_max;
+  Eigen::VectorXd initial_state; // Recorded states at phase 0 and 1
+  Eigen::VectorXd final_state;
+  bool resident; // Built and published by the cache
+  uint64_t last_used; // Last check with a robot in its neighborhood
+};
+
+/// The libraries stay mapped and their records are indexed with the boxes and the endpoints of the recorded
+/// states, nothing is built. Periodically the manager gives the positions of the robots (tracked by the real
+/// time loop) and the names of the published guides to Select, which returns the guides to build (a robot is
+/// closer than load_dist to their boxes) and the ones to remove to stay under max_resident, the least recently
+/// used first. The guides close to a robot are never evicted, if they are more than max_resident the closest
+/// ones are loaded. A published guide with the name of a lazy guide but not built by the cache (e.g. inserted
+/// from a file) hides it, a resident guide renamed or deleted by the user is not resident anymore.
+class GuidesCache
+{
+
+  public:
+    GuidesCache(const int position_dim, const int max_robots);
+
+    /// Register all the records of the library, return the number of guides added.
+    /// The records without recorded states of position_dim or with an already registered name are skipped.
+    int Add(const std::string& library_path);
+
+    /// Real time method, the robots beyond max_robots are not tracked
+    inline void Track(const double* const positions, const int n_robots)
+    {
+        const int n = std::min(n_robots,max_robots_) * position_dim_;
+        // Sequence lock, the sequence is odd while the positions are written
+        const unsigned int seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(int i=0;i<n;i++)
+            positions_[i].store(positions[i],std::memory_order_relaxed);
+        n_tracked_.store(n / position_dim_,std::memory_order_relaxed);
+        seq_.store(seq + 2,std::memory_order_release);
+    }
+
+    /// Return false if the real time loop did not track the robots yet
+    bool GetPositions(std::vector<Eigen::VectorXd>& positions) const;
+
+    /// Non real time method, called by a single thread. published_names are the guides published now,
+    /// to_load the indexes (see GetRecord) of the guides to build, to_evict the names of the guides to delete.
+    /// The caller marks the guides it did publish with SetResident, to_evict are already not resident.
+    void Select(const std::vector<Eigen::VectorXd>& positions, const std::vector<std::string>& published_names,
+                const double load_dist, const int max_resident, std::vector<int>& to_load, std::vector<std::string>& to_evict);
+    void SetResident(const int idx, const bool resident);
+
+    /// The record stays valid while the cache exists
+    library::RecordView GetRecord(const int idx) const;
+    LazyGuide GetGuide(const int idx) const;
+    int GetNbGuides() const;
+    int GetNbResident() const;
+
+  private:
+
+    GuidesCache(const GuidesCache&);
+    GuidesCache& operator=(const GuidesCache&);
+
+    int position_dim_;
+    int max_robots_;
+
+    std::vector<boost::shared_ptr<library::Library> > libs_;
+    std::vector<LazyGuide> guides_;
+    uint64_t n_checks_;
+    mutable boost::mutex mtx_;
+
+    /// Written by the real time loop
+    std::vector<std::atomic<double> > positions_;
+    std::atomic<int> n_tracked_;
+    std::atomic<unsigned int> seq_;
+};
+
+}
+
+#endif
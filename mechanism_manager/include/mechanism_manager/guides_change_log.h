@@ -0,0 +1,90 @@
+/**
+ * @file   guides_change_log.h
+ * @brief  Revisions of the guides list, to synchronize the clients with the changes only.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GUIDES_CHANGE_LOG_H
+#define GUIDES_CHANGE_LOG_H
+
+////////// STD
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <stdint.h>
+
+////////// BOOST
+#include <boost/thread.hpp>
+
+namespace mechanism_manager
+{
+
+enum guide_delta_t {GUIDE_INSERTED = 0, GUIDE_DELETED, GUIDE_RENAMED};
+
+/// A change of the guides list, applied in order: idx is the index in the list after the previous changes
+struct GuideDelta
+{
+  unsigned long revision; // Revision of the list once the change is applied
+  guide_delta_t type;
+  int idx;
+  std::string name; // Empty for GUIDE_DELETED
+};
+
+/// The manager gives each new list of names (Publish) and each rename, the log keeps a copy of the
+/// names and the last max_deltas changes, each one increasing the revision. A client keeps the revision
+/// of its copy of the list and asks the changes since it. The log has its own lock, so the clients
+/// do not wait for the manager services and read only what changed.
+/// The revisions restart with each log, the random session of the log tells a client that its revision
+/// belongs to another one (e.g. the manager restarted).
+class GuidesChangeLog
+{
+
+  public:
+    GuidesChangeLog(const size_t max_deltas = 1024);
+
+    /// The names are unique and the guides kept by the new list are in the same order: the changes
+    /// are the deletions of the missing names, then the insertions of the new ones
+    void Publish(const std::vector<std::string>& names);
+    void Rename(const int idx, const std::string& name);
+
+    /// Return false if since is 0 or too old (or newer than the log), or if the session of the client is not the
+    /// one of the log: then names is the whole list and deltas is empty, otherwise deltas are the changes since it
+    bool GetChanges(const uint64_t session, const unsigned long since, std::vector<GuideDelta>& deltas, std::vector<std::string>& names,
+                    uint64_t& current_session, unsigned long& revision) const;
+
+    inline unsigned long GetRevision() const {return revision_.load(std::memory_order_acquire);}
+    inline uint64_t GetSession() const {return session_;}
+
+  private:
+
+    void Append(const guide_delta_t type, const int idx, const std::string& name);
+
+    uint64_t session_; // Never 0, the session of a client without a copy of the list
+    size_t max_deltas_;
+    std::vector<std::string> names_;
+    std::deque<GuideDelta> deltas_;
+    std::atomic<unsigned long> revision_;
+    mutable boost::mutex mtx_;
+};
+
+}
+
+#endif
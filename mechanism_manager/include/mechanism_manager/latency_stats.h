@@ -0,0 +1,172 @@
+/**
+ * @file   latency_stats.h
+ * @brief  Latency histograms of the stages of the mechanism manager update.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+////////// STD
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+namespace mechanism_manager
+{
+
+/// Monotonic time in ns, clock_gettime is served by the vdso without a system call
+inline int64_t GetTimeNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+/// Histogram of durations with fixed log-linear buckets: 4 buckets per power of two
+/// (25% of resolution) from 1ns to about 8s, the last bucket also counts the longer ones.
+/// It is written by a single thread with plain atomic stores (no read-modify-write),
+/// the other threads can read it at any time.
+class LatencyHistogram
+{
+
+  public:
+
+    static const int n_buckets = 128;
+
+    LatencyHistogram() {Clear();}
+
+    /// Real time method, called by the writer thread only
+    inline void Add(const int64_t ns)
+    {
+        const int bucket = GetBucket(ns);
+        counts_[bucket].store(counts_[bucket].load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+        count_.store(count_.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+        sum_.store(sum_.load(std::memory_order_relaxed) + ns,std::memory_order_relaxed);
+        if(ns > max_.load(std::memory_order_relaxed))
+            max_.store(ns,std::memory_order_relaxed);
+    }
+
+    /// Called by the writer thread only
+    void Clear();
+
+    inline uint64_t GetCount() const {return count_.load(std::memory_order_relaxed);}
+    inline int64_t GetMax() const {return max_.load(std::memory_order_relaxed);}
+    inline double GetMean() const {const uint64_t n = GetCount(); return n > 0 ? static_cast<double>(sum_.load(std::memory_order_relaxed))/n : 0.0;}
+    inline uint64_t GetBucketCount(const int bucket) const {return counts_[bucket].load(std::memory_order_relaxed);}
+
+    /// Upper bound of the bucket containing the percentile p (0-100), bounded by the max
+    int64_t GetPercentile(const double p) const;
+
+    static inline int GetBucket(const int64_t ns)
+    {
+        if(ns < 4)
+            return ns > 0 ? ns : 0;
+        const int msb = 63 - __builtin_clzll(static_cast<uint64_t>(ns));
+        const int bucket = (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+        return bucket < n_buckets ? bucket : n_buckets - 1;
+    }
+    static inline int64_t GetBucketLowerBound(const int bucket)
+    {
+        if(bucket < 4)
+            return bucket;
+        return static_cast<int64_t>(4 + bucket % 4) << (bucket / 4 - 1);
+    }
+
+  private:
+
+    std::atomic<uint64_t> counts_[n_buckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<int64_t> sum_;
+    std::atomic<int64_t> max_;
+};
+
+/// Stages of MechanismManager::Update, the tick is the whole update
+enum latency_stage_t {STAGE_GUIDES = 0, STAGE_SCALES, STAGE_FADE, STAGE_FORCES, STAGE_TICK, N_STAGES};
+
+/// Histograms of the stages, number of ticks longer than the deadline and capture of the
+/// worst tick. Updated by the real time loop, reported and reset by the non real time methods.
+class LatencyStats
+{
+
+  public:
+
+    LatencyStats();
+
+    /// Real time method: t[0] is the beginning of the tick, t[i+1] the end of the stage i
+    inline void Add(const int64_t* t, const int64_t deadline_ns, const int n_guides, const uint64_t tick)
+    {
+        if(reset_requested_.load(std::memory_order_relaxed))
+            Clear();
+
+        int64_t durations[N_STAGES];
+        for(int i=0; i<STAGE_TICK; i++)
+        {
+            durations[i] = t[i+1] - t[i];
+            stages_[i].Add(durations[i]);
+        }
+        durations[STAGE_TICK] = t[STAGE_TICK] - t[0];
+        stages_[STAGE_TICK].Add(durations[STAGE_TICK]);
+
+        if(deadline_ns > 0 && durations[STAGE_TICK] > deadline_ns)
+            n_overruns_.store(n_overruns_.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+
+        // Capture the worst tick, the sequence is odd while it is written
+        if(durations[STAGE_TICK] > worst_[STAGE_TICK].load(std::memory_order_relaxed))
+        {
+            const unsigned int seq = worst_seq_.load(std::memory_order_relaxed);
+            worst_seq_.store(seq + 1,std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for(int i=0; i<N_STAGES; i++)
+                worst_[i].store(durations[i],std::memory_order_relaxed);
+            worst_tick_.store(tick,std::memory_order_relaxed);
+            worst_n_guides_.store(n_guides,std::memory_order_relaxed);
+            worst_seq_.store(seq + 2,std::memory_order_release);
+        }
+    }
+
+    /// The statistics are cleared by the real time loop at its next tick
+    inline void RequestReset() {reset_requested_.store(true);}
+
+    /// Human readable report of the statistics, in us
+    std::string GetReport() const;
+
+    inline const LatencyHistogram& GetHistogram(const latency_stage_t stage) const {return stages_[stage];}
+    inline uint64_t GetNbOverruns() const {return n_overruns_.load(std::memory_order_relaxed);}
+
+  private:
+
+    void Clear();
+
+    LatencyHistogram stages_[N_STAGES];
+    std::atomic<uint64_t> n_overruns_;
+
+    std::atomic<unsigned int> worst_seq_;
+    std::atomic<int64_t> worst_[N_STAGES];
+    std::atomic<uint64_t> worst_tick_;
+    std::atomic<int> worst_n_guides_;
+
+    std::atomic<bool> reset_requested_;
+};
+
+}
+
+#endif
@@ -27,6 +27,8 @@
 ////////// Toolbox
 #include <toolbox/toolbox.h>
 #include <toolbox/filters/filters.h>
+#include <toolbox/gmm/summary.h>
+#include <toolbox/filters/demo_reducer.h>
 
 ////////// ROS
 #include <ros/ros.h>
@@ -39,6 +41,12 @@
 
 ///////// MECHANISM_MANAGER
 #include "mechanism_manager/mechanism_manager_interface.h"
+#include "mechanism_manager/worker_pool.h"
+#include "mechanism_manager/telemetry.h"
+#include "mechanism_manager/latency_stats.h"
+#include "mechanism_manager/demo_recorder.h"
+#include "mechanism_manager/guides_change_log.h"
+#include "mechanism_manager/guides_cache.h"
 
 namespace mechanism_manager
 {
@@ -46,14 +54,77 @@ namespace mechanism_manager
 typedef boost::recursive_mutex mutex_t;
 typedef virtual_mechanism::VirtualMechanismInterface vm_t;
 
+/// What the real time loop does with a guide for a robot in the current tick (see ScheduleGuides)
+enum guide_schedule_t {GUIDE_CULLED = 0, GUIDE_SKIPPED, GUIDE_UPDATED};
+
 struct GuideStruct
 {
   std::string name;
-  double scale;
-  double scale_hard;
-  double scale_t;
-  boost::shared_ptr<vm_t> guide;
-  boost::shared_ptr<tool_box::DynSystemFirstOrder> fade;
+  boost::shared_ptr<vm_t> guide; // Not modified once published, it can be read by any thread
+  boost::shared_ptr<vm_t> instance; // Copy of the guide used as scratch by the real time loop (see PackBank)
+};
+
+/// Packed guides data used by the real time loop (structure of arrays).
+/// Element (column) i belongs to the guide i of the buffer with the same index.
+/// It is allocated in the non real time methods, Update only writes into it.
+/// The bank keeps the data shared by all the robots, RobotBank the data of each robot.
+struct GuideBank
+{
+  void Resize(const int n_guides, const int position_dim);
+
+  Eigen::MatrixXd K; // Diagonals of the gains
+  Eigen::MatrixXd B;
+  Eigen::MatrixXd box_min; // Bounding boxes of the guides, used to skip the far guides
+  Eigen::MatrixXd box_max;
+};
+
+/// Guides data of a robot. The guides (models, tables, recorded refs) are shared by all the robots,
+/// each robot only keeps its own state of the guides (phase, fade...): it is loaded in the guide
+/// before its update and saved back right after it.
+struct RobotBank
+{
+  void Resize(const int n_guides, const int position_dim, const int guide_state_size);
+
+  Eigen::VectorXd position; // Robot state of the tick
+  Eigen::VectorXd velocity;
+  Eigen::VectorXd f_out;
+  Eigen::VectorXd scale;
+  Eigen::VectorXd scale_hard;
+  Eigen::VectorXd scale_t; // Fade filters states
+  Eigen::VectorXd phase;
+  Eigen::MatrixXd state;
+  Eigen::MatrixXd state_dot;
+  Eigen::MatrixXd t_versor;
+  Eigen::MatrixXd guide_states; // Column i: state of the guide i (vm_t::SaveInstanceState)
+  Eigen::MatrixXd inv_variance; // Gaussians of the guides around their states (vm_t::getLogDensity)
+  Eigen::VectorXd log_norm;
+  /// Multi rate scheduling: the skipped guides are extrapolated in the bank, elapsed is the time
+  /// since their last update, given to the guide at its next update
+  std::vector<unsigned char> schedule; // guide_schedule_t
+  Eigen::VectorXd elapsed;
+  Eigen::VectorXi n_skipped;
+  Eigen::VectorXd scale_est; // Scales with the extrapolated states
+  int next_low_rate; // Round robin over the low rate guides
+  /// For computations
+  Eigen::MatrixXd f_vm;
+  Eigen::MatrixXd t_versor_scaled;
+  Eigen::VectorXd f_tangent;
+  Eigen::VectorXd log_prob;
+};
+
+/// Snapshot of the guides published to the real time loop.
+/// Once published the guides list and its guides are not modified anymore, only the banks and the
+/// instances of the guides are written by the real time loop.
+/// The robot banks are written under a seqlock: robots_seq is odd during an Update, the non real time
+/// methods copy them and retry if it changed meanwhile (see ReadRobots).
+struct GuideSet
+{
+  GuideSet():epoch(0),robots_seq(0) {}
+  std::vector<GuideStruct> guides;
+  GuideBank bank;
+  std::vector<RobotBank> robots;
+  unsigned long epoch; // Publication number
+  std::atomic<uint32_t> robots_seq;
 };
 
 class MechanismManager
@@ -70,6 +141,9 @@ class MechanismManager
   
     /// Loop Update Interface
     void Update(const Eigen::VectorXd& robot_position, const Eigen::VectorXd& robot_velocity, double dt, Eigen::VectorXd& f_out);
+    /// Batched update of all the robots in a single pass over the guides, the robot k is at
+    /// robots_position + k * position_dim (same for the velocities and f_out)
+    void Update(const double* robots_position, const double* robots_velocity, const int n_robots, double dt, double* f_out);
 
     /// Non Real time methods, to be launched in seprated threads
     void InsertVm(std::string& model_name);
@@ -79,37 +153,108 @@ class MechanismManager
     void UpdateVm(Eigen::MatrixXd& data, const int idx);
     void ClusterVm(Eigen::MatrixXd& data);
     void ClusterVm(double* data, const int n_rows);
+    /// Demonstrations recorded by the real time loop, the shared pointer is the only thing copied into the job
+    void InsertRecordedVm(boost::shared_ptr<const Demonstration> demo);
+    void ClusterRecordedVm(boost::shared_ptr<const Demonstration> demo);
     void SaveVm(const int idx);
+    /// Binary library of guides in models/library, all the guides are loaded in one call.
+    /// With lazy_load_dist the guides are only registered, see GuidesCache.
+    void InsertLibrary(std::string& library_name);
+    void SaveLibrary(std::string& library_name);
+    /// The next libraries are fully loaded, the guides already built by the cache stay. Used by the capture and the replay
+    /// since the loads and the evictions of the cache depend on the timing. NOTE Do not call it while Update is running
+    void DisableGuidesCache();
     void GetVmName(const int idx, std::string& name);
     void SetVmName(const int idx, std::string& name);
     void GetVmNames(std::vector<std::string>& names);
+    /// Changes of the guides list since a revision (see GuidesChangeLog::GetChanges), mtx_ is not locked
+    bool GetVmChanges(const uint64_t session, const unsigned long since, std::vector<GuideDelta>& deltas, std::vector<std::string>& names,
+                      uint64_t& current_session, unsigned long& revision);
     void SetVmMode(const scale_mode_t mode);
     scale_mode_t& GetVmMode();
     void SetMergeThreshold(double merge_th);
     void GetMergeThreshold(double& merge_th);
-
+    void SetNbWorkers(const int n_workers); // NOTE Do not call it while Update is running
+    inline int GetNbWorkers() const {return n_workers_;}
+    void SetNbRobots(const int n_robots); // The new robots start from the state of the robot 0
+    /// Scheduling of the guides updates (see ScheduleGuides), as in the configuration. NOTE Do not call them while Update is running
+    void SetCulling(const double cull_epsilon); // 0 to update all the guides
+    void SetMultiRate(const double low_rate_th, const int low_rate_budget, const int low_rate_max_period); // low_rate_th 0 to update all at each tick
+    int GetNbRobots();
+    void ReloadConfig(); // Parse the configuration files again, used by the guides created afterwards
+    unsigned long GetEpoch(); // Publication number of the last guides set
+    void GetLatencyStats(std::string& report); // Timing of the update stages, the deadline is the dt of Update
+    void ResetLatencyStats();
 
     /// Real time methods, they can be called in a real time loop
     inline int GetPositionDim() const {return position_dim_;}
     int GetNbVms();
-    void GetVmPosition(const int idx, Eigen::VectorXd& position);
-    void GetVmVelocity(const int idx, Eigen::VectorXd& velocity);
-    double GetPhase(const int idx);
-    double GetScale(const int idx);
+    void GetVmPosition(const int idx, Eigen::VectorXd& position, const int robot_idx = 0);
+    void GetVmVelocity(const int idx, Eigen::VectorXd& velocity, const int robot_idx = 0);
+    double GetPhase(const int idx, const int robot_idx = 0);
+    double GetScale(const int idx, const int robot_idx = 0);
     void SetMode(const scale_mode_t mode);
-    void Stop();
-    bool OnVm();
-    void SetCollisionDetected(const bool collision);
+    void Stop(); // All the robots, done by the next Update
+    bool OnVm(const int robot_idx = 0);
+    void SetCollisionDetected(const bool collision); // Shared by all the robots, applied by the next Update
+    /// Guides set used by the last Update, to be called by the thread of the real time loop
+    inline unsigned long GetRtEpoch() const {return rt_epoch_.load(std::memory_order_relaxed);}
+
+    /// Step of the fade filters of a robot: the active one goes to 1, the others to 0, with the time constant fade_time.
+    /// The first order filters are integrated exactly, so the fade does not depend on the period of Update
+    static void IntegrateFade(Eigen::VectorXd& scale_t, const int i_active, const double fade_time, const double dt);
+
+    /// Score of a guide for a demonstration used by ClusterVm: the log likelihood of data (ComputeResponsability),
+    /// with a coreset the one of its points given the guide summary (ComputeMergeScore). False if there is no summary
+    static bool ComputeMergeScore(const vm_t* const guide, const Eigen::MatrixXd& data, const gmm::Coreset* const coreset, double& score);
+    /// The same metric on both paths: the ratio of the scores of a guide and of the guide fitted on the demonstration,
+    /// a guide explaining the demonstration better than it is merged anyway
+    static inline double RelativeMergeScore(const double score, const double max_score) {return std::min(score/max_score,1.0);}
 
   protected:
 
     bool ReadConfig();
     void AddNewVm(vm_t* const vm_tmp_ptr, std::string& name);
+    void AddNewVms(const std::vector<vm_t*>& vms, const std::vector<std::string>& names);
+    int RemoveVms(const std::vector<std::string>& names); // A single publication, return the number of guides removed
     bool CheckForNamesCollision(const std::string& name);
+    void PackBank(GuideSet& new_set, const std::vector<int>& src_idx, const int n_robots);
+    void PublishSet(GuideSet* const new_set);
+    void ReclaimSets();
+    /// Readers outside of the real time loop: the pinned set is not deleted until UnpinSet, they do not lock
+    GuideSet* PinSet();
+    void UnpinSet();
+    static void ReadRobots(const GuideSet& set, std::vector<RobotBank>& robots);
+    void UpdateGuides(const int first_idx, const int last_idx);
+    void RecordTick(const GuideSet& rt_set, const int64_t tick_start, const int64_t tick_end);
+    void ScheduleGuides(RobotBank& robot, const GuideBank& bank, const double dt);
+    void ComputePosteriors(RobotBank& robot);
+    /// Build the lazy guides close to the robots and evict the least recently used ones
+    void CheckCache();
+    void CacheLoop();
+    static void UpdateGuidesJob(void* mm, const int worker_idx, const int n_workers);
+    /// Relative scores of the guides (see RelativeMergeScore), max_score is the one of the new guide.
+    /// With a coreset the guides are compared with their summaries, otherwise data is fully evaluated by the function approximators
+    void FindClosestVm(const std::vector<GuideStruct>& guides, const Eigen::MatrixXd& data, const gmm::Coreset* const coreset, const double max_score, const double exit_th, int& max_idx, double& max_rel_lik);
 
     scale_mode_t scale_mode_;
 
     double merge_th_;
+    double merge_exit_th_; // ClusterVm stops looking for the closest guide once one reaches it
+    int n_cluster_threads_; // Threads used to compare the demonstration to the guides, 0 for all the cores
+    int merge_coreset_size_; // Points of the demonstration compared to the guide summaries, 0 to use all the samples
+
+    /// Crop, filter and decimate a demonstration before a guide is built from it, returns false if too few points are left
+    bool ReduceData(Eigen::MatrixXd& data);
+    /// The recorded samples are read in place by the reducer, only the kept points are copied in data
+    bool ReduceData(const Demonstration& demo, Eigen::MatrixXd& data);
+    void InsertReducedVm(const Eigen::MatrixXd& data);
+    void ClusterReducedVm(Eigen::MatrixXd& data);
+
+    double demo_sample_period_; // [s] Period of the recorded samples
+    double demo_crop_dist_; // Samples moving less than it are dropped
+    double demo_cutoff_freq_; // [Hz] Low pass filter of the samples, 0 to disable it
+    double demo_ds_; // Arc length between two kept points, 0 to only crop the data
 
   private:   
     
@@ -118,26 +263,66 @@ class MechanismManager
     virtual_mechanism::VirtualMechanismFactory vm_factory_;
 
     /// For computations
-    Eigen::VectorXd f_K_;
-    Eigen::VectorXd f_B_;
-    Eigen::VectorXd f_vm_;
-    Eigen::VectorXd err_pos_;
-    Eigen::VectorXd err_vel_;
-    Eigen::VectorXd robot_position_;
-    Eigen::VectorXd robot_velocity_;
+    Eigen::VectorXd f_sum_;
+    Eigen::VectorXd f_self_;
+    Eigen::MatrixXd projector_; // Sum of the weighted jacobian versors projections
+    Eigen::VectorXd pos_err_;
 
     int position_dim_;
 
     double escape_factor_;
+    double cull_epsilon_; // Guides with a scale surely lower than it are not updated, 0 to update all
+    double cull_dist_;
+    double low_rate_th_; // Guides with a lower scale_hard are updated at a lower rate, 0 to update all at each tick
+    int low_rate_budget_; // Low rate guides updated at each tick (for each robot)
+    int low_rate_max_period_; // [ticks] A low rate guide is updated at least once in this period, even beyond the budget
+    double fade_time_; // [s] Time constant of the fade filters
+
+    /// Parallel update of the guides
+    WorkerPool* worker_pool_;
+    int n_workers_;
+    std::vector<int> workers_cpus_;
+    int workers_priority_;
+    GuideSet* job_set_;
+    int job_n_robots_;
+    double job_dt_;
+    bool job_stop_;
+    bool job_collision_;
+
+    /// Telemetry, NULL if disabled
+    Telemetry* telemetry_;
+    int telemetry_buffer_size_; // 0 to disable the telemetry
+    std::string telemetry_log_file_;
+    int64_t telemetry_start_; // [ns]
+    uint64_t tick_;
+
+    /// Lazy guides of the libraries, NULL if disabled
+    GuidesCache* guides_cache_;
+    double lazy_load_dist_; // A guide is built when a robot is closer than it to its box, 0 to build all the library guides
+    int lazy_max_resident_; // Guides built by the cache, 0 for no limit
+    double lazy_check_period_; // [s]
+    std::atomic<bool> cache_stop_;
+    boost::thread cache_thread_;
+
+    /// Always on timing of the update stages
+    LatencyStats latency_stats_;
 
     std::string pkg_path_;
     int guide_unique_id_; // Incremental id
 
-    /// Double buffer http://gameprogrammingpatterns.com/double-buffer.html
-    /// Mechanism used: Page-flipping
-    std::vector<GuideStruct> vm_buffers_[2];
-    std::atomic<int> rt_idx_; // atom
-    std::atomic<int> no_rt_idx_; // atom
+    /// Guides publication (RCU like): the non real time methods build a new set under mtx_
+    /// and publish it with an atomic pointer swap, the real time loop never waits.
+    /// At each Update the real time loop acknowledges the epoch of the set it is using,
+    /// the replaced sets are deleted once the real time loop acknowledged a newer epoch.
+    std::atomic<GuideSet*> rt_set_;
+    std::atomic<unsigned long> rt_epoch_;
+    std::vector<GuideSet*> retired_sets_;
+    std::atomic<int> n_pins_; // Readers outside of the real time loop holding the published set (see PinSet)
+    GuidesChangeLog change_log_; // Names of the published sets
+    std::atomic<bool> hard_mode_requested_; // Pass to HARD once on a guide
+    std::atomic<bool> stop_requested_; // The guides states are owned by the real time loop
+    std::atomic<bool> collision_detected_;
+    int n_robots_; // Read from the configuration, applied at the construction
     mutex_t mtx_;
 };
 
@@ -37,13 +37,19 @@
 ////////// BOOST
 #include <boost/thread.hpp>
 
+///////// MECHANISM_MANAGER
+#include "mechanism_manager/guides_change_log.h"
+#include "mechanism_manager/trace.h"
+
 
 namespace mechanism_manager
 {
 
-enum scale_mode_t {HARD,SOFT};
+/// PROB selects the guides with their gaussians (see MechanismManager::Update), then scales them as SOFT
+enum scale_mode_t {HARD,SOFT,PROB};
 class MechanismManagerServer;
 class MechanismManager;
+class DemoRecorder;
 static bool default_threading_on = false;
 
 class MechanismManagerInterface
@@ -56,9 +62,17 @@ class MechanismManagerInterface
     /// Real time loop
     void Update(const Eigen::VectorXd& robot_pose, const Eigen::VectorXd& robot_velocity, double dt, Eigen::VectorXd& f_out);
     void Update(const double* robot_position_ptr, const double* robot_velocity_ptr, double dt, double* f_out_ptr);
+    /// Batched update of several robots sharing the same guides, the columns (the consecutive
+    /// blocks of position_dim values for the raw vectors) are the robots
+    void Update(const Eigen::MatrixXd& robots_position, const Eigen::MatrixXd& robots_velocity, double dt, Eigen::MatrixXd& f_out);
+    void Update(const double* robots_position_ptr, const double* robots_velocity_ptr, const int n_robots, double dt, double* f_out_ptr);
 
     /// Non real time async services
     /// threading enables the use of separate threads to ensure the real time
+    /// With capture_file in the configuration the updates and the services changing the guides are captured,
+    /// a service once it is done. The real time setters (SetVmMode(scale_mode_t), Stop...) are not captured.
+    /// NOTE During a capture the services run one at a time, a sync service waits for the async one running.
+    /// The guides cache is disabled, the libraries are fully loaded.
     void InsertVm(std::string& model_name, bool threading = default_threading_on);
     void InsertVm(Eigen::MatrixXd& data, bool threading = default_threading_on);
     void InsertVm(double* data, const int n_rows, bool threading = default_threading_on);
@@ -67,34 +81,61 @@ class MechanismManagerInterface
     void ClusterVm(Eigen::MatrixXd& data, bool threading = default_threading_on);
     void ClusterVm(double* data, const int n_rows, bool threading = default_threading_on);
     void SaveVm(const int idx, bool threading = default_threading_on);
+    void InsertLibrary(std::string& library_name, bool threading = default_threading_on);
+    void SaveLibrary(std::string& library_name, bool threading = default_threading_on);
+    /// Wait until the async services queued are done
+    void WaitVmServices();
+
+    /// Demonstration recording: from StartRecording each Update appends the position of the robot
+    /// (the first one for the batched updates) without locks or allocations, the recorded samples
+    /// are then moved to the service creating or clustering the guide, not copied
+    void StartRecording();
+    void InsertRecordedVm(bool threading = default_threading_on);
+    void ClusterRecordedVm(bool threading = default_threading_on);
+    void DiscardRecording();
+    bool IsRecording();
+    long GetNbRecordedSamples();
 
     /// Non real time sync services
     void GetVmName(const int idx, std::string& name);
     void SetVmName(const int idx, std::string& name);
     void GetVmNames(std::vector<std::string>& names);
+    /// Changes of the guides list since the revision of the caller copy, all the names if since is 0 or too old, or if
+    /// session is not the one of this manager (returns false). Each delta changes the list as left by the previous one,
+    /// revision is the one of the list after the last delta, current_session the one to give with it.
+    bool GetVmChanges(const uint64_t session, const unsigned long since, std::vector<GuideDelta>& deltas, std::vector<std::string>& names,
+                      uint64_t& current_session, unsigned long& revision);
     void SetVmMode(const std::string mode);
 
     /// Stop the mechanisms
     void Stop();
 
     /// Check if the robot is on a guide
-    bool OnVm();
+    bool OnVm(const int robot_idx = 0);
 
     /// Gets
     inline int GetPositionDim() const {return position_dim_;}
     int GetNbVms();
-    void GetVmPosition(const int idx, Eigen::VectorXd& position);
-    void GetVmVelocity(const int idx, Eigen::VectorXd& velocity);
-    void GetVmPosition(const int idx, double* const position_ptr);
-    void GetVmVelocity(const int idx, double* const velocity_ptr);
-    double GetPhase(const int idx);
-    double GetScale(const int idx);
+    int GetNbRobots();
+    void GetVmPosition(const int idx, Eigen::VectorXd& position, const int robot_idx = 0);
+    void GetVmVelocity(const int idx, Eigen::VectorXd& velocity, const int robot_idx = 0);
+    void GetVmPosition(const int idx, double* const position_ptr, const int robot_idx = 0);
+    void GetVmVelocity(const int idx, double* const velocity_ptr, const int robot_idx = 0);
+    double GetPhase(const int idx, const int robot_idx = 0);
+    double GetScale(const int idx, const int robot_idx = 0);
     void GetVmMode(std::string& mode);
     void GetMergeThreshold(double& merge_th);
+    int GetNbWorkers();
+    void GetLatencyStats(std::string& report); // Timing of the stages of Update, overruns and worst tick
+
+    /// Resets
+    void ResetLatencyStats();
 
     /// Sets
     void SetVmMode(const scale_mode_t mode);
     void SetMergeThreshold(double merge_th);
+    void SetNbWorkers(const int n_workers);
+    void SetNbRobots(const int n_robots); // Not real time, the new robots start from the state of the robot 0
 
     /// Sets
     void SetCollisionDetected(const bool collision);
@@ -103,6 +144,12 @@ class MechanismManagerInterface
 
     bool ReadConfig();
 
+    /// Run the service, then capture it once done (entry is NULL if the capture is disabled)
+    void RunService(const tool_box::AsyncThread::funct_t& service, const boost::shared_ptr<const TraceEntry>& entry, const bool threading);
+    void CaptureService(const tool_box::AsyncThread::funct_t& service, const boost::shared_ptr<const TraceEntry>& entry);
+    boost::shared_ptr<const TraceEntry> MakeEntry(const trace_entry_t type, const long idx, const std::string& name = "",
+                                                  const Eigen::MatrixXd& data = Eigen::MatrixXd());
+
   private:
 
     /// Used to convert std to eigen vector
@@ -117,6 +164,18 @@ class MechanismManagerInterface
     /// Mechanism Manager
     MechanismManager* mm_;
 
+    /// Demonstration recording
+    DemoRecorder* recorder_;
+    int record_chunk_size_; // Samples per chunk
+    long record_max_samples_; // The samples beyond it are dropped
+
+    /// Capture of the updates and of the services changing the guides, to replay them offline
+    /// (see mechanism_manager_replay). NULL if disabled.
+    TraceWriter* capture_;
+    std::string capture_file_; // Empty to disable the capture
+    int capture_buffer_size_; // Ticks in the ring
+    boost::mutex capture_mtx_; // Captured services
+
     /// Thread stuff
     tool_box::AsyncThread* async_thread_;
 
@@ -0,0 +1,372 @@
+/**
+ * @file   shared_memory.h
+ * @brief  Lock free exchange of the robot state and of the guides force through POSIX shared memory.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+// NOTE: This header is used by the control process, it does not depend on ros, eigen or the
+// toolbox. The control process only includes it and links librt.
+
+////////// STD
+#include <string>
+#include <vector>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <time.h>
+
+////////// POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace mechanism_manager
+{
+
+static const int shm_max_dim = 3;
+static const char shm_magic[8] = {'V','F','S','H','M','\0','\0','\0'};
+static const uint32_t shm_version = 1;
+
+/// Block of doubles with a single writer (seqlock): the sequence is odd while the block is written,
+/// a reader retries if the sequence changed while it was reading. Nobody waits for the other side.
+/// The values are relaxed atomics (plain loads and stores on x86) so that the concurrent
+/// accesses are well defined, they are lock free and address free, so they work across processes.
+template <int N>
+struct SeqBlock
+{
+    std::atomic<uint32_t> seq;
+    std::atomic<double> data[N];
+
+    inline void Write(const double* in)
+    {
+        const uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1,std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(int i=0; i<N; i++)
+            data[i].store(in[i],std::memory_order_relaxed);
+        seq.store(s + 2,std::memory_order_release);
+    }
+
+    /// Return false if the block was written meanwhile, out is not valid then
+    inline bool TryRead(double* out) const
+    {
+        const uint32_t s = seq.load(std::memory_order_acquire);
+        if(s & 1)
+            return false;
+        for(int i=0; i<N; i++)
+            out[i] = data[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) == s;
+    }
+
+    /// A torn read means that the writer is in the middle of a write: retry a few times
+    inline bool Read(double* out, const int max_retries = 16) const
+    {
+        for(int i=0; i<max_retries; i++)
+            if(TryRead(out))
+                return true;
+        return false;
+    }
+};
+
+/// Exchange of one robot, each block is in its own cache line.
+/// command: tick, dt, position[shm_max_dim], velocity[shm_max_dim], written by the controller
+/// force: tick of the command used, f_out[shm_max_dim], written by the guides engine
+/// The ticks are counted by the controller from 1, 0 means that nothing was written yet.
+struct ShmSlot
+{
+    static const int command_size = 2 + 2 * shm_max_dim;
+    static const int force_size = 1 + shm_max_dim;
+
+    alignas(64) SeqBlock<command_size> command;
+    alignas(64) SeqBlock<force_size> force;
+};
+
+struct ShmHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t position_dim;
+    std::atomic<uint64_t> heartbeat; // Incremented by the engine loop, to detect a dead engine
+};
+
+/// The slots start on the cache line after the header
+static const size_t shm_slots_offset = ((sizeof(ShmHeader) + 63) / 64) * 64;
+
+inline size_t GetShmSize(const int n_slots)
+{
+    return shm_slots_offset + n_slots * sizeof(ShmSlot);
+}
+
+/// Controller side, the real time methods do not lock, allocate or call the system
+class SharedMemoryClient
+{
+    public:
+
+        SharedMemoryClient():base_(NULL),size_(0),slot_(NULL),position_dim_(0),tick_(0) {}
+        ~SharedMemoryClient() {Close();}
+
+        /// Map the shared memory created by the engine, return false if it does not exist or it is not compatible
+        bool Open(const std::string& name, const int slot_idx = 0)
+        {
+            Close();
+            const int fd = ::shm_open(name.c_str(),O_RDWR,0);
+            if(fd < 0)
+                return false;
+            struct stat st;
+            if(::fstat(fd,&st) != 0 || static_cast<size_t>(st.st_size) < shm_slots_offset)
+            {
+                ::close(fd);
+                return false;
+            }
+            void* addr = ::mmap(NULL,st.st_size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+            ::close(fd); // The mapping stays valid
+            if(addr == MAP_FAILED)
+                return false;
+            base_ = static_cast<char*>(addr);
+            size_ = st.st_size;
+
+            const ShmHeader* header = GetHeader();
+            if(std::memcmp(header->magic,shm_magic,sizeof(shm_magic)) != 0 || header->version != shm_version
+               || slot_idx < 0 || slot_idx >= static_cast<int>(header->n_slots) || GetShmSize(header->n_slots) > size_)
+            {
+                Close();
+                return false;
+            }
+            ::mlock(base_,size_); // Avoid page faults in the real time loop, best effort
+            slot_ = reinterpret_cast<ShmSlot*>(base_ + shm_slots_offset) + slot_idx;
+            position_dim_ = header->position_dim;
+            tick_ = 0;
+            return true;
+        }
+
+        void Close()
+        {
+            if(base_ != NULL)
+                ::munmap(base_,size_);
+            base_ = NULL;
+            size_ = 0;
+            slot_ = NULL;
+        }
+
+        inline bool IsOpen() const {return base_ != NULL;}
+        inline int GetPositionDim() const {return position_dim_;}
+        inline uint64_t GetHeartbeat() const {return GetHeader()->heartbeat.load(std::memory_order_relaxed);}
+
+        /// Real time method: publish the robot state, return its tick
+        inline uint64_t WriteRobotState(const double* position, const double* velocity, const double dt)
+        {
+            double command[ShmSlot::command_size] = {0.0};
+            tick_++;
+            command[0] = static_cast<double>(tick_);
+            command[1] = dt;
+            for(int i=0; i<position_dim_; i++)
+            {
+                command[2 + i] = position[i];
+                command[2 + shm_max_dim + i] = velocity[i];
+            }
+            slot_->command.Write(command);
+            return tick_;
+        }
+
+        /// Real time method: last force published by the engine and the tick of the robot state it used,
+        /// return false if there is no force yet
+        inline bool ReadForce(double* f_out, uint64_t& tick) const
+        {
+            double force[ShmSlot::force_size];
+            if(!slot_->force.Read(force) || force[0] == 0.0)
+                return false;
+            tick = static_cast<uint64_t>(force[0]);
+            for(int i=0; i<position_dim_; i++)
+                f_out[i] = force[1 + i];
+            return true;
+        }
+
+        /// Real time method: spin until the force computed with the robot state of tick is published,
+        /// return false after timeout_ns, f_out is not modified then
+        inline bool WaitForce(double* f_out, const uint64_t tick, const int64_t timeout_ns) const
+        {
+            const int64_t start = GetTimeNs();
+            uint64_t force_tick;
+            double force[shm_max_dim];
+            do
+            {
+                if(ReadForce(force,force_tick) && force_tick >= tick)
+                {
+                    for(int i=0; i<position_dim_; i++)
+                        f_out[i] = force[i];
+                    return true;
+                }
+            }
+            while(GetTimeNs() - start < timeout_ns);
+            return false;
+        }
+
+    private:
+
+        SharedMemoryClient(const SharedMemoryClient&);
+        SharedMemoryClient& operator=(const SharedMemoryClient&);
+
+        static inline int64_t GetTimeNs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC,&ts);
+            return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        }
+
+        inline const ShmHeader* GetHeader() const {return reinterpret_cast<const ShmHeader*>(base_);}
+
+        char* base_;
+        size_t size_;
+        ShmSlot* slot_;
+        int position_dim_;
+        uint64_t tick_;
+};
+
+/// Guides engine side, it creates the shared memory and removes it at destruction
+class SharedMemoryEngine
+{
+    public:
+
+        SharedMemoryEngine():base_(NULL),size_(0),n_slots_(0),position_dim_(0) {}
+        ~SharedMemoryEngine() {Destroy();}
+
+        /// Create (or recreate) the shared memory, return false if it can not be created
+        bool Create(const std::string& name, const int n_slots, const int position_dim)
+        {
+            Destroy();
+            if(n_slots <= 0 || position_dim <= 0 || position_dim > shm_max_dim)
+                return false;
+            const int fd = ::shm_open(name.c_str(),O_CREAT | O_RDWR,0660);
+            if(fd < 0)
+                return false;
+            const size_t size = GetShmSize(n_slots);
+            if(::ftruncate(fd,size) != 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            void* addr = ::mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+            ::close(fd);
+            if(addr == MAP_FAILED)
+                return false;
+            base_ = static_cast<char*>(addr);
+            size_ = size;
+            name_ = name;
+            n_slots_ = n_slots;
+            position_dim_ = position_dim;
+            ::mlock(base_,size_);
+
+            // Initialize the layout in place
+            std::memset(base_,0,size_);
+            ShmHeader* header = new (base_) ShmHeader();
+            std::memcpy(header->magic,shm_magic,sizeof(shm_magic));
+            header->version = shm_version;
+            header->n_slots = n_slots;
+            header->position_dim = position_dim;
+            header->heartbeat.store(0);
+            for(int i=0; i<n_slots; i++)
+            {
+                ShmSlot* slot = new (GetSlot(i)) ShmSlot();
+                slot->command.seq.store(0);
+                slot->force.seq.store(0);
+                for(int j=0; j<ShmSlot::command_size; j++)
+                    slot->command.data[j].store(0.0);
+                for(int j=0; j<ShmSlot::force_size; j++)
+                    slot->force.data[j].store(0.0);
+            }
+            last_ticks_.assign(n_slots,0);
+            return true;
+        }
+
+        void Destroy()
+        {
+            if(base_ != NULL)
+            {
+                ::munmap(base_,size_);
+                ::shm_unlink(name_.c_str());
+            }
+            base_ = NULL;
+            size_ = 0;
+        }
+
+        inline bool IsCreated() const {return base_ != NULL;}
+        inline int GetNbSlots() const {return n_slots_;}
+        inline int GetPositionDim() const {return position_dim_;}
+
+        /// Real time method: return true if the controller of the slot published a new robot state
+        inline bool ReadRobotState(const int slot_idx, double* position, double* velocity, double& dt, uint64_t& tick)
+        {
+            double command[ShmSlot::command_size];
+            if(!GetSlot(slot_idx)->command.Read(command))
+                return false;
+            tick = static_cast<uint64_t>(command[0]);
+            if(tick == 0 || tick == last_ticks_[slot_idx])
+                return false;
+            last_ticks_[slot_idx] = tick;
+            dt = command[1];
+            for(int i=0; i<position_dim_; i++)
+            {
+                position[i] = command[2 + i];
+                velocity[i] = command[2 + shm_max_dim + i];
+            }
+            return true;
+        }
+
+        /// Real time method: publish the force computed with the robot state of tick
+        inline void WriteForce(const int slot_idx, const double* f_out, const uint64_t tick)
+        {
+            double force[ShmSlot::force_size] = {0.0};
+            force[0] = static_cast<double>(tick);
+            for(int i=0; i<position_dim_; i++)
+                force[1 + i] = f_out[i];
+            GetSlot(slot_idx)->force.Write(force);
+        }
+
+        inline void Beat()
+        {
+            std::atomic<uint64_t>& heartbeat = reinterpret_cast<ShmHeader*>(base_)->heartbeat;
+            heartbeat.store(heartbeat.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+        }
+
+    private:
+
+        SharedMemoryEngine(const SharedMemoryEngine&);
+        SharedMemoryEngine& operator=(const SharedMemoryEngine&);
+
+        inline ShmSlot* GetSlot(const int slot_idx) {return reinterpret_cast<ShmSlot*>(base_ + shm_slots_offset) + slot_idx;}
+
+        char* base_;
+        size_t size_;
+        std::string name_;
+        int n_slots_;
+        int position_dim_;
+        std::vector<uint64_t> last_ticks_; // Last robot state read for each slot
+};
+
+}
+
+#endif
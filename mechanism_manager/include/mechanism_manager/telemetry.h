@@ -0,0 +1,116 @@
+/**
+ * @file   telemetry.h
+ * @brief  Per tick telemetry of the mechanism manager, drained by a non real time thread.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+////////// Toolbox
+#include <toolbox/debug.h>
+#include <toolbox/ring_buffer/ring_buffer.h>
+
+////////// STD
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <atomic>
+
+////////// BOOST
+#include <boost/thread.hpp>
+
+namespace mechanism_manager
+{
+
+static const int telemetry_max_guides = 32; // Only the first guides are recorded
+static const int telemetry_max_dim = 3;
+
+/// Fixed size record written by the real time loop at each tick
+struct TickRecord
+{
+  uint64_t tick;
+  double time; // [s] Since the start of the telemetry
+  double duration; // [s] Cost of the update
+  int32_t n_guides; // All the guides, also the ones not recorded
+  int32_t position_dim;
+  double f_out[telemetry_max_dim];
+  double phase[telemetry_max_guides];
+  double scale[telemetry_max_guides];
+  double scale_t[telemetry_max_guides];
+};
+
+/// Header of the binary log, followed by the records
+struct TelemetryFileHeader
+{
+  char magic[8]; // VFTLM
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t max_guides;
+  uint32_t max_dim;
+};
+
+/// The real time loop fills the records in place in a lock free ring (Claim/Commit),
+/// a thread drains the ring every drain_period seconds: the records are appended to a binary
+/// file (a TelemetryFileHeader, then the records) and, with the ros publishers, published
+/// as a single Float64MultiArray per batch (one row per record, the fields in the TickRecord order).
+/// If the ring is full the record is dropped, the real time loop never waits.
+/// Without a sink (no log file and no ros publisher) the records are not drained: the drain thread is not started.
+class Telemetry
+{
+
+  public:
+
+    /// log_file: binary file where to write the records, empty to not write them
+    Telemetry(const int capacity, const std::string& log_file = "", const double drain_period = 0.01);
+    ~Telemetry();
+
+    /// Real time methods: return the record to fill, NULL if the ring is full
+    inline TickRecord* Claim() {return ring_.Claim();}
+    inline void Commit() {ring_.Commit();}
+
+    inline unsigned long GetNbDropped() const {return ring_.GetNbDropped();}
+    inline unsigned long GetNbDrained() const {return n_drained_.load(std::memory_order_relaxed);}
+    inline bool HasSink() const {return log_file_ != NULL || ros_pub_ != NULL;}
+
+  private:
+
+    void Loop();
+    void Drain();
+    void Publish(const int n_records);
+
+    ring_buffer::SpscRing<TickRecord> ring_;
+    std::FILE* log_file_;
+    double drain_period_;
+    std::vector<TickRecord> batch_;
+    std::atomic<unsigned long> n_drained_;
+    unsigned long n_dropped_reported_;
+    std::atomic<bool> stop_;
+    boost::thread thread_;
+
+    /// Ros stuff, used by the drainer only
+    struct RosPublisher;
+    RosPublisher* ros_pub_;
+};
+
+}
+
+#endif
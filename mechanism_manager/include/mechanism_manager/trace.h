@@ -0,0 +1,225 @@
+/**
+ * @file   trace.h
+ * @brief  Capture of the robot streams and of the guides services, to replay them offline.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+////////// Toolbox
+#include <toolbox/debug.h>
+#include <toolbox/ring_buffer/ring_buffer.h>
+
+////////// STD
+#include <string>
+#include <deque>
+#include <cstdio>
+#include <stdint.h>
+#include <atomic>
+#include <algorithm>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+
+////////// BOOST
+#include <boost/thread.hpp>
+
+namespace mechanism_manager
+{
+
+static const int trace_max_robots = 4; // Only the first robots are captured
+static const int trace_max_dim = 3;
+
+/// The entries of a trace: the ticks of the real time loop and the services changing the guides.
+/// idx is the guide of TRACE_DELETE, TRACE_UPDATE and TRACE_RENAME, the mode of TRACE_SET_MODE, the robots of TRACE_SET_NB_ROBOTS.
+/// The threshold of TRACE_SET_MERGE_THRESHOLD is its 1x1 data.
+/// NOTE The lazy guides of the libraries are not captured, the cache is disabled during a capture and a replay
+/// (see MechanismManager::DisableGuidesCache): the libraries are fully loaded.
+enum trace_entry_t {TRACE_TICK = 0, TRACE_INSERT_MODEL, TRACE_INSERT_DATA, TRACE_DELETE, TRACE_UPDATE, TRACE_CLUSTER,
+                    TRACE_INSERT_RECORDED, TRACE_CLUSTER_RECORDED, TRACE_INSERT_LIBRARY, TRACE_SET_MODE, TRACE_SET_NB_ROBOTS,
+                    TRACE_SET_MERGE_THRESHOLD, TRACE_RENAME, N_TRACE_ENTRIES};
+
+static const char trace_magic[8] = {'V','F','T','R','C','\0','\0','\0'};
+static const uint32_t trace_version = 2; // The traces of the previous versions can still be read
+
+/// File layout, in the host byte order: a TraceFileHeader, then for each entry a TraceEntryHeader followed by
+/// - TRACE_TICK: dt, then the positions, the velocities and the forces (rows position_dim, cols n_robots),
+/// - the services: the name (name_size chars, no terminator), then the data (rows x cols, column major).
+struct TraceFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t position_dim;
+  uint32_t n_robots; // At the beginning of the capture
+  uint32_t pad;
+};
+
+struct TraceEntryHeader
+{
+  uint32_t type;
+  uint32_t name_size;
+  uint64_t tick; // Ticks done before the entry, a service is applied before the tick with this index
+  int64_t idx;
+  uint32_t rows;
+  uint32_t cols;
+};
+
+/// Tick written in place in the ring by the real time loop
+struct TraceTick
+{
+  uint64_t tick;
+  uint64_t epoch; // Guides set used by the tick (MechanismManager::GetRtEpoch)
+  double dt;
+  int32_t n_robots;
+  int32_t pad;
+  double position[trace_max_robots * trace_max_dim];
+  double velocity[trace_max_robots * trace_max_dim];
+  double f_out[trace_max_robots * trace_max_dim];
+};
+
+/// Entry read from a trace, or written by the offline tools
+struct TraceEntry
+{
+  TraceEntry():type(TRACE_TICK),tick(0),idx(0),dt(0.0) {}
+  trace_entry_t type;
+  uint64_t tick;
+  long idx;
+  std::string name;
+  Eigen::MatrixXd data; // The demonstration of the services, one sample per row
+  double dt;
+  Eigen::MatrixXd position; // Column k: robot k
+  Eigen::MatrixXd velocity;
+  Eigen::MatrixXd f_out;
+};
+
+/// The real time loop fills the ticks in place in a lock free ring (RecordTick), the services are
+/// recorded once they are done (RecordEvent) and a thread drains both every drain_period seconds into the file.
+/// A service which published a guides set is written before the first tick which used that set (or a newer one),
+/// the other services before the ticks done after they were recorded. The services keep the order in which they
+/// were recorded. If the ring is full the tick is dropped, but the index of each tick is kept so that the gaps are known.
+/// With capacity 0 there is no ring and no thread, the entries are written directly (Write, offline tools).
+class TraceWriter
+{
+
+  public:
+
+    TraceWriter(const std::string& file_path, const int position_dim, const int n_robots, const int capacity, const double drain_period = 0.01);
+    ~TraceWriter();
+
+    inline bool IsOpen() const {return file_ != NULL;}
+
+    /// Real time method, the robot k is at k * position_dim
+    inline void RecordTick(const double* positions, const double* velocities, const double* f_out, const int n_robots, const double dt,
+                           const unsigned long epoch = 0)
+    {
+        const uint64_t tick = n_ticks_.load(std::memory_order_relaxed);
+        TraceTick* record = ring_ != NULL ? ring_->Claim() : NULL;
+        if(record != NULL)
+        {
+            const int n = std::min(n_robots,trace_max_robots) * position_dim_;
+            record->tick = tick;
+            record->epoch = epoch;
+            record->dt = dt;
+            record->n_robots = n / position_dim_;
+            for(int i=0;i<n;i++)
+            {
+                record->position[i] = positions[i];
+                record->velocity[i] = velocities[i];
+                record->f_out[i] = f_out[i];
+            }
+            ring_->Commit();
+        }
+        n_ticks_.store(tick + 1,std::memory_order_release);
+    }
+
+    /// Non real time methods, epoch is the last guides set published by the service, 0 if it did not publish any
+    void RecordEvent(const trace_entry_t type, const long idx, const std::string& name, const Eigen::MatrixXd& data,
+                     const unsigned long epoch = 0);
+    void Write(const TraceEntry& entry); // The tick of the entry is not changed
+
+    inline unsigned long GetNbDropped() const {return ring_ != NULL ? ring_->GetNbDropped() : 0;}
+
+  private:
+
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+
+    /// Service waiting for its tick, tick of the entry is the ticks done when it was recorded
+    struct PendingEvent
+    {
+      TraceEntry entry;
+      unsigned long epoch;
+    };
+
+    void Loop();
+    void Drain();
+    void WriteEvents(const uint64_t tick, const unsigned long epoch);
+    void WriteEntry(const TraceEntry& entry);
+    void WriteHeader(const trace_entry_t type, const uint64_t tick, const long idx, const std::string& name, const int rows, const int cols);
+    void WriteData(const double* data, const size_t size);
+
+    int position_dim_;
+    ring_buffer::SpscRing<TraceTick>* ring_;
+    std::FILE* file_;
+    double drain_period_;
+    std::deque<PendingEvent> events_; // Recorded, not written yet
+    std::atomic<uint64_t> n_ticks_;
+    unsigned long n_dropped_reported_;
+    std::atomic<bool> stop_;
+    boost::thread thread_;
+    boost::mutex mtx_; // Events queue and file
+};
+
+/// Sequential reader of a trace
+class TraceReader
+{
+
+  public:
+
+    TraceReader():file_(NULL),position_dim_(0),n_robots_(0) {}
+    ~TraceReader() {Close();}
+
+    /// Return false if the file can not be opened or it is not a trace of this version
+    bool Open(const std::string& file_path);
+    void Close();
+
+    /// Return false at the end of the trace (or if it is truncated)
+    bool Next(TraceEntry& entry);
+
+    inline bool IsOpen() const {return file_ != NULL;}
+    inline int GetPositionDim() const {return position_dim_;}
+    inline int GetNbRobots() const {return n_robots_;}
+
+  private:
+
+    TraceReader(const TraceReader&);
+    TraceReader& operator=(const TraceReader&);
+
+    bool Read(double* data, const size_t size);
+
+    std::FILE* file_;
+    int position_dim_;
+    int n_robots_;
+};
+
+}
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file   trace_replay.h
+ * @brief  Offline replay of a trace against the mechanism manager.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+///////// MECHANISM_MANAGER
+#include "mechanism_manager/trace.h"
+#include "mechanism_manager/latency_stats.h"
+
+////////// STD
+#include <string>
+
+namespace mechanism_manager
+{
+
+class MechanismManager;
+
+/// Result of a replay, the forces are compared tick by tick with the ones of the reference
+struct ReplayReport
+{
+  ReplayReport():n_ticks(0),n_services(0),n_missing(0),n_compared(0),n_diffs(0),first_diff_tick(0),max_diff(0.0),sum_sq_diff(0.0),duration(0.0) {}
+
+  uint64_t n_ticks;
+  uint64_t n_services;
+  uint64_t n_missing; // Ticks dropped by the capture
+  uint64_t n_compared;
+  uint64_t n_diffs; // Ticks with a force component differing more than the tolerance
+  uint64_t first_diff_tick;
+  double max_diff;
+  double sum_sq_diff;
+  double duration; // [s] Wall time of the updates only
+  LatencyHistogram latency; // Duration of the updates
+
+  /// Human readable report, the latencies in us
+  std::string GetReport() const;
+};
+
+/// Run the trace against mm as fast as possible: each service is applied synchronously before the tick
+/// it precedes in the trace, so a replay is deterministic (the services of the capture ran in parallel
+/// with the real time loop and were published at some point between two ticks).
+/// The forces are compared with the ones of the reference trace, the trace itself if NULL.
+/// If output is not NULL the trace is written with the forces of the replay, to be used as a reference.
+/// The guides cache of mm is disabled, as it was during the capture.
+/// Return false if the trace does not match mm (position_dim).
+bool ReplayTrace(TraceReader& trace, MechanismManager& mm, ReplayReport& report, const double tolerance = 1e-9,
+                 TraceReader* const reference = NULL, TraceWriter* const output = NULL);
+
+}
+
+#endif
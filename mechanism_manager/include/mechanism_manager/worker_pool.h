@@ -0,0 +1,84 @@
+/**
+ * @file   worker_pool.h
+ * @brief  Pool of real time workers used to update the guides in parallel.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+////////// Toolbox
+#include <toolbox/debug.h>
+
+////////// STD
+#include <vector>
+#include <atomic>
+
+////////// BOOST
+#include <boost/thread.hpp>
+
+namespace mechanism_manager
+{
+
+/// Fixed set of threads spawned at construction, they wait for a job spinning on an atomic
+/// generation counter and signal its end with an atomic counter. After a spin budget an idle
+/// worker sleeps on a futex on the generation counter, so between the ticks the workers do not
+/// take the cpu from the other threads; Run wakes them only if some of them are sleeping.
+/// Running a job does not allocate or lock. The calling thread is the worker 0, so n_workers-1 threads are created.
+class WorkerPool
+{
+
+  public:
+    typedef void (*job_t)(void* arg, const int worker_idx, const int n_workers);
+
+    /// cpus: cpus where to pin the workers (worker i uses cpus[i % cpus.size()]), empty to not pin them
+    /// priority: SCHED_FIFO priority of the spawned threads, 0 to keep the default scheduler
+    WorkerPool(const int n_workers, const std::vector<int>& cpus = std::vector<int>(), const int priority = 0);
+    ~WorkerPool();
+
+    /// Real time method: run job on all the workers and wait for all of them to finish
+    void Run(job_t job, void* arg);
+
+    inline int GetNbWorkers() const {return n_workers_;}
+
+  private:
+
+    void Loop(const int worker_idx);
+    void SetupThread(const int worker_idx);
+
+    int n_workers_;
+    std::vector<int> cpus_;
+    int priority_;
+
+    job_t job_;
+    void* arg_;
+    std::atomic<unsigned int> generation_; // Incremented for each job, futex word of the sleeping workers
+    std::atomic<int> n_sleeping_; // Workers sleeping (or about to) on generation_
+    std::atomic<int> n_done_; // Spawned workers that finished the current job
+    std::atomic<bool> stop_;
+#ifdef USE_REAL_TIME_CHECKS
+    bool rt_critical_code_; // The workers run the job with the real time checks of the caller
+#endif
+    boost::thread_group threads_;
+};
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * @file   demo_recorder.cpp
+ * @brief  Lock free recording of the demonstrations in the real time loop.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/demo_recorder.h"
+
+////////// STD
+#include <algorithm>
+
+////////// BOOST
+#include <boost/thread.hpp>
+
+namespace mechanism_manager
+{
+
+void Demonstration::GetData(Eigen::MatrixXd& data) const
+{
+    data.resize(n_samples_,dim_);
+    long row = 0;
+    for(size_t c=0;c<chunks_.size();c++)
+    {
+        const long n_rows = std::min(static_cast<long>(chunk_size_),n_samples_ - row);
+        typedef Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> row_major_t;
+        data.middleRows(row,n_rows) = Eigen::Map<const row_major_t>(chunks_[c].data(),n_rows,dim_);
+        row += n_rows;
+    }
+}
+
+void Demonstration::Clear()
+{
+    chunks_.clear();
+    n_samples_ = 0;
+}
+
+DemoRecorder::DemoRecorder(const int dim, const int chunk_size, const long max_samples)
+    :dim_(dim),chunk_size_(chunk_size),max_samples_(max_samples)
+{
+    assert(dim > 0);
+    assert(chunk_size > 0);
+    assert(max_samples > 0);
+    chunks_.resize((max_samples_ + chunk_size_ - 1)/chunk_size_);
+    recording_.store(false);
+    in_record_.store(false);
+    n_samples_.store(0);
+    n_dropped_.store(0);
+}
+
+void DemoRecorder::Halt()
+{
+    recording_.store(false);
+    while(in_record_.load())
+        boost::this_thread::yield();
+}
+
+void DemoRecorder::Start()
+{
+    Halt();
+
+    // Replace the chunks given away by the previous recordings
+    for(size_t c=0;c<chunks_.size();c++)
+        if(chunks_[c].empty())
+            chunks_[c].resize(chunk_size_ * dim_);
+
+    n_samples_.store(0,std::memory_order_relaxed);
+    n_dropped_.store(0,std::memory_order_relaxed);
+    recording_.store(true);
+}
+
+bool DemoRecorder::Stop(Demonstration& demo)
+{
+    Halt();
+
+    const long n_samples = n_samples_.load(std::memory_order_acquire);
+    demo.Clear();
+    demo.dim_ = dim_;
+    demo.chunk_size_ = chunk_size_;
+    demo.n_samples_ = n_samples;
+
+    const long n_chunks = (n_samples + chunk_size_ - 1)/chunk_size_;
+    demo.chunks_.resize(n_chunks);
+    for(long c=0;c<n_chunks;c++)
+        demo.chunks_[c].swap(chunks_[c]); // chunks_[c] is left empty
+    n_samples_.store(0,std::memory_order_relaxed);
+
+    return n_samples > 0;
+}
+
+}
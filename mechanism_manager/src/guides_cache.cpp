@@ -0,0 +1,245 @@
+/**
+ * @file   guides_cache.cpp
+ * @brief  Lazy guides of the libraries, built only when a robot gets close to them.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/guides_cache.h"
+
+////////// STD
+#include <unordered_set>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <cassert>
+
+using namespace Eigen;
+
+namespace mechanism_manager
+{
+
+void ComputeGuideBox(const MatrixXd& states, VectorXd& box_min, VectorXd& box_max)
+{
+    assert(states.rows() > 0);
+    double margin = 0.0;
+    for(int j = 0; j<states.rows()-1; j++)
+        margin = std::max(margin,0.5 * (states.row(j+1) - states.row(j)).norm());
+    box_min = states.colwise().minCoeff().transpose().array() - margin;
+    box_max = states.colwise().maxCoeff().transpose().array() + margin;
+}
+
+GuidesCache::GuidesCache(const int position_dim, const int max_robots)
+    :position_dim_(position_dim),max_robots_(max_robots),n_checks_(0),positions_(position_dim * max_robots)
+{
+    assert(position_dim > 0);
+    assert(max_robots > 0);
+    n_tracked_.store(0);
+    seq_.store(0);
+}
+
+int GuidesCache::Add(const std::string& library_path)
+{
+    boost::shared_ptr<library::Library> lib(new library::Library());
+    if(!lib->Open(library_path))
+        return 0;
+
+    boost::mutex::scoped_lock guard(mtx_);
+
+    std::unordered_set<std::string> names;
+    for(size_t i=0;i<guides_.size();i++)
+        names.insert(guides_[i].name);
+
+    int n_added = 0;
+    for(int i=0;i<lib->GetNbRecords();i++)
+    {
+        const library::RecordView record = lib->GetRecord(i);
+        LazyGuide guide;
+        guide.name = record.GetName();
+        if(!record.Has("state_recorded") || record.Get("state_recorded").rows() == 0 || record.Get("state_recorded").cols() != position_dim_)
+        {
+            PRINT_WARNING("The guide "<<guide.name<<" of the library has no recorded states, skipped");
+            continue;
+        }
+        if(!names.insert(guide.name).second)
+        {
+            PRINT_WARNING("The guide "<<guide.name<<" is already registered, skipped");
+            continue;
+        }
+        const MatrixXd states = record.Get("state_recorded");
+        guide.lib_idx = libs_.size();
+        guide.record_idx = i;
+        ComputeGuideBox(states,guide.box_min,guide.box_max);
+        guide.initial_state = states.row(0).transpose();
+        guide.final_state = states.row(states.rows()-1).transpose();
+        guide.resident = false;
+        guide.last_used = 0;
+        guides_.push_back(guide);
+        n_added++;
+    }
+
+    if(n_added > 0)
+        libs_.push_back(lib); // Mapped until the destruction
+    return n_added;
+}
+
+bool GuidesCache::GetPositions(std::vector<VectorXd>& positions) const
+{
+    unsigned int seq_start, seq_end;
+    int n_tracked;
+    do
+    {
+        seq_start = seq_.load(std::memory_order_acquire);
+        n_tracked = n_tracked_.load(std::memory_order_relaxed);
+        positions.resize(n_tracked);
+        for(int k=0;k<n_tracked;k++)
+        {
+            positions[k].resize(position_dim_);
+            for(int j=0;j<position_dim_;j++)
+                positions[k](j) = positions_[k * position_dim_ + j].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_end = seq_.load(std::memory_order_relaxed);
+    }
+    while((seq_start & 1) || seq_start != seq_end);
+
+    return n_tracked > 0;
+}
+
+void GuidesCache::Select(const std::vector<VectorXd>& positions, const std::vector<std::string>& published_names,
+                         const double load_dist, const int max_resident, std::vector<int>& to_load, std::vector<std::string>& to_evict)
+{
+    assert(load_dist >= 0.0);
+    assert(max_resident >= 0);
+
+    boost::mutex::scoped_lock guard(mtx_);
+    to_load.clear();
+    to_evict.clear();
+    n_checks_++;
+
+    const std::unordered_set<std::string> published(published_names.begin(),published_names.end());
+    const double load_sq_dist = load_dist * load_dist;
+
+    // (box distance, distance from the start) of the close guides not resident, the closest are loaded first
+    std::vector<std::pair<std::pair<double,double>,int> > candidates;
+    // (last use, idx) of the resident guides far from the robots
+    std::vector<std::pair<uint64_t,int> > evictable;
+    int n_resident = 0;
+    for(size_t i=0;i<guides_.size();i++)
+    {
+        LazyGuide& guide = guides_[i];
+        const bool is_published = published.count(guide.name) > 0;
+        if(guide.resident && !is_published) // Renamed or deleted by the user
+            guide.resident = false;
+
+        double min_sq_dist = std::numeric_limits<double>::infinity();
+        double start_sq_dist = std::numeric_limits<double>::infinity();
+        for(size_t k=0;k<positions.size();k++)
+        {
+            assert(positions[k].size() == position_dim_);
+            double sq_dist = 0.0;
+            for(int j=0;j<position_dim_;j++)
+            {
+                const double d = std::max(std::max(guide.box_min(j) - positions[k](j),positions[k](j) - guide.box_max(j)),0.0);
+                sq_dist += d * d;
+            }
+            min_sq_dist = std::min(min_sq_dist,sq_dist);
+            start_sq_dist = std::min(start_sq_dist,(guide.initial_state - positions[k]).squaredNorm());
+        }
+        const bool close = min_sq_dist <= load_sq_dist;
+        if(close)
+            guide.last_used = n_checks_;
+
+        if(guide.resident)
+        {
+            n_resident++;
+            if(!close)
+                evictable.push_back(std::make_pair(guide.last_used,static_cast<int>(i)));
+        }
+        else if(close && !is_published) // A published guide with the same name hides it
+            candidates.push_back(std::make_pair(std::make_pair(min_sq_dist,start_sq_dist),static_cast<int>(i)));
+    }
+
+    std::sort(candidates.begin(),candidates.end());
+    std::sort(evictable.begin(),evictable.end());
+
+    size_t n_evicted = 0;
+    const bool bounded = max_resident > 0;
+    // The cap could have been exceeded by the guides which were close at the previous checks
+    while(bounded && n_resident > max_resident && n_evicted < evictable.size())
+    {
+        LazyGuide& guide = guides_[evictable[n_evicted++].second];
+        guide.resident = false;
+        to_evict.push_back(guide.name);
+        n_resident--;
+    }
+    for(size_t n=0;n<candidates.size();n++)
+    {
+        if(bounded && n_resident >= max_resident)
+        {
+            if(n_evicted == evictable.size())
+                break; // Only close guides are resident
+            LazyGuide& guide = guides_[evictable[n_evicted++].second];
+            guide.resident = false;
+            to_evict.push_back(guide.name);
+            n_resident--;
+        }
+        to_load.push_back(candidates[n].second);
+        n_resident++;
+    }
+}
+
+void GuidesCache::SetResident(const int idx, const bool resident)
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    assert(idx >= 0 && idx < static_cast<int>(guides_.size()));
+    guides_[idx].resident = resident;
+}
+
+library::RecordView GuidesCache::GetRecord(const int idx) const
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    assert(idx >= 0 && idx < static_cast<int>(guides_.size()));
+    return libs_[guides_[idx].lib_idx]->GetRecord(guides_[idx].record_idx);
+}
+
+LazyGuide GuidesCache::GetGuide(const int idx) const
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    assert(idx >= 0 && idx < static_cast<int>(guides_.size()));
+    return guides_[idx];
+}
+
+int GuidesCache::GetNbGuides() const
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    return guides_.size();
+}
+
+int GuidesCache::GetNbResident() const
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    int n_resident = 0;
+    for(size_t i=0;i<guides_.size();i++)
+        if(guides_[i].resident)
+            n_resident++;
+    return n_resident;
+}
+
+}
@@ -0,0 +1,114 @@
+/**
+ * @file   guides_change_log.cpp
+ * @brief  Revisions of the guides list, to synchronize the clients with the changes only.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/guides_change_log.h"
+
+////////// STD
+#include <unordered_set>
+#include <random>
+#include <cassert>
+
+namespace mechanism_manager
+{
+
+GuidesChangeLog::GuidesChangeLog(const size_t max_deltas)
+    :max_deltas_(max_deltas)
+{
+    assert(max_deltas > 0);
+    revision_.store(0);
+
+    std::random_device rd;
+    do
+        session_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+    while(session_ == 0);
+}
+
+void GuidesChangeLog::Append(const guide_delta_t type, const int idx, const std::string& name)
+{
+    GuideDelta delta;
+    delta.revision = revision_.load(std::memory_order_relaxed) + 1;
+    delta.type = type;
+    delta.idx = idx;
+    delta.name = name;
+    deltas_.push_back(delta);
+    if(deltas_.size() > max_deltas_)
+        deltas_.pop_front();
+    revision_.store(delta.revision,std::memory_order_release);
+}
+
+void GuidesChangeLog::Publish(const std::vector<std::string>& names)
+{
+    boost::mutex::scoped_lock guard(mtx_);
+
+    const std::unordered_set<std::string> new_names(names.begin(),names.end());
+    const std::unordered_set<std::string> old_names(names_.begin(),names_.end());
+
+    // From the last one, so that the indexes of the previous ones do not change
+    for(int i=static_cast<int>(names_.size())-1;i>=0;i--)
+        if(new_names.count(names_[i]) == 0)
+        {
+            Append(GUIDE_DELETED,i,"");
+            names_.erase(names_.begin() + i);
+        }
+
+    for(size_t i=0;i<names.size();i++)
+        if(old_names.count(names[i]) == 0)
+        {
+            Append(GUIDE_INSERTED,i,names[i]);
+            names_.insert(names_.begin() + i,names[i]);
+        }
+
+    assert(names_ == names);
+}
+
+void GuidesChangeLog::Rename(const int idx, const std::string& name)
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    assert(idx >= 0 && idx < static_cast<int>(names_.size()));
+    if(names_[idx] == name)
+        return;
+    names_[idx] = name;
+    Append(GUIDE_RENAMED,idx,name);
+}
+
+bool GuidesChangeLog::GetChanges(const uint64_t session, const unsigned long since, std::vector<GuideDelta>& deltas, std::vector<std::string>& names,
+                                 uint64_t& current_session, unsigned long& revision) const
+{
+    boost::mutex::scoped_lock guard(mtx_);
+    current_session = session_;
+    revision = revision_.load(std::memory_order_relaxed);
+    deltas.clear();
+    names.clear();
+
+    // The deltas kept are the ones of the revisions in (revision - deltas_.size(), revision]
+    if(session != session_ || since == 0 || since > revision || revision - since > deltas_.size())
+    {
+        names = names_;
+        return false;
+    }
+
+    deltas.assign(deltas_.end() - (revision - since),deltas_.end());
+    return true;
+}
+
+}
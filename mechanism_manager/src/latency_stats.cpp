@@ -0,0 +1,135 @@
+/**
+ * @file   latency_stats.cpp
+ * @brief  Latency histograms of the stages of the mechanism manager update.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/latency_stats.h"
+
+////////// STD
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace mechanism_manager
+{
+
+static const char* stage_names[N_STAGES] = {"guides","scales","fade","forces","tick"};
+
+void LatencyHistogram::Clear()
+{
+    for(int i=0; i<n_buckets; i++)
+        counts_[i].store(0,std::memory_order_relaxed);
+    count_.store(0,std::memory_order_relaxed);
+    sum_.store(0,std::memory_order_relaxed);
+    max_.store(0,std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::GetPercentile(const double p) const
+{
+    const uint64_t n = GetCount();
+    if(n == 0)
+        return 0;
+    const uint64_t target = std::max(static_cast<uint64_t>(p/100.0 * n + 0.5),static_cast<uint64_t>(1));
+    uint64_t cumulated = 0;
+    for(int i=0; i<n_buckets-1; i++)
+    {
+        cumulated += GetBucketCount(i);
+        if(cumulated >= target)
+            return std::min(GetBucketLowerBound(i+1),GetMax());
+    }
+    return GetMax();
+}
+
+LatencyStats::LatencyStats()
+{
+    worst_seq_.store(0);
+    Clear();
+}
+
+void LatencyStats::Clear()
+{
+    for(int i=0; i<N_STAGES; i++)
+        stages_[i].Clear();
+    n_overruns_.store(0,std::memory_order_relaxed);
+
+    const unsigned int seq = worst_seq_.load(std::memory_order_relaxed);
+    worst_seq_.store(seq + 1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(int i=0; i<N_STAGES; i++)
+        worst_[i].store(0,std::memory_order_relaxed);
+    worst_tick_.store(0,std::memory_order_relaxed);
+    worst_n_guides_.store(0,std::memory_order_relaxed);
+    worst_seq_.store(seq + 2,std::memory_order_release);
+
+    reset_requested_.store(false);
+}
+
+std::string LatencyStats::GetReport() const
+{
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3);
+
+    for(int i=0; i<N_STAGES; i++)
+    {
+        const LatencyHistogram& hist = stages_[i];
+        report << stage_names[i] << ": n " << hist.GetCount()
+               << " mean " << hist.GetMean() * 1e-3
+               << " p50 " << hist.GetPercentile(50.0) * 1e-3
+               << " p99 " << hist.GetPercentile(99.0) * 1e-3
+               << " p99.9 " << hist.GetPercentile(99.9) * 1e-3
+               << " max " << hist.GetMax() * 1e-3 << " us\n";
+    }
+    report << "overruns: " << GetNbOverruns() << "\n";
+
+    // Read the worst tick, retry if the real time loop is writing it
+    int64_t worst[N_STAGES];
+    uint64_t worst_tick;
+    int worst_n_guides;
+    unsigned int seq_start, seq_end;
+    do
+    {
+        seq_start = worst_seq_.load(std::memory_order_acquire);
+        for(int i=0; i<N_STAGES; i++)
+            worst[i] = worst_[i].load(std::memory_order_relaxed);
+        worst_tick = worst_tick_.load(std::memory_order_relaxed);
+        worst_n_guides = worst_n_guides_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_end = worst_seq_.load(std::memory_order_relaxed);
+    }
+    while(seq_start != seq_end || (seq_start & 1));
+
+    report << "worst tick: #" << worst_tick << " guides " << worst_n_guides;
+    for(int i=0; i<N_STAGES; i++)
+        report << " " << stage_names[i] << " " << worst[i] * 1e-3;
+    report << " us\n";
+
+    // Non empty buckets of the tick histogram, lower bound in us and count
+    const LatencyHistogram& tick_hist = stages_[STAGE_TICK];
+    report << "tick histogram:";
+    for(int i=0; i<LatencyHistogram::n_buckets; i++)
+        if(tick_hist.GetBucketCount(i) > 0)
+            report << " " << LatencyHistogram::GetBucketLowerBound(i) * 1e-3 << ":" << tick_hist.GetBucketCount(i);
+    report << "\n";
+
+    return report.str();
+}
+
+}
@@ -0,0 +1,115 @@
+/**
+ * @file   malloc_checks.cpp
+ * @brief  Heap allocation checks for the real time code.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// When RT_MALLOC_CHECKS is defined, the library replaces malloc/calloc/realloc/free and the
+// aligned allocations (memalign/posix_memalign/aligned_alloc) so that any heap operation done
+// by a thread inside START/END_REAL_TIME_CRITICAL_CODE aborts the program.
+// The replacements forward to the glibc implementation.
+
+#ifdef RT_MALLOC_CHECKS
+
+////////// Toolbox
+#include <toolbox/debug.h>
+
+////////// STD
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+extern "C"
+{
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+void* __libc_memalign(size_t alignment, size_t size); // glibc has no __libc_ version of the other aligned allocations
+
+static void AbortOnRealTimeHeap(const char* function)
+{
+    tool_box::RealTimeCriticalCode() = false; // abort can allocate
+    const char* msg = " called inside the real time critical code, aborting.\n";
+    if(write(STDERR_FILENO,function,std::strlen(function)) < 0 || write(STDERR_FILENO,msg,std::strlen(msg)) < 0)
+        std::abort();
+    std::abort();
+}
+
+void* malloc(size_t size)
+{
+    if(tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    if(tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("calloc");
+    return __libc_calloc(n,size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if(tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("realloc");
+    return __libc_realloc(ptr,size);
+}
+
+void free(void* ptr)
+{
+    if(ptr != NULL && tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("free");
+    __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    if(tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("memalign");
+    return __libc_memalign(alignment,size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    if(tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("posix_memalign");
+    if(alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    void* const mem = __libc_memalign(alignment,size);
+    if(mem == NULL)
+        return ENOMEM;
+    *ptr = mem;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    if(tool_box::RealTimeCriticalCode())
+        AbortOnRealTimeHeap("aligned_alloc");
+    return __libc_memalign(alignment,size);
+}
+
+}
+
+#endif
@@ -23,6 +23,9 @@
 
 #include "mechanism_manager/mechanism_manager.h"
 
+////////// STD
+#include <unordered_set>
+
 namespace mechanism_manager
 {
 
@@ -30,7 +33,76 @@ namespace mechanism_manager
   using namespace tool_box;
   using namespace Eigen;
 
-MechanismManager::MechanismManager(int position_dim)
+void GuideBank::Resize(const int n_guides, const int position_dim)
+{
+    K.resize(position_dim,n_guides);
+    B.resize(position_dim,n_guides);
+    box_min.resize(position_dim,n_guides);
+    box_max.resize(position_dim,n_guides);
+
+    K.fill(0.0);
+    B.fill(0.0);
+    box_min.fill(0.0);
+    box_max.fill(0.0);
+}
+
+void RobotBank::Resize(const int n_guides, const int position_dim, const int guide_state_size)
+{
+    position.resize(position_dim);
+    velocity.resize(position_dim);
+    f_out.resize(position_dim);
+    scale.resize(n_guides);
+    scale_hard.resize(n_guides);
+    scale_t.resize(n_guides);
+    phase.resize(n_guides);
+    state.resize(position_dim,n_guides);
+    state_dot.resize(position_dim,n_guides);
+    t_versor.resize(position_dim,n_guides);
+    guide_states.resize(guide_state_size,n_guides);
+    inv_variance.resize(position_dim,n_guides);
+    log_norm.resize(n_guides);
+    schedule.assign(n_guides,GUIDE_UPDATED);
+    elapsed.resize(n_guides);
+    n_skipped.resize(n_guides);
+    scale_est.resize(n_guides);
+    f_vm.resize(position_dim,n_guides);
+    t_versor_scaled.resize(position_dim,n_guides);
+    f_tangent.resize(n_guides);
+    log_prob.resize(n_guides);
+
+    position.fill(0.0);
+    velocity.fill(0.0);
+    f_out.fill(0.0);
+    scale.fill(0.0);
+    scale_hard.fill(0.0);
+    scale_t.fill(0.0);
+    phase.fill(0.0);
+    state.fill(0.0);
+    state_dot.fill(0.0);
+    t_versor.fill(0.0);
+    guide_states.fill(0.0);
+    inv_variance.fill(0.0);
+    log_norm.fill(-std::numeric_limits<double>::infinity());
+    elapsed.fill(0.0);
+    n_skipped.fill(0);
+    scale_est.fill(0.0);
+    next_low_rate = 0;
+    f_vm.fill(0.0);
+    t_versor_scaled.fill(0.0);
+    f_tangent.fill(0.0);
+    log_prob.fill(-std::numeric_limits<double>::infinity());
+}
+
+// The defaults of the configuration, in case it can not be read
+MechanismManager::MechanismManager(int position_dim):
+    merge_exit_th_(1.0), n_cluster_threads_(1), merge_coreset_size_(0),
+    demo_sample_period_(0.001), demo_crop_dist_(0.0001), demo_cutoff_freq_(0.0), demo_ds_(0.0),
+    escape_factor_(150.0), cull_epsilon_(0.0), cull_dist_(std::numeric_limits<double>::infinity()),
+    low_rate_th_(0.0), low_rate_budget_(0), low_rate_max_period_(1), fade_time_(0.1),
+    worker_pool_(NULL), n_workers_(0), workers_priority_(0),
+    telemetry_(NULL), telemetry_buffer_size_(0),
+    guides_cache_(NULL), lazy_load_dist_(0.0), lazy_max_resident_(0), lazy_check_period_(0.05),
+    n_robots_(1)
 {
       if(!ReadConfig())
       {
@@ -41,18 +113,16 @@ MechanismManager::MechanismManager(int position_dim)
       position_dim_ = position_dim;
 
       // Resize
-      f_K_.resize(position_dim_);
-      f_B_.resize(position_dim_);
-      f_vm_.resize(position_dim_);
-      err_pos_.resize(position_dim_);
-      err_vel_.resize(position_dim_);
+      f_sum_.resize(position_dim_);
+      f_self_.resize(position_dim_);
+      projector_.resize(position_dim_,position_dim_);
+      pos_err_.resize(position_dim_);
 
       // Clear
-      f_K_.fill(0.0);
-      f_B_.fill(0.0);
-      f_vm_.fill(0.0);
-      err_pos_.fill(0.0);
-      err_vel_.fill(0.0);
+      f_sum_.fill(0.0);
+      f_self_.fill(0.0);
+      projector_.fill(0.0);
+      pos_err_.fill(0.0);
 
       loopCnt = 0;
 
@@ -60,73 +130,184 @@ MechanismManager::MechanismManager(int position_dim)
 
       guide_unique_id_ = 0;
 
-      rt_idx_ = 0;
-      no_rt_idx_ = 1;
+      GuideSet* empty_set = new GuideSet();
+      empty_set->bank.Resize(0,position_dim_);
+      empty_set->robots.resize(n_robots_);
+      for(int k=0;k<n_robots_;k++)
+          empty_set->robots[k].Resize(0,position_dim_,0);
+      rt_set_ = empty_set;
+      rt_epoch_ = 0;
+      n_pins_ = 0;
+      hard_mode_requested_ = false;
+      stop_requested_ = false;
+      collision_detected_ = false;
 
       scale_mode_ = SOFT; // By default use soft guides
 
       merge_th_ = 0.3;
+
+      job_set_ = NULL;
+      job_n_robots_ = 0;
+      job_dt_ = 0.0;
+      job_stop_ = false;
+      job_collision_ = false;
+
+      SetNbWorkers(n_workers_);
+
+      tick_ = 0;
+      telemetry_start_ = GetTimeNs();
+      if(telemetry_buffer_size_ > 0)
+      {
+          assert(position_dim_ <= telemetry_max_dim);
+          telemetry_ = new Telemetry(telemetry_buffer_size_,telemetry_log_file_);
+          if(!telemetry_->HasSink())
+          {
+              PRINT_WARNING("No telemetry log file and no telemetry publisher, the telemetry is disabled");
+              delete telemetry_;
+              telemetry_ = NULL;
+          }
+      }
+
+      cache_stop_ = false;
+      if(lazy_load_dist_ > 0.0)
+      {
+          guides_cache_ = new GuidesCache(position_dim_,n_robots_);
+          cache_thread_ = boost::thread(&MechanismManager::CacheLoop,this);
+      }
 }
 
 MechanismManager::~MechanismManager()
 {
-    for(size_t i=0;i<2;i++)
-        vm_buffers_[i].clear();
+    cache_stop_ = true;
+    if(cache_thread_.joinable())
+        cache_thread_.join();
+    delete guides_cache_;
+
+    delete worker_pool_;
+    delete telemetry_;
+
+    delete rt_set_.load();
+    for(size_t i=0;i<retired_sets_.size();i++)
+        delete retired_sets_[i];
 }
 
 void MechanismManager::AddNewVm(vm_t* const vm_tmp_ptr, std::string& name)
 {
-    if(!CheckForNamesCollision(name))
+    std::vector<vm_t*> vms(1,vm_tmp_ptr);
+    std::vector<std::string> names(1,name);
+    AddNewVms(vms,names);
+}
+
+void MechanismManager::AddNewVms(const std::vector<vm_t*>& vms, const std::vector<std::string>& names)
+{
+    assert(vms.size() == names.size());
+
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    //guard.lock(); // Lock
+
+    if(scale_mode_ == HARD)
     {
-        boost::recursive_mutex::scoped_lock guard(mtx_);
-        //guard.lock(); // Lock
+        PRINT_WARNING("Impossible to insert the guide while in HARD mode.");
+        for(size_t i = 0; i < vms.size(); i++)
+            delete vms[i];
+        return;
+    }
+
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
+    GuideSet* new_set = new GuideSet();
+
+    std::vector<int> src_idx;
+
+    // Copy
+    new_set->guides.reserve(rt_buffer.size()+vms.size());
+    for (size_t i = 0; i < rt_buffer.size(); i++)
+    {
+      new_set->guides.push_back(rt_buffer[i]);
+      src_idx.push_back(i);
+    }
 
-        if(scale_mode_ == HARD)
+    for (size_t i = 0; i < vms.size(); i++)
+    {
+        bool collision = CheckForNamesCollision(names[i]);
+        for (size_t j = rt_buffer.size(); j < new_set->guides.size(); j++)
+            if(new_set->guides[j].name == names[i])
+                collision = true;
+        if(collision)
         {
-            PRINT_WARNING("Impossible to insert the guide while in HARD mode.");
-            return;
+            PRINT_WARNING("Impossible to insert the guide "<<names[i]<<", guide already existing.");
+            delete vms[i];
+            continue;
         }
 
-        std::vector<GuideStruct>& no_rt_buffer = vm_buffers_[no_rt_idx_];
-        std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-        no_rt_buffer.clear();
+        GuideStruct new_guide;
+        new_guide.name = names[i];
+        new_guide.guide = boost::shared_ptr<vm_t>(vms[i]);
 
-        // Copy
-        for (size_t i = 0; i < rt_buffer.size(); i++)
-          no_rt_buffer.push_back(rt_buffer[i]); // FIXME possible problems in the copy!!! (fade)
+        // Add the new guide to the set
+        new_set->guides.push_back(new_guide);
+        src_idx.push_back(-1);
+    }
 
-        GuideStruct new_guide;
-        new_guide.name = name;
-        new_guide.scale = 0.0;
-        new_guide.scale_t = 0.0;
-        new_guide.guide = boost::shared_ptr<vm_t>(vm_tmp_ptr);
-        new_guide.fade = boost::shared_ptr<DynSystemFirstOrder>(new DynSystemFirstOrder(10.0)); // FIXME since it's a dynamic system, it should be a pointer or in the vm
-
-        // Define a new ros node with the same name as the guide
-#ifdef USE_ROS_RT_PUBLISHER
-        new_guide.guide->InitRtPublishers(name);
-#endif
-        // Add the new guide to the buffer
-        no_rt_buffer.push_back(new_guide);
-
-        // Circular swap
-        rt_idx_ = (rt_idx_ + 1) % 2;
-        no_rt_idx_ = (no_rt_idx_ + 1) % 2;
+    if(new_set->guides.size() == rt_buffer.size()) // Nothing to publish
+    {
+        delete new_set;
+        return;
     }
-    else
-        PRINT_WARNING("Impossible to insert the guide, guide already existing.");
+
+    // A single publication for all the guides
+    PackBank(*new_set,src_idx,rt_set_.load()->robots.size());
+    PublishSet(new_set);
 }
 
 bool MechanismManager::ReadConfig()
 {
-    YAML::Node main_node = CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+    YAML::Node main_node = GetYamlNodeFromPkgName(ROS_PKG_NAME);
     if (const YAML::Node& curr_node = main_node["mechanism_manager"])
     {
         std::string vm_order, vm_model_type;
         curr_node["vm_order"] >> vm_order;
         curr_node["vm_model_type"] >> vm_model_type;
         curr_node["escape_factor"] >> escape_factor_;
+        curr_node["fade_time"] >> fade_time_;
+        curr_node["cull_epsilon"] >> cull_epsilon_;
+        curr_node["low_rate_th"] >> low_rate_th_;
+        curr_node["low_rate_budget"] >> low_rate_budget_;
+        curr_node["low_rate_max_period"] >> low_rate_max_period_;
+        curr_node["n_workers"] >> n_workers_;
+        curr_node["workers_cpus"] >> workers_cpus_;
+        curr_node["workers_priority"] >> workers_priority_;
+        curr_node["merge_exit_th"] >> merge_exit_th_;
+        curr_node["n_cluster_threads"] >> n_cluster_threads_;
+        curr_node["merge_coreset_size"] >> merge_coreset_size_;
+        curr_node["demo_sample_period"] >> demo_sample_period_;
+        curr_node["demo_crop_dist"] >> demo_crop_dist_;
+        curr_node["demo_cutoff_freq"] >> demo_cutoff_freq_;
+        curr_node["demo_ds"] >> demo_ds_;
+        curr_node["telemetry_buffer_size"] >> telemetry_buffer_size_;
+        curr_node["telemetry_log_file"] >> telemetry_log_file_;
+        curr_node["n_robots"] >> n_robots_;
+        curr_node["lazy_load_dist"] >> lazy_load_dist_;
+        curr_node["lazy_max_resident"] >> lazy_max_resident_;
+        curr_node["lazy_check_period"] >> lazy_check_period_;
         assert(escape_factor_ > 0.0);
+        assert(fade_time_ > 0.0);
+        SetCulling(cull_epsilon_);
+        SetMultiRate(low_rate_th_,low_rate_budget_,low_rate_max_period_);
+        assert(n_workers_ >= 0);
+        assert(workers_priority_ >= 0);
+        assert(n_cluster_threads_ >= 0);
+        assert(merge_coreset_size_ >= 0);
+        assert(demo_sample_period_ > 0.0);
+        assert(demo_crop_dist_ >= 0.0);
+        assert(demo_cutoff_freq_ >= 0.0 && demo_cutoff_freq_ < 0.5/demo_sample_period_);
+        assert(demo_ds_ >= 0.0);
+        assert(telemetry_buffer_size_ >= 0);
+        assert(n_robots_ > 0);
+        assert(lazy_load_dist_ >= 0.0);
+        assert(lazy_max_resident_ >= 0);
+        assert(lazy_check_period_ > 0.0);
+        if(n_cluster_threads_ == 0)
+            n_cluster_threads_ = std::max(static_cast<int>(boost::thread::hardware_concurrency()),1);
 
         vm_factory_.SetDefaultPreferences(vm_order,vm_model_type);
 
@@ -136,6 +317,22 @@ bool MechanismManager::ReadConfig()
         return false;
 }
 
+void MechanismManager::ReloadConfig()
+{
+    tool_box::ReloadYamlNodeFromPkgName(ROS_PKG_NAME);
+    vm_factory_.ReloadConfig();
+}
+
+void MechanismManager::GetLatencyStats(std::string& report)
+{
+    report = latency_stats_.GetReport();
+}
+
+void MechanismManager::ResetLatencyStats()
+{
+    latency_stats_.RequestReset();
+}
+
 void MechanismManager::InsertVm(std::string& model_name)
 {
     if(model_name.empty())
@@ -162,6 +359,33 @@ void MechanismManager::InsertVm(std::string& model_name)
 }
 
 void MechanismManager::InsertVm(const MatrixXd& data)
+{
+    if(demo_ds_ > 0.0)
+    {
+        MatrixXd reduced_data = data;
+        if(!ReduceData(reduced_data))
+        {
+            PRINT_WARNING("Impossible to create the guide, data is empty.");
+            return;
+        }
+        InsertReducedVm(reduced_data);
+    }
+    else
+        InsertReducedVm(data);
+}
+
+void MechanismManager::InsertRecordedVm(boost::shared_ptr<const Demonstration> demo)
+{
+    MatrixXd data;
+    if(!ReduceData(*demo,data))
+    {
+        PRINT_WARNING("Impossible to create the guide, the recording is empty.");
+        return;
+    }
+    InsertReducedVm(data);
+}
+
+void MechanismManager::InsertReducedVm(const MatrixXd& data)
 {
     PRINT_INFO("Creating the guide from data...");
     vm_t* vm_tmp_ptr = NULL;
@@ -197,15 +421,13 @@ void MechanismManager::UpdateVm(MatrixXd& data, const int idx)
         return;
     }
 
-    std::vector<GuideStruct>& no_rt_buffer = vm_buffers_[no_rt_idx_];
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    no_rt_buffer.clear();
-
-    PRINT_INFO("Update guide: " << rt_buffer[idx].name);
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
 
     if(idx<rt_buffer.size())
     {
-        // Clone the vm to update
+        PRINT_INFO("Update guide: " << rt_buffer[idx].name);
+
+        // Clone the vm to update, the clone copies the tables and the splines without rebuilding them
         vm_t* vm_tmp_ptr = NULL;
         vm_tmp_ptr = rt_buffer[idx].guide->Clone();
 
@@ -213,96 +435,211 @@ void MechanismManager::UpdateVm(MatrixXd& data, const int idx)
         // Behavior:
         //  - Spline: substitute the model
         //  - GMR: incremental training
+        // The tables, the merge summary and the splines (Normalize) are rebuilt once by CreateModelFromData,
+        // which does not call Init: the recorded states and the kd-tree are refreshed here
         vm_tmp_ptr->CreateModelFromData(data);
+        vm_tmp_ptr->Init();
         //vm_tmp_ptr->AlignAndUpateGuide(data);
 
         GuideStruct updated_guide;
         updated_guide.name = rt_buffer[idx].name;
-        updated_guide.scale = rt_buffer[idx].scale;
-        updated_guide.scale_t = rt_buffer[idx].scale_t;
         updated_guide.guide = boost::shared_ptr<vm_t>(vm_tmp_ptr);
-        updated_guide.fade = rt_buffer[idx].fade; // Copy the shared pointer
 
+        GuideSet* new_set = new GuideSet();
+        new_set->guides.reserve(rt_buffer.size());
+        std::vector<int> src_idx;
         for (size_t i = 0; i < rt_buffer.size(); i++)
         {
             if(i != idx)
-                 no_rt_buffer.push_back(rt_buffer[i]); // Copy all the vms except the one to update
+                 new_set->guides.push_back(rt_buffer[i]); // Copy all the vms except the one to update
             else
-                 no_rt_buffer.push_back(updated_guide);
+                 new_set->guides.push_back(updated_guide);
+            src_idx.push_back(i); // Keep scale and fade of the updated guide
         }
 
-        // Circular swap
-        rt_idx_ = (rt_idx_ + 1) % 2;
-        no_rt_idx_ = (no_rt_idx_ + 1) % 2;
+        PackBank(*new_set,src_idx,rt_set_.load()->robots.size());
+        PublishSet(new_set);
     }
     else
         PRINT_WARNING("Impossible to update the guide.");
 }
 
+bool MechanismManager::ReduceData(MatrixXd& data)
+{
+    if(demo_ds_ == 0.0 || data.cols() != position_dim_)
+        return CropData(data);
+
+    // The data is pushed as if it was streamed, the training then scales with the length of the path
+    filters::DemoReducer reducer(position_dim_,demo_sample_period_,demo_crop_dist_,demo_cutoff_freq_,demo_ds_);
+    reducer.Push(data);
+    reducer.Flush();
+    if(reducer.GetNbPoints() < 2)
+        return false;
+    reducer.GetData(data);
+    PRINT_INFO("Demonstration reduced from "<<reducer.GetNbSamples()<<" to "<<reducer.GetNbPoints()<<" points");
+    return true;
+}
+
+bool MechanismManager::ReduceData(const Demonstration& demo, MatrixXd& data)
+{
+    if(demo.IsEmpty() || demo.GetDim() != position_dim_)
+        return false;
+
+    // The recordings are raw samples of the real time loop, they are always cropped and filtered
+    filters::DemoReducer reducer(position_dim_,demo_sample_period_,demo_crop_dist_,demo_cutoff_freq_,demo_ds_);
+    for(long i=0;i<demo.GetNbSamples();i++)
+        reducer.Push(demo.GetSample(i));
+    reducer.Flush();
+    if(reducer.GetNbPoints() < 2)
+        return false;
+    reducer.GetData(data);
+    PRINT_INFO("Recording reduced from "<<reducer.GetNbSamples()<<" to "<<reducer.GetNbPoints()<<" points");
+    return true;
+}
+
 void MechanismManager::ClusterVm(MatrixXd& data)
+{
+    if(!ReduceData(data))
+    {
+        PRINT_WARNING("Impossible to update guide, data is empty.");
+        return;
+    }
+    ClusterReducedVm(data);
+}
+
+void MechanismManager::ClusterRecordedVm(boost::shared_ptr<const Demonstration> demo)
+{
+    MatrixXd data;
+    if(!ReduceData(*demo,data))
+    {
+        PRINT_WARNING("Impossible to update guide, the recording is empty.");
+        return;
+    }
+    ClusterReducedVm(data);
+}
+
+void MechanismManager::ClusterReducedVm(MatrixXd& data)
 {
     // TODO Check if the guide is a probabilistic one
     // otherwise skip
 
-    if(CropData(data))
+    // Create a temporary gmm model, the lock is not needed
+    vm_t* vm_tmp_ptr = NULL;
+    try
+    {
+        vm_tmp_ptr = vm_factory_.Build(data);
+    }
+    catch(...)
     {
-        boost::unique_lock<mutex_t> guard(mtx_, boost::defer_lock);
-        guard.lock(); // Lock
+        PRINT_WARNING("Impossible to create the guide from data...");
+        return;
+    }
 
-        // Create a temporary gmm model
-        vm_t* vm_tmp_ptr = NULL;
-        try
-        {
-            vm_tmp_ptr = vm_factory_.Build(data);
-        }
-        catch(...)
+    // Snapshot of the guides, the shared pointers keep them alive if the set is changed meanwhile
+    std::vector<GuideStruct> guides;
+    double merge_th;
+    {
+        boost::recursive_mutex::scoped_lock guard(mtx_);
+        guides = rt_set_.load()->guides;
+        merge_th = merge_th_;
+    }
+
+    int max_idx = -1;
+    double max_rel_lik = -std::numeric_limits<double>::infinity();
+    if(guides.size()>0 && merge_th != 1.0)
+    {
+        // Few representative points of the demonstration are enough if the guides have a summary
+        gmm::Coreset coreset;
+        double max_score;
+        bool use_coreset = false;
+        if(merge_coreset_size_ > 0)
         {
-            PRINT_WARNING("Impossible to create the guide from data...");
-            return;
+            gmm::BuildCoreset(data.rightCols(position_dim_),merge_coreset_size_,coreset);
+            use_coreset = ComputeMergeScore(vm_tmp_ptr,data,&coreset,max_score);
         }
+        if(!use_coreset)
+            max_score = vm_tmp_ptr->GetResponsability(); // ComputeResponsability(data), cached by the training
+        FindClosestVm(guides,data,use_coreset ? &coreset : NULL,max_score,std::max(merge_exit_th_,merge_th),max_idx,max_rel_lik);
+    }
+
+    // The lock is held only to insert or update
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+
+    // The closest guide could have been moved or deleted meanwhile
+    int idx = -1;
+    if(max_idx >= 0 && max_rel_lik >= merge_th)
+    {
+        const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
+        for(size_t i=0;i<rt_buffer.size();i++)
+            if(rt_buffer[i].guide == guides[max_idx].guide)
+                idx = i;
+    }
+
+    if(idx >= 0)
+    {
+        delete vm_tmp_ptr;
+        UpdateVm(data,idx);
+    }
+    else
+    {
+        PRINT_INFO("Creating a new guide.");
         std::string default_name = "guide_"+std::to_string(++guide_unique_id_);
+        AddNewVm(vm_tmp_ptr,default_name);
+    }
+}
+
+bool MechanismManager::ComputeMergeScore(const vm_t* const guide, const MatrixXd& data, const gmm::Coreset* const coreset, double& score)
+{
+    if(coreset != NULL)
+        return guide->ComputeMergeScore(coreset->points,coreset->weights,score);
+    score = guide->ComputeResponsability(data);
+    return true;
+}
 
-        std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-        if(rt_buffer.size()>0 && merge_th_ != 1.0)
+void MechanismManager::FindClosestVm(const std::vector<GuideStruct>& guides, const MatrixXd& data, const gmm::Coreset* const coreset, const double max_score, const double exit_th, int& max_idx, double& max_rel_lik)
+{
+    // Each thread takes the next guide to evaluate, all the threads stop as soon as a guide
+    // reaches exit_th (not lower than the merge threshold) since the demonstration will be merged anyway
+    const int n_guides = guides.size();
+    std::vector<double> rel_liks(n_guides,-std::numeric_limits<double>::infinity());
+    std::atomic<int> next_idx(0);
+    std::atomic<bool> found(false);
+
+    auto evaluate = [&]()
+    {
+        int i;
+        while(!found && (i = next_idx++) < n_guides)
         {
-            int max_idx = 0;
-            double max_lik, lik;
-            double max_rel_lik = -std::numeric_limits<double>::min();
-            double rel_lik = 0.0;
-            //max_lik = std::exp(vm_tmp_ptr->GetResponsability());
-            max_lik = vm_tmp_ptr->GetResponsability();
-            for(int i=0;i<rt_buffer.size();i++)
+            double score;
+            if(ComputeMergeScore(guides[i].guide.get(),data,coreset,score))
             {
-                //lik = std::exp(rt_buffer[i].guide->ComputeResponsability(data));
-                lik = rt_buffer[i].guide->ComputeResponsability(data);
-                rel_lik = lik/max_lik;
                 //assert(rel_lik>=0 && rel_lik<=1); // This should never happen
-                assert(rel_lik<=1); // This should never happen
-                if(rel_lik>max_rel_lik) // Search the maximum relative likelihood
-                {
-                    max_rel_lik = rel_lik;
-                    max_idx = i;
-                }
-            }
-            if(max_rel_lik<merge_th_)
-            {
-                PRINT_INFO("Creating a new guide.");
-                AddNewVm(vm_tmp_ptr,default_name);
-            }
-            else
-            {
-                UpdateVm(data,max_idx);
+                assert(coreset != NULL || score/max_score <= 1); // This should never happen
+                rel_liks[i] = RelativeMergeScore(score,max_score);
             }
+            if(rel_liks[i] >= exit_th)
+                found = true;
         }
-        else
+    };
+
+    const int n_threads = std::min(n_cluster_threads_,n_guides);
+    boost::thread_group threads;
+    for(int i=1;i<n_threads;i++)
+        threads.create_thread(evaluate);
+    evaluate();
+    threads.join_all();
+
+    // Search the maximum relative likelihood
+    max_idx = 0;
+    max_rel_lik = rel_liks[0];
+    for(int i=1;i<n_guides;i++)
+    {
+        if(rel_liks[i]>max_rel_lik)
         {
-            PRINT_INFO("Creating a new guide.");
-            AddNewVm(vm_tmp_ptr,default_name);
+            max_rel_lik = rel_liks[i];
+            max_idx = i;
         }
-        guard.unlock();
     }
-    else
-        PRINT_WARNING("Impossible to update guide, data is empty.");
 }
 
 void MechanismManager::ClusterVm(double* const data, const int n_rows)
@@ -315,7 +652,7 @@ void MechanismManager::SaveVm(const int idx)
 {
     boost::unique_lock<mutex_t> guard(mtx_, boost::defer_lock);
     guard.lock();
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
     if(idx<rt_buffer.size())
     {
         std::string model_complete_path(pkg_path_+"/models/gmm/"+rt_buffer[idx].name);
@@ -331,11 +668,171 @@ void MechanismManager::SaveVm(const int idx)
     guard.unlock();
 }
 
-void MechanismManager::DeleteVm(const int idx)
+void MechanismManager::InsertLibrary(std::string& library_name)
 {
+    std::string library_complete_path(pkg_path_+"/models/library/"+library_name);
+
+    if(guides_cache_ != NULL)
+    {
+        // Only the boxes are computed, the guides are built by CheckCache
+        PRINT_INFO("Registering the guides library... " << library_complete_path);
+        const int n_added = guides_cache_->Add(library_complete_path);
+        PRINT_INFO("... Done! "<<n_added<<" guides registered, "<<guides_cache_->GetNbGuides()<<" in the cache");
+        return;
+    }
+
+    PRINT_INFO("Loading the guides library... " << library_complete_path);
+
+    library::Library lib;
+    if(!lib.Open(library_complete_path))
+    {
+        PRINT_WARNING("Impossible to open the guides library "<<library_complete_path);
+        return;
+    }
+
+    std::vector<vm_t*> vms;
+    std::vector<std::string> names;
+    for(int i = 0; i < lib.GetNbRecords(); i++)
+    {
+        const library::RecordView record = lib.GetRecord(i);
+        try
+        {
+            vms.push_back(vm_factory_.Build(record));
+            names.push_back(record.GetName());
+        }
+        catch(...)
+        {
+            PRINT_WARNING("Impossible to create the guide "<<record.GetName()<<" from the library");
+        }
+    }
+
+    AddNewVms(vms,names);
+    PRINT_INFO("... Done! "<<vms.size()<<" guides loaded");
+}
+
+void MechanismManager::DisableGuidesCache()
+{
+    if(guides_cache_ == NULL)
+        return;
+    cache_stop_ = true;
+    if(cache_thread_.joinable())
+        cache_thread_.join();
+    delete guides_cache_;
+    guides_cache_ = NULL;
+    PRINT_INFO("The guides cache is disabled, the libraries are fully loaded");
+}
+
+void MechanismManager::CacheLoop()
+{
+    const boost::posix_time::microseconds period(static_cast<long>(lazy_check_period_ * 1e6));
+    while(!cache_stop_.load())
+    {
+        boost::this_thread::sleep(period);
+        CheckCache();
+    }
+}
+
+void MechanismManager::CheckCache()
+{
+    std::vector<VectorXd> positions;
+    if(guides_cache_->GetNbGuides() == 0 || !guides_cache_->GetPositions(positions))
+        return;
+
+    std::vector<std::string> names;
+    {
+        boost::recursive_mutex::scoped_lock guard(mtx_);
+        if(scale_mode_ == HARD) // The guides can not be inserted or deleted
+            return;
+        GetVmNames(names);
+    }
+
+    std::vector<int> to_load;
+    std::vector<std::string> to_evict;
+    guides_cache_->Select(positions,names,lazy_load_dist_,lazy_max_resident_,to_load,to_evict);
+
+    if(!to_evict.empty())
+        PRINT_INFO("Evicting "<<RemoveVms(to_evict)<<" guides from the cache");
+
+    if(to_load.empty())
+        return;
+
+    // The models are built without locking, the records stay mapped by the cache
+    std::vector<vm_t*> vms;
+    std::vector<std::string> vms_names;
+    std::vector<int> vms_idx;
+    for(size_t i = 0; i < to_load.size(); i++)
+    {
+        const library::RecordView record = guides_cache_->GetRecord(to_load[i]);
+        try
+        {
+            vms.push_back(vm_factory_.Build(record));
+            vms_names.push_back(record.GetName());
+            vms_idx.push_back(to_load[i]);
+        }
+        catch(...)
+        {
+            PRINT_WARNING("Impossible to create the guide "<<record.GetName()<<" from the library");
+        }
+    }
+    // The mode or the names could have changed in the meantime, only the guides inserted by the cache are resident
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    if(scale_mode_ == HARD)
+    {
+        for(size_t i = 0; i < vms.size(); i++)
+            delete vms[i];
+        return;
+    }
+    size_t n_loaded = 0;
+    for(size_t i = 0; i < vms.size(); i++)
+    {
+        if(CheckForNamesCollision(vms_names[i]))
+        {
+            delete vms[i];
+            continue;
+        }
+        vms[n_loaded] = vms[i];
+        vms_names[n_loaded] = vms_names[i];
+        guides_cache_->SetResident(vms_idx[i],true);
+        n_loaded++;
+    }
+    vms.resize(n_loaded);
+    vms_names.resize(n_loaded);
+    AddNewVms(vms,vms_names);
+    PRINT_INFO("Loaded "<<n_loaded<<" guides from the cache, "<<guides_cache_->GetNbResident()<<" resident");
+}
+
+void MechanismManager::SaveLibrary(std::string& library_name)
+{
+    // Snapshot of the guides, the published guides are not modified by the non real time methods
+    std::vector<GuideStruct> guides;
+    {
+        boost::recursive_mutex::scoped_lock guard(mtx_);
+        guides = rt_set_.load()->guides;
+    }
+
+    std::vector<library::Record> records;
+    records.reserve(guides.size());
+    for(size_t i = 0; i < guides.size(); i++)
+    {
+        records.push_back(library::Record(guides[i].name));
+        if(!guides[i].guide->SaveModelToRecord(records.back()))
+        {
+            PRINT_WARNING("Impossible to save the guide "<<guides[i].name<<" in the library");
+            records.pop_back();
+        }
+    }
 
-   bool delete_complete = false;
+    ::mkdir((pkg_path_+"/models/library").c_str(),0755); // If it does not exist
+    std::string library_complete_path(pkg_path_+"/models/library/"+library_name);
+    PRINT_INFO("Saving "<<records.size()<<" guides to " << library_complete_path);
+    if(!library::Write(library_complete_path,records))
+        PRINT_ERROR("Impossible to save the file " << library_complete_path);
+    else
+        PRINT_INFO("Saving complete");
+}
 
+void MechanismManager::DeleteVm(const int idx)
+{
    boost::recursive_mutex::scoped_lock guard(mtx_);
 
    //guard.lock(); // Lock
@@ -344,33 +841,59 @@ void MechanismManager::DeleteVm(const int idx)
        PRINT_WARNING("Impossible to delete the guide while in HARD mode.");
        return;
    }
-   std::vector<GuideStruct>& no_rt_buffer = vm_buffers_[no_rt_idx_];
-   std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-   no_rt_buffer.clear();
-
-   PRINT_INFO("Deleting guide "<<rt_buffer[idx].name);
-
-   // Copy all the guides, except the one to delete
-   // It will be deleted from the no_rt_buffer at the next Delete or Insert
-   // thanks to the clear()
-   for (size_t i = 0; i < rt_buffer.size(); i++)
+   const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
+   if(idx<0 || idx>=rt_buffer.size())
    {
-       if(i != idx)
-            no_rt_buffer.push_back(rt_buffer[i]);
-       else
-           delete_complete = true;
+       PRINT_WARNING("Impossible to remove guide number#"<<idx);
+       return;
    }
+   const std::string name = rt_buffer[idx].name;
+
+   PRINT_INFO("Deleting guide "<<name);
 
-   // Circular swap
-   rt_idx_ = (rt_idx_ + 1) % 2;
-   no_rt_idx_ = (no_rt_idx_ + 1) % 2;
+   const bool delete_complete = RemoveVms(std::vector<std::string>(1,name)) == 1;
 
    guard.unlock();
 
    if(delete_complete)
-       PRINT_INFO("Delete of guide "<<rt_buffer[idx].name<<" complete");
+       PRINT_INFO("Delete of guide "<<name<<" complete");
    else
-       PRINT_WARNING("Impossible to remove guide "<<rt_buffer[idx].name);
+       PRINT_WARNING("Impossible to remove guide "<<name);
+}
+
+int MechanismManager::RemoveVms(const std::vector<std::string>& names)
+{
+   boost::recursive_mutex::scoped_lock guard(mtx_);
+
+   if(scale_mode_ == HARD)
+       return 0;
+
+   // Copy all the guides, except the ones to delete
+   // They will be deleted with the old set, once the real time loop does not use it anymore
+   const std::unordered_set<std::string> deleted(names.begin(),names.end());
+   const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
+   GuideSet* new_set = new GuideSet();
+   new_set->guides.reserve(rt_buffer.size());
+   std::vector<int> src_idx;
+   for (size_t i = 0; i < rt_buffer.size(); i++)
+   {
+       if(deleted.count(rt_buffer[i].name) == 0)
+       {
+            new_set->guides.push_back(rt_buffer[i]);
+            src_idx.push_back(i);
+       }
+   }
+
+   const int n_removed = rt_buffer.size() - new_set->guides.size();
+   if(n_removed == 0) // Nothing to publish
+   {
+       delete new_set;
+       return 0;
+   }
+
+   PackBank(*new_set,src_idx,rt_set_.load()->robots.size());
+   PublishSet(new_set);
+   return n_removed;
 }
 
 void MechanismManager::GetVmName(const int idx, std::string& name)
@@ -378,7 +901,7 @@ void MechanismManager::GetVmName(const int idx, std::string& name)
     PRINT_INFO("Get name of guide number#"<<idx);
     boost::unique_lock<mutex_t> guard(mtx_, boost::defer_lock);
     guard.lock();
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
     if(idx<rt_buffer.size())
     {
         name = rt_buffer[idx].name;
@@ -393,7 +916,7 @@ void MechanismManager::GetVmNames(std::vector<std::string>& names)
     //PRINT_INFO("Get the guides name");
     boost::unique_lock<mutex_t> guard(mtx_, boost::defer_lock);
     guard.lock();
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
     names.resize(rt_buffer.size());
     for(size_t i=0;i<rt_buffer.size();i++)
     {
@@ -402,20 +925,32 @@ void MechanismManager::GetVmNames(std::vector<std::string>& names)
     guard.unlock();
 }
 
+bool MechanismManager::GetVmChanges(const uint64_t session, const unsigned long since, std::vector<GuideDelta>& deltas, std::vector<std::string>& names,
+                                    uint64_t& current_session, unsigned long& revision)
+{
+    return change_log_.GetChanges(session,since,deltas,names,current_session,revision);
+}
+
 void MechanismManager::SetVmName(const int idx, std::string& name)
 {
     PRINT_INFO("Set name of guide number#"<<idx);
     boost::unique_lock<mutex_t> guard(mtx_, boost::defer_lock);
     guard.lock();
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
     if(idx<rt_buffer.size())
     {
         if(!CheckForNamesCollision(name))
         {
-            rt_buffer[idx].name = name;
-#ifdef USE_ROS_RT_PUBLISHER
-            rt_buffer[idx].guide->InitRtPublishers(name);
-#endif
+            // The published set is not modified: same guides with the new name
+            GuideSet* new_set = new GuideSet();
+            new_set->guides = rt_buffer;
+            new_set->guides[idx].name = name;
+            std::vector<int> src_idx(rt_buffer.size());
+            for (size_t i = 0; i < rt_buffer.size(); i++)
+                src_idx[i] = i;
+            PackBank(*new_set,src_idx,rt_set_.load()->robots.size());
+            change_log_.Rename(idx,name); // Then the publication does not change the log
+            PublishSet(new_set);
         }
         else
             PRINT_WARNING("Name already used, please change it");
@@ -431,23 +966,29 @@ void MechanismManager::SetVmMode(const scale_mode_t mode)
     boost::unique_lock<mutex_t> guard(mtx_, boost::defer_lock);
     guard.lock();
 
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
 
     if(rt_buffer.size()>0)
     {
         switch(mode)
         {
           case HARD:
-            while(!OnVm()) // Pass to Hard when on guide
-              boost::this_thread::sleep(boost::posix_time::milliseconds(100));
-            scale_mode_ = HARD;
-            PRINT_INFO("Set mode to HARD");
+            // Pass to Hard when on guide, the switch is done by the real time loop
+            hard_mode_requested_ = true;
+            PRINT_INFO("Set mode to HARD, it will be active once on a guide");
             break;
           case SOFT:
+            hard_mode_requested_ = false;
             scale_mode_ = SOFT;
             PRINT_INFO("Set mode to SOFT");
             break;
+          case PROB:
+            hard_mode_requested_ = false;
+            scale_mode_ = PROB;
+            PRINT_INFO("Set mode to PROB");
+            break;
           default:
+            hard_mode_requested_ = false;
             scale_mode_ = SOFT;
             PRINT_INFO("Set mode to SOFT");
             break;
@@ -483,11 +1024,85 @@ void MechanismManager::GetMergeThreshold(double& merge_th)
     //PRINT_INFO("Get Merge threshold: "<< merge_th);
 }
 
+void MechanismManager::SetNbWorkers(const int n_workers)
+{
+    assert(n_workers >= 0);
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+
+    delete worker_pool_;
+    worker_pool_ = NULL;
+    n_workers_ = n_workers;
+
+    if(n_workers_ > 1)
+    {
+        worker_pool_ = new WorkerPool(n_workers,workers_cpus_,workers_priority_);
+        PRINT_INFO("Update the guides with "<< n_workers <<" workers");
+    }
+    else
+        PRINT_INFO("Update the guides with a single thread");
+}
+
+void MechanismManager::SetNbRobots(const int n_robots)
+{
+    assert(n_robots > 0);
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
+
+    // Same guides, new robot banks
+    GuideSet* new_set = new GuideSet();
+    new_set->guides = rt_buffer;
+    std::vector<int> src_idx(rt_buffer.size());
+    for (size_t i = 0; i < rt_buffer.size(); i++)
+        src_idx[i] = i;
+
+    PackBank(*new_set,src_idx,n_robots);
+    PublishSet(new_set);
+    PRINT_INFO("Update the guides for "<< n_robots <<" robots");
+}
+
+void MechanismManager::SetCulling(const double cull_epsilon)
+{
+    assert(cull_epsilon >= 0.0 && cull_epsilon < 1.0);
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    cull_epsilon_ = cull_epsilon;
+
+    // scale = exp(-escape_factor * distance) < cull_epsilon when distance > cull_dist
+    if(cull_epsilon_ > 0.0)
+        cull_dist_ = -std::log(cull_epsilon_)/escape_factor_;
+    else
+        cull_dist_ = std::numeric_limits<double>::infinity();
+}
+
+void MechanismManager::SetMultiRate(const double low_rate_th, const int low_rate_budget, const int low_rate_max_period)
+{
+    assert(low_rate_th >= 0.0 && low_rate_th < 1.0);
+    assert(low_rate_budget >= 0);
+    assert(low_rate_max_period > 0);
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    low_rate_th_ = low_rate_th;
+    low_rate_budget_ = low_rate_budget;
+    low_rate_max_period_ = low_rate_max_period;
+}
+
+unsigned long MechanismManager::GetEpoch()
+{
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    return rt_set_.load()->epoch;
+}
+
+int MechanismManager::GetNbRobots()
+{
+    const int n_robots = PinSet()->robots.size();
+    UnpinSet();
+    return n_robots;
+}
+
 bool MechanismManager::CheckForNamesCollision(const std::string& name)
 {
     bool collision = false;
     boost::recursive_mutex::scoped_lock guard(mtx_);
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const std::vector<GuideStruct>& rt_buffer = rt_set_.load()->guides;
 
     for(size_t i = 0; i<rt_buffer.size(); i++)
     {
@@ -498,139 +1113,617 @@ bool MechanismManager::CheckForNamesCollision(const std::string& name)
     return collision;
 }
 
+void MechanismManager::PackBank(GuideSet& new_set, const std::vector<int>& src_idx, const int n_robots)
+{
+    // Fill the banks of the new set with its guides,
+    // src_idx[i] is the index in the published set of the guide i, or -1 for a new guide
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    const std::vector<GuideStruct>& no_rt_buffer = new_set.guides;
+    GuideBank& no_rt_bank = new_set.bank;
+    // The real time loop keeps writing the published banks, work on a consistent copy of them
+    std::vector<RobotBank> rt_robots;
+    ReadRobots(*rt_set_.load(),rt_robots);
+
+    // The published guides are only read, the real time loop updates an instance of each of them
+    std::vector<GuideStruct>& guides = new_set.guides;
+    for(int i = 0; i<static_cast<int>(guides.size()); i++)
+        if(!guides[i].instance)
+            guides[i].instance.reset(guides[i].guide->Clone());
+
+    assert(src_idx.size() == no_rt_buffer.size());
+    assert(n_robots > 0);
+    const int n_guides = no_rt_buffer.size();
+    no_rt_bank.Resize(n_guides,position_dim_);
+
+    VectorXd box_min, box_max;
+    int guide_state_size = 0;
+    for(int i = 0; i<n_guides; i++)
+        guide_state_size = std::max(guide_state_size,no_rt_buffer[i].guide->getInstanceStateSize());
+    new_set.robots.resize(n_robots);
+    for(int k = 0; k<n_robots; k++)
+        new_set.robots[k].Resize(n_guides,position_dim_,guide_state_size);
+
+    for(int i = 0; i<n_guides; i++)
+    {
+        const vm_t& guide = *no_rt_buffer[i].guide;
+        no_rt_bank.K.col(i) = no_rt_buffer[i].guide->getK().diagonal();
+        no_rt_bank.B.col(i) = no_rt_buffer[i].guide->getB().diagonal();
+
+        // Same boxes as the lazy guides of the cache
+        assert(guide.getStateRecorded().cols() == position_dim_);
+        ComputeGuideBox(guide.getStateRecorded(),box_min,box_max);
+        no_rt_bank.box_min.col(i) = box_min;
+        no_rt_bank.box_max.col(i) = box_max;
+
+        const int state_size = guide.getInstanceStateSize();
+        for(int k = 0; k<n_robots; k++)
+        {
+            RobotBank& robot = new_set.robots[k];
+            const int j = src_idx[i];
+            const RobotBank& rt_robot = rt_robots[k < static_cast<int>(rt_robots.size()) ? k : 0]; // The new robots start from the robot 0
+            if(j >= 0 && rt_robot.guide_states.rows() >= state_size)
+            {
+                // Carry the state of the guide, the real time loop could advance it until the new set
+                // is published but the difference is at most few ticks
+                robot.scale(i) = rt_robot.scale(j);
+                robot.scale_hard(i) = rt_robot.scale_hard(j);
+                robot.elapsed(i) = rt_robot.elapsed(j);
+                robot.n_skipped(i) = rt_robot.n_skipped(j);
+                robot.scale_t(i) = rt_robot.scale_t(j);
+                robot.phase(i) = rt_robot.phase(j);
+                robot.state.col(i) = rt_robot.state.col(j);
+                robot.state_dot.col(i) = rt_robot.state_dot.col(j);
+                robot.t_versor.col(i) = rt_robot.t_versor.col(j);
+                robot.guide_states.col(i).head(state_size) = rt_robot.guide_states.col(j).head(state_size);
+            }
+            else // New guide, not used yet by the real time loop
+            {
+                guide.SaveInstanceState(robot.guide_states.col(i).data());
+                robot.phase(i) = guide.getPhase();
+                robot.state.col(i) = no_rt_buffer[i].guide->getState();
+                robot.state_dot.col(i) = no_rt_buffer[i].guide->getStateDot();
+                robot.t_versor.col(i) = no_rt_buffer[i].guide->getJacobianVersor();
+            }
+        }
+    }
+}
+
+void MechanismManager::PublishSet(GuideSet* const new_set)
+{
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    GuideSet* old_set = rt_set_.load();
+    new_set->epoch = old_set->epoch + 1;
+    rt_set_.store(new_set); // Sequentially consistent with the pins (see ReclaimSets)
+    retired_sets_.push_back(old_set);
+
+    std::vector<std::string> names(new_set->guides.size());
+    for(size_t i=0;i<names.size();i++)
+        names[i] = new_set->guides[i].name;
+    change_log_.Publish(names);
+
+    ReclaimSets();
+}
+
+void MechanismManager::ReclaimSets()
+{
+    // The real time loop acknowledges the set it uses at the beginning of Update,
+    // so it does not hold anymore the sets older than the acknowledged one.
+    // NOTE If Update is not called, the old sets are kept until the next publications (or the destruction)
+    // A pinned reader could hold any of the replaced sets, the ones taking a pin from now on
+    // load the last published set: keep them all until there are no pins.
+    boost::recursive_mutex::scoped_lock guard(mtx_);
+    if(n_pins_.load() > 0)
+        return;
+    const unsigned long rt_epoch = rt_epoch_.load(std::memory_order_acquire);
+    size_t n_kept = 0;
+    for(size_t i=0;i<retired_sets_.size();i++)
+    {
+        if(retired_sets_[i]->epoch < rt_epoch)
+            delete retired_sets_[i];
+        else
+            retired_sets_[n_kept++] = retired_sets_[i];
+    }
+    retired_sets_.resize(n_kept);
+}
+
+void MechanismManager::IntegrateFade(VectorXd& scale_t, const int i_active, const double fade_time, const double dt)
+{
+    const double decay = std::exp(-dt/fade_time);
+    scale_t *= decay;
+    if(scale_t.size() > 0)
+        scale_t(i_active) += 1.0 - decay;
+}
+
+GuideSet* MechanismManager::PinSet()
+{
+    n_pins_.fetch_add(1);
+    return rt_set_.load();
+}
+
+void MechanismManager::UnpinSet()
+{
+    n_pins_.fetch_sub(1);
+}
+
+/// Reader of the robots seqlock: read copies some values out of set.robots and it is run again if an Update
+/// overlapped it. The banks sizes are fixed once published so the reads are always in bounds.
+template<typename read_t>
+static void ReadRobotsSeq(const GuideSet& set, read_t read)
+{
+    for(;;)
+    {
+        const uint32_t seq = set.robots_seq.load(std::memory_order_acquire);
+        if((seq & 1) == 0)
+        {
+            read();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(set.robots_seq.load(std::memory_order_relaxed) == seq)
+                return;
+        }
+        boost::this_thread::yield();
+    }
+}
+
+void MechanismManager::ReadRobots(const GuideSet& set, std::vector<RobotBank>& robots)
+{
+    // A copy done during an Update is discarded
+    ReadRobotsSeq(set,[&]() {robots = set.robots;});
+}
+
 ///// RT METHODS
 
 void MechanismManager::Update(const VectorXd& robot_position, const VectorXd& robot_velocity, double dt, VectorXd& f_out)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    // NOTE f_out has to be already allocated
+    assert(robot_position.size() == position_dim_);
+    assert(robot_velocity.size() == position_dim_);
+    assert(f_out.size() == position_dim_);
 
-    double sum = 0.0;
-    for(int i=0; i<rt_buffer.size();i++)
+    Update(robot_position.data(),robot_velocity.data(),1,dt,f_out.data());
+}
+
+void MechanismManager::Update(const double* robots_position, const double* robots_velocity, const int n_robots, double dt, double* f_out)
+{
+    // NOTE All the memory used here is allocated by the non real time methods (PackBank)
+    assert(n_robots > 0);
+
+    // Beginning of the tick and end of each stage
+    int64_t t[N_STAGES];
+    t[0] = GetTimeNs();
+
+    // Take the last published set and acknowledge it, from now on the older sets are not used
+    GuideSet* rt_set = rt_set_.load(std::memory_order_acquire);
+    rt_epoch_.store(rt_set->epoch,std::memory_order_release);
+    // Writer of the robot banks seqlock (see ReadRobots)
+    const uint32_t robots_seq = rt_set->robots_seq.load(std::memory_order_relaxed);
+    rt_set->robots_seq.store(robots_seq + 1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::vector<GuideStruct>& rt_buffer = rt_set->guides;
+    std::vector<RobotBank>& robots = rt_set->robots;
+    const GuideBank& bank = rt_set->bank;
+
+    // Only the robots of the published set are updated (see SetNbRobots), the others get a null force
+    const int n_updated = std::min(n_robots,static_cast<int>(robots.size()));
+    for(int k=0; k<n_updated; k++)
     {
-        // Compute the scale for each mechanism
-        rt_buffer[i].scale = rt_buffer[i].guide->getScale(robot_position,escape_factor_);
-        // Update the virtual mechanisms states
-        rt_buffer[i].guide->Update(robot_position,robot_velocity,dt,rt_buffer[i].scale);
-        sum += rt_buffer[i].scale;
+        robots[k].position = VectorXd::Map(robots_position + k * position_dim_,position_dim_);
+        robots[k].velocity = VectorXd::Map(robots_velocity + k * position_dim_,position_dim_);
     }
-
-    f_out.fill(0.0); // Reset the force
+    if(guides_cache_ != NULL)
+        guides_cache_->Track(robots_position,n_updated);
+
+    // Requested by Stop
+    bool stop_requested = stop_requested_.load(std::memory_order_relaxed);
+    job_stop_ = stop_requested && stop_requested_.compare_exchange_strong(stop_requested,false);
+    job_collision_ = collision_detected_.load(std::memory_order_relaxed);
+
+    // Choose the guides to update for each robot, then compute the scale for each mechanism and
+    // update the virtual mechanisms states of all the robots,
+    // then gather the states into the robot banks. The rest of the loop only runs over the banks.
+    // With the worker pool, each worker updates a fixed contiguous block of guides and the
+    // reductions below are done after the barrier, so the result does not depend on the workers.
+    for(int k=0; k<n_updated; k++)
+        ScheduleGuides(robots[k],bank,dt);
+    job_set_ = rt_set;
+    job_n_robots_ = n_updated;
+    job_dt_ = dt;
+    if(worker_pool_ != NULL && rt_buffer.size() > 1)
+        worker_pool_->Run(&MechanismManager::UpdateGuidesJob,this);
+    else
+        UpdateGuides(0,rt_buffer.size());
+    t[STAGE_GUIDES+1] = GetTimeNs();
 
     // Compute the global scales
-    for(int i=0; i<rt_buffer.size();i++)
+    for(int k=0; k<n_updated; k++)
     {
-      rt_buffer[i].scale_hard = rt_buffer[i].scale/sum;
-      switch(scale_mode_)
-      {
-        case HARD:
-            rt_buffer[i].scale =  rt_buffer[i].scale_hard;
-            break;
-        case SOFT:
-            rt_buffer[i].scale =  rt_buffer[i].scale * rt_buffer[i].scale_hard;
-            break;
-        default:
-          rt_buffer[i].scale =  rt_buffer[i].scale * rt_buffer[i].scale_hard; // Soft
-          break;
-      }
+        RobotBank& robot = robots[k];
+        if(scale_mode_ == PROB)
+            ComputePosteriors(robot);
+        else
+        {
+            const double sum = robot.scale.sum();
+            if(sum > 0.0)
+                robot.scale_hard = robot.scale / sum;
+            else // All the guides are far (or culled)
+                robot.scale_hard.fill(0.0);
+        }
+        switch(scale_mode_)
+        {
+          case HARD:
+              robot.scale = robot.scale_hard;
+              break;
+          case SOFT:
+          case PROB:
+              robot.scale.array() *= robot.scale_hard.array();
+              break;
+          default:
+              robot.scale.array() *= robot.scale_hard.array(); // Soft
+              break;
+        }
     }
+    t[STAGE_SCALES+1] = GetTimeNs();
 
     // For each mechanism that is not active (low scale value), remove the force component tangent to
     // the active mechanism jacobian. In this way we avoid to be locked if one or more guide overlap in a certain area.
     // Use a first order filter to gently remove these components.
+    for(int k=0; k<n_updated; k++)
+    {
+        RobotBank& robot = robots[k];
+
+        //1) Find the active mechanism (i.e. the one with the max scale)
+        double max_scale = 0.0;
+        int i_active = 0;
+        const double* scale_hard = robot.scale_hard.data();
+        for(int i=0; i<robot.scale_hard.size();i++)
+        {
+            if(scale_hard[i] > max_scale)
+            {
+                i_active = i;
+                max_scale = scale_hard[i];
+            }
+        }
+        //2) Activate the filters, the active one goes to 1, the others to 0
+        IntegrateFade(robot.scale_t,i_active,fade_time_,dt);
+    }
+    t[STAGE_FADE+1] = GetTimeNs();
+
+    //3) Compute the force for each mechanism, remove the antagonist force components
+    // The removal of the components tangent to the other mechanisms:
+    //   f_out = sum_i scale_i * (f_vm_i - sum_{j!=i} scale_t_j * t_j * t_j' * f_vm_i)
+    // is rewritten as:
+    //   f_out = f_sum - P * f_sum + f_self
+    // where f_sum = sum_i scale_i * f_vm_i, P = sum_j scale_t_j * t_j * t_j' and
+    // f_self = sum_i scale_i * scale_t_i * t_i * t_i' * f_vm_i (the j==i terms).
+    // In this way it is computed with a single pass over the guides, O(N) instead of O(N^2).
+    bool on_guide = false;
+    for(int k=0; k<n_updated; k++)
+    {
+        RobotBank& robot = robots[k];
+        robot.f_vm = bank.K.cwiseProduct(robot.state.colwise() - robot.position) + bank.B.cwiseProduct(robot.state_dot.colwise() - robot.velocity);
+        robot.f_tangent = robot.f_vm.cwiseProduct(robot.t_versor).colwise().sum().transpose();
+        robot.f_tangent.array() *= robot.scale.array() * robot.scale_t.array();
+        robot.t_versor_scaled = robot.t_versor * robot.scale_t.asDiagonal();
+
+        f_sum_.noalias() = robot.f_vm * robot.scale;
+        f_self_.noalias() = robot.t_versor * robot.f_tangent;
+        projector_.noalias() = robot.t_versor_scaled * robot.t_versor.transpose();
+
+        robot.f_out = f_sum_ + f_self_;
+        robot.f_out.noalias() -= projector_ * f_sum_;
+        VectorXd::Map(f_out + k * position_dim_,position_dim_) = robot.f_out;
+
+        on_guide = on_guide || (robot.scale.array() > 0.9).any();
+    }
+    for(int k=n_updated; k<n_robots; k++)
+        VectorXd::Map(f_out + k * position_dim_,position_dim_).setZero();
+    t[STAGE_FORCES+1] = GetTimeNs();
+    rt_set->robots_seq.store(robots_seq + 2,std::memory_order_release);
+
+    // Requested by SetVmMode, pass to HARD once a robot is on a guide
+    if(hard_mode_requested_.load(std::memory_order_relaxed) && on_guide)
+    {
+        bool requested = true;
+        if(hard_mode_requested_.compare_exchange_strong(requested,false))
+            scale_mode_ = HARD;
+    }
+
+    latency_stats_.Add(t,static_cast<int64_t>(dt * 1e9),rt_buffer.size(),tick_);
+    if(telemetry_ != NULL)
+        RecordTick(*rt_set,t[0],t[STAGE_TICK]);
+    tick_++;
+}
 
-    //1) Find the active mechanism (i.e. the one with the max scale)
+void MechanismManager::RecordTick(const GuideSet& rt_set, const int64_t tick_start, const int64_t tick_end)
+{
+    // The record is written in place in the ring, if it is full the tick is not recorded
+    // NOTE Only the robot 0 is recorded
+    TickRecord* record = telemetry_->Claim();
+    if(record == NULL)
+        return;
+
+    const RobotBank& robot = rt_set.robots[0];
+    const int n_guides = rt_set.guides.size();
+    const int n_recorded = std::min(n_guides,telemetry_max_guides);
+
+    record->tick = tick_;
+    record->time = (tick_start - telemetry_start_) * 1e-9;
+    record->duration = (tick_end - tick_start) * 1e-9;
+    record->n_guides = n_guides;
+    record->position_dim = position_dim_;
+    for(int j=0; j<telemetry_max_dim; j++)
+        record->f_out[j] = j < position_dim_ ? robot.f_out(j) : 0.0;
+    for(int i=0; i<telemetry_max_guides; i++)
+    {
+        if(i < n_recorded)
+        {
+            record->phase[i] = robot.phase(i);
+            record->scale[i] = robot.scale(i);
+            record->scale_t[i] = robot.scale_t(i);
+        }
+        else
+        {
+            record->phase[i] = 0.0;
+            record->scale[i] = 0.0;
+            record->scale_t[i] = 0.0;
+        }
+    }
+
+    telemetry_->Commit();
+}
+
+void MechanismManager::ScheduleGuides(RobotBank& robot, const GuideBank& bank, const double dt)
+{
+    const int n_guides = robot.scale.size();
+    const double cull_sq_dist = cull_dist_ * cull_dist_;
+    double sq_dist, d;
+
+    // Broad phase: if the robot is far from the guide bounding box, its scale is surely
+    // lower than cull_epsilon, freeze the guide. Once the robot is close enough again,
+    // the first update relocates it with the discrete update (low scale).
+    for(int i=0; i<n_guides; i++)
+    {
+        sq_dist = 0.0;
+        for(int j=0; j<position_dim_; j++)
+        {
+            d = std::max(std::max(bank.box_min(j,i) - robot.position(j),robot.position(j) - bank.box_max(j,i)),0.0);
+            sq_dist += d * d;
+        }
+        robot.schedule[i] = sq_dist > cull_sq_dist ? GUIDE_CULLED : GUIDE_UPDATED;
+    }
+
+    if(low_rate_th_ == 0.0)
+        return;
+
+    // The active guide (max scale_hard of the previous tick) and the guides with a high weight are updated
+    // at each tick. A low rate guide is promoted as soon as its weight, estimated with its state extrapolated
+    // from the last update, rises above the threshold. The others are updated round robin within the budget.
+    int i_active = -1;
     double max_scale = 0.0;
-    int i_active = 0;
-    for(int i=0; i<rt_buffer.size();i++)
+    double scale_est_sum = 0.0;
+    for(int i=0; i<n_guides; i++)
     {
-        if(rt_buffer[i].scale_hard > max_scale)
+        if(robot.schedule[i] == GUIDE_CULLED)
+        {
+            robot.scale_est(i) = 0.0;
+            continue;
+        }
+        if(robot.scale_hard(i) > max_scale)
         {
             i_active = i;
-            max_scale = rt_buffer[i].scale_hard;
+            max_scale = robot.scale_hard(i);
         }
+        pos_err_ = robot.state.col(i) + robot.state_dot.col(i) * dt - robot.position;
+        robot.scale_est(i) = std::exp(-escape_factor_ * pos_err_.norm());
+        scale_est_sum += robot.scale_est(i);
     }
-    //2) Activate the filters
-    for(int j=0; j<rt_buffer.size();j++)
-        if(j==i_active) // active
-            rt_buffer[j].scale_t = rt_buffer[j].fade->IntegrateForward(); // -> 1
-        else // not active
-            rt_buffer[j].scale_t = rt_buffer[j].fade->IntegrateBackward(); // -> 0
+    for(int i=0; i<n_guides; i++)
+    {
+        if(robot.schedule[i] == GUIDE_CULLED)
+            continue;
+        if(i != i_active && robot.scale_est(i) < low_rate_th_ * scale_est_sum && robot.n_skipped(i) + 1 < low_rate_max_period_)
+            robot.schedule[i] = GUIDE_SKIPPED;
+    }
+    int n_scheduled = 0;
+    const int first_low_rate = robot.next_low_rate;
+    for(int n=0; n<n_guides && n_scheduled<low_rate_budget_; n++)
+    {
+        const int i = (first_low_rate + n) % n_guides;
+        if(robot.schedule[i] == GUIDE_SKIPPED)
+        {
+            robot.schedule[i] = GUIDE_UPDATED;
+            robot.next_low_rate = (i + 1) % n_guides;
+            n_scheduled++;
+        }
+    }
+}
 
-    //3) Compute the force for each mechanism, remove the antagonist force components
-    for(int i=0; i<rt_buffer.size();i++)
+void MechanismManager::UpdateGuides(const int first_idx, const int last_idx)
+{
+    std::vector<GuideStruct>& rt_buffer = job_set_->guides;
+    std::vector<RobotBank>& robots = job_set_->robots;
+
+    // Guides in the outer loop: the model of a guide is used by all the robots while it is in cache
+    for(int i=first_idx; i<last_idx;i++)
     {
-        err_pos_ = rt_buffer[i].guide->getState() - robot_position;
-        f_K_ .noalias() = rt_buffer[i].guide->getK() * err_pos_;
-        err_vel_ = rt_buffer[i].guide->getStateDot() - robot_velocity;
-        f_B_.noalias() = rt_buffer[i].guide->getB() * err_vel_;
+        vm_t& guide = *rt_buffer[i].instance;
+        guide.setCollisionDetected(job_collision_);
+        for(int k=0; k<job_n_robots_; k++)
+        {
+            RobotBank& robot = robots[k];
+            double* guide_state = robot.guide_states.col(i).data();
 
-        // Sum spring force + damping force for the current mechanism
-        f_vm_ = f_K_ + f_B_;
+            switch(robot.schedule[i])
+            {
+              case GUIDE_CULLED:
+                  robot.scale(i) = 0.0;
+                  robot.log_norm(i) = -std::numeric_limits<double>::infinity();
+                  robot.elapsed(i) = 0.0; // Frozen
+                  robot.n_skipped(i) = 0;
+                  break;
+              case GUIDE_SKIPPED:
+                  // Extrapolate the state of the last update, the phase is kept.
+                  // Its log density is not evaluated, ComputePosteriors keeps its last posterior
+                  robot.state.col(i) += robot.state_dot.col(i) * job_dt_;
+                  robot.scale(i) = robot.scale_est(i);
+                  robot.elapsed(i) += job_dt_;
+                  robot.n_skipped(i)++;
+                  break;
+              case GUIDE_UPDATED:
+                  guide.LoadInstanceState(guide_state);
+                  if(job_stop_)
+                      guide.Stop();
+                  robot.scale(i) = guide.getScale(robot.position,escape_factor_);
+                  guide.Update(robot.position,robot.velocity,job_dt_ + robot.elapsed(i),robot.scale(i));
+                  guide.SaveInstanceState(guide_state);
+                  robot.elapsed(i) = 0.0;
+                  robot.n_skipped(i) = 0;
+
+                  robot.phase(i) = guide.getPhase();
+                  robot.state.col(i) = guide.getState();
+                  robot.state_dot.col(i) = guide.getStateDot();
+                  robot.t_versor.col(i) = guide.getJacobianVersor();
+                  if(!guide.getLogDensity(robot.inv_variance.col(i).data(),robot.log_norm(i)))
+                  {
+                      // Without variance the log of the scale plays the role of the log probability
+                      robot.inv_variance.col(i).setZero();
+                      robot.log_norm(i) = std::log(robot.scale(i));
+                  }
+                  continue;
+            }
 
-        f_out += rt_buffer[i].scale * f_vm_;
-        for(int j=0; j<rt_buffer.size();j++)
+            // Not updated, only the stop is applied to its state
+            if(job_stop_)
+            {
+                guide.LoadInstanceState(guide_state);
+                guide.Stop();
+                guide.SaveInstanceState(guide_state);
+            }
+        }
+    }
+}
+
+void MechanismManager::ComputePosteriors(RobotBank& robot)
+{
+    // Posterior of each guide given the robot position, with equal priors:
+    //   scale_hard_i = exp(log_prob_i - log(sum_j exp(log_prob_j)))
+    // The log probabilities of all the guides are computed at once from the banks and shifted by their
+    // max before the exponentials, so the far guides do not underflow the sum to zero.
+    // The skipped guides (multi rate) are excluded from the normalization since their densities are not
+    // evaluated: they keep the posterior of their last tick and the updated guides share the rest.
+    robot.log_prob = robot.log_norm;
+    robot.log_prob.noalias() -= 0.5 * ((robot.state.colwise() - robot.position).cwiseAbs2().cwiseProduct(robot.inv_variance)).colwise().sum().transpose();
+    double skipped_mass = 0.0;
+    for(int i=0; i<robot.log_prob.size(); i++)
+    {
+        if(robot.schedule[i] == GUIDE_SKIPPED)
         {
-            if(j!=i)
-                f_out -= rt_buffer[i].scale * rt_buffer[j].scale_t * rt_buffer[j].guide->getJacobianVersor() * f_vm_.dot(rt_buffer[j].guide->getJacobianVersor());
+            robot.log_prob(i) = -std::numeric_limits<double>::infinity();
+            skipped_mass += robot.scale_hard(i);
         }
     }
+    const double max_log_prob = robot.log_prob.size() > 0 ? robot.log_prob.maxCoeff() : -std::numeric_limits<double>::infinity();
+    if(max_log_prob > -std::numeric_limits<double>::infinity())
+    {
+        double sum = 0.0;
+        for(int i=0; i<robot.log_prob.size(); i++)
+        {
+            if(robot.schedule[i] != GUIDE_SKIPPED)
+            {
+                robot.scale_hard(i) = std::exp(robot.log_prob(i) - max_log_prob);
+                sum += robot.scale_hard(i);
+            }
+        }
+        const double norm = std::max(1.0 - skipped_mass,0.0) / sum; // Mass left by the skipped guides
+        for(int i=0; i<robot.log_prob.size(); i++)
+            if(robot.schedule[i] != GUIDE_SKIPPED)
+                robot.scale_hard(i) *= norm;
+    }
+    else // All the guides are culled or skipped
+    {
+        for(int i=0; i<robot.log_prob.size(); i++)
+            if(robot.schedule[i] != GUIDE_SKIPPED)
+                robot.scale_hard(i) = 0.0;
+    }
 }
 
-void MechanismManager::GetVmPosition(const int idx, Eigen::VectorXd& position)
+void MechanismManager::UpdateGuidesJob(void* mm, const int worker_idx, const int n_workers)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    if(idx < rt_buffer.size())
-        rt_buffer[idx].guide->getState(position);
+    MechanismManager* mm_ptr = static_cast<MechanismManager*>(mm);
+    const int n_guides = mm_ptr->job_set_->guides.size();
+    mm_ptr->UpdateGuides(n_guides * worker_idx / n_workers, n_guides * (worker_idx + 1) / n_workers);
 }
 
-void MechanismManager::GetVmVelocity(const int idx, Eigen::VectorXd& velocity)
+void MechanismManager::GetVmPosition(const int idx, Eigen::VectorXd& position, const int robot_idx)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    if(idx < rt_buffer.size())
-        rt_buffer[idx].guide->getStateDot(velocity);
+    // The accessors can be called by the thread of the real time loop: they pin the published set
+    // instead of locking mtx_, they copy the last values written by the real time loop under the
+    // robots seqlock (see ReadRobots), the thread of the real time loop never retries
+    const GuideSet& set = *PinSet();
+    const std::vector<RobotBank>& robots = set.robots;
+    if(robot_idx < robots.size() && idx < robots[robot_idx].state.cols())
+        ReadRobotsSeq(set,[&]() {position = robots[robot_idx].state.col(idx);});
+    UnpinSet();
 }
 
-double MechanismManager::GetPhase(const int idx)
+void MechanismManager::GetVmVelocity(const int idx, Eigen::VectorXd& velocity, const int robot_idx)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    if(idx < rt_buffer.size())
-        return rt_buffer[idx].guide->getPhase();
-    else
-        return 0.0;
+    const GuideSet& set = *PinSet();
+    const std::vector<RobotBank>& robots = set.robots;
+    if(robot_idx < robots.size() && idx < robots[robot_idx].state_dot.cols())
+        ReadRobotsSeq(set,[&]() {velocity = robots[robot_idx].state_dot.col(idx);});
+    UnpinSet();
 }
 
-double MechanismManager::GetScale(const int idx)
+double MechanismManager::GetPhase(const int idx, const int robot_idx)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    if(idx < rt_buffer.size())
-        return rt_buffer[idx].scale;
-    else
-        return 0.0;
+    const GuideSet& set = *PinSet();
+    const std::vector<RobotBank>& robots = set.robots;
+    double phase = 0.0;
+    if(robot_idx < robots.size() && idx < robots[robot_idx].phase.size())
+        ReadRobotsSeq(set,[&]() {phase = robots[robot_idx].phase(idx);});
+    UnpinSet();
+    return phase;
 }
 
-int MechanismManager::GetNbVms()
+double MechanismManager::GetScale(const int idx, const int robot_idx)
 {
-    // NO RT Version
-    //PRINT_INFO("Get number of guides");
-    //boost::recursive_mutex::scoped_lock guard(mtx_);
-    //std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    //return rt_buffer.size();
+    const GuideSet& set = *PinSet();
+    const std::vector<RobotBank>& robots = set.robots;
+    double scale = 0.0;
+    if(robot_idx < robots.size() && idx < robots[robot_idx].scale.size())
+        ReadRobotsSeq(set,[&]() {scale = robots[robot_idx].scale(idx);});
+    UnpinSet();
+    return scale;
+}
 
-     std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-     return rt_buffer.size();
+int MechanismManager::GetNbVms()
+{
+    const int n_guides = PinSet()->guides.size();
+    UnpinSet();
+    return n_guides;
 }
 
-bool MechanismManager::OnVm()
+bool MechanismManager::OnVm(const int robot_idx)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
+    const GuideSet& set = *PinSet();
+    const std::vector<RobotBank>& robots = set.robots;
 
     bool on_guide = false;
 
-    for(int i=0;i<rt_buffer.size();i++)
+    if(robot_idx < robots.size())
     {
-        if(rt_buffer[i].scale > 0.9) // We are on a guide if it's scale is ... (so that we are on it)
-            on_guide = true;
+        const RobotBank& rt_robot = robots[robot_idx];
+        ReadRobotsSeq(set,[&]()
+        {
+            on_guide = false;
+            for(int i=0;i<rt_robot.scale.size();i++)
+            {
+                if(rt_robot.scale(i) > 0.9) // We are on a guide if it's scale is ... (so that we are on it)
+                    on_guide = true;
+            }
+        });
     }
+    UnpinSet();
 
     return on_guide;
 }
@@ -642,16 +1735,14 @@ void MechanismManager::SetMode(const scale_mode_t mode)
 
 void MechanismManager::Stop()
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    for(int i=0;i<rt_buffer.size();i++)
-        rt_buffer[i].guide->Stop();
+    // The states of the guides are owned by the real time loop, it stops them at the next Update
+    stop_requested_ = true;
 }
 
 void MechanismManager::SetCollisionDetected(const bool collision)
 {
-    std::vector<GuideStruct>& rt_buffer = vm_buffers_[rt_idx_];
-    for(int i=0;i<rt_buffer.size();i++)
-        rt_buffer[i].guide->setCollisionDetected(collision);
+    // The guides used by the real time loop are its instances, the flag is given to them by the next Update
+    collision_detected_ = collision;
 }
 
 } // namespace
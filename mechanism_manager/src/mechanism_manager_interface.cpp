@@ -31,7 +31,12 @@ namespace mechanism_manager
   using namespace tool_box;
   using namespace Eigen;
 
-MechanismManagerInterface::MechanismManagerInterface(): mm_(NULL), mm_server_(NULL)
+// The defaults of the configuration, in case it can not be read
+MechanismManagerInterface::MechanismManagerInterface():
+    position_dim_(2), mm_(NULL),
+    recorder_(NULL), record_chunk_size_(4096), record_max_samples_(600000),
+    capture_(NULL), capture_buffer_size_(8192),
+    mm_server_(NULL)
 {
       //threads_pool_ = new ThreadsPool(4); // Create 4 workers
 
@@ -70,6 +75,13 @@ MechanismManagerInterface::MechanismManagerInterface(): mm_(NULL), mm_server_(NU
       }
 
       mm_ = new MechanismManager(position_dim_);
+      recorder_ = new DemoRecorder(position_dim_,record_chunk_size_,record_max_samples_);
+      if(!capture_file_.empty())
+      {
+          mm_->DisableGuidesCache(); // Its loads and evictions are not captured
+          capture_ = new TraceWriter(capture_file_,position_dim_,mm_->GetNbRobots(),capture_buffer_size_);
+          PRINT_INFO("Capturing the updates and the services in "<<capture_file_);
+      }
 }
 
 MechanismManagerInterface::~MechanismManagerInterface()
@@ -83,16 +95,25 @@ MechanismManagerInterface::~MechanismManagerInterface()
     if(mm_server_!=NULL)
       delete mm_server_;
 
+    delete capture_; // After the async services, they could still record
     delete mm_;
+    delete recorder_;
 }
 
 bool MechanismManagerInterface::ReadConfig()
 {
-    YAML::Node main_node = CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+    YAML::Node main_node = GetYamlNodeFromPkgName(ROS_PKG_NAME);
     if (const YAML::Node& curr_node = main_node["mechanism_manager_interface"])
     {
         curr_node["position_dim"] >> position_dim_;
+        curr_node["record_chunk_size"] >> record_chunk_size_;
+        curr_node["record_max_samples"] >> record_max_samples_;
+        curr_node["capture_file"] >> capture_file_;
+        curr_node["capture_buffer_size"] >> capture_buffer_size_;
         assert(position_dim_ == 1 || position_dim_ == 2);
+        assert(record_chunk_size_ > 0);
+        assert(record_max_samples_ > 0);
+        assert(capture_buffer_size_ > 0);
 
         return true;
     }
@@ -100,92 +121,169 @@ bool MechanismManagerInterface::ReadConfig()
         return false;
 }
 
-void MechanismManagerInterface::InsertVm(MatrixXd& data, bool threading)
+void MechanismManagerInterface::RunService(const AsyncThread::funct_t& service, const boost::shared_ptr<const TraceEntry>& entry, const bool threading)
 {
     if(threading)
-    {
-        async_thread_->AddHandler(boost::bind(static_cast<void (MechanismManager::*)(const MatrixXd&)>(&MechanismManager::InsertVm), mm_, data));
-        async_thread_->Trigger();
-    }
+        async_thread_->AddJob(boost::bind(&MechanismManagerInterface::CaptureService, this, service, entry));
     else
-        mm_->InsertVm(data);
+        CaptureService(service,entry);
 }
 
-void MechanismManagerInterface::InsertVm(std::string& model_name, bool threading)
+void MechanismManagerInterface::CaptureService(const AsyncThread::funct_t& service, const boost::shared_ptr<const TraceEntry>& entry)
 {
-    if(threading)
+    if(!entry)
     {
-        async_thread_->AddHandler(boost::bind(static_cast<void (MechanismManager::*)(std::string&)>(&MechanismManager::InsertVm), mm_, model_name));
-        async_thread_->Trigger();
+        service();
+        return;
     }
-    else
-        mm_->InsertVm(model_name);
+
+    // The captured services run one at a time, so the set published meanwhile is the one of this service.
+    // It is written before the first tick which used it (see TraceWriter).
+    boost::mutex::scoped_lock guard(capture_mtx_);
+    const unsigned long epoch = mm_->GetEpoch();
+    service();
+    const unsigned long published_epoch = mm_->GetEpoch();
+    capture_->RecordEvent(entry->type,entry->idx,entry->name,entry->data,published_epoch != epoch ? published_epoch : 0);
 }
 
-void MechanismManagerInterface::InsertVm(double* data, const int n_rows, bool threading)
+boost::shared_ptr<const TraceEntry> MechanismManagerInterface::MakeEntry(const trace_entry_t type, const long idx, const std::string& name, const MatrixXd& data)
 {
-    if(threading)
+    boost::shared_ptr<TraceEntry> entry;
+    if(capture_ != NULL)
     {
-        async_thread_->AddHandler(boost::bind(&MechanismManager::InsertVm, mm_, data, n_rows));
-        async_thread_->Trigger();
+        entry.reset(new TraceEntry());
+        entry->type = type;
+        entry->idx = idx;
+        entry->name = name;
+        entry->data = data;
     }
-    else
-        mm_->InsertVm(data,n_rows);
+    return entry;
+}
+
+void MechanismManagerInterface::InsertVm(MatrixXd& data, bool threading)
+{
+    RunService(boost::bind(static_cast<void (MechanismManager::*)(const MatrixXd&)>(&MechanismManager::InsertVm), mm_, data),
+               MakeEntry(TRACE_INSERT_DATA,0,"",data),threading);
+}
+
+void MechanismManagerInterface::InsertVm(std::string& model_name, bool threading)
+{
+    RunService(boost::bind(static_cast<void (MechanismManager::*)(std::string&)>(&MechanismManager::InsertVm), mm_, model_name),
+               MakeEntry(TRACE_INSERT_MODEL,0,model_name),threading);
+}
+
+void MechanismManagerInterface::InsertVm(double* data, const int n_rows, bool threading)
+{
+    RunService(boost::bind(static_cast<void (MechanismManager::*)(double*, const int)>(&MechanismManager::InsertVm), mm_, data, n_rows),
+               MakeEntry(TRACE_INSERT_DATA,0,"",capture_ != NULL ? MatrixXd(MatrixXd::Map(data,n_rows,position_dim_)) : MatrixXd()),threading);
 }
 
 void MechanismManagerInterface::UpdateVm(Eigen::MatrixXd& data, const int idx, bool threading)
 {
-    if(threading)
-    {
-        async_thread_->AddHandler(boost::bind(&MechanismManager::UpdateVm, mm_, data, idx));
-        async_thread_->Trigger();
-    }
-    else
-        mm_->UpdateVm(data,idx);
+    RunService(boost::bind(&MechanismManager::UpdateVm, mm_, data, idx),
+               MakeEntry(TRACE_UPDATE,idx,"",data),threading);
 }
 
 void MechanismManagerInterface::ClusterVm(Eigen::MatrixXd& data, bool threading)
 {
-    if(threading)
-    {
-        async_thread_->AddHandler(boost::bind(&MechanismManager::ClusterVm, mm_, data));
-        async_thread_->Trigger();
-    }
-    else
-        mm_->ClusterVm(data);
+    RunService(boost::bind(static_cast<void (MechanismManager::*)(MatrixXd&)>(&MechanismManager::ClusterVm), mm_, data),
+               MakeEntry(TRACE_CLUSTER,0,"",data),threading);
 }
 
 void MechanismManagerInterface::ClusterVm(double* data, const int n_rows, bool threading)
+{
+    RunService(boost::bind(static_cast<void (MechanismManager::*)(double*, const int)>(&MechanismManager::ClusterVm), mm_, data, n_rows),
+               MakeEntry(TRACE_CLUSTER,0,"",capture_ != NULL ? MatrixXd(MatrixXd::Map(data,n_rows,position_dim_)) : MatrixXd()),threading);
+}
+
+void MechanismManagerInterface::SaveVm(const int idx, bool threading)
 {
     if(threading)
     {
-        async_thread_->AddHandler(boost::bind(&MechanismManager::ClusterVm, mm_, data, n_rows));
-        async_thread_->Trigger();
+        async_thread_->AddJob(boost::bind(&MechanismManager::SaveVm, mm_, idx), "save_" + std::to_string(idx)); // Pending saves of the same guide are merged
     }
     else
-        mm_->InsertVm(data,n_rows);
+        mm_->SaveVm(idx);
 }
 
-void MechanismManagerInterface::SaveVm(const int idx, bool threading)
+void MechanismManagerInterface::InsertLibrary(std::string& library_name, bool threading)
+{
+    RunService(boost::bind(&MechanismManager::InsertLibrary, mm_, library_name),
+               MakeEntry(TRACE_INSERT_LIBRARY,0,library_name),threading);
+}
+
+void MechanismManagerInterface::SaveLibrary(std::string& library_name, bool threading)
 {
     if(threading)
     {
-        async_thread_->AddHandler(boost::bind(&MechanismManager::SaveVm, mm_, idx));
-        async_thread_->Trigger();
+        async_thread_->AddJob(boost::bind(&MechanismManager::SaveLibrary, mm_, library_name), "save_library_" + library_name);
     }
     else
-        mm_->SaveVm(idx);
+        mm_->SaveLibrary(library_name);
 }
 
 void MechanismManagerInterface::DeleteVm(const int idx, bool threading)
 {
-    if(threading)
+    RunService(boost::bind(&MechanismManager::DeleteVm, mm_, idx),
+               MakeEntry(TRACE_DELETE,idx),threading);
+}
+
+void MechanismManagerInterface::WaitVmServices()
+{
+    async_thread_->Wait();
+}
+
+void MechanismManagerInterface::StartRecording()
+{
+    recorder_->Start();
+}
+
+void MechanismManagerInterface::InsertRecordedVm(bool threading)
+{
+    boost::shared_ptr<Demonstration> demo(new Demonstration());
+    if(!recorder_->Stop(*demo))
     {
-        async_thread_->AddHandler(boost::bind(&MechanismManager::DeleteVm, mm_, idx));
-        async_thread_->Trigger();
+        PRINT_WARNING("Nothing recorded, did you call StartRecording?");
+        return;
     }
-    else
-        mm_->DeleteVm(idx);
+    // The samples are copied only for the capture
+    MatrixXd data;
+    if(capture_ != NULL)
+        demo->GetData(data);
+    RunService(boost::bind(&MechanismManager::InsertRecordedVm, mm_, demo),
+               MakeEntry(TRACE_INSERT_RECORDED,0,"",data),threading);
+}
+
+void MechanismManagerInterface::ClusterRecordedVm(bool threading)
+{
+    boost::shared_ptr<Demonstration> demo(new Demonstration());
+    if(!recorder_->Stop(*demo))
+    {
+        PRINT_WARNING("Nothing recorded, did you call StartRecording?");
+        return;
+    }
+    // The samples are copied only for the capture
+    MatrixXd data;
+    if(capture_ != NULL)
+        demo->GetData(data);
+    RunService(boost::bind(&MechanismManager::ClusterRecordedVm, mm_, demo),
+               MakeEntry(TRACE_CLUSTER_RECORDED,0,"",data),threading);
+}
+
+void MechanismManagerInterface::DiscardRecording()
+{
+    Demonstration demo;
+    recorder_->Stop(demo);
+}
+
+bool MechanismManagerInterface::IsRecording()
+{
+    return recorder_->IsRecording();
+}
+
+long MechanismManagerInterface::GetNbRecordedSamples()
+{
+    return recorder_->GetNbSamples();
 }
 
 void MechanismManagerInterface::SetVmMode(const scale_mode_t mode)
@@ -200,8 +298,11 @@ void MechanismManagerInterface::SetVmMode(const std::string mode)
        enum_mode = SOFT;
     else if(std::strcmp(mode.c_str(), "HARD") == 0)
        enum_mode = HARD;
+    else if(std::strcmp(mode.c_str(), "PROB") == 0)
+       enum_mode = PROB;
 
-    mm_->SetVmMode(enum_mode);
+    RunService(boost::bind(&MechanismManager::SetVmMode, mm_, enum_mode),
+               MakeEntry(TRACE_SET_MODE,enum_mode),false);
 }
 
 void MechanismManagerInterface::GetVmMode(std::string& mode)
@@ -214,12 +315,16 @@ void MechanismManagerInterface::GetVmMode(std::string& mode)
         case HARD:
             mode = "HARD";
             break;
+        case PROB:
+            mode = "PROB";
+            break;
     }
 }
 
 void MechanismManagerInterface::SetMergeThreshold(double merge_th)
 {
-    mm_->SetMergeThreshold(merge_th);
+    RunService(boost::bind(&MechanismManager::SetMergeThreshold, mm_, merge_th),
+               MakeEntry(TRACE_SET_MERGE_THRESHOLD,0,"",MatrixXd::Constant(1,1,merge_th)),false);
 }
 
 void MechanismManagerInterface::GetMergeThreshold(double& merge_th)
@@ -227,6 +332,32 @@ void MechanismManagerInterface::GetMergeThreshold(double& merge_th)
     mm_->GetMergeThreshold(merge_th);
 }
 
+void MechanismManagerInterface::SetNbWorkers(const int n_workers)
+{
+    mm_->SetNbWorkers(n_workers);
+}
+
+int MechanismManagerInterface::GetNbWorkers()
+{
+    return mm_->GetNbWorkers();
+}
+
+void MechanismManagerInterface::SetNbRobots(const int n_robots)
+{
+    RunService(boost::bind(&MechanismManager::SetNbRobots, mm_, n_robots),
+               MakeEntry(TRACE_SET_NB_ROBOTS,n_robots),false);
+}
+
+void MechanismManagerInterface::GetLatencyStats(std::string& report)
+{
+    mm_->GetLatencyStats(report);
+}
+
+void MechanismManagerInterface::ResetLatencyStats()
+{
+    mm_->ResetLatencyStats();
+}
+
 void MechanismManagerInterface::GetVmName(const int idx, std::string& name)
 {
     mm_->GetVmName(idx,name);
@@ -237,9 +368,16 @@ void MechanismManagerInterface::GetVmNames(std::vector<std::string>& names)
     mm_->GetVmNames(names);
 }
 
+bool MechanismManagerInterface::GetVmChanges(const uint64_t session, const unsigned long since, std::vector<GuideDelta>& deltas, std::vector<std::string>& names,
+                                             uint64_t& current_session, unsigned long& revision)
+{
+    return mm_->GetVmChanges(session,since,deltas,names,current_session,revision);
+}
+
 void MechanismManagerInterface::SetVmName(const int idx, std::string& name)
 {
-    mm_->SetVmName(idx,name);
+    RunService(boost::bind(&MechanismManager::SetVmName, mm_, idx, name),
+               MakeEntry(TRACE_RENAME,idx,name),false);
 }
 
 void MechanismManagerInterface::Update(const double* robot_position_ptr, const double* robot_velocity_ptr, double dt, double* f_out_ptr)
@@ -248,10 +386,13 @@ void MechanismManagerInterface::Update(const double* robot_position_ptr, const d
 
     robot_position_ = VectorXd::Map(robot_position_ptr, position_dim_);
     robot_velocity_ = VectorXd::Map(robot_velocity_ptr, position_dim_);
+    recorder_->Record(robot_position_ptr);
 
     mm_->Update(robot_position_,robot_velocity_,dt,f_);
 
     VectorXd::Map(f_out_ptr, position_dim_) = f_;
+    if(capture_ != NULL)
+        capture_->RecordTick(robot_position_ptr,robot_velocity_ptr,f_out_ptr,1,dt,mm_->GetRtEpoch());
 }
 
 void MechanismManagerInterface::Update(const VectorXd& robot_position, const VectorXd& robot_velocity, double dt, VectorXd& f_out)
@@ -263,10 +404,34 @@ void MechanismManagerInterface::Update(const VectorXd& robot_position, const Vec
     assert(f_out.size() == position_dim_);
     robot_position_ = robot_position;
     robot_velocity_ = robot_velocity;
+    recorder_->Record(robot_position.data());
 
     mm_->Update(robot_position_,robot_velocity_,dt,f_);
 
     f_out = f_;
+    if(capture_ != NULL)
+        capture_->RecordTick(robot_position.data(),robot_velocity.data(),f_out.data(),1,dt,mm_->GetRtEpoch());
+}
+
+void MechanismManagerInterface::Update(const MatrixXd& robots_position, const MatrixXd& robots_velocity, double dt, MatrixXd& f_out)
+{
+    assert(robots_position.rows() == position_dim_);
+    assert(robots_velocity.rows() == position_dim_ && robots_velocity.cols() == robots_position.cols());
+    assert(f_out.rows() == position_dim_ && f_out.cols() == robots_position.cols());
+
+    Update(robots_position.data(),robots_velocity.data(),robots_position.cols(),dt,f_out.data());
+}
+
+void MechanismManagerInterface::Update(const double* robots_position_ptr, const double* robots_velocity_ptr, const int n_robots, double dt, double* f_out_ptr)
+{
+    assert(dt > 0.0);
+    assert(n_robots > 0);
+
+    recorder_->Record(robots_position_ptr); // The first robot
+    // All the robots in one pass, directly on the caller memory
+    mm_->Update(robots_position_ptr,robots_velocity_ptr,n_robots,dt,f_out_ptr);
+    if(capture_ != NULL)
+        capture_->RecordTick(robots_position_ptr,robots_velocity_ptr,f_out_ptr,n_robots,dt,mm_->GetRtEpoch());
 }
 
 void MechanismManagerInterface::SetCollisionDetected(const bool collision)
@@ -279,37 +444,37 @@ void MechanismManagerInterface::Stop()
     mm_->Stop();
 }
 
-void MechanismManagerInterface::GetVmPosition(const int idx, double* const position_ptr)
+void MechanismManagerInterface::GetVmPosition(const int idx, double* const position_ptr, const int robot_idx)
 {
     tmp_eigen_vector_ = VectorXd::Map(position_ptr, position_dim_);
-    mm_->GetVmPosition(idx,tmp_eigen_vector_);
+    mm_->GetVmPosition(idx,tmp_eigen_vector_,robot_idx);
     VectorXd::Map(position_ptr, position_dim_) = tmp_eigen_vector_;
 }
 
-void MechanismManagerInterface::GetVmVelocity(const int idx, double* const velocity_ptr)
+void MechanismManagerInterface::GetVmVelocity(const int idx, double* const velocity_ptr, const int robot_idx)
 {
     tmp_eigen_vector_ = VectorXd::Map(velocity_ptr, position_dim_);
-    mm_->GetVmVelocity(idx,tmp_eigen_vector_);
+    mm_->GetVmVelocity(idx,tmp_eigen_vector_,robot_idx);
     VectorXd::Map(velocity_ptr, position_dim_) = tmp_eigen_vector_;
 }
 
-void MechanismManagerInterface::GetVmPosition(const int idx, Eigen::VectorXd& position)
+void MechanismManagerInterface::GetVmPosition(const int idx, Eigen::VectorXd& position, const int robot_idx)
 {
-    mm_->GetVmPosition(idx,position);
+    mm_->GetVmPosition(idx,position,robot_idx);
 }
 
-void MechanismManagerInterface::GetVmVelocity(const int idx, Eigen::VectorXd& velocity)
+void MechanismManagerInterface::GetVmVelocity(const int idx, Eigen::VectorXd& velocity, const int robot_idx)
 {
-    mm_->GetVmVelocity(idx,velocity);
+    mm_->GetVmVelocity(idx,velocity,robot_idx);
 }
 
-double MechanismManagerInterface::GetPhase(const int idx)
+double MechanismManagerInterface::GetPhase(const int idx, const int robot_idx)
 {
-    return mm_->GetPhase(idx);
+    return mm_->GetPhase(idx,robot_idx);
 }
-double MechanismManagerInterface::GetScale(const int idx)
+double MechanismManagerInterface::GetScale(const int idx, const int robot_idx)
 {
-    return mm_->GetScale(idx);
+    return mm_->GetScale(idx,robot_idx);
 }
 
 int MechanismManagerInterface::GetNbVms()
@@ -317,9 +482,14 @@ int MechanismManagerInterface::GetNbVms()
     return mm_->GetNbVms();
 }
 
-bool MechanismManagerInterface::OnVm()
+int MechanismManagerInterface::GetNbRobots()
+{
+    return mm_->GetNbRobots();
+}
+
+bool MechanismManagerInterface::OnVm(const int robot_idx)
 {
-    return mm_->OnVm();
+    return mm_->OnVm(robot_idx);
 }
 
 } // namespace
@@ -109,8 +109,35 @@ bool MechanismManagerServer::CallBack(MechanismManagerServices::Request &req,
         res.response_command = req.request_command;
     }
 
-    // Update the names list
-    mm_interface_->GetVmNames(res.list_guides);
+    if(std::strcmp(req.request_command.c_str(), "get_latency_stats") == 0)
+    {
+        mm_interface_->GetLatencyStats(res.latency_stats);
+        res.response_command = req.request_command;
+    }
+
+    if(std::strcmp(req.request_command.c_str(), "reset_latency_stats") == 0)
+    {
+        mm_interface_->ResetLatencyStats();
+        res.response_command = req.request_command;
+    }
+
+    // Changes of the names list since the revision of the client, all the names if it is 0 or too old,
+    // or if it belongs to another session of the manager
+    std::vector<GuideDelta> deltas;
+    uint64_t session;
+    unsigned long revision;
+    res.full_list = !mm_interface_->GetVmChanges(req.session,req.revision,deltas,res.list_guides,session,revision);
+    res.session = session;
+    res.revision = revision;
+    res.delta_types.resize(deltas.size());
+    res.delta_idxs.resize(deltas.size());
+    res.delta_names.resize(deltas.size());
+    for(size_t i=0;i<deltas.size();i++)
+    {
+        res.delta_types[i] = deltas[i].type;
+        res.delta_idxs[i] = deltas[i].idx;
+        res.delta_names[i] = deltas[i].name;
+    }
 
     return true;
 }
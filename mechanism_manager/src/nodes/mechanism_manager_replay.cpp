@@ -0,0 +1,112 @@
+/**
+ * @file   mechanism_manager_replay.cpp
+ * @brief  Replay a captured trace offline against the guides engine and report its timing and its forces.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <toolbox/debug.h>
+#include "mechanism_manager/mechanism_manager.h"
+#include "mechanism_manager/trace_replay.h"
+
+////////// STD
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// Usage: mechanism_manager_replay trace_file [--reference file] [--output file] [--workers n] [--tol x]
+// The trace is captured by MechanismManagerInterface (capture_file in the configuration). The ticks are
+// replayed as fast as possible after the services preceding them, the forces are compared with the ones of
+// the reference trace (the captured ones by default). With --output the trace is written again with the
+// forces of the replay, to compare later another build or another configuration with it.
+// NOTE: The engine reads its configuration as in the capture, use the same cfg.yml.
+
+static void usage()
+{
+    std::cerr << "Usage: mechanism_manager_replay trace_file [--reference file] [--output file] [--workers n] [--tol x]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const std::string trace_file = argv[1];
+    std::string reference_file, output_file;
+    int n_workers = 0;
+    double tolerance = 1e-9;
+    for(int i=2; i<argc; i++)
+    {
+        if(i + 1 >= argc)
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+        if(std::strcmp(argv[i],"--reference") == 0)
+            reference_file = argv[++i];
+        else if(std::strcmp(argv[i],"--output") == 0)
+            output_file = argv[++i];
+        else if(std::strcmp(argv[i],"--workers") == 0)
+            n_workers = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i],"--tol") == 0)
+            tolerance = std::atof(argv[++i]);
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    mechanism_manager::TraceReader trace;
+    if(!trace.Open(trace_file))
+    {
+        PRINT_ERROR("Cannot read the trace "<<trace_file);
+        return EXIT_FAILURE;
+    }
+    mechanism_manager::TraceReader reference;
+    if(!reference_file.empty() && !reference.Open(reference_file))
+    {
+        PRINT_ERROR("Cannot read the reference trace "<<reference_file);
+        return EXIT_FAILURE;
+    }
+
+    mechanism_manager::MechanismManager mm(trace.GetPositionDim());
+    if(n_workers > 0)
+        mm.SetNbWorkers(n_workers);
+
+    mechanism_manager::TraceWriter* output = NULL;
+    if(!output_file.empty())
+        output = new mechanism_manager::TraceWriter(output_file,trace.GetPositionDim(),trace.GetNbRobots(),0);
+
+    mechanism_manager::ReplayReport report;
+    const bool done = mechanism_manager::ReplayTrace(trace,mm,report,tolerance,reference.IsOpen() ? &reference : NULL,output);
+    delete output;
+    if(!done)
+    {
+        PRINT_ERROR("The trace does not match the engine");
+        return EXIT_FAILURE;
+    }
+
+    std::string stats;
+    mm.GetLatencyStats(stats);
+    std::cout << report.GetReport() << stats << std::endl;
+    return report.n_diffs > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file   mechanism_manager_shm.cpp
+ * @brief  Guides engine running out of process, it exchanges the robot state and the force through shared memory.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <toolbox/debug.h>
+#include "mechanism_manager/mechanism_manager_interface.h"
+#include "mechanism_manager/shared_memory.h"
+
+////////// STD
+#include <csignal>
+#include <cstdlib>
+#include <vector>
+#include <sched.h>
+#include <sys/mman.h>
+
+// Usage: mechanism_manager_shm [shm_name] [rt_priority]
+// The controller opens the shared memory with mechanism_manager::SharedMemoryClient, it writes
+// the robot state at each of its ticks and it reads back the force computed with it.
+// There is a slot for each robot (n_robots in the configuration), all the robots are updated
+// in a single batched update once each of them published a new state. If some robots are late,
+// the others are not blocked: after max_sync_spins polls the late robots are updated with their
+// last state.
+// The engine polls the slots: it spins for a while after each update, then it sleeps shortly
+// to not burn a core while the controllers are idle.
+// NOTE: Use a rt_priority > 0 (SCHED_FIFO) to run the engine as a real time task.
+
+static const int max_spins = 2000; // Polls before sleeping
+static const int max_sync_spins = 200; // Polls waiting for the late robots
+static const long idle_sleep_ns = 20000;
+
+static volatile std::sig_atomic_t kill_loop = 0;
+
+void shutdown(int signum)
+{
+    kill_loop = 1;
+}
+
+bool rt_init(const int priority)
+{
+    if(priority > 0)
+    {
+        struct sched_param param;
+        param.sched_priority = priority;
+        if(sched_setscheduler(0,SCHED_FIFO,&param) != 0)
+        {
+            PRINT_WARNING("Cannot set the SCHED_FIFO priority "<<priority<<", running as a normal task");
+            return false;
+        }
+    }
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) // Prevent memory swaps
+        PRINT_WARNING("Cannot lock the memory");
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const std::string shm_name = argc > 1 ? argv[1] : "/mechanism_manager";
+    const int priority = argc > 2 ? std::atoi(argv[2]) : 0;
+
+    std::signal(SIGINT,shutdown);
+    std::signal(SIGTERM,shutdown);
+
+    mechanism_manager::MechanismManagerInterface mm;
+    const int position_dim = mm.GetPositionDim();
+    const int n_robots = mm.GetNbRobots();
+
+    mechanism_manager::SharedMemoryEngine shm;
+    if(position_dim > mechanism_manager::shm_max_dim || !shm.Create(shm_name,n_robots,position_dim))
+    {
+        PRINT_ERROR("Cannot create the shared memory "<<shm_name);
+        return EXIT_FAILURE;
+    }
+    PRINT_INFO("Guides engine ready on the shared memory "<<shm_name<<" for "<<n_robots<<" robots");
+
+    rt_init(priority);
+
+    // Robot k at k * position_dim, allocated once
+    std::vector<double> positions(n_robots * position_dim,0.0);
+    std::vector<double> velocities(n_robots * position_dim,0.0);
+    std::vector<double> f_out(n_robots * position_dim,0.0);
+    std::vector<uint64_t> ticks(n_robots,0);
+    std::vector<bool> updated(n_robots,false);
+    double dt = 0.0, robot_dt;
+    int n_updated = 0;
+    int n_spins = 0;
+    int n_sync_spins = 0;
+
+    const struct timespec idle_sleep = {0,idle_sleep_ns};
+    while(!kill_loop) // RT Loop
+    {
+        for(int k=0; k<n_robots; k++)
+        {
+            if(!updated[k] && shm.ReadRobotState(k,&positions[k * position_dim],&velocities[k * position_dim],robot_dt,ticks[k]))
+            {
+                updated[k] = true;
+                n_updated++;
+                dt = robot_dt;
+            }
+        }
+
+        if(n_updated == n_robots || (n_updated > 0 && ++n_sync_spins > max_sync_spins))
+        {
+            mm.Update(&positions[0],&velocities[0],n_robots,dt,&f_out[0]);
+            for(int k=0; k<n_robots; k++)
+            {
+                if(updated[k])
+                    shm.WriteForce(k,&f_out[k * position_dim],ticks[k]);
+                updated[k] = false;
+            }
+            n_updated = 0;
+            n_sync_spins = 0;
+            n_spins = 0;
+        }
+        else if(n_updated == 0 && ++n_spins > max_spins)
+        {
+            nanosleep(&idle_sleep,NULL);
+            n_spins = 0;
+        }
+        shm.Beat();
+    }
+
+    PRINT_INFO("Guides engine stopped");
+    return EXIT_SUCCESS;
+}
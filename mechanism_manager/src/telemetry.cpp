@@ -0,0 +1,185 @@
+/**
+ * @file   telemetry.cpp
+ * @brief  Per tick telemetry of the mechanism manager, drained by a non real time thread.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/telemetry.h"
+
+////////// STD
+#include <cstring>
+
+////////// ROS
+#include <ros/ros.h>
+#ifdef USE_ROS_RT_PUBLISHER
+  #include <std_msgs/Float64MultiArray.h>
+#endif
+
+namespace mechanism_manager
+{
+
+static const char telemetry_magic[8] = {'V','F','T','L','M','\0','\0','\0'};
+static const uint32_t telemetry_version = 1;
+static const int max_batch_size = 256; // Records published in a single message
+static const int record_width = 5 + telemetry_max_dim + 3 * telemetry_max_guides; // Doubles in a published row
+
+struct Telemetry::RosPublisher
+{
+#ifdef USE_ROS_RT_PUBLISHER
+  ros::NodeHandle nh;
+  ros::Publisher pub;
+  std_msgs::Float64MultiArray msg;
+
+  RosPublisher():nh(ROS_PKG_NAME)
+  {
+      pub = nh.advertise<std_msgs::Float64MultiArray>("telemetry",10);
+      msg.layout.dim.resize(2);
+      msg.layout.dim[0].label = "records";
+      msg.layout.dim[1].label = "fields";
+      msg.layout.dim[1].size = record_width;
+      msg.layout.dim[1].stride = record_width;
+      msg.data.reserve(max_batch_size * record_width);
+  }
+#endif
+};
+
+Telemetry::Telemetry(const int capacity, const std::string& log_file, const double drain_period)
+    :ring_(capacity),log_file_(NULL),drain_period_(drain_period),ros_pub_(NULL)
+{
+    assert(capacity > 0);
+    assert(drain_period > 0.0);
+
+    batch_.resize(max_batch_size);
+    n_drained_ = 0;
+    n_dropped_reported_ = 0;
+    stop_ = false;
+
+    if(!log_file.empty())
+    {
+        log_file_ = std::fopen(log_file.c_str(),"wb");
+        if(log_file_ != NULL)
+        {
+            TelemetryFileHeader header;
+            std::memset(&header,0,sizeof(TelemetryFileHeader));
+            std::memcpy(header.magic,telemetry_magic,sizeof(telemetry_magic));
+            header.version = telemetry_version;
+            header.record_size = sizeof(TickRecord);
+            header.max_guides = telemetry_max_guides;
+            header.max_dim = telemetry_max_dim;
+            std::fwrite(&header,sizeof(TelemetryFileHeader),1,log_file_);
+            PRINT_INFO("Telemetry written to "<<log_file);
+        }
+        else
+            PRINT_WARNING("Impossible to open the telemetry file "<<log_file);
+    }
+
+#ifdef USE_ROS_RT_PUBLISHER
+    if(ros::isInitialized())
+        ros_pub_ = new RosPublisher();
+    else
+        PRINT_WARNING("Ros is not initialized, the telemetry is not published.");
+#endif
+
+    if(HasSink())
+        thread_ = boost::thread(&Telemetry::Loop,this);
+}
+
+Telemetry::~Telemetry()
+{
+    stop_ = true;
+    if(thread_.joinable())
+    {
+        thread_.join();
+        Drain(); // The last records
+    }
+
+    if(log_file_ != NULL)
+        std::fclose(log_file_);
+    delete ros_pub_;
+}
+
+void Telemetry::Loop()
+{
+    const boost::posix_time::microseconds period(static_cast<long>(drain_period_ * 1e6));
+    while(!stop_.load())
+    {
+        boost::this_thread::sleep(period);
+        Drain();
+    }
+}
+
+void Telemetry::Drain()
+{
+    int n_records;
+    do
+    {
+        // Copy the records out, so that the slots are released immediately
+        n_records = 0;
+        while(n_records < max_batch_size && ring_.Pop(batch_[n_records]))
+            n_records++;
+
+        if(n_records > 0)
+        {
+            if(log_file_ != NULL)
+                std::fwrite(&batch_[0],sizeof(TickRecord),n_records,log_file_);
+            Publish(n_records);
+            n_drained_.store(n_drained_.load(std::memory_order_relaxed) + n_records,std::memory_order_relaxed);
+        }
+    }
+    while(n_records == max_batch_size);
+
+    const unsigned long n_dropped = ring_.GetNbDropped();
+    if(n_dropped > n_dropped_reported_)
+    {
+        PRINT_WARNING("Telemetry: "<<n_dropped - n_dropped_reported_<<" records dropped, the ring is full");
+        n_dropped_reported_ = n_dropped;
+    }
+}
+
+void Telemetry::Publish(const int n_records)
+{
+#ifdef USE_ROS_RT_PUBLISHER
+    if(ros_pub_ == NULL)
+        return;
+
+    std_msgs::Float64MultiArray& msg = ros_pub_->msg;
+    msg.layout.dim[0].size = n_records;
+    msg.layout.dim[0].stride = n_records * record_width;
+    msg.data.resize(n_records * record_width);
+    double* row = msg.data.data();
+    for(int i=0;i<n_records;i++)
+    {
+        const TickRecord& record = batch_[i];
+        row[0] = record.tick;
+        row[1] = record.time;
+        row[2] = record.duration;
+        row[3] = record.n_guides;
+        row[4] = record.position_dim;
+        std::memcpy(row + 5,record.f_out,sizeof(record.f_out));
+        std::memcpy(row + 5 + telemetry_max_dim,record.phase,sizeof(record.phase));
+        std::memcpy(row + 5 + telemetry_max_dim + telemetry_max_guides,record.scale,sizeof(record.scale));
+        std::memcpy(row + 5 + telemetry_max_dim + 2 * telemetry_max_guides,record.scale_t,sizeof(record.scale_t));
+        row += record_width;
+    }
+    ros_pub_->pub.publish(msg);
+#endif
+}
+
+}
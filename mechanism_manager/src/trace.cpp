@@ -0,0 +1,272 @@
+/**
+ * @file   trace.cpp
+ * @brief  Capture of the robot streams and of the guides services, to replay them offline.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/trace.h"
+
+////////// STD
+#include <cstring>
+
+namespace mechanism_manager
+{
+
+TraceWriter::TraceWriter(const std::string& file_path, const int position_dim, const int n_robots, const int capacity, const double drain_period)
+    :position_dim_(position_dim),ring_(NULL),file_(NULL),drain_period_(drain_period),n_dropped_reported_(0)
+{
+    assert(position_dim > 0 && position_dim <= trace_max_dim);
+    assert(n_robots > 0);
+    assert(capacity >= 0);
+    assert(drain_period > 0.0);
+
+    n_ticks_ = 0;
+    stop_ = false;
+
+    file_ = std::fopen(file_path.c_str(),"wb");
+    if(file_ == NULL)
+    {
+        PRINT_WARNING("Impossible to open the trace file "<<file_path);
+        return;
+    }
+    TraceFileHeader header;
+    std::memset(&header,0,sizeof(TraceFileHeader));
+    std::memcpy(header.magic,trace_magic,sizeof(trace_magic));
+    header.version = trace_version;
+    header.position_dim = position_dim;
+    header.n_robots = n_robots;
+    std::fwrite(&header,sizeof(TraceFileHeader),1,file_);
+
+    if(capacity > 0)
+    {
+        ring_ = new ring_buffer::SpscRing<TraceTick>(capacity);
+        thread_ = boost::thread(&TraceWriter::Loop,this);
+    }
+}
+
+TraceWriter::~TraceWriter()
+{
+    stop_ = true;
+    if(thread_.joinable())
+    {
+        thread_.interrupt(); // Do not wait for the end of the drain period
+        thread_.join();
+    }
+
+    if(file_ != NULL)
+    {
+        Drain(); // The last entries
+        std::fclose(file_);
+    }
+    delete ring_;
+}
+
+void TraceWriter::RecordEvent(const trace_entry_t type, const long idx, const std::string& name, const Eigen::MatrixXd& data,
+                              const unsigned long epoch)
+{
+    assert(type != TRACE_TICK);
+    if(file_ == NULL)
+        return;
+
+    boost::mutex::scoped_lock guard(mtx_);
+    PendingEvent event;
+    event.entry.type = type;
+    event.entry.tick = n_ticks_.load(std::memory_order_acquire); // The ticks before it are already in the ring
+    event.entry.idx = idx;
+    event.entry.name = name;
+    event.entry.data = data;
+    event.epoch = epoch;
+    if(ring_ != NULL)
+        events_.push_back(event);
+    else
+        WriteEntry(event.entry);
+}
+
+void TraceWriter::Write(const TraceEntry& entry)
+{
+    if(file_ == NULL)
+        return;
+
+    boost::mutex::scoped_lock guard(mtx_);
+    WriteEntry(entry);
+}
+
+void TraceWriter::WriteEntry(const TraceEntry& entry)
+{
+    if(entry.type == TRACE_TICK)
+    {
+        assert(entry.position.rows() == position_dim_);
+        assert(entry.velocity.rows() == position_dim_ && entry.velocity.cols() == entry.position.cols());
+        assert(entry.f_out.rows() == position_dim_ && entry.f_out.cols() == entry.position.cols());
+        WriteHeader(TRACE_TICK,entry.tick,0,"",position_dim_,entry.position.cols());
+        WriteData(&entry.dt,1);
+        WriteData(entry.position.data(),entry.position.size());
+        WriteData(entry.velocity.data(),entry.velocity.size());
+        WriteData(entry.f_out.data(),entry.f_out.size());
+    }
+    else
+    {
+        WriteHeader(entry.type,entry.tick,entry.idx,entry.name,entry.data.rows(),entry.data.cols());
+        WriteData(entry.data.data(),entry.data.size());
+    }
+}
+
+void TraceWriter::Loop()
+{
+    const boost::posix_time::microseconds period(static_cast<long>(drain_period_ * 1e6));
+    while(!stop_.load())
+    {
+        boost::this_thread::sleep(period);
+        Drain();
+    }
+}
+
+void TraceWriter::Drain()
+{
+    boost::mutex::scoped_lock guard(mtx_);
+
+    // The ticks are in order in the ring, the services are written before the first tick which saw them
+    const TraceTick* record;
+    while(ring_ != NULL && (record = ring_->Front()) != NULL)
+    {
+        WriteEvents(record->tick,record->epoch);
+        WriteHeader(TRACE_TICK,record->tick,0,"",position_dim_,record->n_robots);
+        WriteData(&record->dt,1);
+        const size_t size = record->n_robots * position_dim_;
+        WriteData(record->position,size);
+        WriteData(record->velocity,size);
+        WriteData(record->f_out,size);
+        ring_->Pop();
+    }
+    // All the ticks before the remaining services have been written
+    while(!events_.empty())
+    {
+        WriteEntry(events_.front().entry);
+        events_.pop_front();
+    }
+    std::fflush(file_);
+
+    const unsigned long n_dropped = GetNbDropped();
+    if(n_dropped > n_dropped_reported_)
+    {
+        PRINT_WARNING("Trace: "<<n_dropped - n_dropped_reported_<<" ticks dropped, the ring is full");
+        n_dropped_reported_ = n_dropped;
+    }
+}
+
+void TraceWriter::WriteEvents(const uint64_t tick, const unsigned long epoch)
+{
+    // A published set is seen from the tick which acknowledged its epoch, which could be done before the
+    // service was recorded. A later service waits for the previous ones, so the order is kept.
+    while(!events_.empty())
+    {
+        PendingEvent& event = events_.front();
+        if(event.epoch > 0 ? event.epoch > epoch : event.entry.tick > tick)
+            return;
+        event.entry.tick = tick;
+        WriteEntry(event.entry);
+        events_.pop_front();
+    }
+}
+
+void TraceWriter::WriteHeader(const trace_entry_t type, const uint64_t tick, const long idx, const std::string& name, const int rows, const int cols)
+{
+    TraceEntryHeader header;
+    std::memset(&header,0,sizeof(TraceEntryHeader));
+    header.type = type;
+    header.name_size = name.size();
+    header.tick = tick;
+    header.idx = idx;
+    header.rows = rows;
+    header.cols = cols;
+    std::fwrite(&header,sizeof(TraceEntryHeader),1,file_);
+    if(!name.empty())
+        std::fwrite(name.data(),1,name.size(),file_);
+}
+
+void TraceWriter::WriteData(const double* data, const size_t size)
+{
+    if(size > 0)
+        std::fwrite(data,sizeof(double),size,file_);
+}
+
+bool TraceReader::Open(const std::string& file_path)
+{
+    Close();
+    file_ = std::fopen(file_path.c_str(),"rb");
+    if(file_ == NULL)
+        return false;
+
+    TraceFileHeader header;
+    if(std::fread(&header,sizeof(TraceFileHeader),1,file_) != 1 || std::memcmp(header.magic,trace_magic,sizeof(trace_magic)) != 0
+       || header.version == 0 || header.version > trace_version || header.position_dim == 0 || header.position_dim > trace_max_dim || header.n_robots == 0)
+    {
+        Close();
+        return false;
+    }
+    position_dim_ = header.position_dim;
+    n_robots_ = header.n_robots;
+    return true;
+}
+
+void TraceReader::Close()
+{
+    if(file_ != NULL)
+        std::fclose(file_);
+    file_ = NULL;
+}
+
+bool TraceReader::Next(TraceEntry& entry)
+{
+    if(file_ == NULL)
+        return false;
+
+    TraceEntryHeader header;
+    if(std::fread(&header,sizeof(TraceEntryHeader),1,file_) != 1 || header.type >= N_TRACE_ENTRIES)
+        return false;
+    entry.type = static_cast<trace_entry_t>(header.type);
+    entry.tick = header.tick;
+    entry.idx = header.idx;
+
+    entry.name.resize(header.name_size);
+    if(header.name_size > 0 && std::fread(&entry.name[0],1,header.name_size,file_) != header.name_size)
+        return false;
+
+    if(entry.type == TRACE_TICK)
+    {
+        if(static_cast<int>(header.rows) != position_dim_)
+            return false;
+        entry.position.resize(header.rows,header.cols);
+        entry.velocity.resize(header.rows,header.cols);
+        entry.f_out.resize(header.rows,header.cols);
+        return Read(&entry.dt,1) && Read(entry.position.data(),entry.position.size())
+            && Read(entry.velocity.data(),entry.velocity.size()) && Read(entry.f_out.data(),entry.f_out.size());
+    }
+
+    entry.data.resize(header.rows,header.cols);
+    return Read(entry.data.data(),entry.data.size());
+}
+
+bool TraceReader::Read(double* data, const size_t size)
+{
+    return size == 0 || std::fread(data,sizeof(double),size,file_) == size;
+}
+
+}
@@ -0,0 +1,207 @@
+/**
+ * @file   trace_replay.cpp
+ * @brief  Offline replay of a trace against the mechanism manager.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/trace_replay.h"
+#include "mechanism_manager/mechanism_manager.h"
+
+////////// STD
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+
+using namespace Eigen;
+
+namespace mechanism_manager
+{
+
+std::string ReplayReport::GetReport() const
+{
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3);
+
+    report << "ticks: " << n_ticks << " services: " << n_services << " missing ticks: " << n_missing << "\n";
+    report << "throughput: " << (duration > 0.0 ? n_ticks / duration : 0.0) << " ticks/s, " << duration << " s of updates\n";
+    report << "tick: mean " << latency.GetMean() * 1e-3
+           << " p50 " << latency.GetPercentile(50.0) * 1e-3
+           << " p99 " << latency.GetPercentile(99.0) * 1e-3
+           << " p99.9 " << latency.GetPercentile(99.9) * 1e-3
+           << " max " << latency.GetMax() * 1e-3 << " us\n";
+    report << "tick histogram:";
+    for(int i=0; i<LatencyHistogram::n_buckets; i++)
+        if(latency.GetBucketCount(i) > 0)
+            report << " " << LatencyHistogram::GetBucketLowerBound(i) * 1e-3 << ":" << latency.GetBucketCount(i);
+    report << "\n";
+
+    report << std::scientific << std::setprecision(3);
+    report << "forces: " << n_compared << " ticks compared, " << n_diffs << " differing, max diff " << max_diff
+           << " rms diff " << (n_compared > 0 ? std::sqrt(sum_sq_diff/n_compared) : 0.0);
+    if(n_diffs > 0)
+        report << " first differing tick #" << first_diff_tick;
+    report << "\n";
+
+    return report.str();
+}
+
+/// Apply a service of the trace, as the interface did when it was captured
+static void ApplyService(const TraceEntry& entry, MechanismManager& mm)
+{
+    std::string name = entry.name;
+    MatrixXd data = entry.data;
+    switch(entry.type)
+    {
+      case TRACE_INSERT_MODEL:
+        mm.InsertVm(name);
+        break;
+      case TRACE_INSERT_DATA:
+        mm.InsertVm(data);
+        break;
+      case TRACE_DELETE:
+        mm.DeleteVm(entry.idx);
+        break;
+      case TRACE_UPDATE:
+        mm.UpdateVm(data,entry.idx);
+        break;
+      case TRACE_CLUSTER:
+        mm.ClusterVm(data);
+        break;
+      case TRACE_INSERT_RECORDED:
+      case TRACE_CLUSTER_RECORDED:
+      {
+        // Recorded again, so that the guide is built from a Demonstration as in the capture
+        if(data.rows() == 0)
+            break;
+        DemoRecorder recorder(data.cols(),4096,data.rows());
+        recorder.Start();
+        VectorXd sample(data.cols());
+        for(int i=0;i<data.rows();i++)
+        {
+            sample = data.row(i).transpose();
+            recorder.Record(sample.data());
+        }
+        boost::shared_ptr<Demonstration> demo(new Demonstration());
+        recorder.Stop(*demo);
+        if(entry.type == TRACE_INSERT_RECORDED)
+            mm.InsertRecordedVm(demo);
+        else
+            mm.ClusterRecordedVm(demo);
+        break;
+      }
+      case TRACE_INSERT_LIBRARY:
+        mm.InsertLibrary(name);
+        break;
+      case TRACE_SET_MODE:
+        mm.SetVmMode(static_cast<scale_mode_t>(entry.idx));
+        break;
+      case TRACE_SET_NB_ROBOTS:
+        mm.SetNbRobots(entry.idx);
+        break;
+      case TRACE_SET_MERGE_THRESHOLD:
+        if(data.size() == 1)
+            mm.SetMergeThreshold(data(0,0));
+        break;
+      case TRACE_RENAME:
+        mm.SetVmName(entry.idx,name);
+        break;
+      default:
+        assert(false);
+    }
+}
+
+bool ReplayTrace(TraceReader& trace, MechanismManager& mm, ReplayReport& report, const double tolerance,
+                 TraceReader* const reference, TraceWriter* const output)
+{
+    assert(tolerance >= 0.0);
+    if(!trace.IsOpen() || trace.GetPositionDim() != mm.GetPositionDim())
+        return false;
+    if(reference != NULL && (!reference->IsOpen() || reference->GetPositionDim() != mm.GetPositionDim()))
+        return false;
+
+    const int position_dim = mm.GetPositionDim();
+    mm.DisableGuidesCache(); // As in the capture
+    if(mm.GetNbRobots() != trace.GetNbRobots())
+        mm.SetNbRobots(trace.GetNbRobots());
+
+    TraceEntry entry;
+    TraceEntry ref_entry;
+    bool ref_available = reference != NULL && reference->Next(ref_entry);
+    MatrixXd f_out(position_dim,trace_max_robots);
+    uint64_t next_tick = 0;
+    while(trace.Next(entry))
+    {
+        if(entry.type != TRACE_TICK)
+        {
+            ApplyService(entry,mm);
+            report.n_services++;
+            if(output != NULL)
+                output->Write(entry);
+            continue;
+        }
+
+        if(entry.tick > next_tick)
+            report.n_missing += entry.tick - next_tick;
+        next_tick = entry.tick + 1;
+
+        const int n_robots = entry.position.cols();
+        if(n_robots > f_out.cols())
+            f_out.resize(position_dim,n_robots);
+        const int64_t start = GetTimeNs();
+        mm.Update(entry.position.data(),entry.velocity.data(),n_robots,entry.dt,f_out.data());
+        const int64_t duration = GetTimeNs() - start;
+        report.latency.Add(duration);
+        report.duration += duration * 1e-9;
+        report.n_ticks++;
+
+        // Forces of the same tick in the reference, the ticks are in order
+        const MatrixXd* f_ref = &entry.f_out;
+        if(reference != NULL)
+        {
+            while(ref_available && (ref_entry.type != TRACE_TICK || ref_entry.tick < entry.tick))
+                ref_available = reference->Next(ref_entry);
+            f_ref = ref_available && ref_entry.tick == entry.tick ? &ref_entry.f_out : NULL;
+        }
+        if(f_ref != NULL)
+        {
+            const int n_compared = std::min(n_robots,static_cast<int>(f_ref->cols()));
+            const double diff = n_compared > 0 ? (f_out.leftCols(n_compared) - f_ref->leftCols(n_compared)).lpNorm<Infinity>() : 0.0;
+            if(diff > tolerance)
+            {
+                if(report.n_diffs == 0)
+                    report.first_diff_tick = entry.tick;
+                report.n_diffs++;
+            }
+            report.max_diff = std::max(report.max_diff,diff);
+            report.sum_sq_diff += diff * diff;
+            report.n_compared++;
+        }
+
+        if(output != NULL)
+        {
+            entry.f_out = f_out.leftCols(n_robots);
+            output->Write(entry);
+        }
+    }
+
+    return true;
+}
+
+}
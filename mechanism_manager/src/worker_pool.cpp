@@ -0,0 +1,170 @@
+/**
+ * @file   worker_pool.cpp
+ * @brief  Pool of real time workers used to update the guides in parallel.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mechanism_manager/worker_pool.h"
+
+////////// POSIX
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+namespace mechanism_manager
+{
+
+// Spins before sleeping (workers) or yielding the cpu (barrier) while waiting
+static const int max_spins = 10000;
+
+static_assert(sizeof(std::atomic<unsigned int>) == sizeof(int),"The generation counter is used as a futex word");
+
+static inline void FutexWait(std::atomic<unsigned int>* word, const unsigned int value)
+{
+    // Returns at once if the word is not value anymore, spurious wake ups are handled by the caller
+    syscall(SYS_futex,reinterpret_cast<int*>(word),FUTEX_WAIT_PRIVATE,value,NULL,NULL,0);
+}
+
+static inline void FutexWakeAll(std::atomic<unsigned int>* word)
+{
+    syscall(SYS_futex,reinterpret_cast<int*>(word),FUTEX_WAKE_PRIVATE,INT_MAX,NULL,NULL,0);
+}
+
+WorkerPool::WorkerPool(const int n_workers, const std::vector<int>& cpus, const int priority)
+{
+    assert(n_workers > 0);
+    assert(priority >= 0);
+
+    n_workers_ = n_workers;
+    cpus_ = cpus;
+    priority_ = priority;
+
+    job_ = NULL;
+    arg_ = NULL;
+    generation_ = 0;
+    n_sleeping_ = 0;
+    n_done_ = 0;
+    stop_ = false;
+#ifdef USE_REAL_TIME_CHECKS
+    rt_critical_code_ = false;
+#endif
+
+    for(int i=1;i<n_workers_;i++)
+        threads_.create_thread(boost::bind(&WorkerPool::Loop, this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop_ = true;
+    generation_.fetch_add(1); // Wake up the workers
+    FutexWakeAll(&generation_);
+    threads_.join_all();
+}
+
+void WorkerPool::SetupThread(const int worker_idx)
+{
+    if(!cpus_.empty())
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus_[worker_idx % cpus_.size()],&cpu_set);
+        if(pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpu_set) != 0)
+            PRINT_WARNING("Impossible to pin the worker "<<worker_idx<<" to the cpu "<<cpus_[worker_idx % cpus_.size()]);
+    }
+    if(priority_ > 0)
+    {
+        sched_param param;
+        param.sched_priority = priority_;
+        if(pthread_setschedparam(pthread_self(),SCHED_FIFO,&param) != 0)
+            PRINT_WARNING("Impossible to set SCHED_FIFO for the worker "<<worker_idx<<", check the permissions.");
+    }
+}
+
+void WorkerPool::Loop(const int worker_idx)
+{
+    SetupThread(worker_idx);
+
+    unsigned int generation = 0;
+    int spins;
+    while(true)
+    {
+        // Wait for a new job, spinning for the next tick and then sleeping until Run wakes it.
+        // n_sleeping_ and generation_ are sequentially consistent: either Run sees the worker
+        // going to sleep and wakes it, or the futex sees the new generation and returns at once
+        spins = 0;
+        while(generation_.load(std::memory_order_acquire) == generation)
+        {
+            if(++spins > max_spins)
+            {
+                n_sleeping_.fetch_add(1);
+                FutexWait(&generation_,generation);
+                n_sleeping_.fetch_sub(1);
+                spins = 0;
+            }
+        }
+        generation = generation_.load(std::memory_order_acquire);
+
+        if(stop_)
+            return;
+
+#ifdef USE_REAL_TIME_CHECKS
+        tool_box::RealTimeCriticalCode() = rt_critical_code_;
+#endif
+        job_(arg_,worker_idx,n_workers_);
+#ifdef USE_REAL_TIME_CHECKS
+        tool_box::RealTimeCriticalCode() = false;
+#endif
+
+        n_done_.fetch_add(1,std::memory_order_release);
+    }
+}
+
+void WorkerPool::Run(job_t job, void* arg)
+{
+    assert(job != NULL);
+
+    job_ = job;
+    arg_ = arg;
+#ifdef USE_REAL_TIME_CHECKS
+    rt_critical_code_ = tool_box::RealTimeCriticalCode();
+#endif
+    n_done_.store(0,std::memory_order_relaxed);
+    generation_.fetch_add(1); // Start the workers
+    if(n_sleeping_.load() > 0) // No system call when all the workers are spinning
+        FutexWakeAll(&generation_);
+
+    job(arg,0,n_workers_);
+
+    // Barrier
+    int spins = 0;
+    while(n_done_.load(std::memory_order_acquire) < n_workers_ - 1)
+    {
+        if(++spins > max_spins)
+        {
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
+
+}
@@ -0,0 +1,267 @@
+/**
+ * @file   benchmark_mechanism_manager.cpp
+ * @brief  Microbenchmarks of the hot paths of the mechanism manager and of the virtual mechanisms.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// NOTE: Compile in Release. Each iteration is timed, the mean is the reported time and the
+// percentiles of the iteration cost are reported as counters (p50_us, p90_us, p99_us, max_us).
+// Machine readable output for the regression checks:
+// benchmark_mechanism_manager --benchmark_out=results.json --benchmark_out_format=json
+// two runs can be compared with the compare.py tool of google benchmark.
+
+#include <toolbox/debug.h>
+#include <toolbox/dtw/dtw.h>
+#include "mechanism_manager/mechanism_manager.h"
+#include "virtual_mechanism/virtual_mechanism_gmr.h"
+
+////////// Google benchmark
+#include <benchmark/benchmark.h>
+
+////////// STD
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+////////// ROS
+#include <ros/package.h>
+
+using namespace mechanism_manager;
+using namespace virtual_mechanism;
+using namespace Eigen;
+
+typedef VirtualMechanismInterfaceFirstOrder VMP_1ord_t;
+typedef VirtualMechanismInterfaceSecondOrder VMP_2ord_t;
+
+std::string file_path(ros::package::getPath("virtual_mechanism")+"/test/test_gmm");
+double dt = 0.001;
+int n_points = 100;
+int test_dim = 2; // Dimension of the test model
+
+/// Straight line demonstration in dim dimensions, shifted by offset
+MatrixXd CreateData(const int n_rows, const int dim, const double offset = 0.0)
+{
+  MatrixXd data(n_rows,dim);
+  for (int i=0; i<dim; i++)
+    data.col(i) = VectorXd::LinSpaced(n_rows, 0.0, 1.0).array() + offset * (i+1);
+  return data;
+}
+
+/// Run f for each iteration of the benchmark and report the percentiles of its cost,
+/// the benchmarks have to use the manual time
+template <typename Function>
+void RunTimed(benchmark::State& state, Function f)
+{
+  std::vector<double> samples;
+  samples.reserve(10000);
+  for (auto _ : state)
+  {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(end - start).count();
+    state.SetIterationTime(elapsed);
+    samples.push_back(elapsed);
+  }
+  if(samples.empty())
+    return;
+
+  std::sort(samples.begin(),samples.end());
+  const int n = samples.size();
+  state.counters["p50_us"] = samples[(n-1)*50/100] * 1e6;
+  state.counters["p90_us"] = samples[(n-1)*90/100] * 1e6;
+  state.counters["p99_us"] = samples[(n-1)*99/100] * 1e6;
+  state.counters["max_us"] = samples[n-1] * 1e6;
+}
+
+////////// Mechanism manager
+
+/// Args: number of guides, position dimension
+static void BM_MechanismManagerUpdate(benchmark::State& state)
+{
+  const int n_guides = state.range(0);
+  const int pos_dim = state.range(1);
+  MechanismManager mm(pos_dim);
+  while(mm.GetNbVms() < n_guides)
+  {
+    MatrixXd data = CreateData(n_points,pos_dim,0.01 * mm.GetNbVms());
+    mm.InsertVm(data);
+  }
+
+  VectorXd rob_pos(pos_dim);
+  VectorXd rob_vel(pos_dim);
+  VectorXd f_out(pos_dim);
+  rob_pos.fill(0.25);
+  rob_vel.fill(1.0);
+  f_out.fill(0.0);
+
+  RunTimed(state,[&]()
+  {
+    mm.Update(rob_pos,rob_vel,dt,f_out);
+    benchmark::DoNotOptimize(f_out.data());
+  });
+}
+BENCHMARK(BM_MechanismManagerUpdate)
+  ->ArgsProduct({{1,4,16,64,256},{2,3}})
+  ->ArgNames({"guides","dim"})
+  ->UseManualTime();
+
+/// Args: number of robots, the guides are shared by the robots
+static void BM_MechanismManagerUpdateRobots(benchmark::State& state)
+{
+  const int n_robots = state.range(0);
+  const int n_guides = 16;
+  const int pos_dim = 2;
+  MechanismManager mm(pos_dim);
+  while(mm.GetNbVms() < n_guides)
+  {
+    MatrixXd data = CreateData(n_points,pos_dim,0.01 * mm.GetNbVms());
+    mm.InsertVm(data);
+  }
+  mm.SetNbRobots(n_robots);
+
+  MatrixXd rob_pos(pos_dim,n_robots);
+  MatrixXd rob_vel(pos_dim,n_robots);
+  MatrixXd f_out(pos_dim,n_robots);
+  for (int k=0; k<n_robots; k++)
+    rob_pos.col(k).fill(0.25 + 0.01 * k);
+  rob_vel.fill(1.0);
+  f_out.fill(0.0);
+
+  RunTimed(state,[&]()
+  {
+    mm.Update(rob_pos.data(),rob_vel.data(),n_robots,dt,f_out.data());
+    benchmark::DoNotOptimize(f_out.data());
+  });
+}
+BENCHMARK(BM_MechanismManagerUpdateRobots)
+  ->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+  ->ArgNames({"robots"})
+  ->UseManualTime();
+
+////////// Virtual mechanisms
+
+template <typename VM_t>
+static void BM_VmUpdate(benchmark::State& state)
+{
+  VM_t vm(file_path);
+  VectorXd pos(test_dim);
+  VectorXd vel(test_dim);
+  pos.fill(0.25);
+  vel.fill(1.0);
+
+  RunTimed(state,[&]()
+  {
+    vm.Update(pos,vel,dt);
+    benchmark::DoNotOptimize(vm.getPhase());
+  });
+}
+BENCHMARK_TEMPLATE(BM_VmUpdate,VirtualMechanismGmr<VMP_1ord_t>)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_VmUpdate,VirtualMechanismGmr<VMP_2ord_t>)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_VmUpdate,VirtualMechanismGmrNormalized<VMP_1ord_t>)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_VmUpdate,VirtualMechanismGmrNormalized<VMP_2ord_t>)->UseManualTime();
+
+/// The query moves along the guide, as the robot does
+static void BM_FindMinDist(benchmark::State& state)
+{
+  VirtualMechanismGmr<VMP_1ord_t> vm(file_path);
+  MatrixXd queries(n_points,test_dim);
+  VectorXd state_tmp(test_dim);
+  VectorXd phases = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  for (int i=0; i<n_points; i++)
+  {
+    vm.ComputeStateGivenPhase(phases(i),state_tmp);
+    queries.row(i) = state_tmp.transpose().array() + 0.01;
+  }
+
+  int i = 0;
+  VectorXd pos(test_dim);
+  RunTimed(state,[&]()
+  {
+    pos = queries.row(i).transpose();
+    vm.FindMinDist(pos);
+    benchmark::DoNotOptimize(vm.getPhase());
+    i = (i + 1) % n_points;
+  });
+}
+BENCHMARK(BM_FindMinDist)->UseManualTime();
+
+/// Arg: number of points of the demonstration
+static void BM_ComputeResponsability(benchmark::State& state)
+{
+  VirtualMechanismGmr<VMP_1ord_t> vm(file_path);
+  MatrixXd data = CreateData(state.range(0),test_dim);
+
+  RunTimed(state,[&]()
+  {
+    benchmark::DoNotOptimize(vm.ComputeResponsability(data));
+  });
+}
+BENCHMARK(BM_ComputeResponsability)->Arg(100)->Arg(1000)->UseManualTime();
+
+/// Arg: number of points of the signals
+static void BM_AlignPhase(benchmark::State& state)
+{
+  const int n_rows = state.range(0);
+  VectorXd t = VectorXd::LinSpaced(n_rows, 0.0, 1.0);
+  MatrixXd sig1(n_rows,2);
+  MatrixXd sig2(n_rows,2);
+  sig1.col(0) = t;
+  sig1.col(1) = (2 * M_PI * t).array().sin();
+  sig2.col(0) = t.array().pow(1.5);
+  sig2.col(1) = (2 * M_PI * sig2.col(0)).array().sin();
+  VectorXd phase1(n_rows);
+  VectorXd phase2 = t;
+
+  RunTimed(state,[&]()
+  {
+    phase1 = t;
+    dtw::align_phase(phase1,phase2,sig1,sig2);
+    benchmark::DoNotOptimize(phase1.data());
+  });
+}
+BENCHMARK(BM_AlignPhase)->Arg(100)->Arg(400)->UseManualTime();
+
+////////// Models
+
+static void BM_ModelLoad(benchmark::State& state)
+{
+  RunTimed(state,[&]()
+  {
+    VirtualMechanismGmr<VMP_1ord_t> vm(file_path);
+    benchmark::DoNotOptimize(vm.getPhase());
+  });
+}
+BENCHMARK(BM_ModelLoad)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+/// Arg: number of points of the demonstration
+static void BM_ModelTrain(benchmark::State& state)
+{
+  MatrixXd data = CreateData(state.range(0),test_dim);
+
+  RunTimed(state,[&]()
+  {
+    VirtualMechanismGmr<VMP_1ord_t> vm(data);
+    benchmark::DoNotOptimize(vm.getPhase());
+  });
+}
+BENCHMARK(BM_ModelTrain)->Arg(100)->Arg(1000)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
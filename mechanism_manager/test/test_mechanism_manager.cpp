@@ -25,12 +25,20 @@
 
 #include <gtest/gtest.h>
 #include "mechanism_manager/mechanism_manager_interface.h"
+#include "mechanism_manager/shared_memory.h"
+#include "mechanism_manager/guides_cache.h"
+#include "mechanism_manager/trace_replay.h"
+#include "mechanism_manager/mechanism_manager.h"
+#include "mechanism_manager/worker_pool.h"
 
 ////////// STD
 #include <iostream>
 #include <fstream> 
 #include <iterator>
+#include <atomic>
 #include <boost/concept_check.hpp>
+#include <boost/thread.hpp>
+#include <boost/scoped_ptr.hpp>
 
 using namespace mechanism_manager;
 using namespace Eigen;
@@ -247,6 +255,466 @@ TEST(MechanismManagerTest, Clustering)
 
 }
 
+TEST(MechanismManagerTest, MergeScoreCoreset)
+{
+  // A demonstration along a guide, slightly shifted, and the guide fitted on it
+  virtual_mechanism::VirtualMechanismFactory factory;
+  boost::scoped_ptr<vm_t> guide(factory.Build(ros::package::getPath("mechanism_manager")+"/models/gmm/"+model_name));
+  const MatrixXd states = guide->getStateRecorded();
+  const int n_samples = 2000;
+  MatrixXd demo(n_samples,states.cols());
+  for (int i=0; i<n_samples; i++)
+  {
+    const double s = static_cast<double>(i) * (states.rows() - 1) / (n_samples - 1);
+    const int j = std::min(static_cast<int>(s),static_cast<int>(states.rows()) - 2);
+    demo.row(i) = states.row(j) + (s - j) * (states.row(j+1) - states.row(j));
+  }
+  demo.array() += 0.002;
+  boost::scoped_ptr<vm_t> demo_guide(factory.Build(demo));
+
+  // The scores on the coreset stay close to the scores on all the samples, so do the merge decisions
+  gmm::Coreset all, coreset;
+  gmm::BuildCoreset(demo,n_samples,all);
+  gmm::BuildCoreset(demo,200,coreset);
+  double score, max_score, score_all, max_score_all;
+  ASSERT_TRUE(MechanismManager::ComputeMergeScore(guide.get(),demo,&coreset,score));
+  ASSERT_TRUE(MechanismManager::ComputeMergeScore(demo_guide.get(),demo,&coreset,max_score));
+  ASSERT_TRUE(MechanismManager::ComputeMergeScore(guide.get(),demo,&all,score_all));
+  ASSERT_TRUE(MechanismManager::ComputeMergeScore(demo_guide.get(),demo,&all,max_score_all));
+  EXPECT_NEAR(score,score_all,0.02 * std::abs(score_all));
+  EXPECT_NEAR(max_score,max_score_all,0.02 * std::abs(max_score_all));
+  EXPECT_NEAR(MechanismManager::RelativeMergeScore(score,max_score),MechanismManager::RelativeMergeScore(score_all,max_score_all),0.02);
+  EXPECT_LE(MechanismManager::RelativeMergeScore(score,max_score),1.0);
+}
+
+/// Exposes the search of the closest guide used by ClusterVm
+class ClusterTestManager: public MechanismManager
+{
+public:
+  ClusterTestManager(int position_dim):MechanismManager(position_dim) {}
+  using MechanismManager::FindClosestVm;
+};
+
+TEST(MechanismManagerTest, MergeDecisions)
+{
+  // Guides along the test guide at increasing distances
+  virtual_mechanism::VirtualMechanismFactory factory;
+  const MatrixXd states = boost::scoped_ptr<vm_t>(factory.Build(ros::package::getPath("mechanism_manager")+"/models/gmm/"+model_name))->getStateRecorded();
+  const double offsets[4] = {0.0, 0.01, 0.05, 0.2};
+  std::vector<GuideStruct> guides(4);
+  for(int i=0;i<4;i++)
+  {
+    MatrixXd demo = states;
+    demo.array() += offsets[i];
+    guides[i].name = "guide_" + std::to_string(i);
+    guides[i].guide.reset(factory.Build(demo));
+  }
+
+  // With the default configuration (sequential exit only on a perfect match, no coreset) the parallel search
+  // takes the same decisions as the sequential scan of all the guides with ComputeResponsability
+  ClusterTestManager mm(states.cols());
+  const double shifts[5] = {0.0, 0.005, 0.03, 0.1, 0.5};
+  const double merge_ths[3] = {0.3, 0.6, 0.9};
+  for(int n=0;n<5;n++)
+  {
+    MatrixXd data = states;
+    data.array() += shifts[n];
+    boost::scoped_ptr<vm_t> demo_guide(factory.Build(data));
+    const double max_score = demo_guide->GetResponsability();
+
+    int baseline_idx = 0;
+    double baseline_rel_lik = -std::numeric_limits<double>::infinity();
+    for(unsigned int i=0;i<guides.size();i++)
+    {
+      const double rel_lik = guides[i].guide->ComputeResponsability(data)/max_score;
+      if(rel_lik > baseline_rel_lik)
+      {
+        baseline_rel_lik = rel_lik;
+        baseline_idx = i;
+      }
+    }
+
+    for(int t=0;t<3;t++)
+    {
+      int max_idx = -1;
+      double max_rel_lik = 0.0;
+      mm.FindClosestVm(guides,data,NULL,max_score,std::max(1.0,merge_ths[t]),max_idx,max_rel_lik);
+      EXPECT_EQ(max_idx,baseline_idx);
+      EXPECT_NEAR(max_rel_lik,std::min(baseline_rel_lik,1.0),1e-12);
+      EXPECT_EQ(max_rel_lik >= merge_ths[t],baseline_rel_lik >= merge_ths[t]);
+    }
+  }
+}
+
+TEST(MechanismManagerTest, RecordDemonstration)
+{
+  MechanismManagerInterface mm;
+
+  int pos_dim = mm.GetPositionDim();
+
+  Eigen::VectorXd rob_pos(pos_dim);
+  Eigen::VectorXd rob_vel(pos_dim);
+  Eigen::VectorXd f_out(pos_dim);
+  rob_vel.fill(0.0);
+  f_out.fill(0.0);
+
+  // Nothing is recorded before the start
+  rob_pos.fill(0.0);
+  EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+  EXPECT_FALSE(mm.IsRecording());
+  EXPECT_EQ(mm.GetNbRecordedSamples(),0);
+
+  EXPECT_NO_THROW(mm.StartRecording());
+  EXPECT_TRUE(mm.IsRecording());
+
+  int n_steps = 2000;
+  for (int i=0;i<n_steps;i++)
+  {
+      rob_pos.fill(0.5 * i/n_steps);
+      START_REAL_TIME_CRITICAL_CODE();
+      EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+      END_REAL_TIME_CRITICAL_CODE();
+  }
+  EXPECT_EQ(mm.GetNbRecordedSamples(),n_steps);
+
+  // The recording is moved to the service
+  EXPECT_NO_THROW(mm.InsertRecordedVm(true));
+  EXPECT_FALSE(mm.IsRecording());
+  EXPECT_EQ(mm.GetNbRecordedSamples(),0);
+  mm.WaitVmServices();
+  EXPECT_EQ(mm.GetNbVms(),1);
+
+  // Record again, the same path is clustered with the first guide
+  EXPECT_NO_THROW(mm.SetMergeThreshold(0.3));
+  EXPECT_NO_THROW(mm.StartRecording());
+  for (int i=0;i<n_steps;i++)
+  {
+      rob_pos.fill(0.5 * i/n_steps);
+      EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+  }
+  EXPECT_NO_THROW(mm.ClusterRecordedVm());
+  EXPECT_EQ(mm.GetNbVms(),1);
+
+  // Nothing to insert
+  EXPECT_NO_THROW(mm.InsertRecordedVm());
+  EXPECT_EQ(mm.GetNbVms(),1);
+
+  EXPECT_NO_THROW(mm.StartRecording());
+  EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+  EXPECT_NO_THROW(mm.DiscardRecording());
+  EXPECT_FALSE(mm.IsRecording());
+  EXPECT_EQ(mm.GetNbVms(),1);
+}
+
+TEST(MechanismManagerTest, GuidesChangeFeed)
+{
+  GuidesChangeLog log(4);
+  std::vector<GuideDelta> deltas;
+  std::vector<std::string> names;
+  uint64_t session;
+  unsigned long revision;
+
+  std::vector<std::string> list;
+  list.push_back("a");
+  list.push_back("b");
+  list.push_back("c");
+  log.Publish(list);
+  EXPECT_EQ(log.GetRevision(),3);
+
+  // A new client gets the whole list
+  EXPECT_FALSE(log.GetChanges(0,0,deltas,names,session,revision));
+  EXPECT_EQ(names,list);
+  EXPECT_EQ(revision,3);
+  EXPECT_NE(session,0);
+  EXPECT_EQ(session,log.GetSession());
+
+  // Delete b, insert d, rename a
+  list.erase(list.begin() + 1);
+  list.push_back("d");
+  log.Publish(list);
+  log.Rename(0,"e");
+  list[0] = "e";
+  EXPECT_TRUE(log.GetChanges(session,3,deltas,names,session,revision));
+  ASSERT_EQ(deltas.size(),3);
+  EXPECT_TRUE(names.empty());
+  EXPECT_EQ(revision,6);
+
+  // The client copy follows the deltas
+  std::vector<std::string> client;
+  client.push_back("a");
+  client.push_back("b");
+  client.push_back("c");
+  for (size_t i=0; i<deltas.size(); i++)
+  {
+    if(deltas[i].type == GUIDE_INSERTED)
+      client.insert(client.begin() + deltas[i].idx,deltas[i].name);
+    else if(deltas[i].type == GUIDE_DELETED)
+      client.erase(client.begin() + deltas[i].idx);
+    else
+      client[deltas[i].idx] = deltas[i].name;
+  }
+  EXPECT_EQ(client,list);
+
+  // Up to date, or too old for the deltas kept
+  EXPECT_TRUE(log.GetChanges(session,6,deltas,names,session,revision));
+  EXPECT_TRUE(deltas.empty());
+  EXPECT_FALSE(log.GetChanges(session,1,deltas,names,session,revision));
+  EXPECT_EQ(names,list);
+
+  // After a restart the revision of the client could be a valid one of the new log, its session is not
+  GuidesChangeLog restarted_log(4);
+  EXPECT_NE(restarted_log.GetSession(),session);
+  std::vector<std::string> restarted_list(4,"");
+  for (int i=0; i<4; i++)
+    restarted_list[i] = "f" + std::to_string(i);
+  restarted_log.Publish(restarted_list);
+  uint64_t restarted_session;
+  EXPECT_FALSE(restarted_log.GetChanges(session,2,deltas,names,restarted_session,revision));
+  EXPECT_TRUE(deltas.empty());
+  EXPECT_EQ(names,restarted_list);
+  EXPECT_EQ(restarted_session,restarted_log.GetSession());
+
+  // The manager publishes the changes of its guides
+  MechanismManagerInterface mm;
+  EXPECT_NO_THROW(mm.InsertVm(model_name));
+  EXPECT_FALSE(mm.GetVmChanges(0,0,deltas,names,session,revision));
+  ASSERT_EQ(names.size(),1);
+  unsigned long client_revision = revision;
+  std::string new_name = "renamed";
+  EXPECT_NO_THROW(mm.SetVmName(0,new_name));
+  EXPECT_NO_THROW(mm.DeleteVm(0));
+  EXPECT_TRUE(mm.GetVmChanges(session,client_revision,deltas,names,session,revision));
+  ASSERT_EQ(deltas.size(),2);
+  EXPECT_EQ(deltas[0].type,GUIDE_RENAMED);
+  EXPECT_EQ(deltas[0].name,new_name);
+  EXPECT_EQ(deltas[1].type,GUIDE_DELETED);
+  EXPECT_EQ(deltas[1].idx,0);
+}
+
+TEST(MechanismManagerTest, LazyGuidesCache)
+{
+  // Four straight guides along x, one every meter along y: only the recorded states are needed to register them
+  const int n_guides = 4;
+  std::vector<library::Record> records;
+  for (int i=0; i<n_guides; i++)
+  {
+    MatrixXd states(11,2);
+    for (int j=0; j<states.rows(); j++)
+    {
+      states(j,0) = 0.1 * j;
+      states(j,1) = i;
+    }
+    records.push_back(library::Record("lazy_"+std::to_string(i)));
+    records.back().Add("state_recorded",states);
+  }
+  records.push_back(library::Record("no_states")); // Skipped
+  const std::string library_path = "/tmp/test_guides_cache.vflib";
+  ASSERT_TRUE(library::Write(library_path,records));
+
+  GuidesCache cache(2,2);
+  EXPECT_EQ(cache.Add(library_path),n_guides);
+  EXPECT_EQ(cache.Add(library_path),0); // Same names
+  ASSERT_EQ(cache.GetNbGuides(),n_guides);
+  LazyGuide guide = cache.GetGuide(1);
+  EXPECT_NEAR(guide.box_min(0),-0.05,1e-9);
+  EXPECT_NEAR(guide.box_max(1),1.05,1e-9);
+  EXPECT_NEAR(guide.final_state(0),1.0,1e-9);
+
+  // The positions tracked by the real time loop
+  std::vector<VectorXd> positions;
+  EXPECT_FALSE(cache.GetPositions(positions));
+  double robots_position[4] = {0.5, 0.0, 0.5, 3.0};
+  cache.Track(robots_position,1);
+  ASSERT_TRUE(cache.GetPositions(positions));
+  ASSERT_EQ(positions.size(),1);
+  EXPECT_EQ(positions[0](1),0.0);
+
+  // Only the guide around the robot is loaded
+  std::vector<std::string> published;
+  std::vector<int> to_load;
+  std::vector<std::string> to_evict;
+  cache.Select(positions,published,0.2,2,to_load,to_evict);
+  ASSERT_EQ(to_load.size(),1);
+  EXPECT_EQ(to_load[0],0);
+  EXPECT_TRUE(to_evict.empty());
+  cache.SetResident(0,true);
+  published.push_back("lazy_0");
+
+  // The robot moves along y: the least recently used guide is evicted to stay under the cap
+  for (int i=1; i<n_guides; i++)
+  {
+    positions[0](1) = i;
+    cache.Select(positions,published,0.2,2,to_load,to_evict);
+    ASSERT_EQ(to_load.size(),1);
+    EXPECT_EQ(to_load[0],i);
+    cache.SetResident(i,true);
+    published.push_back("lazy_"+std::to_string(i));
+    if(i >= 2)
+    {
+      ASSERT_EQ(to_evict.size(),1);
+      EXPECT_EQ(to_evict[0],"lazy_"+std::to_string(i-2));
+      published.erase(std::find(published.begin(),published.end(),to_evict[0]));
+    }
+    EXPECT_LE(cache.GetNbResident(),2);
+  }
+
+  // Two robots: the close guides are not evicted, even beyond the cap
+  robots_position[1] = 0.0;
+  cache.Track(robots_position,2);
+  ASSERT_TRUE(cache.GetPositions(positions));
+  ASSERT_EQ(positions.size(),2);
+  cache.Select(positions,published,0.2,1,to_load,to_evict);
+  EXPECT_TRUE(to_load.empty());
+  ASSERT_EQ(to_evict.size(),1);
+  EXPECT_EQ(to_evict[0],"lazy_2");
+
+  // A guide deleted by the user is not resident anymore, one with the same name hides the lazy one
+  published.clear();
+  published.push_back("lazy_0");
+  cache.Select(positions,published,0.2,0,to_load,to_evict);
+  ASSERT_EQ(to_load.size(),1);
+  EXPECT_EQ(to_load[0],3);
+  EXPECT_TRUE(to_evict.empty());
+  EXPECT_EQ(cache.GetNbResident(),0);
+
+  std::remove(library_path.c_str());
+}
+
+TEST(MechanismManagerTest, TraceReplay)
+{
+  // Capture a session as the interface does: a service, then the ticks with the forces of the engine
+  const std::string trace_file = "/tmp/test_trace.vftrc";
+  const std::string replay_file = "/tmp/test_trace_replay.vftrc";
+  const int n_ticks = 500;
+  {
+    MechanismManager mm(2);
+    TraceWriter capture(trace_file,2,1,n_ticks,3600.0); // A ring for all the ticks, drained only by the destructor
+    ASSERT_TRUE(capture.IsOpen());
+    mm.InsertVm(model_name);
+    capture.RecordEvent(TRACE_INSERT_MODEL,0,model_name,MatrixXd());
+
+    VectorXd rob_pos(2), rob_vel(2), f_out(2);
+    rob_vel.fill(1.0);
+    for (int i=0;i<n_ticks;i++)
+    {
+      rob_pos.fill(0.25 + 0.0005 * i);
+      mm.Update(rob_pos,rob_vel,dt,f_out);
+      capture.RecordTick(rob_pos.data(),rob_vel.data(),f_out.data(),1,dt);
+    }
+    EXPECT_EQ(capture.GetNbDropped(),0);
+  }
+
+  // The service first, then the ticks in order
+  TraceReader trace;
+  ASSERT_TRUE(trace.Open(trace_file));
+  EXPECT_EQ(trace.GetPositionDim(),2);
+  EXPECT_EQ(trace.GetNbRobots(),1);
+  TraceEntry entry;
+  ASSERT_TRUE(trace.Next(entry));
+  EXPECT_EQ(entry.type,TRACE_INSERT_MODEL);
+  EXPECT_EQ(entry.tick,0);
+  EXPECT_EQ(entry.name,model_name);
+  for (int i=0;i<n_ticks;i++)
+  {
+    ASSERT_TRUE(trace.Next(entry));
+    ASSERT_EQ(entry.type,TRACE_TICK);
+    EXPECT_EQ(entry.tick,i);
+    EXPECT_EQ(entry.dt,dt);
+    EXPECT_NEAR(entry.position(0,0),0.25 + 0.0005 * i,1e-12);
+  }
+  EXPECT_FALSE(trace.Next(entry));
+
+  // The replay gives back the captured forces
+  ASSERT_TRUE(trace.Open(trace_file));
+  MechanismManager mm(2);
+  ReplayReport report;
+  {
+    TraceWriter output(replay_file,2,1,0);
+    ASSERT_TRUE(ReplayTrace(trace,mm,report,1e-9,NULL,&output));
+  }
+  EXPECT_EQ(report.n_ticks,n_ticks);
+  EXPECT_EQ(report.n_services,1);
+  EXPECT_EQ(report.n_missing,0);
+  EXPECT_EQ(report.n_compared,n_ticks);
+  EXPECT_EQ(report.n_diffs,0);
+  EXPECT_EQ(report.latency.GetCount(),n_ticks);
+  EXPECT_FALSE(report.GetReport().empty());
+
+  // Against the replay as the reference, on an engine with another dimension the trace is refused
+  TraceReader reference;
+  ASSERT_TRUE(trace.Open(trace_file));
+  ASSERT_TRUE(reference.Open(replay_file));
+  MechanismManager mm_again(2);
+  ReplayReport report_again;
+  ASSERT_TRUE(ReplayTrace(trace,mm_again,report_again,1e-9,&reference));
+  EXPECT_EQ(report_again.n_compared,n_ticks);
+  EXPECT_EQ(report_again.n_diffs,0);
+  MechanismManager mm_1d(1);
+  ASSERT_TRUE(trace.Open(trace_file));
+  EXPECT_FALSE(ReplayTrace(trace,mm_1d,report_again));
+}
+
+TEST(MechanismManagerTest, TraceServiceStamp)
+{
+  // A service is written before the first tick which used the set it published, even if it is recorded later
+  const std::string trace_file = "/tmp/test_trace_stamp.vftrc";
+  {
+    TraceWriter capture(trace_file,2,1,16,3600.0); // Drained only by the destructor
+    ASSERT_TRUE(capture.IsOpen());
+    VectorXd rob_pos(2), rob_vel(2), f_out(2);
+    rob_pos.fill(0.0);
+    rob_vel.fill(0.0);
+    f_out.fill(0.0);
+    capture.RecordTick(rob_pos.data(),rob_vel.data(),f_out.data(),1,dt,0);
+    capture.RecordTick(rob_pos.data(),rob_vel.data(),f_out.data(),1,dt,1); // The set 1 is published meanwhile
+    capture.RecordTick(rob_pos.data(),rob_vel.data(),f_out.data(),1,dt,1);
+    capture.RecordEvent(TRACE_INSERT_MODEL,0,model_name,MatrixXd(),1);
+    capture.RecordEvent(TRACE_SET_MODE,SOFT,"",MatrixXd()); // No publication, after the ticks already done
+    capture.RecordTick(rob_pos.data(),rob_vel.data(),f_out.data(),1,dt,1);
+  }
+
+  TraceReader trace;
+  ASSERT_TRUE(trace.Open(trace_file));
+  const trace_entry_t types[6] = {TRACE_TICK,TRACE_INSERT_MODEL,TRACE_TICK,TRACE_TICK,TRACE_SET_MODE,TRACE_TICK};
+  const uint64_t ticks[6] = {0,1,1,2,3,3};
+  TraceEntry entry;
+  for (int i=0;i<6;i++)
+  {
+    ASSERT_TRUE(trace.Next(entry));
+    EXPECT_EQ(entry.type,types[i]);
+    EXPECT_EQ(entry.tick,ticks[i]);
+  }
+  EXPECT_FALSE(trace.Next(entry));
+  std::remove(trace_file.c_str());
+}
+
+TEST(MechanismManagerTest, TraceReplaySetters)
+{
+  // The renames and the merge threshold are replayed as well
+  const std::string trace_file = "/tmp/test_trace_setters.vftrc";
+  {
+    TraceWriter capture(trace_file,2,1,0);
+    ASSERT_TRUE(capture.IsOpen());
+    capture.RecordEvent(TRACE_INSERT_MODEL,0,model_name,MatrixXd());
+    capture.RecordEvent(TRACE_RENAME,0,"renamed",MatrixXd());
+    capture.RecordEvent(TRACE_SET_MERGE_THRESHOLD,0,"",MatrixXd::Constant(1,1,0.7));
+  }
+
+  TraceReader trace;
+  ASSERT_TRUE(trace.Open(trace_file));
+  MechanismManager mm(2);
+  ReplayReport report;
+  ASSERT_TRUE(ReplayTrace(trace,mm,report));
+  EXPECT_EQ(report.n_services,3);
+  std::string name;
+  mm.GetVmName(0,name);
+  EXPECT_EQ(name,"renamed");
+  double merge_th = 0.0;
+  mm.GetMergeThreshold(merge_th);
+  EXPECT_EQ(merge_th,0.7);
+  std::remove(trace_file.c_str());
+}
+
 TEST(MechanismManagerTest, LoopUpdate)
 {
   //int nb = omp_get_num_threads();
@@ -323,6 +791,557 @@ TEST(MechanismManagerTest, LoopUpdate)
   //getchar();
 }
 
+TEST(MechanismManagerTest, ParallelUpdate)
+{
+  MechanismManagerInterface mm_serial;
+  MechanismManagerInterface mm_parallel;
+  mm_serial.SetNbWorkers(1);
+  mm_parallel.SetNbWorkers(4);
+
+  int pos_dim = mm_serial.GetPositionDim();
+
+  int n_points = 100;
+  MatrixXd data(n_points,pos_dim);
+  for (int j=0; j<8; j++)
+  {
+    for (int i=0; i<data.cols(); i++)
+      data.col(i) = VectorXd::LinSpaced(n_points, 0.0, 1.0).array() + 0.05 * j * (i+1);
+    EXPECT_NO_THROW(mm_serial.InsertVm(data));
+    EXPECT_NO_THROW(mm_parallel.InsertVm(data));
+  }
+  ASSERT_EQ(mm_serial.GetNbVms(),mm_parallel.GetNbVms());
+
+  Eigen::VectorXd rob_pos(pos_dim);
+  Eigen::VectorXd rob_vel(pos_dim);
+  Eigen::VectorXd f_serial(pos_dim);
+  Eigen::VectorXd f_parallel(pos_dim);
+  rob_pos.fill(0.25);
+  rob_vel.fill(1.0);
+
+  // The result has to be the same, whatever the number of workers
+  for (int i=0;i<100;i++)
+  {
+      START_REAL_TIME_CRITICAL_CODE();
+      EXPECT_NO_THROW(mm_serial.Update(rob_pos,rob_vel,dt,f_serial));
+      EXPECT_NO_THROW(mm_parallel.Update(rob_pos,rob_vel,dt,f_parallel));
+      END_REAL_TIME_CRITICAL_CODE();
+      for (int j=0;j<pos_dim;j++)
+        EXPECT_EQ(f_serial(j),f_parallel(j));
+  }
+}
+
+static void CountJob(void* arg, const int worker_idx, const int n_workers)
+{
+  std::vector<int>& counts = *static_cast<std::vector<int>*>(arg);
+  counts[worker_idx]++;
+}
+
+TEST(MechanismManagerTest, WorkerPoolSleep)
+{
+  const int n_workers = 4;
+  const int n_jobs = 100;
+  std::vector<int> counts(n_workers,0);
+  WorkerPool pool(n_workers);
+  for (int i=0;i<n_jobs;i++)
+    pool.Run(&CountJob,&counts);
+
+  // Idle longer than the spin budget: the workers sleep and the next jobs wake them
+  boost::this_thread::sleep_for(boost::chrono::milliseconds(50));
+  for (int i=0;i<n_jobs;i++)
+    pool.Run(&CountJob,&counts);
+  for (int i=0;i<n_workers;i++)
+    EXPECT_EQ(counts[i],2*n_jobs);
+}
+
+TEST(MechanismManagerTest, EditWhileUpdating)
+{
+  MechanismManagerInterface mm;
+
+  int pos_dim = mm.GetPositionDim();
+
+  int n_points = 100;
+  MatrixXd data(n_points,pos_dim);
+  for (int i=0; i<data.cols(); i++)
+    data.col(i) = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  EXPECT_NO_THROW(mm.InsertVm(data));
+
+  // The real time loop keeps running while the guides are inserted and deleted
+  std::atomic<bool> stop(false);
+  boost::thread loop([&mm,&stop,pos_dim]()
+  {
+      Eigen::VectorXd rob_pos(pos_dim);
+      Eigen::VectorXd rob_vel(pos_dim);
+      Eigen::VectorXd f(pos_dim);
+      rob_pos.fill(0.25);
+      rob_vel.fill(0.0);
+      while(!stop)
+      {
+          mm.Update(rob_pos,rob_vel,dt,f);
+          for (int j=0;j<pos_dim;j++)
+            EXPECT_FALSE(std::isnan(f(j)));
+      }
+  });
+
+  for (int k=0; k<20; k++)
+  {
+    for (int i=0; i<data.cols(); i++)
+      data.col(i) = VectorXd::LinSpaced(n_points, 0.0, 1.0).array() + 0.01 * (k+1);
+    EXPECT_NO_THROW(mm.InsertVm(data));
+    if(k%2 == 1)
+      EXPECT_NO_THROW(mm.DeleteVm(0));
+  }
+
+  stop = true;
+  loop.join();
+
+  EXPECT_EQ(mm.GetNbVms(),11);
+}
+
+TEST(MechanismManagerTest, LatencyStats)
+{
+  MechanismManagerInterface mm;
+
+  int pos_dim = mm.GetPositionDim();
+  Eigen::VectorXd rob_pos(pos_dim);
+  Eigen::VectorXd rob_vel(pos_dim);
+  Eigen::VectorXd f_out(pos_dim);
+  rob_pos.fill(0.25);
+  rob_vel.fill(1.0);
+
+  for (int i=0;i<100;i++)
+  {
+      START_REAL_TIME_CRITICAL_CODE();
+      EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+      END_REAL_TIME_CRITICAL_CODE();
+  }
+
+  std::string report;
+  mm.GetLatencyStats(report);
+  EXPECT_NE(report.find("tick: n 100 "),std::string::npos);
+
+  // The reset is done by the next update
+  mm.ResetLatencyStats();
+  EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+  mm.GetLatencyStats(report);
+  EXPECT_NE(report.find("tick: n 1 "),std::string::npos);
+}
+
+TEST(MechanismManagerTest, MultiRobotUpdate)
+{
+  MechanismManagerInterface mm_single;
+  MechanismManagerInterface mm;
+  int pos_dim = mm.GetPositionDim();
+  int n_robots = 3;
+
+  EXPECT_EQ(mm.GetNbRobots(),1);
+  EXPECT_NO_THROW(mm.SetNbRobots(n_robots));
+  EXPECT_EQ(mm.GetNbRobots(),n_robots);
+
+  // The same guide for all the robots
+  EXPECT_NO_THROW(mm_single.InsertVm(model_name));
+  EXPECT_NO_THROW(mm.InsertVm(model_name));
+  ASSERT_EQ(mm.GetNbVms(),1);
+
+  VectorXd rob_pos(pos_dim);
+  VectorXd rob_vel(pos_dim);
+  VectorXd f_out(pos_dim);
+  MatrixXd robots_pos(pos_dim,n_robots);
+  MatrixXd robots_vel(pos_dim,n_robots);
+  MatrixXd robots_f_out(pos_dim,n_robots);
+  rob_vel.fill(1.0);
+
+  // The robots 0 and 2 follow the same path as the single robot, the robot 1 stays still
+  for (int i=0;i<1000;i++)
+  {
+      rob_pos.fill(0.25 + 0.0005 * i);
+      robots_pos.col(0) = rob_pos;
+      robots_pos.col(1).fill(0.5);
+      robots_pos.col(2) = rob_pos;
+      robots_vel.col(0) = rob_vel;
+      robots_vel.col(1).fill(0.0);
+      robots_vel.col(2) = rob_vel;
+
+      START_REAL_TIME_CRITICAL_CODE();
+      EXPECT_NO_THROW(mm_single.Update(rob_pos,rob_vel,dt,f_out));
+      EXPECT_NO_THROW(mm.Update(robots_pos,robots_vel,dt,robots_f_out));
+      END_REAL_TIME_CRITICAL_CODE();
+
+      for (int j=0;j<pos_dim;j++)
+      {
+        EXPECT_NEAR(robots_f_out(j,0),f_out(j),1e-9);
+        EXPECT_NEAR(robots_f_out(j,2),f_out(j),1e-9);
+      }
+  }
+
+  // Each robot keeps its own phase on the shared guide
+  EXPECT_NEAR(mm.GetPhase(0,0),mm_single.GetPhase(0),1e-9);
+  EXPECT_NEAR(mm.GetPhase(0,2),mm_single.GetPhase(0),1e-9);
+  EXPECT_NE(mm.GetPhase(0,1),mm.GetPhase(0,0));
+
+  // Back to a single robot, it keeps the state of the robot 0
+  double phase = mm.GetPhase(0,0);
+  EXPECT_NO_THROW(mm.SetNbRobots(1));
+  EXPECT_EQ(mm.GetNbRobots(),1);
+  EXPECT_NEAR(mm.GetPhase(0),phase,1e-9);
+}
+
+TEST(MechanismManagerTest, ProbabilisticScaleMode)
+{
+  MechanismManagerInterface mm;
+  int pos_dim = mm.GetPositionDim();
+
+  // Two different guides, a copy of the same one would be rejected (same name)
+  std::string other_model_name = "test2d_1";
+  EXPECT_NO_THROW(mm.InsertVm(model_name));
+  EXPECT_NO_THROW(mm.InsertVm(other_model_name));
+  ASSERT_EQ(mm.GetNbVms(),2);
+
+  std::string mode;
+  EXPECT_NO_THROW(mm.SetVmMode("PROB"));
+  mm.GetVmMode(mode);
+  EXPECT_EQ(mode,"PROB");
+
+  VectorXd rob_pos(pos_dim);
+  VectorXd rob_vel(pos_dim);
+  VectorXd f_out(pos_dim);
+  rob_vel.fill(1.0);
+
+  double max_scale_diff = 0.0;
+  for (int i=0;i<1000;i++)
+  {
+      rob_pos.fill(0.25 + 0.0005 * i);
+
+      START_REAL_TIME_CRITICAL_CODE();
+      EXPECT_NO_THROW(mm.Update(rob_pos,rob_vel,dt,f_out));
+      END_REAL_TIME_CRITICAL_CODE();
+
+      EXPECT_TRUE(f_out.allFinite());
+      EXPECT_GE(mm.GetScale(0),0.0);
+      EXPECT_GE(mm.GetScale(1),0.0);
+      EXPECT_LE(mm.GetScale(0) + mm.GetScale(1),1.0 + 1e-9);
+      max_scale_diff = std::max(max_scale_diff,std::abs(mm.GetScale(0) - mm.GetScale(1)));
+  }
+  // The posterior follows the covariances of each guide
+  EXPECT_GT(max_scale_diff,1e-3);
+}
+
+TEST(MechanismManagerTest, FadeTime)
+{
+  YAML::Node main_node = tool_box::GetYamlNodeFromPkgName("mechanism_manager");
+  double fade_time = 0.0;
+  main_node["mechanism_manager"]["fade_time"] >> fade_time;
+  ASSERT_GT(fade_time,0.0);
+
+  // Switch from the guide 1 to the guide 0: after fade_time they are at 1-1/e and 1/e whatever the period of Update
+  const double periods[3] = {0.001, 0.004, 0.0125};
+  for(int p=0;p<3;p++)
+  {
+    VectorXd scale_t(2);
+    scale_t << 0.0, 1.0;
+    const int n_steps = static_cast<int>(std::floor(fade_time/periods[p] + 0.5));
+    for(int i=0;i<n_steps;i++)
+      MechanismManager::IntegrateFade(scale_t,0,fade_time,periods[p]);
+    const double t = n_steps * periods[p];
+    EXPECT_NEAR(scale_t(0),1.0 - std::exp(-t/fade_time),1e-9);
+    EXPECT_NEAR(scale_t(1),std::exp(-t/fade_time),1e-9);
+    EXPECT_NEAR(t,fade_time,periods[p]);
+    EXPECT_NEAR(scale_t.sum(),1.0,1e-9);
+  }
+}
+
+/// Exposes the scheduler of the real time loop, it is tested on hand made banks without guides
+class ScheduleTestManager: public MechanismManager
+{
+public:
+  ScheduleTestManager():MechanismManager(2) {}
+  using MechanismManager::ScheduleGuides;
+  using MechanismManager::ComputePosteriors;
+};
+
+TEST(MechanismManagerTest, ScheduleCulling)
+{
+  YAML::Node main_node = tool_box::GetYamlNodeFromPkgName("mechanism_manager");
+  double escape_factor = 0.0;
+  main_node["mechanism_manager"]["escape_factor"] >> escape_factor;
+  ASSERT_GT(escape_factor,0.0);
+
+  const int n_guides = 20;
+  const double cull_epsilon = 1e-3;
+  const double cull_dist = -std::log(cull_epsilon)/escape_factor;
+  ScheduleTestManager mm;
+  mm.SetMultiRate(0.0,0,1); // Only the culling
+  mm.SetCulling(cull_epsilon);
+
+  GuideBank bank;
+  bank.Resize(n_guides,2);
+  RobotBank robot;
+  robot.Resize(n_guides,2,1);
+  std::srand(0);
+  for(int i=0;i<n_guides;i++)
+  {
+    const Vector2d center = Vector2d::Random() * 2.0 * cull_dist;
+    const Vector2d half_size = (Vector2d::Random().array() + 1.0).matrix() * 0.5 * cull_dist;
+    bank.box_min.col(i) = center - half_size;
+    bank.box_max.col(i) = center + half_size;
+  }
+
+  int n_culled = 0;
+  int n_updated = 0;
+  for(int n=0;n<200;n++)
+  {
+    robot.position = Vector2d::Random() * 3.0 * cull_dist;
+    mm.ScheduleGuides(robot,bank,dt);
+    for(int i=0;i<n_guides;i++)
+    {
+      const Vector2d closest = robot.position.cwiseMax(bank.box_min.col(i)).cwiseMin(bank.box_max.col(i));
+      const double dist = (robot.position - closest).norm();
+      if(robot.schedule[i] == GUIDE_CULLED)
+      {
+        // The guide can not reach the robot from anywhere in its box
+        EXPECT_GT(dist,cull_dist);
+        EXPECT_LT(std::exp(-escape_factor * dist),cull_epsilon);
+        n_culled++;
+      }
+      else
+      {
+        EXPECT_LE(dist,cull_dist);
+        EXPECT_EQ(robot.schedule[i],GUIDE_UPDATED);
+        n_updated++;
+      }
+    }
+  }
+  EXPECT_GT(n_culled,0);
+  EXPECT_GT(n_updated,0);
+
+  // Inside the box and just within the cull distance from it the guide is never culled
+  bank.box_min.col(0) << -1.0, -1.0;
+  bank.box_max.col(0) << 1.0, 1.0;
+  robot.position << 0.5, -0.5;
+  mm.ScheduleGuides(robot,bank,dt);
+  EXPECT_EQ(robot.schedule[0],GUIDE_UPDATED);
+  robot.position << 1.0 + 0.99 * cull_dist, 0.0;
+  mm.ScheduleGuides(robot,bank,dt);
+  EXPECT_EQ(robot.schedule[0],GUIDE_UPDATED);
+  robot.position << 1.0 + 1.01 * cull_dist, 0.0;
+  mm.ScheduleGuides(robot,bank,dt);
+  EXPECT_EQ(robot.schedule[0],GUIDE_CULLED);
+
+  // Without culling all the guides are updated
+  mm.SetCulling(0.0);
+  robot.position << 1e6, 1e6;
+  mm.ScheduleGuides(robot,bank,dt);
+  for(int i=0;i<n_guides;i++)
+    EXPECT_EQ(robot.schedule[i],GUIDE_UPDATED);
+}
+
+/// Runs the scheduler for n_ticks with the bookkeeping of UpdateGuides, returns the ticks of the guides updates
+/// and checks that each guide is given exactly the time elapsed since its last update
+void RunSchedule(ScheduleTestManager& mm, RobotBank& robot, const GuideBank& bank, const int n_ticks, std::vector<std::vector<int> >& updates)
+{
+  const int n_guides = robot.scale.size();
+  std::vector<double> integrated(n_guides,0.0);
+  updates.assign(n_guides,std::vector<int>());
+  for(int n=0;n<n_ticks;n++)
+  {
+    mm.ScheduleGuides(robot,bank,dt);
+    for(int i=0;i<n_guides;i++)
+    {
+      ASSERT_NE(robot.schedule[i],GUIDE_CULLED);
+      if(robot.schedule[i] == GUIDE_SKIPPED)
+      {
+        robot.elapsed(i) += dt;
+        robot.n_skipped(i)++;
+      }
+      else
+      {
+        integrated[i] += dt + robot.elapsed(i);
+        robot.elapsed(i) = 0.0;
+        robot.n_skipped(i) = 0;
+        updates[i].push_back(n);
+      }
+    }
+  }
+  for(int i=0;i<n_guides;i++)
+    EXPECT_NEAR(integrated[i] + robot.elapsed(i),n_ticks * dt,1e-9);
+}
+
+TEST(MechanismManagerTest, ScheduleMultiRate)
+{
+  YAML::Node main_node = tool_box::GetYamlNodeFromPkgName("mechanism_manager");
+  double escape_factor = 0.0;
+  main_node["mechanism_manager"]["escape_factor"] >> escape_factor;
+  ASSERT_GT(escape_factor,0.0);
+
+  // Guide 0 is the active one, guide 1 is close to the robot, the others are far
+  const int n_guides = 6;
+  const int n_ticks = 100;
+  ScheduleTestManager mm;
+  mm.SetCulling(0.0);
+  GuideBank bank;
+  bank.Resize(n_guides,2);
+  bank.box_min.fill(-1e6);
+  bank.box_max.fill(1e6);
+  RobotBank robot;
+  std::vector<std::vector<int> > updates;
+
+  // Round robin: the low rate guides are updated every n_low/budget ticks
+  const int n_low = n_guides - 2;
+  const int budgets[2] = {1, 2};
+  for(int b=0;b<2;b++)
+  {
+    robot.Resize(n_guides,2,1);
+    robot.scale_hard(0) = 1.0;
+    for(int i=2;i<n_guides;i++)
+      robot.state(0,i) = 10.0/escape_factor;
+    mm.SetMultiRate(0.1,budgets[b],1000);
+    RunSchedule(mm,robot,bank,n_ticks,updates);
+
+    EXPECT_EQ(static_cast<int>(updates[0].size()),n_ticks);
+    EXPECT_EQ(static_cast<int>(updates[1].size()),n_ticks);
+    const int divisor = n_low/budgets[b];
+    for(int i=2;i<n_guides;i++)
+    {
+      ASSERT_GT(updates[i].size(),1u);
+      EXPECT_LT(updates[i][0],divisor);
+      for(unsigned int j=1;j<updates[i].size();j++)
+        EXPECT_EQ(updates[i][j] - updates[i][j-1],divisor);
+    }
+  }
+
+  // No budget: the low rate guides are updated every max period ticks
+  const int max_period = 3;
+  robot.Resize(n_guides,2,1);
+  robot.scale_hard(0) = 1.0;
+  for(int i=2;i<n_guides;i++)
+    robot.state(0,i) = 10.0/escape_factor;
+  mm.SetMultiRate(0.1,0,max_period);
+  RunSchedule(mm,robot,bank,n_ticks,updates);
+  EXPECT_EQ(static_cast<int>(updates[0].size()),n_ticks);
+  for(int i=2;i<n_guides;i++)
+  {
+    ASSERT_GT(updates[i].size(),1u);
+    EXPECT_EQ(updates[i][0],max_period - 1);
+    for(unsigned int j=1;j<updates[i].size();j++)
+      EXPECT_EQ(updates[i][j] - updates[i][j-1],max_period);
+  }
+
+  // Without multi rate all the guides are updated at each tick
+  robot.Resize(n_guides,2,1);
+  mm.SetMultiRate(0.0,0,1);
+  RunSchedule(mm,robot,bank,n_ticks,updates);
+  for(int i=0;i<n_guides;i++)
+    EXPECT_EQ(static_cast<int>(updates[i].size()),n_ticks);
+}
+
+TEST(MechanismManagerTest, PosteriorsSkippedGuides)
+{
+  // Three guides with the same gaussian, the robot on guide 0
+  const int n_guides = 3;
+  ScheduleTestManager mm;
+  RobotBank robot;
+  robot.Resize(n_guides,2,1);
+  robot.position.setZero();
+  robot.state.setZero();
+  robot.state(0,1) = 1.0;
+  robot.state(0,2) = 2.0;
+  robot.inv_variance.fill(1.0);
+  robot.log_norm.fill(0.0);
+  mm.ComputePosteriors(robot);
+  EXPECT_NEAR(robot.scale_hard.sum(),1.0,1e-12);
+  const VectorXd all_updated = robot.scale_hard;
+
+  // The skipped guide keeps its last posterior even if its density changed,
+  // the updated guides share the rest with the same ratio
+  robot.schedule[2] = GUIDE_SKIPPED;
+  robot.log_norm(2) = 10.0;
+  robot.state(0,2) = 0.0;
+  mm.ComputePosteriors(robot);
+  EXPECT_EQ(robot.scale_hard(2),all_updated(2));
+  EXPECT_NEAR(robot.scale_hard.sum(),1.0,1e-12);
+  EXPECT_NEAR(robot.scale_hard(0)/robot.scale_hard(1),all_updated(0)/all_updated(1),1e-9);
+
+  // Once updated its density is used again
+  robot.schedule[2] = GUIDE_UPDATED;
+  mm.ComputePosteriors(robot);
+  EXPECT_GT(robot.scale_hard(2),0.99);
+}
+
+TEST(MechanismManagerTest, SharedMemoryInterface)
+{
+  // The same guide is updated through the shared memory and by an interface in process
+  MechanismManagerInterface mm;
+  MechanismManagerInterface mm_direct;
+  int pos_dim = mm.GetPositionDim();
+  std::string shm_name = "/test_mechanism_manager_shm";
+  EXPECT_NO_THROW(mm.InsertVm(model_name));
+  EXPECT_NO_THROW(mm_direct.InsertVm(model_name));
+  ASSERT_EQ(mm.GetNbVms(),1);
+
+  SharedMemoryClient client;
+  EXPECT_FALSE(client.Open(shm_name)); // No engine yet
+
+  SharedMemoryEngine engine;
+  ASSERT_TRUE(engine.Create(shm_name,1,pos_dim));
+  ASSERT_TRUE(client.Open(shm_name));
+  EXPECT_FALSE(client.Open(shm_name,1)); // Only one slot
+  ASSERT_TRUE(client.Open(shm_name));
+  EXPECT_EQ(client.GetPositionDim(),pos_dim);
+
+  // The engine runs in its own thread, as it would in its own process
+  std::atomic<bool> stop(false);
+  boost::thread engine_loop([&]()
+  {
+      double position[shm_max_dim], velocity[shm_max_dim], f_out[shm_max_dim];
+      double dt_in;
+      uint64_t tick;
+      while(!stop)
+      {
+          if(engine.ReadRobotState(0,position,velocity,dt_in,tick))
+          {
+              mm.Update(position,velocity,dt_in,f_out);
+              engine.WriteForce(0,f_out,tick);
+          }
+          else
+              boost::this_thread::yield(); // Let the client run on a single core
+          engine.Beat();
+      }
+  });
+
+  VectorXd rob_pos(pos_dim);
+  VectorXd rob_vel(pos_dim);
+  VectorXd f_out(pos_dim);
+  VectorXd f_direct(pos_dim);
+  rob_vel.fill(1.0);
+
+  // The robot moves along the guide, both interfaces give the same forces at each tick
+  uint64_t tick = 0;
+  double f_max = 0.0;
+  for (int i=0;i<100;i++)
+  {
+      rob_pos.fill(0.25 + 0.0005 * i);
+      tick = client.WriteRobotState(rob_pos.data(),rob_vel.data(),dt);
+      EXPECT_EQ(tick,i+1);
+      ASSERT_TRUE(client.WaitForce(f_out.data(),tick,1000000000LL));
+      mm_direct.Update(rob_pos,rob_vel,dt,f_direct);
+      for (int j=0;j<pos_dim;j++)
+        EXPECT_NEAR(f_out(j),f_direct(j),1e-12);
+      f_max = std::max(f_max,f_out.cwiseAbs().maxCoeff());
+  }
+  EXPECT_GT(client.GetHeartbeat(),0);
+
+  stop = true;
+  engine_loop.join();
+
+  // The guide was active and it moved along with the robot
+  EXPECT_GT(f_max,0.0);
+  EXPECT_GT(mm.GetPhase(0),0.0);
+  EXPECT_NEAR(mm.GetPhase(0),mm_direct.GetPhase(0),1e-12);
+
+  client.Close();
+  engine.Destroy();
+  EXPECT_FALSE(client.Open(shm_name));
+}
+
 int main(int argc, char** argv)
 {
   //Eigen::initParallel();
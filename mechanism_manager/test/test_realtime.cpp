@@ -99,6 +99,12 @@ bool rt_init()
     return true;
 }
 
+// Number of guides used to measure the scalability of the update, N = 1...max_n_guides
+int max_n_guides = 256;
+int n_ticks_per_step = 2000;
+// Number of workers of the parallel configuration, the first configuration is the serial update
+int n_workers = 4;
+
 void rt_update_loop()
 {
     INIT_CNT(tmp_dt_cnt);
@@ -115,21 +121,84 @@ void rt_update_loop()
         rob_vel.fill(1.0);
         f_out.fill(0.0);
 
-        SAVE_TIME(start_loop_time);
-        while(!kill_loop) // RT Loop
-        {
-            SAVE_TIME(start_dt_time);
+        int n_points = 100;
+        Eigen::MatrixXd data(n_points,pos_dim);
 
-            START_REAL_TIME_CRITICAL_CODE();
-            mm.Update(rob_pos,rob_vel,dt,f_out);
-            END_REAL_TIME_CRITICAL_CODE();
+        std::vector<int> workers_configs;
+        workers_configs.push_back(1);
+        workers_configs.push_back(n_workers);
 
-            rt_task_wait_period(); // Wait until the end of the period.
-            SAVE_TIME(end_dt_time);
-            PRINT_TIME(start_dt_time,end_dt_time,tmp_dt_cnt,"dt");
+        std::vector<int> n_guides;
+        std::vector<int> n_guides_workers;
+        std::vector<double> mean_tick_cost;
+        std::vector<double> max_tick_cost;
+
+        long long start_tick_time, end_tick_time;
+
+        SAVE_TIME(start_loop_time);
+        for(unsigned int c = 0; c < workers_configs.size() && !kill_loop; c++)
+        {
+            rt_make_soft_real_time();
+            mm.SetNbWorkers(workers_configs[c]);
+            rt_make_hard_real_time();
+            for(int n = 1; n <= max_n_guides && !kill_loop; n *= 2)
+            {
+                // Grow the library up to n guides, the insertion is not real time
+                rt_make_soft_real_time();
+                while(mm.GetNbVms() < n)
+                {
+                    double offset = 0.01 * mm.GetNbVms();
+                    for (int i=0; i<data.cols(); i++)
+                        data.col(i) = Eigen::VectorXd::LinSpaced(n_points, 0.0, 1.0).array() + offset * (i+1);
+                    mm.InsertVm(data);
+                }
+                rt_make_hard_real_time();
+
+                double tick_cost = 0.0;
+                double sum_tick_cost = 0.0;
+                double max_cost = 0.0;
+                for(int tick = 0; tick < n_ticks_per_step && !kill_loop; tick++) // RT Loop
+                {
+                    SAVE_TIME(start_dt_time);
+
+                    getCpuCount(start_tick_time);
+                    START_REAL_TIME_CRITICAL_CODE();
+                    mm.Update(rob_pos,rob_vel,dt,f_out);
+                    END_REAL_TIME_CRITICAL_CODE();
+                    getCpuCount(end_tick_time);
+
+                    tick_cost = count2Sec(end_tick_time - start_tick_time);
+                    sum_tick_cost += tick_cost;
+                    if(tick_cost > max_cost)
+                        max_cost = tick_cost;
+
+                    rt_task_wait_period(); // Wait until the end of the period.
+                    SAVE_TIME(end_dt_time);
+                    PRINT_TIME(start_dt_time,end_dt_time,tmp_dt_cnt,"dt");
+                }
+
+                n_guides.push_back(mm.GetNbVms());
+                n_guides_workers.push_back(workers_configs[c]);
+                mean_tick_cost.push_back(sum_tick_cost/n_ticks_per_step);
+                max_tick_cost.push_back(max_cost);
+            }
         }
         SAVE_TIME(end_loop_time);
+
+        rt_make_soft_real_time();
         PRINT_TIME(start_loop_time,end_loop_time,tmp_loop_cnt,"elapsed time");
+
+        // Report the per tick cost of the update, the speedup is computed against the serial update
+        // with the same number of guides
+        for(unsigned int i = 0; i < n_guides.size(); i++)
+        {
+            double speedup = 1.0;
+            for(unsigned int j = 0; j < n_guides.size(); j++)
+                if(n_guides_workers[j] == 1 && n_guides[j] == n_guides[i])
+                    speedup = mean_tick_cost[j]/mean_tick_cost[i];
+            ROS_INFO("N guides: %d N workers: %d mean tick cost: %fus max tick cost: %fus speedup: %f",n_guides[i],n_guides_workers[i],mean_tick_cost[i]*1e6,max_tick_cost[i]*1e6,speedup);
+        }
+
         rt_task_delete(rt_task);
     }
 }
@@ -46,10 +46,36 @@ struct stringwrapper
    operator std::string() { return ss.str(); }
 };
 
+/// Real time checks:
+///  - RT_MALLOC_CHECKS: any malloc/free (or aligned allocation) made by a thread inside the critical code aborts
+///    (see mechanism_manager/src/malloc_checks.cpp). NOTE valloc/pvalloc and the mmap calls are not checked
+///  - EIGEN_MALLOC_CHECKS: Eigen asserts on its heap allocations inside the critical code.
+///    NOTE The Eigen flag is process wide: an allocation of any other thread asserts too, use it only
+///    with single threaded programs. RT_MALLOC_CHECKS is per thread and works with the threads of the manager.
 #ifdef EIGEN_MALLOC_CHECKS
-  #define EIGEN_RUNTIME_NO_MALLOC
-  #define START_REAL_TIME_CRITICAL_CODE() do { Eigen::internal::set_is_malloc_allowed(false); } while (0) 
-  #define END_REAL_TIME_CRITICAL_CODE() do { Eigen::internal::set_is_malloc_allowed(true); } while (0) 
+  #ifndef EIGEN_RUNTIME_NO_MALLOC
+    #define EIGEN_RUNTIME_NO_MALLOC // NOTE It works only if defined before including Eigen, the CMakeLists pass it as well
+  #endif
+  #include <eigen3/Eigen/Core>
+  #define EIGEN_MALLOC_ALLOWED(allowed) Eigen::internal::set_is_malloc_allowed(allowed)
+#else
+  #define EIGEN_MALLOC_ALLOWED(allowed) do {  } while (0)
+#endif
+
+#if defined(EIGEN_MALLOC_CHECKS) || defined(RT_MALLOC_CHECKS)
+  #define USE_REAL_TIME_CHECKS
+  namespace tool_box
+  {
+  /// True while the current thread runs the real time critical code
+  inline bool& RealTimeCriticalCode()
+  {
+      // NOTE initial-exec so that the access never allocates, it is used inside malloc
+      static __thread bool rt_critical_code __attribute__((tls_model("initial-exec"))) = false;
+      return rt_critical_code;
+  }
+  }
+  #define START_REAL_TIME_CRITICAL_CODE() do { EIGEN_MALLOC_ALLOWED(false); tool_box::RealTimeCriticalCode() = true; } while (0)
+  #define END_REAL_TIME_CRITICAL_CODE() do { tool_box::RealTimeCriticalCode() = false; EIGEN_MALLOC_ALLOWED(true); } while (0)
 #else
   #define START_REAL_TIME_CRITICAL_CODE() do {  } while (0) 
   #define END_REAL_TIME_CRITICAL_CODE() do {  } while (0) 
@@ -25,6 +25,13 @@
 #ifndef DTW_H_
 #define DTW_H_
 
+////////// STD
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+////////// Eigen
 #include <eigen3/Eigen/Core>
 
 namespace{
@@ -36,6 +43,7 @@ double dist(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, int i, int
     return (sig1.row(i) - sig2.row(j)).norm();
 }
 
+/// Full cost matrix version, D is (l1+1)x(l2+1). See Dtw for the version with O(window) memory.
 double dtw(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, Eigen::MatrixXd& D, int w = -1)
 {
     assert(sig1.cols() == sig2.cols());
@@ -87,26 +95,257 @@ double dtw(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, Eigen::Matr
     return d;
 }
 
+/// Dynamic time warping engine.
+/// The cost is computed only inside a window (for each row i of sig1 the columns [lo(i),hi(i)] of sig2),
+/// keeping two rows of costs and one direction per cell of the window, so that the warping path
+/// is backtracked with O(window) memory instead of the full (l1+1)x(l2+1) matrix.
+/// The buffers are kept between calls.
+class Dtw
+{
+    public:
+
+        Dtw():l1_(0),l2_(0) {}
+
+        /// Sakoe-Chiba band: |j - i*(l2-1)/(l1-1)| <= w, w = -1 for the full matrix
+        double Compute(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, int w = -1)
+        {
+            assert(sig1.cols() == sig2.cols());
+            assert(sig1.rows() > 0 && sig2.rows() > 0);
+            Resize(sig1.rows(),sig2.rows());
+
+            if(w < 0)
+                SetFullWindow();
+            else
+            {
+                // The band has to be at least as large as the slope of the diagonal to be connected
+                const double slope = l1_ > 1 ? static_cast<double>(l2_-1)/static_cast<double>(l1_-1) : 0.0;
+                w = std::max(w,static_cast<int>(std::ceil(slope)));
+                for(int i=0;i<l1_;i++)
+                {
+                    const int c = static_cast<int>(std::floor(i * slope + 0.5));
+                    lo_[i] = std::max(c - w,0);
+                    hi_[i] = std::min(c + w,l2_-1);
+                }
+                lo_[0] = 0;
+                hi_[l1_-1] = l2_-1;
+            }
+
+            return Run(sig1,sig2);
+        }
+
+        /// Multiresolution approximation (FastDTW, Salvador and Chan 2007): the path found on the signals
+        /// at half resolution is projected and enlarged by radius to define the window of the full resolution.
+        /// The memory and the time are O((l1+l2)*radius).
+        double ComputeFast(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, const int radius)
+        {
+            assert(sig1.cols() == sig2.cols());
+            assert(sig1.rows() > 0 && sig2.rows() > 0);
+            assert(radius >= 0);
+
+            const int min_size = radius + 2;
+            if(sig1.rows() <= min_size || sig2.rows() <= min_size)
+                return Compute(sig1,sig2);
+
+            // Coarse path
+            Eigen::MatrixXd sig1_coarse, sig2_coarse;
+            Reduce(sig1,sig1_coarse);
+            Reduce(sig2,sig2_coarse);
+            ComputeFast(sig1_coarse,sig2_coarse,radius);
+            const std::vector<int> path_i_coarse(path_i_);
+            const std::vector<int> path_j_coarse(path_j_);
+
+            // Project it
+            Resize(sig1.rows(),sig2.rows());
+            std::fill(lo_.begin(),lo_.end(),l2_);
+            std::fill(hi_.begin(),hi_.end(),-1);
+            for(size_t k=0;k<path_i_coarse.size();k++)
+            {
+                const int col_lo = std::max(2 * path_j_coarse[k] - radius,0);
+                const int col_hi = std::min(2 * path_j_coarse[k] + 1 + radius,l2_-1);
+                const int row_hi = std::min(2 * path_i_coarse[k] + 1 + radius,l1_-1);
+                for(int i=std::max(2 * path_i_coarse[k] - radius,0);i<=row_hi;i++)
+                {
+                    lo_[i] = std::min(lo_[i],col_lo);
+                    hi_[i] = std::max(hi_[i],col_hi);
+                }
+            }
+
+            return Run(sig1,sig2);
+        }
+
+        /// Warping path from (0,0) to (l1-1,l2-1), given by the last Compute
+        inline const std::vector<int>& GetPathI() const {return path_i_;}
+        inline const std::vector<int>& GetPathJ() const {return path_j_;}
+
+        /// For each row of sig1, the first row of sig2 matched by the warping path
+        void GetAlignIdx(Eigen::VectorXi& idx) const
+        {
+            idx.resize(l1_);
+            for(int k=path_i_.size()-1;k>=0;k--)
+                idx(path_i_[k]) = path_j_[k];
+        }
+
+    private:
+
+        enum {DIAG = 0, UP, LEFT};
+
+        void Resize(const int l1, const int l2)
+        {
+            l1_ = l1;
+            l2_ = l2;
+            lo_.resize(l1_);
+            hi_.resize(l1_);
+            offset_.resize(l1_+1);
+            prev_.resize(l2_);
+            curr_.resize(l2_);
+        }
+
+        void SetFullWindow()
+        {
+            std::fill(lo_.begin(),lo_.end(),0);
+            std::fill(hi_.begin(),hi_.end(),l2_-1);
+        }
+
+        /// Average of the consecutive pairs of rows
+        static void Reduce(const Eigen::MatrixXd& sig, Eigen::MatrixXd& sig_out)
+        {
+            const int n = sig.rows()/2;
+            sig_out.resize(n + sig.rows()%2,sig.cols());
+            for(int i=0;i<n;i++)
+                sig_out.row(i) = 0.5 * (sig.row(2*i) + sig.row(2*i+1));
+            if(sig.rows()%2)
+                sig_out.row(n) = sig.row(sig.rows()-1);
+        }
+
+        double Run(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2)
+        {
+            const double inf = std::numeric_limits<double>::infinity();
+
+            // Store the points as columns, so that the distances of a row of the window are
+            // computed with a single vectorized expression
+            sig1_t_ = sig1.transpose();
+            sig2_t_ = sig2.transpose();
+
+            offset_[0] = 0;
+            int max_width = 0;
+            for(int i=0;i<l1_;i++)
+            {
+                assert(lo_[i] <= hi_[i]);
+                offset_[i+1] = offset_[i] + hi_[i] - lo_[i] + 1;
+                max_width = std::max(max_width,hi_[i] - lo_[i] + 1);
+            }
+            dirs_.resize(offset_[l1_]);
+            // The distances of a row of the window, allocated once for the widest row
+            if(dist_.size() < max_width)
+                dist_.resize(max_width);
+
+            int prev_lo = 0;
+            int prev_hi = -1; // No previous row
+            for(int i=0;i<l1_;i++)
+            {
+                const int lo = lo_[i];
+                const int width = hi_[i] - lo + 1;
+                dist_.head(width).noalias() = (sig2_t_.middleCols(lo,width).colwise() - sig1_t_.col(i)).colwise().norm().transpose();
+
+                unsigned char* dirs = &dirs_[offset_[i]];
+                for(int k=0;k<width;k++)
+                {
+                    const int j = lo + k;
+                    // Predecessors, outside the window the cost is infinite
+                    const double diag = (i == 0 && j == 0) ? 0.0 : (j-1 >= prev_lo && j-1 <= prev_hi ? prev_[j-1] : inf);
+                    const double up = (j >= prev_lo && j <= prev_hi) ? prev_[j] : inf;
+                    const double left = k > 0 ? curr_[j-1] : inf;
+
+                    double best = diag;
+                    unsigned char dir = DIAG;
+                    if(up < best)
+                    {
+                        best = up;
+                        dir = UP;
+                    }
+                    if(left < best)
+                    {
+                        best = left;
+                        dir = LEFT;
+                    }
+                    curr_[j] = dist_(k) + best;
+                    dirs[k] = dir;
+                }
+                prev_.swap(curr_);
+                prev_lo = lo;
+                prev_hi = hi_[i];
+            }
+
+            const double d = prev_[l2_-1]; // The last row
+            assert(hi_[l1_-1] == l2_-1);
+            assert(d < inf); // The window has to connect the two ends
+
+            // Backtrack the path
+            path_i_.clear();
+            path_j_.clear();
+            int i = l1_-1;
+            int j = l2_-1;
+            path_i_.push_back(i);
+            path_j_.push_back(j);
+            while(i > 0 || j > 0)
+            {
+                switch(dirs_[offset_[i] + j - lo_[i]])
+                {
+                    case DIAG:
+                        i--;
+                        j--;
+                        break;
+                    case UP:
+                        i--;
+                        break;
+                    default:
+                        j--;
+                        break;
+                }
+                path_i_.push_back(i);
+                path_j_.push_back(j);
+            }
+            std::reverse(path_i_.begin(),path_i_.end());
+            std::reverse(path_j_.begin(),path_j_.end());
+
+            return d;
+        }
+
+        int l1_;
+        int l2_;
+        std::vector<int> lo_; // Window
+        std::vector<int> hi_;
+        std::vector<int> offset_; // Start of each row of the window in dirs_
+        std::vector<unsigned char> dirs_;
+        std::vector<double> prev_; // Costs of the previous and of the current row
+        std::vector<double> curr_;
+        Eigen::RowVectorXd dist_;
+        Eigen::MatrixXd sig1_t_;
+        Eigen::MatrixXd sig2_t_;
+        std::vector<int> path_i_;
+        std::vector<int> path_j_;
+};
+
 double dtw(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, int w = -1)
 {
-    Eigen::MatrixXd D;
-    return dtw(sig1,sig2,D,w);
+    Dtw engine;
+    return engine.Compute(sig1,sig2,w);
 }
 
+/// The index of sig2 matched by each row of sig1, given by the warping path
 void align_idx(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, Eigen::VectorXi& idx, int w = -1)
 {
-    Eigen::MatrixXd D_tmp;
-    Eigen::MatrixXd::Index first_min_idx;
-    dtw(sig1,sig2,D_tmp,w);
-
-    Eigen::MatrixXd D = D_tmp.block(1,1,D_tmp.rows()-1,D_tmp.cols()-1);
+    Dtw engine;
+    engine.Compute(sig1,sig2,w);
+    engine.GetAlignIdx(idx);
+}
 
-    idx.resize(D.rows());
-    for (int i_row = 0; i_row<D.rows(); i_row++)
-    {
-        D.row(i_row).minCoeff(&first_min_idx);
-        idx(i_row) = static_cast<int>(first_min_idx);
-    }
+/// Multiresolution version, see Dtw::ComputeFast
+void align_idx_fast(const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, Eigen::VectorXi& idx, const int radius)
+{
+    Dtw engine;
+    engine.ComputeFast(sig1,sig2,radius);
+    engine.GetAlignIdx(idx);
 }
 
 void align_phase(Eigen::VectorXd& phase1, const Eigen::VectorXd& phase2, const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, int w = -1)
@@ -135,6 +374,24 @@ void align_phase(Eigen::MatrixXd& phase1, const Eigen::MatrixXd& phase2, const E
         phase1(i,0) = phase2(idx(i),0);
 }
 
+/// Multiresolution version, radius < 0 for the exact alignment on the full matrix
+void align_phase_fast(Eigen::MatrixXd& phase1, const Eigen::MatrixXd& phase2, const Eigen::MatrixXd& sig1, const Eigen::MatrixXd& sig2, const int radius)
+{
+    assert(phase1.rows() == sig1.rows());
+    assert(phase2.rows() == sig2.rows());
+    assert(phase1.cols() == 1);
+    assert(phase2.cols() == 1);
+
+    Eigen::VectorXi idx;
+    if(radius < 0)
+        align_idx(sig1,sig2,idx);
+    else
+        align_idx_fast(sig1,sig2,idx,radius);
+
+    for (int i = 0; i<idx.size(); i++)
+        phase1(i,0) = phase2(idx(i),0);
+}
+
 } // dtw namespace
 
 } // anonym namespace
@@ -0,0 +1,191 @@
+/**
+ * @file   demo_reducer.h
+ * @brief  Streaming crop, filter and arc length decimation of the demonstrations.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEMO_REDUCER_H
+#define DEMO_REDUCER_H
+
+////////// Toolbox
+#include "toolbox/filters/filters.h"
+
+////////// STD
+#include <vector>
+
+namespace filters
+{
+
+/// Reduce a demonstration while its samples arrive, before a guide is built from it:
+/// 1) filter: each dimension goes through a second order low pass butterworth, stepped on every sample
+///    so that its cutoff holds with the fixed sample period,
+/// 2) crop: the filtered samples moving less than crop_dist from the previous one are dropped (robot still),
+/// 3) decimate: a filtered sample is kept every ds of arc length.
+/// The kept points are stored in chunks of chunk_size rows, allocated only when the previous one is full.
+/// The number of points depends on the length of the path, not on the duration of the recording.
+class DemoReducer
+{
+    public:
+
+        /// cutoff_freq 0 disables the filter, ds 0 keeps all the filtered samples
+        DemoReducer(const int dim, const double sample_period, const double crop_dist, const double cutoff_freq, const double ds, const int chunk_size = 256)
+            :dim_(dim),crop_dist_(crop_dist),use_filter_(cutoff_freq > 0.0),ds_(ds),chunk_size_(chunk_size)
+        {
+            assert(dim > 0);
+            assert(sample_period > 0.0);
+            assert(crop_dist >= 0.0);
+            assert(ds >= 0.0);
+            assert(chunk_size > 0);
+
+            if(use_filter_)
+            {
+                filters_.assign(dim_,Filter(1)); // Butterworth
+                for(int j=0;j<dim_;j++)
+                {
+                    filters_[j].SetSamplePeriod(sample_period);
+                    filters_[j].SetOrder(2);
+                    filters_[j].SetCutoff_freq(cutoff_freq);
+                }
+            }
+            prev_sample_.resize(dim_);
+            filtered_.resize(dim_);
+            last_filtered_.resize(dim_);
+            Clear();
+        }
+
+        void Clear()
+        {
+            chunks_.clear();
+            n_points_ = 0;
+            n_samples_ = 0;
+            arc_length_ = 0.0;
+            last_kept_ = true;
+        }
+
+        /// A sample of dim values
+        void Push(const double* const sample)
+        {
+            const Eigen::Map<const Eigen::VectorXd> x(sample,dim_);
+
+            if(n_samples_ == 0)
+            {
+                // The filters start at rest on the first sample, which is always kept
+                if(use_filter_)
+                    for(int j=0;j<dim_;j++)
+                        filters_[j].Reset(x(j));
+                prev_sample_ = x;
+                last_filtered_ = x;
+                n_samples_++;
+                Keep(x);
+                return;
+            }
+            n_samples_++;
+            prev_sample_ = x;
+
+            for(int j=0;j<dim_;j++)
+                filtered_(j) = use_filter_ ? filters_[j].Step(x(j)) : x(j);
+
+            if((filtered_ - last_filtered_).norm() <= crop_dist_)
+                return;
+
+            arc_length_ += (filtered_ - last_filtered_).norm();
+            last_filtered_ = filtered_;
+            last_kept_ = false;
+            if(arc_length_ >= ds_)
+            {
+                arc_length_ = 0.0;
+                Keep(filtered_);
+            }
+        }
+
+        /// Each row of samples is a sample
+        void Push(const Eigen::MatrixXd& samples)
+        {
+            assert(samples.cols() == dim_);
+            Eigen::VectorXd sample(dim_);
+            for(int i=0;i<samples.rows();i++)
+            {
+                sample = samples.row(i).transpose();
+                Push(sample.data());
+            }
+        }
+
+        /// Keep the last sample as the end of the path once the recording is over, the filters lag behind it
+        void Flush()
+        {
+            if(!last_kept_)
+            {
+                arc_length_ = 0.0;
+                last_filtered_ = prev_sample_;
+                Keep(prev_sample_);
+            }
+        }
+
+        inline int GetNbPoints() const {return n_points_;}
+        inline long GetNbSamples() const {return n_samples_;}
+        inline int GetDim() const {return dim_;}
+
+        /// The kept points in a single matrix, one per row
+        void GetData(Eigen::MatrixXd& data) const
+        {
+            data.resize(n_points_,dim_);
+            int row = 0;
+            for(size_t c=0;c<chunks_.size();c++)
+            {
+                const int n_rows = std::min(chunk_size_,n_points_ - row);
+                data.middleRows(row,n_rows) = chunks_[c].topRows(n_rows);
+                row += n_rows;
+            }
+        }
+
+    private:
+
+        template<typename Derived>
+        void Keep(const Eigen::MatrixBase<Derived>& point)
+        {
+            if(n_points_ == static_cast<int>(chunks_.size()) * chunk_size_)
+                chunks_.push_back(Eigen::MatrixXd(chunk_size_,dim_));
+            chunks_.back().row(n_points_ % chunk_size_) = point.transpose();
+            n_points_++;
+            last_kept_ = true;
+        }
+
+        int dim_;
+        double crop_dist_;
+        bool use_filter_;
+        double ds_;
+        int chunk_size_;
+        std::vector<Filter> filters_;
+
+        std::vector<Eigen::MatrixXd> chunks_;
+        int n_points_;
+        long n_samples_;
+        double arc_length_; // Since the last kept point
+        bool last_kept_; // The last filtered sample has been kept
+
+        /// For computations
+        Eigen::VectorXd prev_sample_; // Last sample, the end of the path
+        Eigen::VectorXd filtered_;
+        Eigen::VectorXd last_filtered_; // Last filtered sample not cropped
+};
+
+} // namespace
+
+#endif
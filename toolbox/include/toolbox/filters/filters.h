@@ -98,6 +98,13 @@ namespace filters
                     _b[cnt]=0.0;
                     }
                 }
+            inline void Reset(const double x0){ //Start from the steady state with the input x0 (unity gain for the low pass filters)
+                const double y0 = (type == DIFF_BUTTERWORTH) ? 0.0 : x0;
+                for ( int cnt = 0; cnt < MAXFILTERTERMS; cnt++ ) {
+                    _x[cnt]=x0;
+                    _y[cnt]=y0;
+                    }
+                }
             /*inline int Coefficients(int N,std::vector<double> A,std::vector<double> B){ //Set the coefficients of the filter.
                     if (N > MAXFILTERTERMS)
                         return -1; //Filter is too small to take this many coefficients
@@ -185,6 +192,7 @@ namespace filters
 			  UpdateFilter();}
 			void SetCutoff_freq(double cutoff_freq){this->cutoff_freq = cutoff_freq;UpdateFilter();} 
 			void SetOrder(int order){this->order = order;UpdateFilter();}
+			void SetSamplePeriod(double T){this->T = T;UpdateFilter();}
             //void SetType(string t);
             //const char * GetType();
 			
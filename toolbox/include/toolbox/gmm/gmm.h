@@ -0,0 +1,582 @@
+/**
+ * @file   gmm.h
+ * @brief  Gaussian mixture model trained with EM on sufficient statistics.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GMM_H
+#define GMM_H
+
+////////// STD
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <random>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Cholesky>
+
+////////// BOOST
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace gmm
+{
+
+/// Threads kept alive between the parallel steps of the EM: Run calls f(first,last) on n_parts contiguous
+/// ranges of [0,n), the calling thread takes the first one and the other threads the next ones
+class ParallelPool
+{
+    public:
+        ParallelPool(const int n_threads):n_threads_(n_threads),stop_(false),generation_(0),n_(0),n_parts_(0),n_pending_(0)
+        {
+            assert(n_threads > 0);
+            for(int p=1;p<n_threads_;p++)
+                threads_.create_thread(boost::bind(&ParallelPool::Loop,this,p));
+        }
+
+        ~ParallelPool()
+        {
+            {
+                boost::mutex::scoped_lock guard(mtx_);
+                stop_ = true;
+            }
+            start_cond_.notify_all();
+            threads_.join_all();
+        }
+
+        inline int GetNbThreads() const {return n_threads_;}
+
+        template<typename F>
+        void Run(const int n, const int n_parts, F f)
+        {
+            assert(n_parts <= n_threads_);
+            if(n_parts <= 1)
+            {
+                f(0,n);
+                return;
+            }
+            {
+                boost::mutex::scoped_lock guard(mtx_);
+                job_ = f;
+                n_ = n;
+                n_parts_ = n_parts;
+                n_pending_ = n_parts - 1;
+                generation_++;
+            }
+            start_cond_.notify_all();
+            f(0,n / n_parts);
+            boost::mutex::scoped_lock guard(mtx_);
+            while(n_pending_ > 0)
+                done_cond_.wait(guard);
+            job_.clear();
+        }
+
+    private:
+        ParallelPool(const ParallelPool&);
+        ParallelPool& operator=(const ParallelPool&);
+
+        void Loop(const int p)
+        {
+            unsigned long generation = 0;
+            while(true)
+            {
+                long first, last;
+                {
+                    boost::mutex::scoped_lock guard(mtx_);
+                    while(!stop_ && generation == generation_)
+                        start_cond_.wait(guard);
+                    if(stop_)
+                        return;
+                    generation = generation_;
+                    if(p >= n_parts_) // Not needed by this step
+                        continue;
+                    first = static_cast<long>(p) * n_ / n_parts_;
+                    last = static_cast<long>(p + 1) * n_ / n_parts_;
+                }
+                job_(first,last); // Run waits for this thread before changing the job
+                boost::mutex::scoped_lock guard(mtx_);
+                if(--n_pending_ == 0)
+                    done_cond_.notify_one();
+            }
+        }
+
+        const int n_threads_;
+        boost::thread_group threads_;
+        boost::mutex mtx_;
+        boost::condition_variable start_cond_;
+        boost::condition_variable done_cond_;
+        bool stop_;
+        unsigned long generation_;
+        boost::function<void(int,int)> job_;
+        int n_;
+        int n_parts_;
+        int n_pending_;
+};
+
+/// Gaussian mixture model with full covariances, each row of the data is a sample.
+/// The EM works on the sufficient statistics of the responsibilities (sum, first and second moments),
+/// the statistics of the samples already learned are kept so that new samples are folded into
+/// the model in a time proportional to the new samples only (incremental EM, Neal and Hinton 1998).
+class Gmm
+{
+    public:
+
+        Gmm(const double reg = 1e-6):dim_(0),n_hist_(0.0),reg_(reg),n_threads_(1),history_weight_(1.0),n_iter_(0),log_lik_(0.0) {}
+
+        /// Threads of the E step, the samples are split among them only if there are enough
+        inline void SetNbThreads(const int n_threads) {assert(n_threads > 0); n_threads_ = n_threads;}
+        /// The statistics of the samples already learned are multiplied by it before each Update:
+        /// 1 warm starts from the whole history, lower values let the new samples move the components more.
+        inline void SetHistoryWeight(const double weight) {assert(weight > 0.0 && weight <= 1.0); history_weight_ = weight;}
+
+        /// Initialize n_components by slicing the data in equal parts along its first column
+        /// (the phase for the GMR), the statistics of the previous samples are cleared.
+        void InitSlicing(const Eigen::MatrixXd& data, const int n_components)
+        {
+            assert(n_components > 0);
+            assert(data.rows() >= n_components);
+            Resize(n_components,data.cols());
+
+            const double x_min = data.col(0).minCoeff();
+            const double x_max = data.col(0).maxCoeff();
+            const double width = (x_max - x_min)/n_components;
+            Eigen::VectorXd n(n_components);
+            n.fill(0.0);
+            for(int k=0;k<n_components;k++)
+            {
+                s1_new_[k].fill(0.0);
+                s2_new_[k].fill(0.0);
+            }
+            for(int i=0;i<data.rows();i++)
+            {
+                int k = width > 0.0 ? static_cast<int>((data(i,0) - x_min)/width) : 0;
+                k = std::min(std::max(k,0),n_components-1);
+                n(k) += 1.0;
+                s1_new_[k] += data.row(i).transpose();
+                s2_new_[k].noalias() += data.row(i).transpose() * data.row(i);
+            }
+            for(int k=0;k<n_components;k++)
+            {
+                // An empty slice takes the first sample of the data
+                if(n(k) == 0.0)
+                {
+                    n(k) = 1.0;
+                    s1_new_[k] = data.row(0).transpose();
+                    s2_new_[k] = data.row(0).transpose() * data.row(0);
+                }
+            }
+            n_new_ = n;
+            Maximize(data.rows());
+        }
+
+        /// Initialize n_components with the k-means++ seeding followed by few Lloyd iterations
+        /// (Arthur and Vassilvitskii 2007), the statistics of the previous samples are cleared.
+        void InitKMeansPlusPlus(const Eigen::MatrixXd& data, const int n_components, const unsigned int seed = 0, const int n_lloyd = 10)
+        {
+            assert(n_components > 0);
+            assert(data.rows() >= n_components);
+            Resize(n_components,data.cols());
+            const int n_samples = data.rows();
+            std::mt19937 gen(seed);
+
+            // Each new center is a sample drawn with a probability proportional to its squared
+            // distance from the closest center already chosen
+            Eigen::MatrixXd centers(n_components,dim_);
+            centers.row(0) = data.row(std::uniform_int_distribution<int>(0,n_samples-1)(gen));
+            Eigen::VectorXd dist2 = (data.rowwise() - centers.row(0)).rowwise().squaredNorm();
+            for(int k=1;k<n_components;k++)
+            {
+                const double sum = dist2.sum();
+                int idx = std::uniform_int_distribution<int>(0,n_samples-1)(gen); // All the samples are on the centers
+                if(sum > 0.0)
+                {
+                    double target = std::uniform_real_distribution<double>(0.0,sum)(gen);
+                    for(idx=0;idx<n_samples-1 && target >= dist2(idx);idx++)
+                        target -= dist2(idx);
+                }
+                centers.row(k) = data.row(idx);
+                dist2 = dist2.cwiseMin((data.rowwise() - centers.row(k)).rowwise().squaredNorm());
+            }
+
+            std::vector<int> labels(n_samples,-1);
+            Eigen::VectorXd n(n_components);
+            for(int iter=0;iter<=n_lloyd;iter++)
+            {
+                bool changed = false;
+                for(int i=0;i<n_samples;i++)
+                {
+                    int label;
+                    (centers.rowwise() - data.row(i)).rowwise().squaredNorm().minCoeff(&label);
+                    changed = changed || label != labels[i];
+                    labels[i] = label;
+                }
+                if(!changed && iter > 0)
+                    break;
+                n.fill(0.0);
+                centers.setZero();
+                for(int i=0;i<n_samples;i++)
+                {
+                    n(labels[i]) += 1.0;
+                    centers.row(labels[i]) += data.row(i);
+                }
+                for(int k=0;k<n_components;k++)
+                    if(n(k) > 0.0)
+                        centers.row(k) /= n(k);
+                    else
+                        centers.row(k) = data.row(std::uniform_int_distribution<int>(0,n_samples-1)(gen)); // Reseed the empty cluster
+            }
+
+            n.fill(0.0);
+            for(int k=0;k<n_components;k++)
+            {
+                s1_new_[k].fill(0.0);
+                s2_new_[k].fill(0.0);
+            }
+            for(int i=0;i<n_samples;i++)
+            {
+                const int k = labels[i];
+                n(k) += 1.0;
+                s1_new_[k] += data.row(i).transpose();
+                s2_new_[k].noalias() += data.row(i).transpose() * data.row(i);
+            }
+            for(int k=0;k<n_components;k++)
+            {
+                // An empty cluster takes its center as a single sample
+                if(n(k) == 0.0)
+                {
+                    n(k) = 1.0;
+                    s1_new_[k] = centers.row(k).transpose();
+                    s2_new_[k] = centers.row(k).transpose() * centers.row(k);
+                }
+            }
+            n_new_ = n;
+            Maximize(n_samples);
+        }
+
+        /// Batch EM from the current components, then n_restarts-1 more from k-means++ seeds (seed + 1, ...),
+        /// all in parallel. The model with the highest log likelihood is kept. Return the number of iterations of it.
+        int TrainRestarts(const Eigen::MatrixXd& data, const int n_restarts, const unsigned int seed = 0, const int max_iter = 100, const double tol = 1e-6)
+        {
+            assert(n_restarts > 0);
+            if(n_restarts == 1)
+                return Train(data,max_iter,tol);
+
+            std::vector<Gmm> candidates(n_restarts,*this);
+            const int n_threads = n_threads_;
+            auto train = [&](const int first, const int last)
+            {
+                for(int r=first;r<last;r++)
+                {
+                    candidates[r].SetNbThreads(std::max(n_threads/n_restarts,1));
+                    if(r > 0)
+                        candidates[r].InitKMeansPlusPlus(data,GetNbComponents(),seed + r);
+                    candidates[r].Train(data,max_iter,tol);
+                }
+            };
+            ParallelFor(n_restarts,std::min(n_threads,n_restarts),train);
+
+            int best = 0;
+            for(int r=1;r<n_restarts;r++)
+                if(candidates[r].log_lik_ > candidates[best].log_lik_)
+                    best = r;
+            *this = candidates[best];
+            n_threads_ = n_threads;
+            return n_iter_;
+        }
+
+        /// Batch EM from the current components, the statistics then contain only data.
+        /// Return the number of iterations.
+        int Train(const Eigen::MatrixXd& data, const int max_iter = 100, const double tol = 1e-6)
+        {
+            ClearHistory();
+            return Update(data,max_iter,tol);
+        }
+
+        /// Incremental EM: the statistics of data are estimated with the free components while
+        /// the ones of the previous samples are kept, then they are added to the history.
+        /// Stop when the average log likelihood of data improves less than tol.
+        /// Return the number of iterations.
+        int Update(const Eigen::MatrixXd& data, const int max_iter = 100, const double tol = 1e-6)
+        {
+            assert(GetNbComponents() > 0);
+            assert(data.cols() == dim_);
+            assert(max_iter > 0);
+
+            if(history_weight_ < 1.0 && IsTrained())
+            {
+                n_hist_ *= history_weight_;
+                n_hist_k_ *= history_weight_;
+                for(int k=0;k<GetNbComponents();k++)
+                {
+                    s1_hist_[k] *= history_weight_;
+                    s2_hist_[k] *= history_weight_;
+                }
+            }
+
+            double log_lik = -std::numeric_limits<double>::infinity();
+            double log_lik_prev;
+            int iter = 0;
+            while(iter < max_iter)
+            {
+                log_lik_prev = log_lik;
+                log_lik = ComputeStatistics(data);
+                Maximize(n_hist_ + data.rows());
+                iter++;
+                if(log_lik - log_lik_prev < tol)
+                    break;
+            }
+
+            // Fold the statistics of the new samples into the history
+            ComputeStatistics(data);
+            n_hist_k_ += n_new_;
+            for(int k=0;k<GetNbComponents();k++)
+            {
+                s1_hist_[k] += s1_new_[k];
+                s2_hist_[k] += s2_new_[k];
+            }
+            n_hist_ += data.rows();
+
+            n_iter_ = iter;
+            log_lik_ = log_lik;
+            return iter;
+        }
+
+        /// Average log likelihood of the samples
+        double LogLikelihood(const Eigen::MatrixXd& data)
+        {
+            assert(data.cols() == dim_);
+            ComputeLogResp(data);
+            double log_lik = 0.0;
+            for(int i=0;i<data.rows();i++)
+                log_lik += LogSumExp(i);
+            return log_lik/data.rows();
+        }
+
+        inline bool IsTrained() const {return n_hist_ > 0.0;}
+        inline int GetNbComponents() const {return priors_.size();}
+        inline int GetDim() const {return dim_;}
+        inline double GetNbSamples() const {return n_hist_;}
+        inline const std::vector<double>& GetPriors() const {return priors_;}
+        inline const std::vector<Eigen::VectorXd>& GetMeans() const {return means_;}
+        inline const std::vector<Eigen::MatrixXd>& GetCovars() const {return covars_;}
+        /// Of the last Train or Update
+        inline int GetNbIterations() const {return n_iter_;}
+        inline double GetLastLogLikelihood() const {return log_lik_;}
+
+    private:
+
+        void Resize(const int n_components, const int dim)
+        {
+            dim_ = dim;
+            priors_.assign(n_components,1.0/n_components);
+            means_.assign(n_components,Eigen::VectorXd::Zero(dim_));
+            covars_.assign(n_components,Eigen::MatrixXd::Identity(dim_,dim_));
+            chols_.assign(n_components,Eigen::MatrixXd::Identity(dim_,dim_));
+            log_norms_.assign(n_components,0.0);
+            n_new_.resize(n_components);
+            s1_new_.assign(n_components,Eigen::VectorXd::Zero(dim_));
+            s2_new_.assign(n_components,Eigen::MatrixXd::Zero(dim_,dim_));
+            n_hist_k_.resize(n_components);
+            s1_hist_.assign(n_components,Eigen::VectorXd::Zero(dim_));
+            s2_hist_.assign(n_components,Eigen::MatrixXd::Zero(dim_,dim_));
+            ClearHistory();
+        }
+
+        void ClearHistory()
+        {
+            n_hist_ = 0.0;
+            n_hist_k_.fill(0.0);
+            for(int k=0;k<GetNbComponents();k++)
+            {
+                s1_hist_[k].fill(0.0);
+                s2_hist_[k].fill(0.0);
+            }
+        }
+
+        template<typename F>
+        inline void ParallelFor(const int n, const int n_parts, F f)
+        {
+            if(n_parts <= 1)
+                f(0,n);
+            else
+                pool_.Get(n_threads_).Run(n,n_parts,f);
+        }
+
+        /// Parts in which the samples are split for the E step
+        inline int GetNbParts(const int n_samples) const
+        {
+            static const int min_samples_per_part = 512;
+            return std::max(std::min(n_threads_,n_samples/min_samples_per_part),1);
+        }
+
+        /// Log of prior * density of each sample (row) for each component (column)
+        void ComputeLogResp(const Eigen::MatrixXd& data)
+        {
+            log_resp_.resize(data.rows(),GetNbComponents());
+            ParallelFor(data.rows(),GetNbParts(data.rows()),[&](const int first, const int last)
+            {
+                ComputeLogResp(data,first,last);
+            });
+        }
+
+        /// Rows [first,last) of log_resp_
+        void ComputeLogResp(const Eigen::MatrixXd& data, const int first, const int last)
+        {
+            Eigen::MatrixXd diff;
+            for(int k=0;k<GetNbComponents();k++)
+            {
+                diff = (data.middleRows(first,last-first).rowwise() - means_[k].transpose()).transpose();
+                chols_[k].triangularView<Eigen::Lower>().solveInPlace(diff);
+                log_resp_.block(first,k,last-first,1) = (-0.5 * diff.colwise().squaredNorm().transpose()).array() + log_norms_[k];
+            }
+        }
+
+        inline double LogSumExp(const int i) const
+        {
+            const double max_log = log_resp_.row(i).maxCoeff();
+            if(max_log == -std::numeric_limits<double>::infinity())
+                return max_log;
+            return max_log + std::log((log_resp_.row(i).array() - max_log).exp().sum());
+        }
+
+        /// E step, return the average log likelihood. The responsibilities are computed in parallel
+        /// over the samples, then the statistics in parallel over the components: the threads never
+        /// write the same memory and the result does not depend on the number of threads.
+        double ComputeStatistics(const Eigen::MatrixXd& data)
+        {
+            const int n_samples = data.rows();
+            const int n_parts = GetNbParts(n_samples);
+            log_resp_.resize(n_samples,GetNbComponents());
+            log_sums_.resize(n_samples);
+            ParallelFor(n_samples,n_parts,[&](const int first, const int last)
+            {
+                ComputeLogResp(data,first,last);
+                for(int i=first;i<last;i++)
+                {
+                    log_sums_(i) = LogSumExp(i);
+                    log_resp_.row(i) = (log_resp_.row(i).array() - log_sums_(i)).exp(); // Normalized responsibilities
+                }
+            });
+            n_new_ = log_resp_.colwise().sum().transpose();
+            ParallelFor(GetNbComponents(),std::min(n_parts,GetNbComponents()),[&](const int first, const int last)
+            {
+                for(int k=first;k<last;k++)
+                {
+                    s1_new_[k].noalias() = data.transpose() * log_resp_.col(k);
+                    s2_new_[k].noalias() = data.transpose() * log_resp_.col(k).asDiagonal() * data;
+                }
+            });
+            return log_sums_.sum()/n_samples;
+        }
+
+        /// M step on the history and the new statistics
+        void Maximize(const double n_samples)
+        {
+            const double log_2pi = std::log(2.0 * M_PI);
+            for(int k=0;k<GetNbComponents();k++)
+            {
+                const double n = n_hist_k_(k) + n_new_(k);
+                if(n > 1e-10) // Otherwise keep the component as it is
+                {
+                    priors_[k] = n/n_samples;
+                    means_[k] = (s1_hist_[k] + s1_new_[k])/n;
+                    covars_[k] = (s2_hist_[k] + s2_new_[k])/n - means_[k] * means_[k].transpose();
+                    covars_[k].diagonal().array() += reg_;
+                }
+                else
+                    priors_[k] = 0.0;
+
+                // A degenerate component (e.g. its samples lie on a line) is regularised until its covariance
+                // is positive definite. If it is not even then (i.e. not finite), the component is rejected
+                Eigen::LLT<Eigen::MatrixXd> llt(covars_[k]);
+                double jitter = std::max(reg_,1e-12) * std::max(covars_[k].diagonal().cwiseAbs().maxCoeff(),1.0);
+                for(int i=0; llt.info() != Eigen::Success && i<max_reg_steps_; i++, jitter *= 10.0)
+                {
+                    covars_[k].diagonal().array() += jitter;
+                    llt.compute(covars_[k]);
+                }
+                if(llt.info() == Eigen::Success)
+                {
+                    chols_[k] = llt.matrixL();
+                    log_norms_[k] = std::log(priors_[k]) - 0.5 * dim_ * log_2pi - chols_[k].diagonal().array().log().sum();
+                }
+                else
+                {
+                    priors_[k] = 0.0;
+                    covars_[k].setIdentity();
+                    chols_[k].setIdentity();
+                    log_norms_[k] = -std::numeric_limits<double>::infinity();
+                }
+            }
+        }
+
+        int dim_;
+        std::vector<double> priors_;
+        std::vector<Eigen::VectorXd> means_;
+        std::vector<Eigen::MatrixXd> covars_;
+        std::vector<Eigen::MatrixXd> chols_; // Cholesky factors of the covariances
+        std::vector<double> log_norms_; // log(prior) - log((2pi)^(D/2) * |covar|^(1/2))
+
+        /// Sufficient statistics of the new samples and of the previous ones
+        Eigen::VectorXd n_new_;
+        std::vector<Eigen::VectorXd> s1_new_;
+        std::vector<Eigen::MatrixXd> s2_new_;
+        Eigen::VectorXd n_hist_k_;
+        std::vector<Eigen::VectorXd> s1_hist_;
+        std::vector<Eigen::MatrixXd> s2_hist_;
+        double n_hist_;
+
+        double reg_; // Added to the diagonal of the covariances
+        static const int max_reg_steps_ = 8; // Regularisations of a degenerate covariance, each 10 times the previous one
+        int n_threads_;
+        double history_weight_;
+        int n_iter_;
+        double log_lik_; // Average of the samples of the last Train or Update
+
+        /// For computations
+        Eigen::MatrixXd log_resp_;
+        Eigen::VectorXd log_sums_;
+
+        /// The copies of a model do not share its pool, each one starts its own at its first parallel step
+        class PoolHolder
+        {
+            public:
+                PoolHolder() {}
+                PoolHolder(const PoolHolder&) {}
+                PoolHolder& operator=(const PoolHolder&) {return *this;}
+                ParallelPool& Get(const int n_threads)
+                {
+                    if(!pool_ || pool_->GetNbThreads() != n_threads)
+                        pool_.reset(new ParallelPool(n_threads));
+                    return *pool_;
+                }
+            private:
+                boost::scoped_ptr<ParallelPool> pool_;
+        };
+        PoolHolder pool_;
+};
+
+} // namespace
+
+#endif
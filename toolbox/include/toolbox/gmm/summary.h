@@ -0,0 +1,170 @@
+/**
+ * @file   summary.h
+ * @brief  Cached gaussian mixture and coreset of the samples for cheap likelihood comparisons.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GMM_SUMMARY_H
+#define GMM_SUMMARY_H
+
+////////// STD
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cassert>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Cholesky>
+
+namespace gmm
+{
+
+/// Weighted representative samples of a larger set, the weights sum to one
+struct Coreset
+{
+    Eigen::MatrixXd points;
+    Eigen::VectorXd weights;
+};
+
+/// Split the rows of data in max_points contiguous chunks of (almost) the same size, each one is
+/// represented by its middle sample weighted by its size. For a demonstration the consecutive samples
+/// are close to each other, so few hundreds of points are enough to approximate its likelihood.
+inline void BuildCoreset(const Eigen::MatrixXd& data, const int max_points, Coreset& coreset)
+{
+    assert(max_points > 0);
+    const int n_samples = data.rows();
+    const int n_points = std::min(n_samples,max_points);
+    coreset.points.resize(n_points,data.cols());
+    coreset.weights.resize(n_points);
+    for(int i=0;i<n_points;i++)
+    {
+        const int first = static_cast<long>(i) * n_samples / n_points;
+        const int last = static_cast<long>(i + 1) * n_samples / n_points; // Excluded
+        coreset.points.row(i) = data.row((first + last - 1)/2);
+        coreset.weights(i) = static_cast<double>(last - first) / n_samples;
+    }
+}
+
+/// Gaussian mixture with the inverse of the Cholesky factors and the log normalizations of its
+/// components precomputed, built once when the model changes. The likelihood of many samples is
+/// then a product by a triangular matrix and a log-sum-exp per component, without factorizations.
+class Summary
+{
+    public:
+
+        Summary():dim_(0) {}
+
+        /// Components with a null prior are discarded
+        void Init(const std::vector<double>& priors, const std::vector<Eigen::VectorXd>& means, const std::vector<Eigen::MatrixXd>& covars)
+        {
+            assert(priors.size() == means.size() && priors.size() == covars.size());
+            Clear();
+            for(size_t k=0;k<priors.size();k++)
+                if(priors[k] > 0.0)
+                    AddComponent(priors[k],means[k],covars[k]);
+        }
+
+        /// Components with equal priors and diagonal covariances, one for each row of means and variances
+        void InitDiagonal(const Eigen::MatrixXd& means, const Eigen::MatrixXd& variances)
+        {
+            assert(means.rows() == variances.rows() && means.cols() == variances.cols());
+            Clear();
+            const double prior = 1.0/means.rows();
+            for(int k=0;k<means.rows();k++)
+                AddComponent(prior,means.row(k).transpose(),variances.row(k).asDiagonal());
+        }
+
+        void Clear()
+        {
+            dim_ = 0;
+            means_.clear();
+            inv_chols_.clear();
+            log_norms_.clear();
+        }
+
+        inline bool IsEmpty() const {return means_.empty();}
+        inline int GetNbComponents() const {return means_.size();}
+        inline int GetDim() const {return dim_;}
+
+        /// Log likelihood of each sample (row)
+        void LogLikelihoods(const Eigen::MatrixXd& data, Eigen::VectorXd& log_liks) const
+        {
+            assert(!IsEmpty());
+            assert(data.cols() == dim_);
+            const int n_samples = data.rows();
+            Eigen::MatrixXd log_resp(n_samples,GetNbComponents());
+            Eigen::MatrixXd diff(dim_,n_samples);
+            for(int k=0;k<GetNbComponents();k++)
+            {
+                diff = (data.rowwise() - means_[k].transpose()).transpose();
+                diff = inv_chols_[k].triangularView<Eigen::Lower>() * diff;
+                log_resp.col(k) = (-0.5 * diff.colwise().squaredNorm().transpose()).array() + log_norms_[k];
+            }
+            const Eigen::VectorXd max_log = log_resp.rowwise().maxCoeff();
+            log_liks = max_log.array() + (log_resp.colwise() - max_log).array().exp().rowwise().sum().log();
+        }
+
+        /// Weighted average log likelihood of the samples
+        double LogLikelihood(const Eigen::MatrixXd& data, const Eigen::VectorXd& weights) const
+        {
+            assert(weights.size() == data.rows());
+            Eigen::VectorXd log_liks;
+            LogLikelihoods(data,log_liks);
+            return log_liks.dot(weights)/weights.sum();
+        }
+
+        inline double LogLikelihood(const Coreset& coreset) const
+        {
+            return LogLikelihood(coreset.points,coreset.weights);
+        }
+
+        /// Average log likelihood of all the samples, the exact value approximated by the coreset
+        double LogLikelihood(const Eigen::MatrixXd& data) const
+        {
+            Eigen::VectorXd log_liks;
+            LogLikelihoods(data,log_liks);
+            return log_liks.mean();
+        }
+
+    private:
+
+        void AddComponent(const double prior, const Eigen::VectorXd& mean, const Eigen::MatrixXd& covar)
+        {
+            assert(IsEmpty() || mean.size() == dim_);
+            dim_ = mean.size();
+            Eigen::LLT<Eigen::MatrixXd> llt(covar);
+            const Eigen::MatrixXd chol = llt.matrixL();
+            means_.push_back(mean);
+            inv_chols_.push_back(chol.triangularView<Eigen::Lower>().solve(Eigen::MatrixXd::Identity(dim_,dim_)));
+            // log(prior) - log((2pi)^(D/2) * |covar|^(1/2))
+            log_norms_.push_back(std::log(prior) - 0.5 * dim_ * std::log(2.0 * M_PI) - chol.diagonal().array().log().sum());
+        }
+
+        int dim_;
+        std::vector<Eigen::VectorXd> means_;
+        std::vector<Eigen::MatrixXd> inv_chols_; // Inverses of the Cholesky factors of the covariances
+        std::vector<double> log_norms_;
+};
+
+} // namespace
+
+#endif
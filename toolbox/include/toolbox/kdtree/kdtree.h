@@ -0,0 +1,153 @@
+/**
+ * @file   kdtree.h
+ * @brief  Static kd-tree for nearest point queries.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KDTREE_H
+#define KDTREE_H
+
+////////// STD
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+
+namespace kdtree
+{
+
+/// The tree is implicit: the node of the range [lo,hi) is the point in mid = (lo+hi)/2,
+/// the ranges [lo,mid) and [mid+1,hi) are its children.
+/// It is built once (not rt), the queries do not allocate memory.
+class KdTree
+{
+    public:
+
+        KdTree():n_points_(0),dim_(0) {}
+
+        /// Each row of points is a point
+        void Build(const Eigen::MatrixXd& points)
+        {
+            n_points_ = points.rows();
+            dim_ = points.cols();
+            indices_.resize(n_points_);
+            for(int i=0;i<n_points_;i++)
+                indices_[i] = i;
+            split_dims_.assign(n_points_,0);
+
+            BuildRange(points,0,n_points_);
+
+            // Store the points in the tree order
+            points_.resize(n_points_,dim_);
+            for(int i=0;i<n_points_;i++)
+                points_.row(i) = points.row(indices_[i]);
+        }
+
+        inline int GetNbPoints() const {return n_points_;}
+
+        /// Return the row index of the nearest point to query.
+        /// best_idx and best_sq_dist can be used to start from a known candidate (warm start),
+        /// by default no candidate is given.
+        template <typename Derived>
+        inline int FindNearest(const Eigen::MatrixBase<Derived>& query, int best_idx = 0,
+                               double best_sq_dist = std::numeric_limits<double>::infinity()) const
+        {
+            assert(n_points_ > 0);
+            assert(query.size() == dim_);
+            Search(query,0,n_points_,best_idx,best_sq_dist);
+            return best_idx;
+        }
+
+    private:
+
+        void BuildRange(const Eigen::MatrixXd& points, const int lo, const int hi)
+        {
+            if(hi - lo < 2)
+                return;
+
+            // Split along the dimension with the largest spread
+            int split_dim = 0;
+            double max_spread = -1.0;
+            for(int d=0;d<dim_;d++)
+            {
+                double min_val = std::numeric_limits<double>::infinity();
+                double max_val = -std::numeric_limits<double>::infinity();
+                for(int i=lo;i<hi;i++)
+                {
+                    min_val = std::min(min_val,points(indices_[i],d));
+                    max_val = std::max(max_val,points(indices_[i],d));
+                }
+                if(max_val - min_val > max_spread)
+                {
+                    max_spread = max_val - min_val;
+                    split_dim = d;
+                }
+            }
+
+            const int mid = (lo + hi)/2;
+            std::nth_element(indices_.begin()+lo,indices_.begin()+mid,indices_.begin()+hi,
+                             [&points,split_dim](int a, int b){return points(a,split_dim) < points(b,split_dim);});
+            split_dims_[mid] = split_dim;
+
+            BuildRange(points,lo,mid);
+            BuildRange(points,mid+1,hi);
+        }
+
+        template <typename Derived>
+        void Search(const Eigen::MatrixBase<Derived>& query, const int lo, const int hi, int& best_idx, double& best_sq_dist) const
+        {
+            if(lo >= hi)
+                return;
+
+            const int mid = (lo + hi)/2;
+            const double sq_dist = (points_.row(mid).transpose() - query).squaredNorm();
+            if(sq_dist < best_sq_dist)
+            {
+                best_sq_dist = sq_dist;
+                best_idx = indices_[mid];
+            }
+
+            const double diff = query(split_dims_[mid]) - points_(mid,split_dims_[mid]);
+            if(diff < 0.0)
+            {
+                Search(query,lo,mid,best_idx,best_sq_dist);
+                if(diff * diff < best_sq_dist) // The other side can still contain a closer point
+                    Search(query,mid+1,hi,best_idx,best_sq_dist);
+            }
+            else
+            {
+                Search(query,mid+1,hi,best_idx,best_sq_dist);
+                if(diff * diff < best_sq_dist)
+                    Search(query,lo,mid,best_idx,best_sq_dist);
+            }
+        }
+
+        int n_points_;
+        int dim_;
+        std::vector<int> indices_;
+        std::vector<int> split_dims_;
+        Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> points_;
+};
+
+} // namespace
+
+#endif
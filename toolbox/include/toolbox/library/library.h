@@ -0,0 +1,316 @@
+/**
+ * @file   library.h
+ * @brief  Binary library of records made of named matrices, loaded with mmap.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+////////// STD
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <cassert>
+
+////////// POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+////////// Eigen
+#include <eigen3/Eigen/Core>
+
+namespace library
+{
+
+/// File layout, in the host byte order and with all the fields 8 bytes aligned:
+/// FileHeader, RecordHeader[n_records], then for each record MatrixHeader[n_matrices], then the
+/// data of the matrices (column major doubles). The offsets are from the beginning of the file,
+/// so a mapped file is used as it is, without parsing.
+static const char file_magic[8] = {'V','F','G','L','I','B','\0','\0'};
+static const uint32_t file_version = 1;
+static const size_t name_size = 64;
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_records;
+    uint64_t file_size;
+};
+
+struct RecordHeader
+{
+    char name[name_size];
+    uint64_t matrices_offset;
+    uint64_t n_matrices;
+};
+
+struct MatrixHeader
+{
+    char name[name_size];
+    uint64_t data_offset;
+    uint32_t rows;
+    uint32_t cols;
+};
+
+/// Record to write, a matrix added with an existing name replaces the previous one
+class Record
+{
+    public:
+
+        Record(const std::string& name = ""):name_(name) {}
+
+        inline void Add(const std::string& name, const Eigen::MatrixXd& mat)
+        {
+            assert(name.size() < name_size);
+            for(size_t i=0;i<names_.size();i++)
+            {
+                if(names_[i] == name)
+                {
+                    mats_[i] = mat;
+                    return;
+                }
+            }
+            names_.push_back(name);
+            mats_.push_back(mat);
+        }
+        inline void Add(const std::string& name, const double value)
+        {
+            Add(name,Eigen::MatrixXd::Constant(1,1,value));
+        }
+
+        inline const std::string& GetName() const {return name_;}
+        inline void SetName(const std::string& name) {assert(name.size() < name_size); name_ = name;}
+        inline size_t GetNbMatrices() const {return mats_.size();}
+        inline const std::string& GetMatrixName(const size_t i) const {return names_[i];}
+        inline const Eigen::MatrixXd& GetMatrix(const size_t i) const {return mats_[i];}
+
+    private:
+        std::string name_;
+        std::vector<std::string> names_;
+        std::vector<Eigen::MatrixXd> mats_;
+};
+
+/// Write the records in a single file, return false if the file can not be written.
+/// The records are written in file_path.tmp which then replaces the file: a library which is
+/// mapped (see Library) keeps its old content and it is never seen partially written.
+inline bool Write(const std::string& file_path, const std::vector<Record>& records)
+{
+    // Compute the offsets
+    uint64_t offset = sizeof(FileHeader) + records.size() * sizeof(RecordHeader);
+    std::vector<RecordHeader> record_headers(records.size());
+    std::vector<std::vector<MatrixHeader> > matrix_headers(records.size());
+    for(size_t i=0;i<records.size();i++)
+    {
+        std::memset(&record_headers[i],0,sizeof(RecordHeader));
+        std::strncpy(record_headers[i].name,records[i].GetName().c_str(),name_size-1);
+        record_headers[i].matrices_offset = offset;
+        record_headers[i].n_matrices = records[i].GetNbMatrices();
+        offset += records[i].GetNbMatrices() * sizeof(MatrixHeader);
+    }
+    for(size_t i=0;i<records.size();i++)
+    {
+        matrix_headers[i].resize(records[i].GetNbMatrices());
+        for(size_t j=0;j<records[i].GetNbMatrices();j++)
+        {
+            MatrixHeader& header = matrix_headers[i][j];
+            std::memset(&header,0,sizeof(MatrixHeader));
+            std::strncpy(header.name,records[i].GetMatrixName(j).c_str(),name_size-1);
+            header.data_offset = offset;
+            header.rows = records[i].GetMatrix(j).rows();
+            header.cols = records[i].GetMatrix(j).cols();
+            offset += records[i].GetMatrix(j).size() * sizeof(double);
+        }
+    }
+
+    FileHeader file_header;
+    std::memset(&file_header,0,sizeof(FileHeader));
+    std::memcpy(file_header.magic,file_magic,sizeof(file_magic));
+    file_header.version = file_version;
+    file_header.n_records = records.size();
+    file_header.file_size = offset;
+
+    const std::string tmp_path = file_path + ".tmp";
+    FILE* file = std::fopen(tmp_path.c_str(),"wb");
+    if(file == NULL)
+        return false;
+    bool ok = std::fwrite(&file_header,sizeof(FileHeader),1,file) == 1;
+    if(!record_headers.empty())
+        ok = ok && std::fwrite(&record_headers[0],sizeof(RecordHeader),record_headers.size(),file) == record_headers.size();
+    for(size_t i=0;i<records.size();i++)
+        if(!matrix_headers[i].empty())
+            ok = ok && std::fwrite(&matrix_headers[i][0],sizeof(MatrixHeader),matrix_headers[i].size(),file) == matrix_headers[i].size();
+    for(size_t i=0;i<records.size();i++)
+        for(size_t j=0;j<records[i].GetNbMatrices();j++)
+        {
+            const Eigen::MatrixXd& mat = records[i].GetMatrix(j);
+            if(mat.size() > 0)
+                ok = ok && std::fwrite(mat.data(),sizeof(double),mat.size(),file) == static_cast<size_t>(mat.size());
+        }
+    ok = ok && std::fflush(file) == 0 && ::fsync(::fileno(file)) == 0;
+    ok = (std::fclose(file) == 0) && ok;
+    ok = ok && std::rename(tmp_path.c_str(),file_path.c_str()) == 0;
+    if(!ok)
+        std::remove(tmp_path.c_str());
+    return ok;
+}
+
+typedef Eigen::Map<const Eigen::MatrixXd> map_t;
+
+/// Read only view of a record in a mapped library, valid while the library is open
+class RecordView
+{
+    public:
+
+        RecordView(const char* base, const RecordHeader* header):base_(base),header_(header)
+        {
+            matrices_ = reinterpret_cast<const MatrixHeader*>(base_ + header_->matrices_offset);
+        }
+
+        inline std::string GetName() const {return std::string(header_->name);}
+
+        inline bool Has(const std::string& name) const {return Find(name) != NULL;}
+
+        /// The matrix has to exist, see Has
+        inline map_t Get(const std::string& name) const
+        {
+            const MatrixHeader* header = Find(name);
+            assert(header != NULL);
+            return map_t(reinterpret_cast<const double*>(base_ + header->data_offset),header->rows,header->cols);
+        }
+        inline double GetScalar(const std::string& name) const
+        {
+            return Get(name)(0,0);
+        }
+
+    private:
+
+        inline const MatrixHeader* Find(const std::string& name) const
+        {
+            for(uint64_t i=0;i<header_->n_matrices;i++)
+                if(std::strncmp(matrices_[i].name,name.c_str(),name_size) == 0)
+                    return &matrices_[i];
+            return NULL;
+        }
+
+        const char* base_;
+        const RecordHeader* header_;
+        const MatrixHeader* matrices_;
+};
+
+/// Library mapped in memory, the file is not parsed: the views point directly in the mapping
+class Library
+{
+    public:
+
+        Library():base_(NULL),size_(0) {}
+        ~Library() {Close();}
+
+        /// Return false if the file can not be mapped, it is not a library of this version or
+        /// any of its offsets falls outside the file
+        bool Open(const std::string& file_path)
+        {
+            Close();
+            const int fd = ::open(file_path.c_str(),O_RDONLY);
+            if(fd < 0)
+                return false;
+            struct stat st;
+            if(::fstat(fd,&st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FileHeader))
+            {
+                ::close(fd);
+                return false;
+            }
+            void* addr = ::mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+            ::close(fd); // The mapping stays valid
+            if(addr == MAP_FAILED)
+                return false;
+            base_ = static_cast<const char*>(addr);
+            size_ = st.st_size;
+
+            if(!Check())
+            {
+                Close();
+                return false;
+            }
+            return true;
+        }
+
+        void Close()
+        {
+            if(base_ != NULL)
+                ::munmap(const_cast<char*>(base_),size_);
+            base_ = NULL;
+            size_ = 0;
+        }
+
+        inline bool IsOpen() const {return base_ != NULL;}
+        inline int GetNbRecords() const {return IsOpen() ? GetHeader()->n_records : 0;}
+        inline RecordView GetRecord(const int i) const
+        {
+            assert(i >= 0 && i < GetNbRecords());
+            return RecordView(base_,reinterpret_cast<const RecordHeader*>(base_ + sizeof(FileHeader)) + i);
+        }
+
+    private:
+
+        Library(const Library&);
+        Library& operator=(const Library&);
+
+        inline const FileHeader* GetHeader() const {return reinterpret_cast<const FileHeader*>(base_);}
+
+        /// The size elements of elem_size bytes at offset are in the mapping, without overflows
+        inline bool InFile(const uint64_t offset, const uint64_t size, const uint64_t elem_size) const
+        {
+            return offset % 8 == 0 && offset <= size_ && size <= (size_ - offset) / elem_size;
+        }
+
+        /// Validate all the headers once, so that the views never point outside the mapping
+        bool Check() const
+        {
+            const FileHeader* header = GetHeader();
+            if(std::memcmp(header->magic,file_magic,sizeof(file_magic)) != 0 || header->version != file_version || header->file_size != size_
+               || !InFile(sizeof(FileHeader),header->n_records,sizeof(RecordHeader)))
+                return false;
+            const RecordHeader* records = reinterpret_cast<const RecordHeader*>(base_ + sizeof(FileHeader));
+            for(uint32_t i=0;i<header->n_records;i++)
+            {
+                if(records[i].name[name_size-1] != '\0' || !InFile(records[i].matrices_offset,records[i].n_matrices,sizeof(MatrixHeader)))
+                    return false;
+                const MatrixHeader* matrices = reinterpret_cast<const MatrixHeader*>(base_ + records[i].matrices_offset);
+                for(uint64_t j=0;j<records[i].n_matrices;j++)
+                    if(matrices[j].name[name_size-1] != '\0'
+                       || !InFile(matrices[j].data_offset,static_cast<uint64_t>(matrices[j].rows) * matrices[j].cols,sizeof(double)))
+                        return false;
+            }
+            return true;
+        }
+
+        const char* base_;
+        size_t size_;
+};
+
+} // namespace
+
+#endif
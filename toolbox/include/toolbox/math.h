@@ -26,6 +26,8 @@
 
 ////////// STD
 #include <cmath>
+#include <vector>
+#include <algorithm>
 
 ////////// Eigen
 #include <eigen3/Eigen/Core>
@@ -126,6 +128,11 @@ public:
         return state_;
     }
 
+    inline void SetState(double state)
+    {
+        state_ = state;
+    }
+
     inline double GetRef() const
     {
         return ref_;
@@ -248,6 +255,243 @@ class AdaptiveGain
         double c_;
 };
 
+/// Table of a vector function of a scalar x in [x_min,x_max], sampled on uniform knots.
+/// It is evaluated with a cubic Hermite interpolation of the values and derivatives at the knots.
+/// Each knot is a row [values, derivatives * step] so an evaluation reads two contiguous rows.
+class HermiteTable
+{
+    public:
+
+        HermiteTable():n_knots_(0),dim_(0),x_min_(0.0),step_(1.0) {}
+
+        /// values and derivatives are n_knots x dim, sampled at LinSpaced(n_knots,x_min,x_max)
+        void Init(const Eigen::MatrixXd& values, const Eigen::MatrixXd& derivatives, const double x_min = 0.0, const double x_max = 1.0)
+        {
+            assert(values.rows() > 1);
+            assert(values.rows() == derivatives.rows());
+            assert(values.cols() == derivatives.cols());
+            assert(x_max > x_min);
+            n_knots_ = values.rows();
+            dim_ = values.cols();
+            x_min_ = x_min;
+            step_ = (x_max - x_min)/(n_knots_ - 1);
+            knots_.resize(n_knots_,2*dim_);
+            knots_.leftCols(dim_) = values;
+            knots_.rightCols(dim_) = derivatives * step_;
+        }
+
+        inline bool IsEmpty() const {return n_knots_ == 0;}
+        inline int GetDim() const {return dim_;}
+        inline int GetNbKnots() const {return n_knots_;}
+
+        /// Values and derivatives as given to Init
+        inline void GetSamples(Eigen::MatrixXd& values, Eigen::MatrixXd& derivatives) const
+        {
+            values = knots_.leftCols(dim_);
+            derivatives = knots_.rightCols(dim_) / step_;
+        }
+
+        /// value and derivative are 1 x dim rows, x is saturated to [x_min,x_max]
+        inline void Evaluate(const double x, Eigen::MatrixXd& value, Eigen::MatrixXd& derivative) const
+        {
+            assert(value.cols() == dim_ && derivative.cols() == dim_);
+
+            double s = (x - x_min_)/step_;
+            if(s < 0.0)
+                s = 0.0;
+            else if(s > n_knots_ - 1)
+                s = n_knots_ - 1;
+            int k = static_cast<int>(s);
+            if(k > n_knots_ - 2)
+                k = n_knots_ - 2;
+            const double t = s - k;
+            const double t2 = t * t;
+            const double t3 = t2 * t;
+
+            // Hermite basis and its derivative
+            const double h00 = 2.0*t3 - 3.0*t2 + 1.0;
+            const double h10 = t3 - 2.0*t2 + t;
+            const double h01 = -2.0*t3 + 3.0*t2;
+            const double h11 = t3 - t2;
+            const double dh00 = (6.0*t2 - 6.0*t)/step_;
+            const double dh10 = (3.0*t2 - 4.0*t + 1.0)/step_;
+            const double dh01 = (-6.0*t2 + 6.0*t)/step_;
+            const double dh11 = (3.0*t2 - 2.0*t)/step_;
+
+            const double* p0 = knots_.data() + k * 2 * dim_;
+            const double* p1 = p0 + 2 * dim_;
+            for(int j=0;j<dim_;j++)
+            {
+                value(0,j) = h00 * p0[j] + h10 * p0[dim_+j] + h01 * p1[j] + h11 * p1[dim_+j];
+                derivative(0,j) = dh00 * p0[j] + dh10 * p0[dim_+j] + dh01 * p1[j] + dh11 * p1[dim_+j];
+            }
+        }
+
+    private:
+        int n_knots_;
+        int dim_;
+        double x_min_;
+        double step_;
+        Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> knots_;
+};
+
+/// Cubic spline with zero second derivative at the ends and linear extrapolation, as tk::spline.
+/// All the channels share the knots, their coefficients are packed by segment so that one
+/// evaluation gives the values and the derivatives of all of them.
+/// The evaluations are const and thread safe: the segment of the last evaluation is a hint owned
+/// by the caller, with a continuous input (i.e. the phase) the knot search is O(1), otherwise
+/// (or without hint) it falls back to a binary search.
+class CubicSpline
+{
+    public:
+
+        CubicSpline():n_knots_(0),n_channels_(0) {}
+
+        /// x are the knots (strictly increasing), each column of y is a channel sampled on x
+        void Init(const Eigen::VectorXd& x, const Eigen::MatrixXd& y)
+        {
+            assert(x.size() > 2);
+            assert(x.size() == y.rows());
+            n_knots_ = x.size();
+            n_channels_ = y.cols();
+            knots_.resize(n_knots_);
+            for(int i=0;i<n_knots_;i++)
+                knots_[i] = x(i);
+
+            // Segment s is [x(s-1),x(s)), the segment 0 and n_knots_ are the extrapolations
+            coefs_.resize(n_knots_+1,4*n_channels_);
+            Eigen::VectorXd h = x.tail(n_knots_-1) - x.head(n_knots_-1);
+            Eigen::VectorXd b(n_knots_), rhs(n_knots_), diag(n_knots_), upper(n_knots_);
+            for(int j=0;j<n_channels_;j++)
+            {
+                // Tridiagonal system on b = y''/2 (Thomas algorithm), b(0) = b(n-1) = 0
+                diag(0) = 1.0;
+                upper(0) = 0.0;
+                rhs(0) = 0.0;
+                for(int i=1;i<n_knots_-1;i++)
+                {
+                    const double lower = h(i-1)/3.0;
+                    const double m = lower/diag(i-1);
+                    diag(i) = 2.0/3.0*(h(i-1)+h(i)) - m*upper(i-1);
+                    upper(i) = h(i)/3.0;
+                    rhs(i) = (y(i+1,j)-y(i,j))/h(i) - (y(i,j)-y(i-1,j))/h(i-1) - m*rhs(i-1);
+                }
+                b(n_knots_-1) = 0.0;
+                for(int i=n_knots_-2;i>=1;i--)
+                    b(i) = (rhs(i) - upper(i)*b(i+1))/diag(i);
+                b(0) = 0.0;
+
+                // y = ((a*t + b)*t + c)*t + d with t = x - x(s-1)
+                for(int i=0;i<n_knots_-1;i++)
+                {
+                    double* p = coefs_.data() + (i+1)*4*n_channels_ + 4*j;
+                    p[0] = (b(i+1)-b(i))/(3.0*h(i));
+                    p[1] = b(i);
+                    p[2] = (y(i+1,j)-y(i,j))/h(i) - (2.0*b(i)+b(i+1))*h(i)/3.0;
+                    p[3] = y(i,j);
+                }
+                const double* p_first = coefs_.data() + 4*n_channels_ + 4*j;
+                const double* p_last = coefs_.data() + (n_knots_-1)*4*n_channels_ + 4*j;
+                const double h_last = h(n_knots_-2);
+                double* p_left = coefs_.data() + 4*j;
+                double* p_right = coefs_.data() + n_knots_*4*n_channels_ + 4*j;
+                p_left[0] = 0.0;
+                p_left[1] = 0.0;
+                p_left[2] = p_first[2];
+                p_left[3] = y(0,j);
+                p_right[0] = 0.0;
+                p_right[1] = 0.0;
+                p_right[2] = (3.0*p_last[0]*h_last + 2.0*p_last[1])*h_last + p_last[2];
+                p_right[3] = y(n_knots_-1,j);
+            }
+        }
+
+        /// Single channel version
+        void Init(const std::vector<double>& x, const std::vector<double>& y)
+        {
+            assert(x.size() == y.size());
+            Init(Eigen::Map<const Eigen::VectorXd>(x.data(),x.size()),Eigen::Map<const Eigen::MatrixXd>(y.data(),y.size(),1));
+        }
+
+        inline bool IsEmpty() const {return n_knots_ == 0;}
+        inline int GetNbChannels() const {return n_channels_;}
+
+        /// Values and first and second derivatives of all the channels in x,
+        /// the outputs are arrays of GetNbChannels() elements, d1 and d2 are optional.
+        /// seg is the segment hint, updated with the segment of x (any value the first time).
+        inline void Evaluate(const double x, int& seg, double* value, double* d1 = NULL, double* d2 = NULL) const
+        {
+            assert(n_knots_ > 0);
+            seg = FindSegment(x,seg);
+            const double t = x - knots_[seg > 0 ? seg-1 : 0];
+            const double* p = coefs_.data() + seg*4*n_channels_;
+            for(int j=0;j<n_channels_;j++,p+=4)
+                value[j] = ((p[0]*t + p[1])*t + p[2])*t + p[3];
+            if(d1 != NULL)
+            {
+                p = coefs_.data() + seg*4*n_channels_;
+                for(int j=0;j<n_channels_;j++,p+=4)
+                    d1[j] = (3.0*p[0]*t + 2.0*p[1])*t + p[2];
+            }
+            if(d2 != NULL)
+            {
+                p = coefs_.data() + seg*4*n_channels_;
+                for(int j=0;j<n_channels_;j++,p+=4)
+                    d2[j] = 6.0*p[0]*t + 2.0*p[1];
+            }
+        }
+
+        /// Without hint
+        inline void Evaluate(const double x, double* value, double* d1 = NULL, double* d2 = NULL) const
+        {
+            int seg = -1;
+            Evaluate(x,seg,value,d1,d2);
+        }
+
+        /// Value of one channel in x
+        inline double Evaluate(const double x, const int channel) const
+        {
+            assert(n_knots_ > 0);
+            assert(channel >= 0 && channel < n_channels_);
+            const int seg = FindSegment(x,-1);
+            const double t = x - knots_[seg > 0 ? seg-1 : 0];
+            const double* p = coefs_.data() + seg*4*n_channels_ + 4*channel;
+            return ((p[0]*t + p[1])*t + p[2])*t + p[3];
+        }
+
+        /// First channel only
+        inline double operator()(const double x) const
+        {
+            return Evaluate(x,0);
+        }
+
+    private:
+
+        /// Number of knots lower or equal than x, starting from the segment hint
+        inline int FindSegment(const double x, const int hint) const
+        {
+            if(hint < 0 || hint > n_knots_)
+                return std::upper_bound(knots_.begin(),knots_.end(),x) - knots_.begin();
+            if(InSegment(x,hint))
+                return hint;
+            if(hint < n_knots_ && InSegment(x,hint+1))
+                return hint+1;
+            if(hint > 0 && InSegment(x,hint-1))
+                return hint-1;
+            return std::upper_bound(knots_.begin(),knots_.end(),x) - knots_.begin();
+        }
+
+        inline bool InSegment(const double x, const int s) const
+        {
+            return (s == 0 || knots_[s-1] <= x) && (s == n_knots_ || x < knots_[s]);
+        }
+
+        int n_knots_;
+        int n_channels_;
+        std::vector<double> knots_;
+        Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> coefs_;
+};
+
 
 
 
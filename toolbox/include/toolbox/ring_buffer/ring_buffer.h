@@ -0,0 +1,151 @@
+/**
+ * @file   ring_buffer.h
+ * @brief  Lock free single producer single consumer ring buffer.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+////////// STD
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cassert>
+
+namespace ring_buffer
+{
+
+/// Ring of fixed size elements, one thread pushes and another one pops.
+/// The slots are allocated at construction, the elements are written and read in place
+/// (Claim/Commit and Front/Pop) so that pushing does not copy more than the caller writes.
+/// Push and pop do not lock or allocate, a push on a full ring fails and it is counted.
+template <typename T>
+class SpscRing
+{
+    public:
+
+        /// The capacity is rounded up to a power of two
+        SpscRing(const size_t capacity):head_(0),tail_(0),head_cache_(0),n_dropped_(0),tail_cache_(0)
+        {
+            assert(capacity > 0);
+            size_t size = 1;
+            while(size < capacity)
+                size *= 2;
+            mask_ = size - 1;
+            slots_.resize(size);
+        }
+
+        inline size_t GetCapacity() const {return slots_.size();}
+
+        /// Number of failed pushes, the ring was full
+        inline unsigned long GetNbDropped() const {return n_dropped_.load(std::memory_order_relaxed);}
+
+        ////////// Producer
+
+        /// Return the slot to write, NULL if the ring is full. The slot is visible after Commit.
+        inline T* Claim()
+        {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if(tail - head_cache_ > mask_)
+            {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if(tail - head_cache_ > mask_)
+                {
+                    n_dropped_.store(n_dropped_.load(std::memory_order_relaxed) + 1,std::memory_order_relaxed);
+                    return NULL;
+                }
+            }
+            return &slots_[tail & mask_];
+        }
+
+        inline void Commit()
+        {
+            tail_.store(tail_.load(std::memory_order_relaxed) + 1,std::memory_order_release);
+        }
+
+        inline bool Push(const T& element)
+        {
+            T* slot = Claim();
+            if(slot == NULL)
+                return false;
+            *slot = element;
+            Commit();
+            return true;
+        }
+
+        ////////// Consumer
+
+        /// Return the oldest element, NULL if the ring is empty. The slot is released by Pop.
+        inline const T* Front()
+        {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            if(head == tail_cache_)
+            {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if(head == tail_cache_)
+                    return NULL;
+            }
+            return &slots_[head & mask_];
+        }
+
+        inline void Pop()
+        {
+            head_.store(head_.load(std::memory_order_relaxed) + 1,std::memory_order_release);
+        }
+
+        inline bool Pop(T& element)
+        {
+            const T* slot = Front();
+            if(slot == NULL)
+                return false;
+            element = *slot;
+            Pop();
+            return true;
+        }
+
+    private:
+
+        SpscRing(const SpscRing&);
+        SpscRing& operator=(const SpscRing&);
+
+        static const size_t cache_line_size = 64;
+
+        std::vector<T> slots_;
+        size_t mask_;
+
+        /// The indexes grow forever, the slot is index & mask. Each side writes in its own cache line
+        /// and keeps a copy of the other index, so that the shared one is read only when needed.
+        /// The padding is used instead of alignas, the ring is allocated with new before C++17.
+        char pad0_[cache_line_size];
+        std::atomic<size_t> head_; // Written by the consumer
+        char pad1_[cache_line_size - sizeof(size_t)];
+        std::atomic<size_t> tail_; // Written by the producer
+        char pad2_[cache_line_size - sizeof(size_t)];
+        size_t head_cache_; // Used by the producer
+        std::atomic<unsigned long> n_dropped_;
+        char pad3_[cache_line_size - sizeof(size_t) - sizeof(unsigned long)];
+        size_t tail_cache_; // Used by the consumer
+        char pad4_[cache_line_size - sizeof(size_t)];
+};
+
+} // namespace
+
+#endif
@@ -26,6 +26,7 @@
 
 ////////// STD
 #include <iterator>
+#include <map>
 
 ////////// Eigen
 #include <eigen3/Eigen/Core>
@@ -42,6 +43,9 @@
 ////////// YAML-CPP
 #include <yaml-cpp/yaml.h>
 
+////////// BOOST
+#include <boost/thread/mutex.hpp>
+
 namespace tool_box
 {
 
@@ -50,9 +54,8 @@ inline std::string GetYamlFilePath(std::string pkg_name)
     return ros::package::getPath(pkg_name) + "/config/cfg.yml"; // FIXME folder and file name are hardcoded
 }
 
-inline YAML::Node CreateYamlNodeFromPkgName(std::string pkg_name)
+inline YAML::Node CreateYamlNodeFromFile(const std::string& file_path)
 {
-    std::string file_path = GetYamlFilePath(pkg_name);
     YAML::Node node;
     try
     {
@@ -65,6 +68,57 @@ inline YAML::Node CreateYamlNodeFromPkgName(std::string pkg_name)
     return node;
 }
 
+inline YAML::Node CreateYamlNodeFromPkgName(std::string pkg_name)
+{
+    return CreateYamlNodeFromFile(GetYamlFilePath(pkg_name));
+}
+
+/// Parsed configurations: a file is read and parsed once, then shared by all the
+/// readers (i.e. every mechanism constructor). Each reader gets a deep copy of the parsed node,
+/// so the nodes can be read by several threads. Reload parses the file again for the next readers.
+class YamlConfigCache
+{
+    public:
+        static YAML::Node Get(const std::string& file_path)
+        {
+            boost::mutex::scoped_lock guard(GetMutex());
+            std::map<std::string,YAML::Node>& nodes = GetNodes();
+            std::map<std::string,YAML::Node>::iterator it = nodes.find(file_path);
+            if(it == nodes.end())
+                it = nodes.insert(std::make_pair(file_path,CreateYamlNodeFromFile(file_path))).first;
+            return YAML::Clone(it->second);
+        }
+
+        static void Reload(const std::string& file_path)
+        {
+            YAML::Node node = CreateYamlNodeFromFile(file_path); // Parse outside the lock
+            boost::mutex::scoped_lock guard(GetMutex());
+            GetNodes()[file_path] = node;
+        }
+
+    private:
+        static boost::mutex& GetMutex()
+        {
+            static boost::mutex mtx;
+            return mtx;
+        }
+        static std::map<std::string,YAML::Node>& GetNodes()
+        {
+            static std::map<std::string,YAML::Node> nodes;
+            return nodes;
+        }
+};
+
+inline YAML::Node GetYamlNodeFromPkgName(const std::string& pkg_name)
+{
+    return YamlConfigCache::Get(GetYamlFilePath(pkg_name));
+}
+
+inline void ReloadYamlNodeFromPkgName(const std::string& pkg_name)
+{
+    YamlConfigCache::Reload(GetYamlFilePath(pkg_name));
+}
+
 class RosNode
 {
     public:
@@ -28,6 +28,9 @@
 #include <iostream>
 #include <fstream>
 #include <atomic>
+#include <deque>
+#include <future>
+#include <string>
 
 ////////// Eigen
 #include <eigen3/Eigen/Core>
@@ -35,6 +38,8 @@
 ////////// BOOST
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 
 ////////// YAML-CPP
 #include <yaml-cpp/yaml.h>
@@ -94,54 +99,138 @@ private:
     T obj_;
 };
 
+/// Worker thread executing in order the jobs of a bounded queue.
+/// The thread is persistent and waits on a condition variable, so a job starts as soon as it is added.
 class AsyncThread
 {
-    typedef boost::function<void ()> funct_t;
     public:
-        AsyncThread()
+        typedef boost::function<void ()> funct_t;
+        typedef std::shared_future<void> future_t;
+
+        AsyncThread(const size_t max_jobs = 16):max_jobs_(max_jobs),busy_(false),stop_loop_(false)
         {
-            trigger_ = false;
-            stop_loop_ = false;
+            assert(max_jobs_ > 0);
             loop_ = boost::thread(boost::bind(&AsyncThread::Loop, this));
         }
         ~AsyncThread()
         {
-            stop_loop_ = true;
-            callback_.join();
+            // The pending jobs are executed before stopping
+            {
+                boost::unique_lock<boost::mutex> guard(mtx_);
+                stop_loop_ = true;
+            }
+            job_added_.notify_all();
             loop_.join();
         }
+        /// Add a job, wait if the queue is full. The returned future is ready when the job is done
+        /// and gives back its exception if any.
+        /// A pending (not started) job with the same non empty key is replaced by this one,
+        /// e.g. several saves of the same guide, both the callers get the same future.
+        /// The merged job is moved to the tail, so it still runs after the jobs added before it.
+        /// A job adding a job does not wait: the queue grows beyond max_jobs instead of deadlocking.
+        inline future_t AddJob(funct_t f, const std::string& key = "")
+        {
+            boost::unique_lock<boost::mutex> guard(mtx_);
+            if(!key.empty())
+            {
+                for(size_t i=0;i<jobs_.size();i++)
+                {
+                    if(jobs_[i].key == key)
+                    {
+                        Job job = jobs_[i];
+                        job.f = f;
+                        jobs_.erase(jobs_.begin() + i);
+                        jobs_.push_back(job);
+                        return job.future;
+                    }
+                }
+            }
+            if(boost::this_thread::get_id() != loop_.get_id())
+                while(jobs_.size() >= max_jobs_)
+                    job_done_.wait(guard);
+
+            Job job;
+            job.f = f;
+            job.key = key;
+            job.promise.reset(new std::promise<void>());
+            job.future = job.promise->get_future().share();
+            jobs_.push_back(job);
+            job_added_.notify_one();
+            return job.future;
+        }
+        /// Wait until all the jobs added are done
+        inline void Wait()
+        {
+            boost::unique_lock<boost::mutex> guard(mtx_);
+            while(!jobs_.empty() || busy_)
+                job_done_.wait(guard);
+        }
+        inline size_t GetNbPendingJobs()
+        {
+            boost::unique_lock<boost::mutex> guard(mtx_);
+            return jobs_.size();
+        }
+        /// Old interface, the job starts without waiting the trigger
         inline void AddHandler(funct_t f)
         {
-            if(trigger_ == true)
-                std::cerr<< "Service thread already busy." << std::endl;
-            else
-                f_ = f;
+            AddJob(f);
         }
         inline void Trigger()
         {
-            trigger_ = true;
         }
+
+    private:
+        struct Job
+        {
+            funct_t f;
+            std::string key;
+            boost::shared_ptr<std::promise<void> > promise;
+            future_t future;
+        };
+
         inline void Loop()
         {
-            while(!stop_loop_)
+            while(true)
             {
-                if(trigger_)
+                Job job;
+                {
+                    boost::unique_lock<boost::mutex> guard(mtx_);
+                    while(jobs_.empty() && !stop_loop_)
+                        job_added_.wait(guard);
+                    if(jobs_.empty()) // Stop
+                        return;
+                    job = jobs_.front();
+                    jobs_.pop_front();
+                    busy_ = true;
+                }
+
+                try
                 {
-                    callback_ =  boost::thread(f_);
-                    callback_.join();
-                    trigger_ = false;
+                    job.f();
+                    job.promise->set_value();
                 }
-                boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+                catch(...)
+                {
+                    std::cerr<< "Exception in the service thread." << std::endl;
+                    job.promise->set_exception(std::current_exception());
+                }
+
+                {
+                    boost::unique_lock<boost::mutex> guard(mtx_);
+                    busy_ = false;
+                }
+                job_done_.notify_all();
             }
-            return;
         }
 
-    private:
-        funct_t f_;
-        std::atomic<bool> trigger_;
-        std::atomic<bool> stop_loop_;
+        const size_t max_jobs_;
+        std::deque<Job> jobs_;
+        bool busy_;
+        bool stop_loop_;
+        boost::mutex mtx_;
+        boost::condition_variable job_added_;
+        boost::condition_variable job_done_;
         boost::thread loop_;
-        boost::thread callback_;
 };
 
 
@@ -230,14 +319,16 @@ inline void PushBack(const Eigen::ArrayXd vect, Eigen::MatrixXd& mat)
 
 inline bool CropData(Eigen::MatrixXd& data, const double dt = 0.1, const double dist_min = 0.01)
 {
-    Eigen::MatrixXd data_tmp = data;
-    data.resize(0,data_tmp.cols());
-
-    for(int i = 0; i < data_tmp.rows()-1; i++)
-        if((data_tmp.row(i+1) - data_tmp.row(i)).norm() > dt*dist_min)
+    // Compact the kept rows in place, a row is only overwritten once it has been compared with the next one
+    int n_kept = 0;
+    for(int i = 0; i < data.rows()-1; i++)
+        if((data.row(i+1) - data.row(i)).norm() > dt*dist_min)
         {
-            PushBack(data_tmp.row(i),data);
+            if(n_kept != i)
+                data.row(n_kept) = data.row(i);
+            n_kept++;
         }
+    data.conservativeResize(n_kept,Eigen::NoChange);
 
     if(data.rows() == 0)
     {
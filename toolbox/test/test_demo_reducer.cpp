@@ -0,0 +1,120 @@
+/**
+ * @file   test_demo_reducer.cpp
+ * @brief  GTest for the demonstrations reducer.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/filters/demo_reducer.h>
+
+using namespace Eigen;
+
+int test_dim = 2;
+
+TEST(DemoReducerTest, CropFilterAndDecimation)
+{
+  // 10s at 1kHz: still, a quarter of circle, still
+  int n_samples = 10000;
+  double radius = 0.1;
+  double ds = 0.002;
+  MatrixXd demo(n_samples,test_dim);
+  for (int i=0; i<n_samples; i++)
+  {
+    double t = i * 0.001;
+    double s = std::min(std::max((t - 2.0)/6.0,0.0),1.0);
+    demo(i,0) = radius * std::cos(M_PI/2 * s);
+    demo(i,1) = radius * std::sin(M_PI/2 * s);
+  }
+
+  filters::DemoReducer reducer(test_dim,0.001,0.0,30.0,ds,64);
+  reducer.Push(demo);
+  reducer.Flush();
+  EXPECT_EQ(reducer.GetNbSamples(),n_samples);
+
+  // The points depend on the length of the path, not on the duration of the recording
+  double length = M_PI/2 * radius;
+  EXPECT_NEAR(reducer.GetNbPoints(),length/ds,2.0);
+
+  MatrixXd data;
+  reducer.GetData(data);
+  ASSERT_EQ(data.rows(),reducer.GetNbPoints());
+  EXPECT_NEAR((data.row(0) - demo.row(0)).norm(),0.0,1e-9);
+  EXPECT_NEAR((data.bottomRows(1) - demo.bottomRows(1)).norm(),0.0,1e-9);
+  // No start transient from the filters and the path is preserved
+  for (int i=0; i<data.rows(); i++)
+    EXPECT_NEAR(data.row(i).norm(),radius,1e-3);
+
+  // Without filter and decimation only the still samples are dropped
+  filters::DemoReducer cropper(test_dim,0.001,0.0,0.0,0.0,64);
+  cropper.Push(demo);
+  EXPECT_NEAR(cropper.GetNbPoints(),6000,2);
+}
+
+TEST(DemoReducerTest, CropSlowMotion)
+{
+  // 4s at 1kHz: slow motion, moving less than crop_dist at each sample, then fast motion.
+  // Both with a 50Hz oscillation that the 10Hz filter has to attenuate the same way
+  int n_samples = 4000;
+  double sample_period = 0.001;
+  double crop_dist = 1e-4;
+  double cutoff_freq = 10.0;
+  MatrixXd demo(n_samples,test_dim);
+  for (int i=0; i<n_samples; i++)
+  {
+    double t = i * sample_period;
+    double s = t < 2.0 ? 0.02 * t : 0.04 + 0.2 * (t - 2.0);
+    demo(i,0) = s + 1e-4 * std::sin(2 * M_PI * 50.0 * t);
+    demo(i,1) = s;
+  }
+
+  // The filters run at the sample period even if the slow samples are cropped:
+  // each kept point is a sample of the butterworth applied to the whole demonstration
+  filters::DemoReducer reducer(test_dim,sample_period,crop_dist,cutoff_freq,0.0,64);
+  reducer.Push(demo);
+  EXPECT_LT(reducer.GetNbPoints(),n_samples - n_samples/4); // Most of the slow samples are cropped
+  MatrixXd data;
+  reducer.GetData(data);
+
+  std::vector<filters::Filter> reference(test_dim,filters::Filter(1));
+  MatrixXd filtered(n_samples,test_dim);
+  for (int j=0; j<test_dim; j++)
+  {
+    reference[j].SetSamplePeriod(sample_period);
+    reference[j].SetOrder(2);
+    reference[j].SetCutoff_freq(cutoff_freq);
+    reference[j].Reset(demo(0,j));
+    filtered(0,j) = demo(0,j);
+    for (int i=1; i<n_samples; i++)
+      filtered(i,j) = reference[j].Step(demo(i,j));
+  }
+  int k = 0;
+  for (int i=1; i<data.rows(); i++)
+  {
+    while (k < n_samples && (filtered.row(k) - data.row(i)).norm() > 1e-12)
+      k++;
+    ASSERT_LT(k,n_samples) << "Kept point " << i << " is not a sample of the filtered demonstration";
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+/**
+ * @file   test_dtw.cpp
+ * @brief  GTest for the dynamic time warping.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/dtw/dtw.h>
+
+using namespace Eigen;
+
+int test_dim = 2;
+
+TEST(DtwTest, Engine)
+{
+  int n_points = 200;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  VectorXd t_warped = t.array().pow(1.5);
+  MatrixXd sig1(n_points,test_dim);
+  MatrixXd sig2(n_points/2,test_dim);
+  sig1.col(0) = t;
+  sig1.col(1) = (2 * M_PI * t).array().sin();
+  for (int i=0; i<sig2.rows(); i++)
+  {
+    sig2(i,0) = t_warped(2*i);
+    sig2(i,1) = std::sin(2 * M_PI * t_warped(2*i));
+  }
+
+  // Same cost of the full matrix version, and a path with the same cost
+  MatrixXd D;
+  dtw::Dtw engine;
+  double d_full = dtw::dtw(sig1,sig2,D);
+  double d = engine.Compute(sig1,sig2);
+  EXPECT_NEAR(d,d_full,1e-9);
+
+  const std::vector<int>& path_i = engine.GetPathI();
+  const std::vector<int>& path_j = engine.GetPathJ();
+  double d_path = 0.0;
+  for (size_t k=0; k<path_i.size(); k++)
+    d_path += (sig1.row(path_i[k]) - sig2.row(path_j[k])).norm();
+  EXPECT_NEAR(d_path,d,1e-9);
+  EXPECT_EQ(path_i.front(),0);
+  EXPECT_EQ(path_j.front(),0);
+  EXPECT_EQ(path_i.back(),sig1.rows()-1);
+  EXPECT_EQ(path_j.back(),sig2.rows()-1);
+
+  // The band and the multiresolution versions can not find a lower cost
+  EXPECT_GE(engine.Compute(sig1,sig2,10),d - 1e-9);
+  EXPECT_GE(engine.ComputeFast(sig1,sig2,5),d - 1e-9);
+  EXPECT_NEAR(engine.ComputeFast(sig1,sig2,5),d,0.05 * d);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
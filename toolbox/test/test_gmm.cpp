@@ -0,0 +1,254 @@
+/**
+ * @file   test_gmm.cpp
+ * @brief  GTest for the gaussian mixture models.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/gmm/gmm.h>
+#include <toolbox/gmm/summary.h>
+
+////////// STD
+#include <set>
+
+////////// Eigen
+#include <eigen3/Eigen/LU>
+
+using namespace Eigen;
+
+int test_dim = 2;
+
+TEST(GmmTest, ParallelPool)
+{
+  // Each step covers the range once, and always with the same threads
+  const int n = 1000;
+  const int n_threads = 4;
+  gmm::ParallelPool pool(n_threads);
+  boost::mutex mtx;
+  std::set<boost::thread::id> ids;
+  for (int iter=0; iter<100; iter++)
+  {
+    std::vector<int> counts(n,0);
+    const int n_parts = iter % n_threads + 1;
+    pool.Run(n,n_parts,[&](const int first, const int last)
+    {
+      for (int i=first; i<last; i++)
+        counts[i]++;
+      boost::mutex::scoped_lock guard(mtx);
+      ids.insert(boost::this_thread::get_id());
+    });
+    for (int i=0; i<n; i++)
+      ASSERT_EQ(counts[i],1);
+  }
+  EXPECT_EQ(static_cast<int>(ids.size()),n_threads);
+}
+
+TEST(GmmTest, Incremental)
+{
+  int n_points = 500;
+  int n_gaussians = 5;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd data1(n_points,test_dim+1);
+  MatrixXd data2(n_points,test_dim+1);
+  MatrixXd data_all(2*n_points,test_dim+1);
+  data1.col(0) = t;
+  data1.col(1) = (2 * M_PI * t).array().sin();
+  data1.col(2) = (M_PI * t).array().cos();
+  data2 = data1;
+  data2.rightCols(test_dim).array() += 0.01;
+  data_all << data1, data2;
+
+  gmm::Gmm gmm_batch;
+  gmm_batch.InitSlicing(data_all,n_gaussians);
+  EXPECT_GT(gmm_batch.Train(data_all),0);
+
+  // Fold the second demonstration into the model of the first one
+  gmm::Gmm gmm_inc;
+  gmm_inc.InitSlicing(data1,n_gaussians);
+  gmm_inc.Train(data1);
+  gmm_inc.Update(data2);
+
+  EXPECT_EQ(gmm_inc.GetNbComponents(),n_gaussians);
+  EXPECT_EQ(gmm_inc.GetNbSamples(),2*n_points);
+  double prior_sum = 0.0;
+  for (int k=0; k<n_gaussians; k++)
+    prior_sum += gmm_inc.GetPriors()[k];
+  EXPECT_NEAR(prior_sum,1.0,1e-9);
+  EXPECT_NEAR(gmm_inc.LogLikelihood(data_all),gmm_batch.LogLikelihood(data_all),0.1);
+}
+
+TEST(GmmTest, ParallelTraining)
+{
+  int n_points = 4000;
+  int n_gaussians = 8;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd data(n_points,test_dim+1);
+  data.col(0) = t;
+  data.col(1) = (2 * M_PI * t).array().sin();
+  data.col(2) = (M_PI * t).array().cos();
+
+  // The E step split among the threads gives the same model
+  gmm::Gmm gmm_serial;
+  gmm_serial.InitSlicing(data,n_gaussians);
+  gmm::Gmm gmm_parallel = gmm_serial;
+  gmm_parallel.SetNbThreads(4);
+  EXPECT_EQ(gmm_serial.Train(data),gmm_parallel.Train(data));
+  EXPECT_EQ(gmm_serial.GetNbIterations(),gmm_parallel.GetNbIterations());
+  EXPECT_NEAR(gmm_serial.GetLastLogLikelihood(),gmm_parallel.GetLastLogLikelihood(),1e-9);
+  for (int k=0; k<n_gaussians; k++)
+    EXPECT_NEAR((gmm_serial.GetMeans()[k] - gmm_parallel.GetMeans()[k]).norm(),0.0,1e-9);
+
+  gmm::Gmm gmm_kmeans;
+  gmm_kmeans.InitKMeansPlusPlus(data,n_gaussians,1);
+  EXPECT_GT(gmm_kmeans.Train(data),0);
+  EXPECT_EQ(gmm_kmeans.GetNbComponents(),n_gaussians);
+  EXPECT_NEAR(gmm_kmeans.GetLastLogLikelihood(),gmm_kmeans.LogLikelihood(data),1e-3);
+
+  // The best of the restarts is not worse than the first one
+  gmm::Gmm gmm_restarts;
+  gmm_restarts.SetNbThreads(2);
+  gmm_restarts.InitSlicing(data,n_gaussians);
+  gmm_restarts.TrainRestarts(data,3);
+  EXPECT_GE(gmm_restarts.GetLastLogLikelihood(),gmm_serial.GetLastLogLikelihood() - 1e-9);
+  EXPECT_EQ(gmm_restarts.GetNbSamples(),n_points);
+
+  // Early stop
+  gmm::Gmm gmm_early;
+  gmm_early.InitSlicing(data,n_gaussians);
+  EXPECT_LE(gmm_early.Train(data,100,1.0),2);
+}
+
+TEST(GmmTest, DegenerateCovariance)
+{
+  // The samples are on a plane, without regularisation the covariances are singular
+  int n_points = 500;
+  int n_gaussians = 4;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd data(n_points,test_dim+1);
+  data.col(0) = t;
+  data.col(1) = (2 * M_PI * t).array().sin();
+  data.col(2).fill(0.5);
+
+  gmm::Gmm gmm(0.0);
+  gmm.InitSlicing(data,n_gaussians);
+  gmm.Train(data);
+  EXPECT_TRUE(std::isfinite(gmm.GetLastLogLikelihood()));
+  EXPECT_TRUE(std::isfinite(gmm.LogLikelihood(data)));
+  for (int k=0; k<n_gaussians; k++)
+  {
+    EXPECT_TRUE(gmm.GetCovars()[k].allFinite());
+    EXPECT_EQ(LLT<MatrixXd>(gmm.GetCovars()[k]).info(),Success);
+  }
+}
+
+TEST(GmmSummaryTest, LogLikelihood)
+{
+  int n_points = 5000;
+  int n_components = 50;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd demo(n_points,test_dim);
+  demo.col(0) = (2 * M_PI * t).array().sin();
+  demo.col(1) = (M_PI * t).array().cos();
+
+  // Tube along a slightly shifted path
+  VectorXd s = VectorXd::LinSpaced(n_components, 0.0, 1.0);
+  MatrixXd means(n_components,test_dim), variances(n_components,test_dim);
+  means.col(0) = (2 * M_PI * s).array().sin() + 0.01;
+  means.col(1) = (M_PI * s).array().cos();
+  variances.fill(0.01);
+
+  gmm::Summary summary;
+  summary.InitDiagonal(means,variances);
+  EXPECT_EQ(summary.GetNbComponents(),n_components);
+
+  // The same mixture with full covariances
+  std::vector<double> priors(n_components,1.0/n_components);
+  std::vector<VectorXd> means_vec(n_components);
+  std::vector<MatrixXd> covars(n_components);
+  for (int k=0; k<n_components; k++)
+  {
+    means_vec[k] = means.row(k).transpose();
+    covars[k] = variances.row(k).asDiagonal();
+  }
+  gmm::Summary summary_full;
+  summary_full.Init(priors,means_vec,covars);
+  EXPECT_NEAR(summary_full.LogLikelihood(demo),summary.LogLikelihood(demo),1e-9);
+
+  // Exact log likelihood of a sample
+  double lik = 0.0;
+  for (int k=0; k<n_components; k++)
+    lik += priors[k] * std::exp(-0.5 * (demo.row(0) - means.row(k)).squaredNorm()/0.01)/(2 * M_PI * 0.01);
+  VectorXd log_liks;
+  summary.LogLikelihoods(demo.topRows(1),log_liks);
+  EXPECT_NEAR(log_liks(0),std::log(lik),1e-9);
+
+  gmm::Coreset coreset;
+  gmm::BuildCoreset(demo,200,coreset);
+  EXPECT_EQ(coreset.points.rows(),200);
+  EXPECT_NEAR(coreset.weights.sum(),1.0,1e-9);
+  EXPECT_NEAR(summary.LogLikelihood(coreset),summary.LogLikelihood(demo),0.05);
+}
+
+TEST(GmmSummaryTest, FromGmmComponents)
+{
+  int n_points = 1000;
+  int n_gaussians = 6;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd data(n_points,test_dim+1);
+  data.col(0) = t;
+  data.col(1) = (2 * M_PI * t).array().sin();
+  data.col(2) = (M_PI * t).array().cos();
+
+  gmm::Gmm model;
+  model.InitSlicing(data,n_gaussians);
+  model.Train(data);
+
+  // The summary built from the trained components evaluates the same mixture
+  gmm::Summary summary;
+  summary.Init(model.GetPriors(),model.GetMeans(),model.GetCovars());
+  EXPECT_NEAR(summary.LogLikelihood(data),model.LogLikelihood(data),1e-9);
+
+  // The marginals over the position, as the guides do: the same as a gmm trained on the (phase, position)
+  // samples evaluated on the positions only
+  std::vector<VectorXd> means(n_gaussians);
+  std::vector<MatrixXd> covars(n_gaussians);
+  for (int k=0; k<n_gaussians; k++)
+  {
+    means[k] = model.GetMeans()[k].tail(test_dim);
+    covars[k] = model.GetCovars()[k].bottomRightCorner(test_dim,test_dim);
+  }
+  gmm::Summary marginal;
+  marginal.Init(model.GetPriors(),means,covars);
+  VectorXd log_liks;
+  marginal.LogLikelihoods(data.rightCols(test_dim).topRows(1),log_liks);
+  double lik = 0.0;
+  for (int k=0; k<n_gaussians; k++)
+  {
+    const VectorXd diff = data.row(0).tail(test_dim).transpose() - means[k];
+    lik += model.GetPriors()[k] * std::exp(-0.5 * diff.dot(covars[k].inverse() * diff))/(2 * M_PI * std::sqrt(covars[k].determinant()));
+  }
+  EXPECT_NEAR(log_liks(0),std::log(lik),1e-9);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+/**
+ * @file   test_kdtree.cpp
+ * @brief  GTest for the kd-tree.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/kdtree/kdtree.h>
+
+////////// STD
+#include <cstdlib>
+
+using namespace Eigen;
+
+int test_dim = 2;
+
+/// Squared distance of the nearest point, by linear scan
+double BruteForceSqDist(const MatrixXd& points, const VectorXd& query)
+{
+  return (points.rowwise() - query.transpose()).rowwise().squaredNorm().minCoeff();
+}
+
+void ExpectSameAsBruteForce(const MatrixXd& points, const MatrixXd& queries)
+{
+  kdtree::KdTree tree;
+  tree.Build(points);
+  ASSERT_EQ(tree.GetNbPoints(),points.rows());
+  for (int q=0; q<queries.rows(); q++)
+  {
+    const VectorXd query = queries.row(q).transpose();
+    const int idx = tree.FindNearest(query);
+    ASSERT_GE(idx,0);
+    ASSERT_LT(idx,points.rows());
+    // With ties any of the nearest points is fine, only the distance is compared
+    EXPECT_EQ((points.row(idx).transpose() - query).squaredNorm(),BruteForceSqDist(points,query));
+  }
+}
+
+TEST(KdTreeTest, RandomPoints)
+{
+  std::srand(0);
+  for (int dim=1; dim<=3; dim++)
+  {
+    for (int n_points=1; n_points<=257; n_points+=32) // Also the degenerate trees
+    {
+      MatrixXd points = MatrixXd::Random(n_points,dim);
+      MatrixXd queries = 1.5 * MatrixXd::Random(100,dim); // Also outside of the points box
+      ExpectSameAsBruteForce(points,queries);
+    }
+  }
+}
+
+TEST(KdTreeTest, TiesAndDuplicates)
+{
+  // Points on an integer grid, the queries in the middle of the cells are equidistant to several points
+  const int n_side = 10;
+  MatrixXd points(n_side * n_side * 2,test_dim);
+  for (int i=0; i<n_side; i++)
+    for (int j=0; j<n_side; j++)
+    {
+      points.row(i * n_side + j) << i, j;
+      points.row(n_side * n_side + i * n_side + j) << i, j; // Each point twice
+    }
+
+  MatrixXd queries(4 * n_side * n_side,test_dim);
+  for (int i=0; i<n_side; i++)
+    for (int j=0; j<n_side; j++)
+    {
+      queries.row(4 * (i * n_side + j)) << i + 0.5, j + 0.5; // Four points at the same distance
+      queries.row(4 * (i * n_side + j) + 1) << i + 0.5, j; // Two points
+      queries.row(4 * (i * n_side + j) + 2) << i, j; // On the duplicated points
+      queries.row(4 * (i * n_side + j) + 3) << i - 0.5, j - 0.25;
+    }
+  ExpectSameAsBruteForce(points,queries);
+
+  // All the points are the same
+  ExpectSameAsBruteForce(MatrixXd::Ones(50,test_dim),MatrixXd::Random(10,test_dim));
+}
+
+TEST(KdTreeTest, WarmStart)
+{
+  std::srand(1);
+  MatrixXd points = MatrixXd::Random(200,test_dim);
+  kdtree::KdTree tree;
+  tree.Build(points);
+  for (int q=0; q<100; q++)
+  {
+    const VectorXd query = MatrixXd::Random(test_dim,1);
+    // Any candidate gives the nearest point, a candidate already the nearest is kept
+    const int start_idx = q % points.rows();
+    const int idx = tree.FindNearest(query,start_idx,(points.row(start_idx).transpose() - query).squaredNorm());
+    EXPECT_EQ((points.row(idx).transpose() - query).squaredNorm(),BruteForceSqDist(points,query));
+    EXPECT_EQ(tree.FindNearest(query,idx,(points.row(idx).transpose() - query).squaredNorm()),idx);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
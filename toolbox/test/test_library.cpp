@@ -0,0 +1,115 @@
+/**
+ * @file   test_library.cpp
+ * @brief  GTest for the memory mapped library.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/library/library.h>
+
+////////// BOOST
+#include <boost/filesystem.hpp>
+
+using namespace Eigen;
+
+std::string TempPath()
+{
+  return (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("test_library_%%%%%%")).string();
+}
+
+TEST(LibraryTest, WriteAndOpen)
+{
+  std::vector<library::Record> records(2);
+  records[0].SetName("first");
+  records[0].Add("mat",MatrixXd::Random(4,3));
+  records[0].Add("value",2.0);
+  records[1].SetName("second");
+  const std::string path = TempPath();
+  ASSERT_TRUE(library::Write(path,records));
+  EXPECT_FALSE(boost::filesystem::exists(path + ".tmp"));
+
+  library::Library lib;
+  ASSERT_TRUE(lib.Open(path));
+  ASSERT_EQ(lib.GetNbRecords(),2);
+  library::RecordView view = lib.GetRecord(0);
+  EXPECT_EQ(view.GetName(),"first");
+  ASSERT_TRUE(view.Has("mat"));
+  EXPECT_EQ((view.Get("mat") - records[0].GetMatrix(0)).norm(),0.0);
+  EXPECT_EQ(view.GetScalar("value"),2.0);
+  EXPECT_FALSE(lib.GetRecord(1).Has("mat"));
+
+  // A library written over a mapped one replaces the file: the mapping keeps the old content
+  std::vector<library::Record> new_records(1);
+  new_records[0].SetName("new");
+  new_records[0].Add("value",3.0);
+  ASSERT_TRUE(library::Write(path,new_records));
+  EXPECT_EQ(view.GetName(),"first");
+  EXPECT_EQ(view.GetScalar("value"),2.0);
+  library::Library new_lib;
+  ASSERT_TRUE(new_lib.Open(path));
+  EXPECT_EQ(new_lib.GetRecord(0).GetScalar("value"),3.0);
+
+  boost::filesystem::remove(path);
+}
+
+TEST(LibraryTest, RejectCorruptedOffsets)
+{
+  std::vector<library::Record> records(1);
+  records[0].SetName("record");
+  records[0].Add("mat",MatrixXd::Ones(10,2));
+  const std::string path = TempPath();
+  ASSERT_TRUE(library::Write(path,records));
+
+  // Patch a header field of the file and try to open it
+  const size_t record_offset = sizeof(library::FileHeader);
+  const size_t matrix_offset = record_offset + sizeof(library::RecordHeader);
+  struct Patch {size_t offset; uint64_t value; size_t size;};
+  const Patch patches[] = {
+    {record_offset + offsetof(library::RecordHeader,matrices_offset),1000000,sizeof(uint64_t)}, // Matrices outside
+    {record_offset + offsetof(library::RecordHeader,n_matrices),uint64_t(1) << 60,sizeof(uint64_t)}, // Overflow
+    {matrix_offset + offsetof(library::MatrixHeader,data_offset),1000000,sizeof(uint64_t)}, // Data outside
+    {matrix_offset + offsetof(library::MatrixHeader,data_offset),record_offset + 4,sizeof(uint64_t)}, // Not aligned
+    {matrix_offset + offsetof(library::MatrixHeader,rows),0xffffffff,sizeof(uint32_t)}, // Data too large
+  };
+  for (size_t i=0; i<sizeof(patches)/sizeof(Patch); i++)
+  {
+    const std::string bad_path = path + "_bad";
+    boost::filesystem::copy_file(path,bad_path,boost::filesystem::copy_option::overwrite_if_exists);
+    FILE* file = std::fopen(bad_path.c_str(),"r+b");
+    ASSERT_TRUE(file != NULL);
+    std::fseek(file,patches[i].offset,SEEK_SET);
+    std::fwrite(&patches[i].value,patches[i].size,1,file);
+    std::fclose(file);
+
+    library::Library lib;
+    EXPECT_FALSE(lib.Open(bad_path)) << "patch " << i;
+    boost::filesystem::remove(bad_path);
+  }
+
+  library::Library lib;
+  EXPECT_TRUE(lib.Open(path));
+  boost::filesystem::remove(path);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
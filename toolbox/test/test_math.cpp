@@ -0,0 +1,103 @@
+/**
+ * @file   test_math.cpp
+ * @brief  GTest for the math tools.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/math.h>
+
+using namespace Eigen;
+
+int test_dim = 2;
+
+TEST(CubicSplineTest, InterpolationAndDerivatives)
+{
+  int n_points = 50;
+  VectorXd x = VectorXd::LinSpaced(n_points, 0.0, 1.0).array().pow(2); // Non uniform knots
+  MatrixXd y(n_points,test_dim);
+  y.col(0) = (2 * M_PI * x).array().sin();
+  y.col(1) = x.array().exp();
+
+  tool_box::CubicSpline spline;
+  spline.Init(x,y);
+  EXPECT_EQ(spline.GetNbChannels(),test_dim);
+
+  VectorXd value(test_dim), d1(test_dim), d2(test_dim);
+  VectorXd value_h(test_dim), d1_h(test_dim);
+  const double h = 1e-6;
+  for (int i=0; i<n_points; i++)
+  {
+    spline.Evaluate(x(i),value.data());
+    for (int j=0; j<test_dim; j++)
+      EXPECT_NEAR(value(j),y(i,j),1e-12);
+  }
+
+  // Backward, to use the segment search, then the derivatives against finite differences
+  for (int k=200; k>=0; k--)
+  {
+    const double xk = -0.1 + 1.2 * k/200.0; // Extrapolation included
+    spline.Evaluate(xk,value.data(),d1.data(),d2.data());
+    spline.Evaluate(xk+h,value_h.data(),d1_h.data());
+    for (int j=0; j<test_dim; j++)
+    {
+      EXPECT_NEAR(d1(j),(value_h(j)-value(j))/h,1e-4);
+      EXPECT_NEAR(d2(j),(d1_h(j)-d1(j))/h,1e-2);
+    }
+  }
+}
+
+TEST(CubicSplineTest, SegmentHintAndChannels)
+{
+  int n_points = 30;
+  VectorXd x = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd y(n_points,test_dim);
+  y.col(0) = (2 * M_PI * x).array().cos();
+  y.col(1) = x.array().square();
+
+  tool_box::CubicSpline spline;
+  spline.Init(x,y);
+
+  // The hint only changes the search: same values with a continuous input, a jump and a wrong hint
+  VectorXd value(test_dim), value_hint(test_dim);
+  int seg = -1;
+  for (int k=0; k<=300; k++)
+  {
+    const double xk = (k == 150) ? 0.05 : -0.1 + 1.2 * k/300.0;
+    if(k == 200)
+      seg = 1000;
+    spline.Evaluate(xk,value.data());
+    spline.Evaluate(xk,seg,value_hint.data());
+    EXPECT_GE(seg,0);
+    EXPECT_LE(seg,n_points);
+    for (int j=0; j<test_dim; j++)
+    {
+      EXPECT_EQ(value_hint(j),value(j));
+      EXPECT_EQ(spline.Evaluate(xk,j),value(j));
+    }
+    EXPECT_EQ(spline(xk),value(0)); // First channel
+  }
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
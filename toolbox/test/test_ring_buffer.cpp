@@ -0,0 +1,69 @@
+/**
+ * @file   test_ring_buffer.cpp
+ * @brief  GTest for the lock free ring buffer.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/ring_buffer/ring_buffer.h>
+
+////////// BOOST
+#include <boost/thread.hpp>
+
+TEST(RingBufferTest, PushPop)
+{
+  ring_buffer::SpscRing<int> ring(100);
+  EXPECT_EQ(ring.GetCapacity(),128u);
+
+  // Full ring
+  int value;
+  for (int i=0; i<128; i++)
+    EXPECT_TRUE(ring.Push(i));
+  EXPECT_FALSE(ring.Push(128));
+  EXPECT_EQ(ring.GetNbDropped(),1u);
+  for (int i=0; i<128; i++)
+  {
+    EXPECT_TRUE(ring.Pop(value));
+    EXPECT_EQ(value,i);
+  }
+  EXPECT_FALSE(ring.Pop(value));
+
+  // A consumer thread receives the pushed elements in order, the failed pushes are retried
+  const int n_elements = 100000;
+  bool in_order = true;
+  boost::thread consumer([&]()
+  {
+    int expected = 0;
+    int element;
+    while(expected < n_elements)
+      if(ring.Pop(element))
+        in_order = in_order && (element == expected++);
+  });
+  for (int i=0; i<n_elements; i++)
+    while(!ring.Push(i)) {}
+  consumer.join();
+  EXPECT_TRUE(in_order);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
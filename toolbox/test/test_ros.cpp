@@ -0,0 +1,72 @@
+/**
+ * @file   test_ros.cpp
+ * @brief  GTest for the ROS utilities.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/ros.h>
+
+////////// STD
+#include <fstream>
+#include <cstdio>
+
+////////// BOOST
+#include <boost/filesystem.hpp>
+
+using namespace tool_box;
+
+void WriteConfig(const std::string& file_path, const int value)
+{
+  std::ofstream file(file_path.c_str());
+  file << "value: " << value << std::endl;
+}
+
+TEST(YamlConfigCacheTest, ParsedOnce)
+{
+  const std::string file_path = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("test_ros_%%%%%%%%.yml")).string();
+
+  WriteConfig(file_path,1);
+  EXPECT_EQ(YamlConfigCache::Get(file_path)["value"].as<int>(),1);
+
+  // The next lookups do not read the file again
+  WriteConfig(file_path,2);
+  EXPECT_EQ(YamlConfigCache::Get(file_path)["value"].as<int>(),1);
+  std::remove(file_path.c_str());
+  EXPECT_EQ(YamlConfigCache::Get(file_path)["value"].as<int>(),1);
+
+  // Each reader gets its own copy
+  YAML::Node node = YamlConfigCache::Get(file_path);
+  node["value"] = 3;
+  EXPECT_EQ(YamlConfigCache::Get(file_path)["value"].as<int>(),1);
+
+  // Reload parses the file again for the next readers
+  WriteConfig(file_path,2);
+  YamlConfigCache::Reload(file_path);
+  EXPECT_EQ(node["value"].as<int>(),3);
+  std::remove(file_path.c_str());
+  EXPECT_EQ(YamlConfigCache::Get(file_path)["value"].as<int>(),2);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,174 @@
+/**
+ * @file   test_utilities.cpp
+ * @brief  GTest for the utilities.
+ * @author Gennaro Raiola
+ *
+ * This file is part of virtual-fixtures, a set of libraries and programs to create
+ * and interact with a library of virtual guides.
+ * Copyright (C) 2014-2016 Gennaro Raiola, ENSTA-ParisTech
+ *
+ * virtual-fixtures is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * virtual-fixtures is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with virtual-fixtures.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+#include <toolbox/utilities.h>
+
+////////// STD
+#include <vector>
+#include <stdexcept>
+
+using namespace tool_box;
+
+/// Keeps the thread of an AsyncThread busy until Open, so that the next jobs stay pending
+class Gate
+{
+  public:
+    Gate():open_(false) {}
+    void Wait()
+    {
+      boost::unique_lock<boost::mutex> guard(mtx_);
+      while(!open_)
+        cond_.wait(guard);
+    }
+    void Open()
+    {
+      {
+        boost::unique_lock<boost::mutex> guard(mtx_);
+        open_ = true;
+      }
+      cond_.notify_all();
+    }
+  private:
+    bool open_;
+    boost::mutex mtx_;
+    boost::condition_variable cond_;
+};
+
+/// Block the thread of async_thread with the gate, return once the gate job is running
+void Block(AsyncThread& async_thread, Gate& gate)
+{
+  async_thread.AddJob(boost::bind(&Gate::Wait,&gate));
+  while(async_thread.GetNbPendingJobs() > 0)
+    boost::this_thread::yield();
+}
+
+void Append(std::vector<std::string>* log, const std::string entry)
+{
+  log->push_back(entry); // Only the thread of the AsyncThread writes it
+}
+
+void Throw()
+{
+  throw std::runtime_error("job failed");
+}
+
+TEST(AsyncThreadTest, Futures)
+{
+  AsyncThread async_thread;
+  std::vector<std::string> log;
+  Gate gate;
+  Block(async_thread,gate);
+  AsyncThread::future_t done = async_thread.AddJob(boost::bind(&Append,&log,"a"));
+  AsyncThread::future_t failed = async_thread.AddJob(&Throw);
+  EXPECT_EQ(done.wait_for(std::chrono::milliseconds(10)),std::future_status::timeout); // Not started yet
+
+  gate.Open();
+  EXPECT_NO_THROW(done.get());
+  ASSERT_EQ(log.size(),1);
+  EXPECT_EQ(log[0],"a");
+  EXPECT_THROW(failed.get(),std::runtime_error); // The exception of the job
+
+  // The thread keeps running after an exception
+  EXPECT_NO_THROW(async_thread.AddJob(boost::bind(&Append,&log,"b")).get());
+  EXPECT_EQ(log.size(),2);
+}
+
+TEST(AsyncThreadTest, Coalescing)
+{
+  AsyncThread async_thread;
+  std::vector<std::string> log;
+  Gate gate;
+  Block(async_thread,gate);
+
+  // The pending jobs with the same key are merged, they run once with the last function
+  AsyncThread::future_t first = async_thread.AddJob(boost::bind(&Append,&log,"save_0 first"),"save_0");
+  async_thread.AddJob(boost::bind(&Append,&log,"save_1"),"save_1");
+  AsyncThread::future_t second = async_thread.AddJob(boost::bind(&Append,&log,"save_0 second"),"save_0");
+  EXPECT_EQ(async_thread.GetNbPendingJobs(),2);
+
+  gate.Open();
+  async_thread.Wait();
+  EXPECT_NO_THROW(first.get());
+  EXPECT_NO_THROW(second.get());
+  ASSERT_EQ(log.size(),2);
+  EXPECT_EQ(log[0],"save_1");
+  EXPECT_EQ(log[1],"save_0 second");
+
+  // A running job is not merged
+  Gate gate_save;
+  log.clear();
+  Block(async_thread,gate_save);
+  async_thread.AddJob(boost::bind(&Append,&log,"save_0"),"save_0");
+  EXPECT_EQ(async_thread.GetNbPendingJobs(),1);
+  gate_save.Open();
+  async_thread.Wait();
+  EXPECT_EQ(log.size(),1);
+}
+
+TEST(AsyncThreadTest, CoalescingKeepsTheOrder)
+{
+  // Save(0), Delete(0), Save(0): the save runs after the delete
+  AsyncThread async_thread;
+  std::vector<std::string> log;
+  Gate gate;
+  Block(async_thread,gate);
+  async_thread.AddJob(boost::bind(&Append,&log,"save_0"),"save_0");
+  async_thread.AddJob(boost::bind(&Append,&log,"delete_0"));
+  async_thread.AddJob(boost::bind(&Append,&log,"save_0"),"save_0");
+
+  gate.Open();
+  async_thread.Wait();
+  ASSERT_EQ(log.size(),2);
+  EXPECT_EQ(log[0],"delete_0");
+  EXPECT_EQ(log[1],"save_0");
+}
+
+void AddJobs(AsyncThread* async_thread, std::vector<std::string>* log, const int n_jobs)
+{
+  for(int i=0;i<n_jobs;i++)
+    async_thread->AddJob(boost::bind(&Append,log,"nested"));
+}
+
+TEST(AsyncThreadTest, ReentrantAddJobOnFullQueue)
+{
+  const size_t max_jobs = 2;
+  AsyncThread async_thread(max_jobs);
+  std::vector<std::string> log;
+  Gate gate;
+  Block(async_thread,gate);
+  async_thread.AddJob(boost::bind(&AddJobs,&async_thread,&log,5)); // Adds more jobs than the queue can hold
+  async_thread.AddJob(boost::bind(&Append,&log,"last"));
+  EXPECT_EQ(async_thread.GetNbPendingJobs(),max_jobs);
+
+  gate.Open();
+  async_thread.Wait(); // Does not deadlock
+  ASSERT_EQ(log.size(),6);
+  EXPECT_EQ(log[0],"last");
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
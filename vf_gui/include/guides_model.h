@@ -27,6 +27,7 @@
 /// ROS
 #include <ros/ros.h>
 #include <mechanism_manager/MechanismManagerServices.h>
+#include <mechanism_manager/guides_change_log.h>
 
 #include <QAbstractListModel>
 #include <QTimer>
@@ -52,7 +53,13 @@ public:
     bool getMergeTh(double& merge_th);
 
 protected:
+    /// Each response brings the changes of the guides list since revision_, the whole list if the server has another session
+    bool call(mechanism_manager::MechanismManagerServices& srv);
+    void applyChanges(const mechanism_manager::MechanismManagerServices::Response& res);
+
     QStringList names_list_;
+    uint64_t session_; // Of the server which gave revision_
+    uint64_t revision_; // Of names_list_ on the server, 0 to ask the whole list
     ros::ServiceClient sc_;
     QTimer* refresh_timer_;
     bool new_guide_;
@@ -27,7 +27,7 @@ using namespace ros;
 using namespace mechanism_manager;
 
 GuidesModel::GuidesModel(NodeHandle& nh, QObject *parent)
-    :QAbstractListModel(parent)
+    :QAbstractListModel(parent),session_(0),revision_(0)
 {
 
     sc_ = nh.serviceClient<MechanismManagerServices>("/mechanism_manager/mechanism_manager_interaction");
@@ -51,21 +51,57 @@ void GuidesModel::refreshTimerHit()
 void GuidesModel::updateList()
 {
     MechanismManagerServices srv;
-    sc_.call(srv);
-    QVector<QString> vec;
-    QString tmp_qstring;
+    call(srv);
+}
+
+bool GuidesModel::call(MechanismManagerServices& srv)
+{
+    srv.request.session = session_;
+    srv.request.revision = revision_;
+    if(!sc_.call(srv))
+        return false;
+    applyChanges(srv.response);
+    return true;
+}
 
-    for (unsigned int i = 0; i<srv.response.list_guides.size(); i++)
+void GuidesModel::applyChanges(const MechanismManagerServices::Response& res)
+{
+    if(res.full_list)
     {
-        tmp_qstring = QString::fromStdString(srv.response.list_guides[i]);
-        vec.append(tmp_qstring);
+        beginResetModel();
+        names_list_.clear();
+        for (unsigned int i = 0; i<res.list_guides.size(); i++)
+            names_list_.append(QString::fromStdString(res.list_guides[i]));
+        if(new_guide_) // Keep the row of the guide being inserted, it is always the last one
+            names_list_.append("");
+        endResetModel();
     }
-
-    //names_list_.clear();
-
-    beginInsertRows(QModelIndex(),0,srv.response.list_guides.size());
-    names_list_ = QStringList::fromVector(vec);
-    endInsertRows();
+    else
+    {
+        for (unsigned int i = 0; i<res.delta_types.size(); i++)
+        {
+            const int idx = res.delta_idxs[i];
+            switch(res.delta_types[i])
+            {
+                case GUIDE_INSERTED:
+                    beginInsertRows(QModelIndex(),idx,idx);
+                    names_list_.insert(idx,QString::fromStdString(res.delta_names[i]));
+                    endInsertRows();
+                    break;
+                case GUIDE_DELETED:
+                    beginRemoveRows(QModelIndex(),idx,idx);
+                    names_list_.removeAt(idx);
+                    endRemoveRows();
+                    break;
+                case GUIDE_RENAMED:
+                    names_list_[idx] = QString::fromStdString(res.delta_names[i]);
+                    emit dataChanged(index(idx),index(idx));
+                    break;
+            }
+        }
+    }
+    session_ = res.session;
+    revision_ = res.revision;
 }
 
 QVariant GuidesModel::data(const QModelIndex &index, int role) const
@@ -85,20 +121,15 @@ int GuidesModel::rowCount(const QModelIndex & /*parent*/) const
 
 bool GuidesModel::removeRow(int row, const QModelIndex & /*parent*/)
 {
-    beginRemoveRows(QModelIndex(),row,row);
     MechanismManagerServices srv;
     std::string command = "delete";
     srv.request.request_command = command;
     srv.request.selected_guide_idx = row;
-    if(!sc_.call(srv))
+    if(!call(srv)) // The row is removed by the changes of the response
     {
         //TODO Visualize the problem on the gui
         return false;
     }
-    names_list_.removeAt(row);
-    endRemoveRows();
-
-    //updateList();
 
     return true;
 }
@@ -109,7 +140,7 @@ bool GuidesModel::saveRow(int row, const QModelIndex & /*parent*/)
     std::string command = "save";
     srv.request.request_command = command;
     srv.request.selected_guide_idx = row;
-    if(!sc_.call(srv))
+    if(!call(srv))
     {
         // TODO Visualize the problem on the gui
         return false;
@@ -132,7 +163,7 @@ bool GuidesModel::setMode(const QString& mode)
     std::string command = "set_mode";
     srv.request.request_command = command;
     srv.request.selected_mode = mode.toStdString();
-    if(!sc_.call(srv))
+    if(!call(srv))
     {
         // TODO Visualize the problem on the gui
         return false;
@@ -145,7 +176,7 @@ bool GuidesModel::getMode(QString& mode)
     MechanismManagerServices srv;
     std::string command = "get_mode";
     srv.request.request_command = command;
-    if(!sc_.call(srv))
+    if(!call(srv))
     {
         // TODO Visualize the problem on the gui
         return false;
@@ -160,7 +191,7 @@ bool GuidesModel::setMergeTh(double merge_th)
     std::string command = "set_merge_th";
     srv.request.request_command = command;
     srv.request.merge_th = merge_th;
-    if(!sc_.call(srv))
+    if(!call(srv))
     {
         // TODO Visualize the problem on the gui
         return false;
@@ -173,7 +204,7 @@ bool GuidesModel::getMergeTh(double& merge_th)
     MechanismManagerServices srv;
     std::string command = "get_merge_th";
     srv.request.request_command = command;
-    if(!sc_.call(srv))
+    if(!call(srv))
     {
         // TODO Visualize the problem on the gui
         return false;
@@ -198,9 +229,13 @@ bool GuidesModel::setData(const QModelIndex & index, const QVariant & value, int
         if(new_guide_) // New guide
         {
             new_guide_ = false; // Reset
+            // The placeholder row is replaced by the guide inserted by the server
+            beginRemoveRows(QModelIndex(),index.row(),index.row());
+            names_list_.removeAt(index.row());
+            endRemoveRows();
             command = "insert";
             srv.request.request_command = command;
-            if(!sc_.call(srv))
+            if(!call(srv))
             {
                 // TODO Visualize the problem on the gui
                 return false;
@@ -212,15 +247,12 @@ bool GuidesModel::setData(const QModelIndex & index, const QVariant & value, int
             command = "set_name";
             srv.request.request_command = command;
             srv.request.selected_guide_idx = index.row();
-            if(!sc_.call(srv))
+            if(!call(srv)) // Renamed by the changes of the response, if the name is not already used
             {
                 // TODO Visualize the problem on the gui
                 return false;
             }
         }
-
-        // Change the internal list
-        names_list_[index.row()] = value.toString();
     }
 
     //updateList();
@@ -112,7 +112,10 @@ void MainWindow::timerEvent(QTimerEvent *event)
 Q_UNUSED(event);
 
 if (guides_model_->isServerConnected())
+{
     ui->label->setText("connected");
+    guides_model_->updateList(); // Only the changes since the last update
+}
 else
     ui->label->setText("disconnected");
 }
@@ -33,10 +33,13 @@ namespace virtual_mechanism
 class VirtualMechanismAutom
 {
 public:
-    VirtualMechanismAutom(){}
+    VirtualMechanismAutom():state_(MANUAL),loopCnt(0){}
     VirtualMechanismAutom(const double phase_dot_preauto_th, const double phase_dot_th);
     void Step(const double& phase_dot, const double& phase_dot_ref, bool& collision_detected);
     bool GetState();
+    /// Raw state of the automaton, to save and restore it
+    inline int GetMode() const {return state_;}
+    inline void SetMode(const int mode) {state_ = static_cast<state_t>(mode);}
 private:
     enum state_t {MANUAL,PREAUTO,AUTO};
     double phase_dot_preauto_th_;
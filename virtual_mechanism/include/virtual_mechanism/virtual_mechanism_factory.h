@@ -47,11 +47,23 @@ public:
     VirtualMechanismInterface* Build(const std::string model_name, const order_t order, const model_type_t model_type);
     VirtualMechanismInterface* Build(const Eigen::MatrixXd& data); // With default order and model_type
     VirtualMechanismInterface* Build(const std::string model_name); // With default order and model_type
+    VirtualMechanismInterface* Build(const library::RecordView& record, const order_t order, const model_type_t model_type);
+    VirtualMechanismInterface* Build(const library::RecordView& record); // With default order and model_type
+    /// Compile time dimension versions, i.e. Build<2>(data), available for Dim = 2,3
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* Build(const Eigen::MatrixXd& data, const order_t order, const model_type_t model_type);
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* Build(const std::string model_name, const order_t order, const model_type_t model_type);
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* Build(const Eigen::MatrixXd& data); // With default order and model_type
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* Build(const std::string model_name); // With default order and model_type
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* Build(const library::RecordView& record, const order_t order, const model_type_t model_type);
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* Build(const library::RecordView& record); // With default order and model_type
     void SetDefaultPreferences(const order_t order, const model_type_t model_type);
     void SetDefaultPreferences(const std::string order, const std::string model_type);
+    /// The configuration is parsed once and shared by all the mechanisms,
+    /// parse it again for the mechanisms created afterwards
+    void ReloadConfig();
 protected:
-    VirtualMechanismInterface* CreateEmptyMechanism(const order_t order, const model_type_t model_type);
-    template<typename ORDER>  VirtualMechanismInterface* SelectModel(const model_type_t model_type);
+    template<int Dim> VirtualMechanismInterfaceDim<Dim>* CreateEmptyMechanism(const order_t order, const model_type_t model_type);
+    template<typename ORDER> typename ORDER::interface_t* SelectModel(const model_type_t model_type);
     order_t default_order_;
     model_type_t default_model_type_;
 };
@@ -38,10 +38,12 @@
 ////////// BOOST
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
 
 ////////// Toolbox
-#include "toolbox/spline/spline.h"
 #include "toolbox/dtw/dtw.h"
+#include "toolbox/gmm/gmm.h"
+#include "toolbox/gmm/summary.h"
 
 namespace virtual_mechanism
 {
@@ -53,28 +55,51 @@ class VirtualMechanismGmr: public VM_t
 {
 	public:
 
+      typedef typename VM_t::interface_t interface_t;
+      typedef typename VM_t::vector_t vector_t;
+      typedef typename VM_t::jacobian_t jacobian_t;
+
       VirtualMechanismGmr();
       VirtualMechanismGmr(const std::string file_path);
       VirtualMechanismGmr(const Eigen::MatrixXd& data);
       VirtualMechanismGmr(const fa_t* const fa);
       ~VirtualMechanismGmr();
 
-      virtual VirtualMechanismInterface* Clone();
+      virtual interface_t* Clone();
 
-      virtual double getDistance(const Eigen::VectorXd& pos);
-      virtual double getScale(const Eigen::VectorXd& pos, const double convergence_factor = 1.0);
+      virtual double getDistance(const vector_t& pos);
+      virtual double getScale(const vector_t& pos, const double convergence_factor = 1.0);
+      virtual bool getLogDensity(double* const inv_variance, double& log_norm) const;
       virtual bool CreateModelFromData(const Eigen::MatrixXd& data);
       virtual bool CreateModelFromFile(const std::string file_path);
       virtual bool SaveModelToFile(const std::string file_path);
-
-      void ComputeStateGivenPhase(const double abscisse_in, Eigen::VectorXd& state_out);
-      double ComputeResponsability(const Eigen::MatrixXd& pos);
+      virtual bool CreateModelFromRecord(const library::RecordView& record);
+      virtual bool SaveModelToRecord(library::Record& record);
+
+      /// Not for rt, the scratch buffers are local. The evaluation of fa_ is not const,
+      /// concurrent callers of a published guide use their own copy (Clone).
+      void ComputeStateGivenPhase(const double abscisse_in, vector_t& state_out);
+      /// Batch versions: each row of phases_in is a phase, the outputs have to be already allocated
+      /// (phases_in.rows() x state_dim), all the phases are given to the model in a single call.
+      void ComputeStatesGivenPhases(const Eigen::MatrixXd& phases_in, Eigen::MatrixXd& states_out);
+      void ComputeStatesGivenPhases(const Eigen::MatrixXd& phases_in, Eigen::MatrixXd& states_out, Eigen::MatrixXd& states_dot_out, Eigen::MatrixXd& variances_out);
+      double ComputeResponsability(const Eigen::MatrixXd& pos) const;
       double GetResponsability();
+      virtual bool ComputeMergeScore(const Eigen::MatrixXd& points, const Eigen::VectorXd& weights, double& log_lik) const;
+
+      inline double getTableError() const {return table_error_;}
 	  
 	protected:
 	  
       bool ReadConfig();
+      /// Used by Clone: the copy owns its function approximator and its orientation
+      void CopyOwnedState();
       void TrainModel(const Eigen::MatrixXd& data);
+      void FitModel(const Eigen::MatrixXd& phase, const Eigen::MatrixXd& pos);
+      DmpBbo::ModelParametersGMR* CreateModelParameters() const;
+      void CreateTable();
+      void CreateMergeSummary();
+      void PredictDot();
 	  virtual void UpdateJacobian();
 	  virtual void UpdateState();
 	  virtual void ComputeInitialState();
@@ -83,7 +108,8 @@ class VirtualMechanismGmr: public VM_t
       void AlignUpdateModel(const Eigen::MatrixXd& data);
 
       void UpdateInvCov();
-      double ComputeProbability(const Eigen::VectorXd& pos);
+      double ComputeLogProbability(const vector_t& pos);
+      double ComputeProbability(const vector_t& pos);
 
       fa_t* fa_; // Function Approximator
 
@@ -91,12 +117,39 @@ class VirtualMechanismGmr: public VM_t
 	  Eigen::MatrixXd fa_output_;
 	  Eigen::MatrixXd fa_output_dot_;
 	  Eigen::MatrixXd variance_;
+	  Eigen::MatrixXd variance_dot_;
 	  Eigen::MatrixXd covariance_;
       Eigen::MatrixXd covariance_inv_;
-	  Eigen::VectorXd err_;
+      double log_norm_; // Log of the normalization of the gaussian with covariance_
+	  vector_t err_;
 
       int n_gaussians_;
       bool use_align_;
+      int dtw_radius_; // Radius of the multiresolution (FastDTW) alignment, -1 (default) for the exact one
+
+      /// Streaming training: the gmm keeps the statistics of all the demonstrations,
+      /// a new one is folded in with a time proportional to its length
+      bool use_streaming_em_;
+      gmm::Gmm gmm_;
+      double responsability_; // Of the last demonstration, when trained by gmm_
+      bool em_kmeans_init_; // k-means++ initialization, otherwise slicing along the phase
+      int em_restarts_; // Trainings of a new model, the best one is kept
+      int em_max_iter_;
+      double em_tol_; // Stop when the average log likelihood improves less than it
+
+      /// Tabulated model, sampled once when the model is created
+      bool use_table_;
+      int n_points_table_;
+      tool_box::HermiteTable mean_table_;
+      tool_box::HermiteTable variance_table_;
+      double table_error_; // Max error on the mean and the variance against the exact model, estimated at n check points (3 per interval of the table), not a bound
+
+      /// Mixture of gaussians placed along the guide, with the mean and the variance of the model,
+      /// used to compare a new demonstration to the guide without evaluating all its samples
+      int n_points_summary_; // Gaussians of the summary sampled along the guide (no GMM components), 0 to disable it
+      gmm::Summary merge_summary_;
+
+      bool recorded_refs_loaded_; // state_recorded_ and phase_recorded_ come from a library record
 };
 
 template <typename VM_t>
@@ -104,17 +157,32 @@ class VirtualMechanismGmrNormalized: public VirtualMechanismGmr<VM_t>
 {
     public:
 
+      typedef typename VM_t::interface_t interface_t;
+      typedef typename VM_t::vector_t vector_t;
+      typedef typename VM_t::jacobian_t jacobian_t;
+
       VirtualMechanismGmrNormalized();
       VirtualMechanismGmrNormalized(const std::string file_path);
       VirtualMechanismGmrNormalized(const Eigen::MatrixXd& data);
       VirtualMechanismGmrNormalized(const fa_t* const fa);
 
-      virtual VirtualMechanismInterface* Clone();
+      virtual interface_t* Clone();
 
-      void ComputeStateGivenPhase(const double phase_in, Eigen::VectorXd& state_out, Eigen::VectorXd& state_out_dot, double& phase_out, double& phase_out_dot);
+      /// Not for rt, the scratch buffers are local. With use_spline_xyz only the (const) splines are evaluated
+      /// and it can be called concurrently, otherwise see VirtualMechanismGmr::ComputeStateGivenPhase.
+      void ComputeStateGivenPhase(const double phase_in, vector_t& state_out, vector_t& state_out_dot, double& phase_out, double& phase_out_dot);
+      /// Batch version, each row of abscisses_in is an abscisse, the outputs have to be already allocated
+      void ComputeStatesGivenPhases(const Eigen::MatrixXd& abscisses_in, Eigen::MatrixXd& states_out, Eigen::MatrixXd& states_dot_out, Eigen::MatrixXd& phases_out, Eigen::MatrixXd& phases_dot_out);
 
       virtual bool CreateModelFromData(const Eigen::MatrixXd& data);
       virtual bool CreateModelFromFile(const std::string file_path);
+      virtual bool CreateModelFromRecord(const library::RecordView& record);
+      virtual bool SaveModelToRecord(library::Record& record);
+
+      /// The phase z is also a state of the robot
+      virtual int getInstanceStateSize() const;
+      virtual void SaveInstanceState(double* const instance_state) const;
+      virtual void LoadInstanceState(const double* const instance_state);
 
     protected:
 
@@ -124,11 +192,17 @@ class VirtualMechanismGmrNormalized: public VirtualMechanismGmr<VM_t>
       virtual void UpdateState();
       virtual void UpdateStateDot();
       void Normalize();
+      void CreateSplines();
       void AlignUpdateModel(const Eigen::MatrixXd& data);
 
-      tk::spline spline_phase_;
-      tk::spline spline_phase_inv_;
-      std::vector<tk::spline > splines_xyz_;
+      tool_box::CubicSpline spline_phase_; // abscisse (s) -> phase (z)
+      tool_box::CubicSpline spline_phase_inv_; // phase (z) -> abscisse (s)
+      tool_box::CubicSpline spline_xyz_; // phase (z) -> xyz, one channel for each coordinate
+      int seg_phase_, seg_phase_inv_, seg_xyz_; // Segment hints of the splines, only used by the real time update
+      /// Knots of the splines, kept to save them
+      std::vector<double> phase_knots_;
+      std::vector<double> abscisse_knots_;
+      std::vector<std::vector<double> > xyz_knots_;
       bool use_spline_xyz_;
       int n_points_splines_;
       double exec_time_;
@@ -137,7 +211,7 @@ class VirtualMechanismGmrNormalized: public VirtualMechanismGmr<VM_t>
       double z_dot_;
       double z_dot_ref_;
 
-      Eigen::MatrixXd Jz_;
+      jacobian_t Jz_;
 
       long long loopCnt;
 };
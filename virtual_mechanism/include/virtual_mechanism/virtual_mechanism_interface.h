@@ -38,6 +38,8 @@
 
 ////////// Toolbox
 #include <toolbox/toolbox.h>
+#include <toolbox/kdtree/kdtree.h>
+#include <toolbox/library/library.h>
 
 ////////// Autom
 #include "virtual_mechanism/virtual_mechanism_autom.h"
@@ -48,10 +50,47 @@ namespace virtual_mechanism
 {
     typedef Eigen::Quaternion<double> quaternion_t;
 
-class VirtualMechanismInterface
+/// Types used by the mechanisms, Dim is the dimension of the state.
+/// With a compile time dimension the states are fixed size and the gains diagonal,
+/// so that Eigen can unroll the computations without dynamic allocations.
+template <int Dim>
+struct VirtualMechanismTraits
+{
+    typedef Eigen::Matrix<double,Dim,1> vector_t;
+    typedef Eigen::Matrix<double,Dim,1> jacobian_t;
+    typedef Eigen::Matrix<double,1,Dim> jacobian_transp_t;
+    typedef Eigen::Matrix<double,1,1> torque_t;
+    typedef Eigen::Matrix<double,1,1> scalar_t;
+    typedef Eigen::DiagonalMatrix<double,Dim> gain_t;
+};
+
+/// Runtime dimension, use dynamic types
+template <>
+struct VirtualMechanismTraits<Eigen::Dynamic>
+{
+    typedef Eigen::VectorXd vector_t;
+    typedef Eigen::MatrixXd jacobian_t;
+    typedef Eigen::MatrixXd jacobian_transp_t;
+    typedef Eigen::VectorXd torque_t;
+    typedef Eigen::MatrixXd scalar_t;
+    typedef Eigen::MatrixXd gain_t;
+};
+
+template <int Dim>
+class VirtualMechanismInterfaceDim
 {
 	public:
-      VirtualMechanismInterface():update_quaternion_(false),phase_(0.0),
+      typedef VirtualMechanismInterfaceDim<Dim> interface_t;
+      typedef typename VirtualMechanismTraits<Dim>::vector_t vector_t;
+      typedef typename VirtualMechanismTraits<Dim>::jacobian_t jacobian_t;
+      typedef typename VirtualMechanismTraits<Dim>::jacobian_transp_t jacobian_transp_t;
+      typedef typename VirtualMechanismTraits<Dim>::torque_t torque_t;
+      typedef typename VirtualMechanismTraits<Dim>::scalar_t scalar_t;
+      typedef typename VirtualMechanismTraits<Dim>::gain_t gain_t;
+
+      EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+      VirtualMechanismInterfaceDim():update_quaternion_(false),phase_(0.0),
           phase_prev_(0.0),phase_dot_(0.0),phase_dot_ref_(0.0),
           phase_ddot_ref_(0.0),phase_ref_(0.0),phase_dot_prev_(0.0),
           phase_ddot_(0.0),scale_(1.0),
@@ -89,26 +128,29 @@ class VirtualMechanismInterface
 	  }
 	
       //VirtualMechanismInterface(const VirtualMechanismInterface& to_copy); // copy constructor
-      virtual VirtualMechanismInterface* Clone() = 0;
+      virtual VirtualMechanismInterfaceDim* Clone() = 0;
 
-	  virtual ~VirtualMechanismInterface()
+	  virtual ~VirtualMechanismInterfaceDim()
       {
       }
 	  
       inline bool ReadConfig()
       {
-          YAML::Node main_node = tool_box::CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+          YAML::Node main_node = tool_box::GetYamlNodeFromPkgName(ROS_PKG_NAME);
           if (const YAML::Node& curr_node = main_node["virtual_mechanism_interface"])
           {
               std::vector<double> K,B;
               curr_node["K"] >> K;
               curr_node["B"] >> B;
               curr_node["n_points_discretization"] >> n_points_discretization_;
+              curr_node["search_window"] >> search_window_;
 
               assert(n_points_discretization_ > 1);
+              assert(search_window_ >= 0);
 
               state_dim_ = K.size();
               assert(state_dim_ == 2 || state_dim_ == 3);
+              assert(Dim == Eigen::Dynamic || Dim == state_dim_);
               //assert(K.size() == static_cast<unsigned int>(state_dim_));
               assert(B.size() == K.size());
               for(unsigned int i=0; i<K.size(); i++)
@@ -118,16 +160,8 @@ class VirtualMechanismInterface
               }
 
               // Create a diagonal gain matrix
-              if(K.size() == 2)
-              {
-                K_ = Eigen::DiagonalMatrix<double,2>(K[0],K[1]);
-                B_ = Eigen::DiagonalMatrix<double,2>(B[0],B[1]);
-              }
-              else if(K.size() == 3)
-              {
-                K_ = Eigen::DiagonalMatrix<double,3>(K[0],K[1],K[2]);
-                B_ = Eigen::DiagonalMatrix<double,3>(B[0],B[1],B[2]);
-              }
+              K_ = Eigen::VectorXd::Map(&K[0],K.size()).asDiagonal();
+              B_ = Eigen::VectorXd::Map(&B[0],B.size()).asDiagonal();
 
               if (const YAML::Node& active_guide_node = curr_node["active_guide"])
               {
@@ -154,7 +188,7 @@ class VirtualMechanismInterface
 
       inline void CheckForActivation();
 
-      virtual void Update(Eigen::VectorXd& force, const double dt)
+      virtual void Update(vector_t& force, const double dt)
 	  {
         assert(dt > 0.0);
 
@@ -193,7 +227,7 @@ class VirtualMechanismInterface
         ComputeJacobianVersor();
 	  }
 
-      void UpdateDiscrete(const Eigen::VectorXd& pos)
+      void UpdateDiscrete(const vector_t& pos)
       {
 
         phase_dot_ = 0.0;
@@ -212,35 +246,39 @@ class VirtualMechanismInterface
         UpdateStateDot();
       }
 	  
-      void FindMinDist(const Eigen::VectorXd& pos)
+      void FindMinDist(const vector_t& pos)
       {
           assert(state_recorded_.rows() > 0);
           assert(pos.size() ==  state_recorded_.cols());
-          assert(tmp_dists_.size() == state_recorded_.rows());
           assert(phase_recorded_.rows() ==  state_recorded_.rows());
           assert(phase_recorded_.cols() ==  1);
+          assert(kdtree_.GetNbPoints() == state_recorded_.rows());
 
           int min_idx = 0;
-          double curr_d;
           double min = std::numeric_limits<double>::infinity();
-          for(unsigned int i_row = 0; i_row < state_recorded_.rows(); i_row++)
+
+          // Warm start: look around the current phase first, the closest point found
+          // bounds the kd-tree search so that most of the tree is pruned
+          if(search_window_ > 0)
           {
-              curr_d = (state_recorded_.row(i_row).transpose() - pos).norm();
-              if(curr_d < min)
+              const int n_points = phase_recorded_.rows();
+              const double* phases = phase_recorded_.data();
+              const int start_idx = std::lower_bound(phases,phases+n_points,phase_) - phases;
+              const int first_idx = std::max(start_idx - search_window_,0);
+              const int last_idx = std::min(start_idx + search_window_,n_points - 1);
+              double curr_d;
+              for(int i_row = first_idx; i_row <= last_idx; i_row++)
               {
-                  min = curr_d;
-                  min_idx = i_row;
+                  curr_d = (state_recorded_.row(i_row).transpose() - pos).squaredNorm();
+                  if(curr_d < min)
+                  {
+                      min = curr_d;
+                      min_idx = i_row;
+                  }
               }
-
-
           }
 
-          /*std::cout << "***" << std::endl;
-
-          std::cout << pos << std::endl;
-
-          std::cout << "***" << std::endl;
-          std::cout << state_recorded_.row(0).transpose() - pos << std::endl;*/
+          min_idx = kdtree_.FindNearest(pos,min_idx,min);
 
           phase_ = phase_recorded_(min_idx,0);
       }
@@ -251,7 +289,7 @@ class VirtualMechanismInterface
           phase_ddot_ = 0.0;
       }
 
-      inline void Update(const Eigen::VectorXd& pos, const Eigen::VectorXd& vel , const double dt, const double scale = 1.0)
+      inline void Update(const vector_t& pos, const vector_t& vel , const double dt, const double scale = 1.0)
 	  {
 	      assert(pos.size() == state_dim_);
 	      assert(vel.size() == state_dim_);
@@ -273,23 +311,28 @@ class VirtualMechanismInterface
           {
               UpdateDiscrete(pos);
           }
-
-          // Publish stuff
-#ifdef USE_ROS_RT_PUBLISHER
-          rt_publishers_.PublishAll();
-#endif
 	  }
 	  
       // Here to no break the polymorphism
-      virtual double ComputeResponsability(const Eigen::MatrixXd& pos){PRINT_ERROR("ComputeResponsability has not been defined.");}
+      /// Const, it can be called by several threads on the same guide
+      virtual double ComputeResponsability(const Eigen::MatrixXd& pos) const {PRINT_ERROR("ComputeResponsability has not been defined.");}
       virtual double GetResponsability(){PRINT_ERROR("GetResponsability has not been defined.");}
+      /// Weighted average log likelihood of representative points of a demonstration given the cached
+      /// summary of the model, false if the guide has no summary
+      virtual bool ComputeMergeScore(const Eigen::MatrixXd& points, const Eigen::VectorXd& weights, double& log_lik) const {return false;}
 
       virtual bool CreateModelFromData(const Eigen::MatrixXd& data)=0;
       virtual bool CreateModelFromFile(const std::string file_path)=0;
       virtual bool SaveModelToFile(const std::string file_path)=0;
+      /// Binary guide library: the record keeps the model and its precomputed tables
+      virtual bool CreateModelFromRecord(const library::RecordView& record)=0;
+      virtual bool SaveModelToRecord(library::Record& record)=0;
 
-      virtual double getDistance(const Eigen::VectorXd& pos)=0;
-      virtual double getScale(const Eigen::VectorXd& pos, const double convergence_factor = 1.0)=0;
+      virtual double getDistance(const vector_t& pos)=0;
+      virtual double getScale(const vector_t& pos, const double convergence_factor = 1.0)=0;
+      /// Diagonal gaussian of the model around the current state: inverse of the variances (state_dim values)
+      /// and log of the normalization, updated with the state. False if the guide has no variance.
+      virtual bool getLogDensity(double* const inv_variance, double& log_norm) const {return false;}
 
       inline double getTorque() const {return torque_(0,0);}
       inline double getFade() const {return fade_;}
@@ -303,11 +346,11 @@ class VirtualMechanismInterface
       inline double getKf() const {return Kf_;}
       inline double getBf() const {return Bf_;}
 
-      inline void getJacobianVersor(Eigen::VectorXd& t_versor) const {assert(t_versor.size() == state_dim_); t_versor = t_versor_;}
-      inline void getInitialPos(Eigen::VectorXd& state) const {assert(state.size() == state_dim_); state = initial_state_;}
-      inline void getFinalPos(Eigen::VectorXd& state) const {assert(state.size() == state_dim_); state = final_state_;}
-      inline void getState(Eigen::VectorXd& state) const {assert(state.size() == state_dim_); state = state_;}
-	  inline void getStateDot(Eigen::VectorXd& state_dot) const {assert(state_dot.size() == state_dim_); state_dot = state_dot_;}
+      inline void getJacobianVersor(vector_t& t_versor) const {assert(t_versor.size() == state_dim_); t_versor = t_versor_;}
+      inline void getInitialPos(vector_t& state) const {assert(state.size() == state_dim_); state = initial_state_;}
+      inline void getFinalPos(vector_t& state) const {assert(state.size() == state_dim_); state = final_state_;}
+      inline void getState(vector_t& state) const {assert(state.size() == state_dim_); state = state_;}
+	  inline void getStateDot(vector_t& state_dot) const {assert(state_dot.size() == state_dim_); state_dot = state_dot_;}
       inline void getJacobian(Eigen::MatrixXd& jacobian) const {jacobian = J_;}
       inline void getK(Eigen::MatrixXd& K) const {K = K_;}
       inline void getB(Eigen::MatrixXd& B) const {B = B_;}
@@ -320,18 +363,91 @@ class VirtualMechanismInterface
               q(3) = quaternion_->z();
       }
 
-      inline Eigen::VectorXd& getJacobianVersor() {return t_versor_;}
-      inline Eigen::VectorXd& getInitialPos() {return initial_state_;}
-      inline Eigen::VectorXd& getFinalPos() {return final_state_;}
-      inline Eigen::VectorXd& getState() {return state_;}
-      inline Eigen::VectorXd& getStateDot() {return state_dot_;}
-      inline Eigen::MatrixXd& getJacobian() {return J_;}
-      inline Eigen::MatrixXd& getK() {return K_;}
-      inline Eigen::MatrixXd& getB() {return B_;}
+      inline vector_t& getJacobianVersor() {return t_versor_;}
+      inline vector_t& getInitialPos() {return initial_state_;}
+      inline vector_t& getFinalPos() {return final_state_;}
+      inline vector_t& getState() {return state_;}
+      inline vector_t& getStateDot() {return state_dot_;}
+      inline jacobian_t& getJacobian() {return J_;}
+      inline gain_t& getK() {return K_;}
+      inline gain_t& getB() {return B_;}
+      inline const Eigen::MatrixXd& getStateRecorded() const {return state_recorded_;}
 
       //inline void setExecutionTime(const double time) {assert(time > 0.0); exec_time_ = time;}
       inline void setCollisionDetected(const bool collision) {collision_detected_ = collision;}
 
+      /// Per robot state: the same guide (model, tables, recorded refs) can be used by several robots,
+      /// each of them keeps its own state, loaded before the update of the guide and saved right after it.
+      /// The derived classes with more states append them to the ones of the base class.
+      virtual int getInstanceStateSize() const
+      {
+          return n_instance_scalars_ + 4 * state_dim_ + (update_quaternion_ ? 4 : 0);
+      }
+
+      virtual void SaveInstanceState(double* const instance_state) const
+      {
+          double* out = instance_state;
+          *out++ = phase_;
+          *out++ = phase_prev_;
+          *out++ = phase_dot_;
+          *out++ = phase_dot_prev_;
+          *out++ = phase_ddot_;
+          *out++ = phase_ref_;
+          *out++ = phase_dot_ref_;
+          *out++ = phase_ddot_ref_;
+          *out++ = scale_;
+          *out++ = fade_;
+          *out++ = fade_sys_.GetState();
+          *out++ = active_ ? 1.0 : 0.0;
+          *out++ = autom_.GetMode();
+          *out++ = dt_;
+          for(int i=0; i<state_dim_; i++)
+          {
+              out[i] = state_(i);
+              out[state_dim_ + i] = state_dot_(i);
+              out[2 * state_dim_ + i] = J_(i,0);
+              out[3 * state_dim_ + i] = t_versor_(i);
+          }
+          out += 4 * state_dim_;
+          if(update_quaternion_)
+          {
+              *out++ = quaternion_->w();
+              *out++ = quaternion_->x();
+              *out++ = quaternion_->y();
+              *out++ = quaternion_->z();
+          }
+      }
+
+      virtual void LoadInstanceState(const double* const instance_state)
+      {
+          const double* in = instance_state;
+          phase_ = *in++;
+          phase_prev_ = *in++;
+          phase_dot_ = *in++;
+          phase_dot_prev_ = *in++;
+          phase_ddot_ = *in++;
+          phase_ref_ = *in++;
+          phase_dot_ref_ = *in++;
+          phase_ddot_ref_ = *in++;
+          scale_ = *in++;
+          fade_ = *in++;
+          fade_sys_.SetState(*in++);
+          active_ = *in++ > 0.5;
+          autom_.SetMode(static_cast<int>(*in++));
+          dt_ = *in++;
+          for(int i=0; i<state_dim_; i++)
+          {
+              state_(i) = in[i];
+              state_dot_(i) = in[state_dim_ + i];
+              J_(i,0) = in[2 * state_dim_ + i];
+              J_transp_(0,i) = in[2 * state_dim_ + i];
+              t_versor_(i) = in[3 * state_dim_ + i];
+          }
+          in += 4 * state_dim_;
+          if(update_quaternion_)
+              *quaternion_ = quaternion_t(in[0],in[1],in[2],in[3]);
+      }
+
       inline void Init()
       {
           // Initialize the attributes
@@ -342,6 +458,7 @@ class VirtualMechanismInterface
           ComputeFinalState();
           ComputeJacobianVersor();
           CreateRecordedRefs();
+          kdtree_.Build(state_recorded_);
       }
 
       inline void Init(const std::vector<double>& q_start, const std::vector<double>& q_end)
@@ -359,39 +476,11 @@ class VirtualMechanismInterface
          Init();
       }
 
-      inline void InitRtPublishers(const std::string node_name)
-      {
-
-#ifdef USE_ROS_RT_PUBLISHER
-
-        // Reset the ros node (usefull if we change node's name)
-        if(ros_node_.InitDone())
-            ros_node_.Reset();
-
-        // Initialize the ros node and the rt-publishers
-        try
-        {
-              ros_node_.Init(node_name);
-              rt_publishers_.AddPublisher(ros_node_.GetNode(),"phase",&phase_);
-              rt_publishers_.AddPublisher(ros_node_.GetNode(),"phase_dot",&phase_dot_);
-              rt_publishers_.AddPublisher(ros_node_.GetNode(),"phase_dot",&phase_ddot_);
-              rt_publishers_.AddPublisher(ros_node_.GetNode(),"scale",&scale_);
-              rt_publishers_.AddPublisher(ros_node_.GetNode(),"phase_dot_ref",&phase_dot_ref_);
-        }
-        catch(const std::runtime_error& e)
-        {
-              ROS_ERROR("Failed to create the real time publishers: %s",e.what());
-        }
-#else
-        PRINT_WARNING("Impossible to start the real time publishers.");
-#endif
-      }
-
    protected:
 
 	  virtual void UpdateJacobian()=0;
 	  virtual void UpdateState()=0;
-	  virtual void UpdatePhase(const Eigen::VectorXd& force, const double dt)=0;
+	  virtual void UpdatePhase(const vector_t& force, const double dt)=0;
 	  virtual void ComputeInitialState()=0;
 	  virtual void ComputeFinalState()=0;
       virtual void CreateRecordedRefs()=0;
@@ -440,6 +529,8 @@ class VirtualMechanismInterface
           *quaternion_ = q_start_->slerp(phase_,*q_end_);
       }
 	  
+      static const int n_instance_scalars_ = 14; // Scalars saved by SaveInstanceState
+
       /// States
 	  double phase_;
 	  double phase_prev_;
@@ -451,31 +542,33 @@ class VirtualMechanismInterface
       double phase_ddot_;
       double scale_;
       int state_dim_;
-      Eigen::VectorXd displacement_;
-      Eigen::VectorXd state_;
-      Eigen::VectorXd state_dot_;
-	  Eigen::VectorXd torque_;
-      Eigen::VectorXd force_;
-      Eigen::VectorXd force_out_;
-      Eigen::VectorXd force_pos_;
-      Eigen::VectorXd force_vel_;
-	  Eigen::VectorXd initial_state_;
-	  Eigen::VectorXd final_state_;
-      Eigen::VectorXd t_versor_;
+      vector_t displacement_;
+      vector_t state_;
+      vector_t state_dot_;
+	  torque_t torque_;
+      vector_t force_;
+      vector_t force_out_;
+      vector_t force_pos_;
+      vector_t force_vel_;
+	  vector_t initial_state_;
+	  vector_t final_state_;
+      vector_t t_versor_;
       Eigen::ArrayXd tmp_dists_;
-      Eigen::MatrixXd BxJ_;
-      Eigen::MatrixXd JtxBxJ_;
-	  Eigen::MatrixXd J_;
-	  Eigen::MatrixXd J_transp_;
+      jacobian_t BxJ_;
+      scalar_t JtxBxJ_;
+	  jacobian_t J_;
+	  jacobian_transp_t J_transp_;
 
       // Discretization
       int n_points_discretization_;
       Eigen::MatrixXd state_recorded_;
       Eigen::MatrixXd phase_recorded_;
+      kdtree::KdTree kdtree_; // Spatial index of state_recorded_
+      int search_window_; // Points checked around the current phase before the kd-tree search
 
 	  // Gains
-      Eigen::MatrixXd B_;
-      Eigen::MatrixXd K_;
+      gain_t B_;
+      gain_t K_;
 
       /// Fade system
       tool_box::DynSystemFirstOrder fade_sys_;
@@ -496,19 +589,16 @@ class VirtualMechanismInterface
       boost::shared_ptr<quaternion_t > q_end_;
       boost::shared_ptr<quaternion_t > quaternion_;
 
-      /// Ros Stuff
-#ifdef USE_ROS_RT_PUBLISHER
-      tool_box::RosNode ros_node_;
-      tool_box::RealTimePublishers<tool_box::RealTimePublisherScalar> rt_publishers_;
-#endif
-
 };
   
-class VirtualMechanismInterfaceFirstOrder : public VirtualMechanismInterface
+template <int Dim>
+class VirtualMechanismInterfaceFirstOrderDim : public VirtualMechanismInterfaceDim<Dim>
 {
 	public:
-      VirtualMechanismInterfaceFirstOrder():
-      VirtualMechanismInterface()
+      typedef typename VirtualMechanismInterfaceDim<Dim>::vector_t vector_t;
+
+      VirtualMechanismInterfaceFirstOrderDim():
+      VirtualMechanismInterfaceDim<Dim>()
 	  {
 
         if(!ReadConfig())
@@ -522,7 +612,7 @@ class VirtualMechanismInterfaceFirstOrder : public VirtualMechanismInterface
 
       inline bool ReadConfig()
       {
-          YAML::Node main_node = tool_box::CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+          YAML::Node main_node = tool_box::GetYamlNodeFromPkgName(ROS_PKG_NAME);
           if (const YAML::Node& curr_node = main_node["first_order"])
           {
               //main_node["Bd_max"] >> Bd_max_;
@@ -542,41 +632,41 @@ class VirtualMechanismInterfaceFirstOrder : public VirtualMechanismInterface
 	  virtual void ComputeInitialState()=0;
 	  virtual void ComputeFinalState()=0;
 	  
-	  virtual void UpdatePhase(const Eigen::VectorXd& force, const double dt)
+	  virtual void UpdatePhase(const vector_t& force, const double dt)
 	  {
-          BxJ_.noalias() = B_ * J_;
-          JtxBxJ_.noalias() = J_transp_ * BxJ_;
+          this->BxJ_.noalias() = this->B_ * this->J_;
+          this->JtxBxJ_.noalias() = this->J_transp_ * this->BxJ_;
 
 	      // Adapt Bf
           /*Bd_ = std::exp(-4/epsilon_*JxJt_(0,0)) * Bd_max_; // NOTE: Since JxJt_ has dim 1x1 the determinant is the only value in it
 	      //Bf_ = std::exp(-4/epsilon_*JxJt_.determinant()) * Bf_max_; // NOTE JxJt_.determinant() is always positive! so it's ok
           det_ = B_ * JxJt_(0,0) + Bd_ * Bd_;*/
 
-          det_ = JtxBxJ_(0,0) + Bd_;
+          det_ = this->JtxBxJ_(0,0) + Bd_;
 
-	      torque_.noalias() = J_transp_ * force;
+	      this->torque_.noalias() = this->J_transp_ * force;
 	      
-          if(active_)
-              fade_sys_.IntegrateForward(dt);
+          if(this->active_)
+              this->fade_sys_.IntegrateForward(dt);
              //fade_ = fade_gain_ * (1 - fade_) * dt + fade_;
           else
-             fade_sys_.IntegrateBackward(dt);
+             this->fade_sys_.IntegrateBackward(dt);
              //fade_ = fade_gain_ * (-fade_) * dt + fade_;
 
-          fade_ = fade_sys_.GetState();
+          this->fade_ = this->fade_sys_.GetState();
 
           // Always keep the external torque
           //phase_dot_ = num_/det_ * torque_(0,0) + fade_ * (Kf_ * (phase_ref_ - phase_) + Bf_ * phase_dot_ref_);
 
           // Switch between open and closed loop with the external torque
-          phase_dot_ = num_/det_ * torque_(0,0);
-          phase_dot_ = fade_ *  phase_dot_ref_ + (1-fade_) * phase_dot_;
+          this->phase_dot_ = num_/det_ * this->torque_(0,0);
+          this->phase_dot_ = this->fade_ *  this->phase_dot_ref_ + (1-this->fade_) * this->phase_dot_;
 
 	      // Compute the new phase
-          phase_ = phase_dot_ * dt + phase_prev_;
+          this->phase_ = this->phase_dot_ * dt + this->phase_prev_;
 
            // Compute phase_ddot
-          phase_ddot_ = (phase_dot_ - phase_dot_prev_)/dt;
+          this->phase_ddot_ = (this->phase_dot_ - this->phase_dot_prev_)/dt;
 	  }
 
 	  double det_;
@@ -586,51 +676,78 @@ class VirtualMechanismInterfaceFirstOrder : public VirtualMechanismInterface
       //double epsilon_;
 };
 
-class VirtualMechanismInterfaceSecondOrder : public VirtualMechanismInterface
+template <int Dim>
+class VirtualMechanismInterfaceSecondOrderDim : public VirtualMechanismInterfaceDim<Dim>
 {
 	public:
-      VirtualMechanismInterfaceSecondOrder():
-      VirtualMechanismInterface()
+      typedef typename VirtualMechanismInterfaceDim<Dim>::vector_t vector_t;
+      typedef Eigen::Vector2d phase_state_t; // phase and phase_dot, fixed size: kept on the stack
+      enum integrator_t {RK4,SYMPLECTIC};
+
+      VirtualMechanismInterfaceSecondOrderDim():
+      VirtualMechanismInterfaceDim<Dim>()
       {
           if(!ReadConfig())
           {
             PRINT_ERROR("VirtualMechanismInterfaceSecondOrder: Can not read config file");
           }
 
-	      // Resize the attributes
-	      phase_state_.resize(2); //phase_ and phase_dot
-          phase_state_dot_.resize(2); //phase_dot and phase_ddot
-          phase_state_integrated_.resize(2);
-
-          phase_state_.fill(0.0);
-          phase_state_dot_.fill(0.0);
+          phase_state_.fill(0.0); //phase_ and phase_dot
+          phase_state_dot_.fill(0.0); //phase_dot and phase_ddot
           phase_state_integrated_.fill(0.0);
 
-	      k1_.resize(2);
-	      k2_.resize(2);
-	      k3_.resize(2);
-	      k4_.resize(2);
-	      
-	      k1_.fill(0.0);
-          k2_.fill(0.0);
-	      k3_.fill(0.0);
-	      k4_.fill(0.0);
-
           control_ = 0.0;
 	  }
 
       inline bool ReadConfig()
       {
-          YAML::Node main_node = tool_box::CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+          YAML::Node main_node = tool_box::GetYamlNodeFromPkgName(ROS_PKG_NAME);
           if (const YAML::Node& curr_node = main_node["second_order"])
           {
+              std::string integrator;
               curr_node["inertia"] >> inertia_;
+              curr_node["integrator"] >> integrator;
               assert(inertia_ > 0.0);
+              if(integrator == "symplectic")
+                  integrator_ = SYMPLECTIC;
+              else
+              {
+                  if(integrator != "rk4")
+                      PRINT_WARNING("VirtualMechanismInterfaceSecondOrder: Unknown integrator "<<integrator<<", using rk4");
+                  integrator_ = RK4;
+              }
               return true;
           }
           else
               return false;
       }
+
+      /// One step of phase_ddot = (- damping * phase_dot + input)/inertia
+      static inline void Integrate(const integrator_t integrator, const double dt, const double inv_inertia, const double damping, const double input,
+                                   const phase_state_t& phase_state, phase_state_t& phase_state_integrated)
+      {
+          switch(integrator)
+          {
+            case SYMPLECTIC:
+            {
+              // Semi-implicit Euler with implicit damping: the damping term never makes it unstable,
+              // unlike RK4 which needs dt * damping/inertia < 2.78 (the guide stiffness is still explicit)
+              phase_state_integrated(1) = (phase_state(1) + dt * inv_inertia * input)/(1.0 + dt * inv_inertia * damping);
+              phase_state_integrated(0) = phase_state(0) + dt * phase_state_integrated(1);
+              break;
+            }
+            case RK4:
+            default:
+            {
+              const phase_state_t k1 = DynSystem(inv_inertia,damping,input,phase_state);
+              const phase_state_t k2 = DynSystem(inv_inertia,damping,input,phase_state + 0.5*dt*k1);
+              const phase_state_t k3 = DynSystem(inv_inertia,damping,input,phase_state + 0.5*dt*k2);
+              const phase_state_t k4 = DynSystem(inv_inertia,damping,input,phase_state + dt*k3);
+              phase_state_integrated = phase_state + dt*(k1 + 2.0*(k2+k3) + k4)/6.0;
+              break;
+            }
+          }
+      }
 	
 	protected:
 	    
@@ -639,34 +756,12 @@ class VirtualMechanismInterfaceSecondOrder : public VirtualMechanismInterface
 	  virtual void ComputeInitialState()=0;
 	  virtual void ComputeFinalState()=0;
 
-      void IntegrateStepRungeKutta(const double& dt, const double& input1, const double& input2, const Eigen::VectorXd& phase_state, Eigen::VectorXd& phase_state_integrated)
-	  {
-	 
-	    phase_state_integrated = phase_state;
-	    
-        DynSystem(dt,input1,input2,phase_state_integrated);
-	    k1_ = phase_state_dot_;
-	    
-	    phase_state_integrated = phase_state_ + 0.5*dt*k1_;
-        DynSystem(dt,input1,input2,phase_state_integrated);
-	    k2_ = phase_state_dot_;
-	    
-	    phase_state_integrated = phase_state_ + 0.5*dt*k2_;
-        DynSystem(dt,input1,input2,phase_state_integrated);
-	    k3_ = phase_state_dot_;
-	    
-	    phase_state_integrated = phase_state_ + dt*k3_;
-        DynSystem(dt,input1,input2,phase_state_integrated);
-	    k4_ = phase_state_dot_;
-	    
-	    phase_state_integrated = phase_state_ + dt*(k1_ + 2.0*(k2_+k3_) + k4_)/6.0;
-	  
-	  }
-	  
-      inline void DynSystem(const double& dt, const double& input1, const double& input2, const Eigen::VectorXd& phase_state)
-	  {
-         phase_state_dot_(1) = (1/inertia_)*(- JtxBxJ_(0,0) * phase_state(1) - input1 + input2); // Old version with damping
-         phase_state_dot_(0) = phase_state(1);
+      /// phase_ddot = (- damping * phase_dot + input)/inertia
+      static inline phase_state_t DynSystem(const double inv_inertia, const double damping, const double input, const phase_state_t& phase_state)
+      {
+         phase_state_t phase_state_dot;
+         phase_state_dot(0) = phase_state(1);
+         phase_state_dot(1) = inv_inertia * (- damping * phase_state(1) + input);
 
          //phase_state_dot_(1) = (1/inertia_)*(- JtxBxJ_(0,0) * phase_state(1) - input1); // Old version with damping
          //phase_state_dot_(1) = (1/inertia_)*(- (B_ * JxJt_(0,0)  + F ) * phase_state(1) - input); // Version with friction
@@ -678,46 +773,60 @@ class VirtualMechanismInterfaceSecondOrder : public VirtualMechanismInterface
          //phase_state_dot_(1) = (1/inertia_)*( - input1 - 0.1 * phase_state(1) + input2 ); // FIXME 0.1 is just a little friction to avoid instability
          //phase_state_dot_(1) = (1/inertia_)*( - input1 - (1.0 - scale_) * 1.0 * phase_state(1) + input2 ); // dynamic brakes!
          //phase_state_dot_(0) = fade_ *  phase_dot_ref_  + (1-fade_) * phase_state(1);
-	  }
-	  
-	  virtual void UpdatePhase(const Eigen::VectorXd& force, const double dt)
+
+         return phase_state_dot;
+      }
+
+      /// Old version with damping, input1 is the torque and input2 the auto completion control:
+      /// phase_ddot = (1/inertia)*(- JtxBxJ * phase_dot - input1 + input2)
+      inline void IntegrateStep(const double dt, const double input1, const double input2, const phase_state_t& phase_state, phase_state_t& phase_state_integrated) const
+      {
+          Integrate(integrator_,dt,1.0/inertia_,this->JtxBxJ_(0,0),input2 - input1,phase_state,phase_state_integrated);
+      }
+
+	  virtual void UpdatePhase(const vector_t& force, const double dt)
 	  {
-          BxJ_.noalias() = B_ * J_;
-          JtxBxJ_.noalias() = J_transp_ * BxJ_;
+          this->BxJ_.noalias() = this->B_ * this->J_;
+          this->JtxBxJ_.noalias() = this->J_transp_ * this->BxJ_;
 
-	      torque_.noalias() = J_transp_ * force;
+	      this->torque_.noalias() = this->J_transp_ * force;
 
-          phase_state_(0) = phase_;
-          phase_state_(1) = phase_dot_;
+          phase_state_(0) = this->phase_;
+          phase_state_(1) = this->phase_dot_;
 	        
-          if(active_)
-              fade_sys_.IntegrateForward(dt);
+          if(this->active_)
+              this->fade_sys_.IntegrateForward(dt);
              //fade_ = fade_gain_ * (1 - fade_) * dt + fade_;
           else
-             fade_sys_.IntegrateBackward(dt);
+             this->fade_sys_.IntegrateBackward(dt);
              //fade_ = fade_gain_ * (-fade_) * dt + fade_;
 
-          fade_ = fade_sys_.GetState();
+          this->fade_ = this->fade_sys_.GetState();
 
-          control_ = fade_ * (Bf_ * (phase_dot_ref_ - phase_dot_) + Kf_ * (phase_ref_ - phase_));
+          control_ = this->fade_ * (this->Bf_ * (this->phase_dot_ref_ - this->phase_dot_) + this->Kf_ * (this->phase_ref_ - this->phase_));
 	      
-          IntegrateStepRungeKutta(dt,torque_(0),control_,phase_state_,phase_state_integrated_);
+          IntegrateStep(dt,this->torque_(0),control_,phase_state_,phase_state_integrated_);
 
-          DynSystem(dt,torque_(0),control_,phase_state_); // to compute the dots
+          phase_state_dot_ = DynSystem(1.0/inertia_,this->JtxBxJ_(0,0),control_ - this->torque_(0),phase_state_); // to compute the dots
 
-          phase_ = phase_state_integrated_(0);
-	      phase_dot_ = phase_state_integrated_(1);
-          phase_ddot_ = phase_state_dot_(1);
+          this->phase_ = phase_state_integrated_(0);
+	      this->phase_dot_ = phase_state_integrated_(1);
+          this->phase_ddot_ = phase_state_dot_(1);
 	  }
-	  
-	  Eigen::VectorXd phase_state_;
-	  Eigen::VectorXd phase_state_dot_;
-	  Eigen::VectorXd phase_state_integrated_;
-	  Eigen::VectorXd k1_, k2_, k3_, k4_;
+
+	  phase_state_t phase_state_;
+	  phase_state_t phase_state_dot_;
+	  phase_state_t phase_state_integrated_;
       double inertia_;
       double control_;
+      integrator_t integrator_;
 };
 
+/// Runtime dimension mechanisms
+typedef VirtualMechanismInterfaceDim<Eigen::Dynamic> VirtualMechanismInterface;
+typedef VirtualMechanismInterfaceFirstOrderDim<Eigen::Dynamic> VirtualMechanismInterfaceFirstOrder;
+typedef VirtualMechanismInterfaceSecondOrderDim<Eigen::Dynamic> VirtualMechanismInterfaceSecondOrder;
+
 }
 
 #endif
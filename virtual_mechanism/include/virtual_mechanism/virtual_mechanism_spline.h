@@ -28,7 +28,7 @@
 #include <virtual_mechanism/virtual_mechanism_interface.h>
 
 ////////// Toolbox
-#include "toolbox/spline/spline.h"
+#include <toolbox/math.h>
 
 namespace virtual_mechanism
 { 
@@ -38,14 +38,24 @@ class VirtualMechanismSpline: public VM_t
 {
 	public:
 
+      typedef typename VM_t::vector_t vector_t;
+      typedef typename VM_t::jacobian_t jacobian_t;
+
       VirtualMechanismSpline();
       VirtualMechanismSpline(const std::string file_path);
       VirtualMechanismSpline(const Eigen::MatrixXd& data);
 	  
-      virtual double getDistance(const Eigen::VectorXd& pos);
-      virtual double getScale(const Eigen::VectorXd& pos, const double convergence_factor = 1.0);
+      virtual double getDistance(const vector_t& pos);
+      virtual double getScale(const vector_t& pos, const double convergence_factor = 1.0);
       virtual bool SaveModelToFile(const std::string file_path);
-      void ComputeStateGivenPhase(const double phase_in, Eigen::VectorXd& state_out);
+      void ComputeStateGivenPhase(const double phase_in, vector_t& state_out);
+      /// Batch version, each row of phases_in is a phase, states_out has to be already allocated
+      void ComputeStatesGivenPhases(const Eigen::MatrixXd& phases_in, Eigen::MatrixXd& states_out);
+
+      /// The phase z is also a state of the robot
+      virtual int getInstanceStateSize() const;
+      virtual void SaveInstanceState(double* const instance_state) const;
+      virtual void LoadInstanceState(const double* const instance_state);
 	  
 	protected:
 
@@ -56,17 +66,20 @@ class VirtualMechanismSpline: public VM_t
       virtual void UpdateStateDot();
       virtual void ComputeInitialState();
       virtual void ComputeFinalState();
+      virtual void CreateRecordedRefs();
 
-      std::vector<tk::spline > splines_xyz_;
-      tk::spline spline_phase_;
-      tk::spline spline_phase_inv_;
+      tool_box::CubicSpline spline_xyz_; // phase (z) -> xyz, one channel for each coordinate
+      tool_box::CubicSpline spline_phase_; // abscisse (s) -> phase (z)
+      tool_box::CubicSpline spline_phase_inv_; // phase (z) -> abscisse (s)
+      int seg_phase_, seg_phase_inv_, seg_xyz_; // Segment hints of the splines, only used by the real time update
 
       double z_;
       double z_dot_;
       double z_dot_ref_;
 
-      Eigen::MatrixXd Jz_;
-      Eigen::VectorXd err_;
+      jacobian_t Jz_;
+      vector_t state_z_; // xyz at z_
+      vector_t err_;
 };
 
 }
@@ -34,9 +34,6 @@ using namespace std;
 namespace virtual_mechanism
 {
 
-typedef VirtualMechanismInterfaceFirstOrder VMP_1ord_t;
-typedef VirtualMechanismInterfaceSecondOrder VMP_2ord_t;
-
 VirtualMechanismFactory::VirtualMechanismFactory()
 {
     default_order_ = FIRST;
@@ -45,10 +42,40 @@ VirtualMechanismFactory::VirtualMechanismFactory()
 
 VirtualMechanismInterface* VirtualMechanismFactory::Build(const MatrixXd& data, const order_t order, const model_type_t model_type)
 {
-    VirtualMechanismInterface* vm_ptr = NULL;
+    return Build<Dynamic>(data,order,model_type);
+}
+
+VirtualMechanismInterface* VirtualMechanismFactory::Build(const string model_name, const order_t order, const model_type_t model_type)
+{
+    return Build<Dynamic>(model_name,order,model_type);
+}
+
+VirtualMechanismInterface* VirtualMechanismFactory::Build(const MatrixXd& data)
+{
+    return Build(data,default_order_,default_model_type_);
+}
+
+VirtualMechanismInterface* VirtualMechanismFactory::Build(const string model_name)
+{
+    return Build(model_name,default_order_,default_model_type_);
+}
+
+VirtualMechanismInterface* VirtualMechanismFactory::Build(const library::RecordView& record, const order_t order, const model_type_t model_type)
+{
+    return Build<Dynamic>(record,order,model_type);
+}
+
+VirtualMechanismInterface* VirtualMechanismFactory::Build(const library::RecordView& record)
+{
+    return Build(record,default_order_,default_model_type_);
+}
+
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::Build(const MatrixXd& data, const order_t order, const model_type_t model_type)
+{
+    VirtualMechanismInterfaceDim<Dim>* vm_ptr = NULL;
     try
     {
-        vm_ptr = CreateEmptyMechanism(order,model_type);
+        vm_ptr = CreateEmptyMechanism<Dim>(order,model_type);
     }
     catch(const runtime_error& e)
     {
@@ -63,12 +90,12 @@ VirtualMechanismInterface* VirtualMechanismFactory::Build(const MatrixXd& data,
     return vm_ptr;
 }
 
-VirtualMechanismInterface* VirtualMechanismFactory::Build(const string model_name, const order_t order, const model_type_t model_type)
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::Build(const string model_name, const order_t order, const model_type_t model_type)
 {
-    VirtualMechanismInterface* vm_ptr = NULL;
+    VirtualMechanismInterfaceDim<Dim>* vm_ptr = NULL;
     try
     {
-        vm_ptr = CreateEmptyMechanism(order,model_type);
+        vm_ptr = CreateEmptyMechanism<Dim>(order,model_type);
     }
     catch(const runtime_error& e)
     {
@@ -83,14 +110,39 @@ VirtualMechanismInterface* VirtualMechanismFactory::Build(const string model_nam
     return vm_ptr;
 }
 
-VirtualMechanismInterface* VirtualMechanismFactory::Build(const MatrixXd& data)
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::Build(const MatrixXd& data)
 {
-    return Build(data,default_order_,default_model_type_);
+    return Build<Dim>(data,default_order_,default_model_type_);
 }
 
-VirtualMechanismInterface* VirtualMechanismFactory::Build(const string model_name)
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::Build(const string model_name)
 {
-    return Build(model_name,default_order_,default_model_type_);
+    return Build<Dim>(model_name,default_order_,default_model_type_);
+}
+
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::Build(const library::RecordView& record, const order_t order, const model_type_t model_type)
+{
+    VirtualMechanismInterfaceDim<Dim>* vm_ptr = NULL;
+    try
+    {
+        vm_ptr = CreateEmptyMechanism<Dim>(order,model_type);
+    }
+    catch(const runtime_error& e)
+    {
+       PRINT_ERROR(e.what());
+    }
+
+    if(vm_ptr->CreateModelFromRecord(record))
+        vm_ptr->Init();
+    else
+        PRINT_ERROR("Can not create the mechanism from the library record "<<record.GetName()<<" in the factory");
+
+    return vm_ptr;
+}
+
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::Build(const library::RecordView& record)
+{
+    return Build<Dim>(record,default_order_,default_model_type_);
 }
 
 void VirtualMechanismFactory::SetDefaultPreferences(const order_t order, const model_type_t model_type)
@@ -116,25 +168,30 @@ void VirtualMechanismFactory::SetDefaultPreferences(const string order, const st
         PRINT_ERROR("VirtualMechanismFactory: Wrong model_type.");
 }
 
-VirtualMechanismInterface* VirtualMechanismFactory::CreateEmptyMechanism(const order_t order, const model_type_t model_type)
+void VirtualMechanismFactory::ReloadConfig()
+{
+    tool_box::ReloadYamlNodeFromPkgName(ROS_PKG_NAME);
+}
+
+template<int Dim> VirtualMechanismInterfaceDim<Dim>* VirtualMechanismFactory::CreateEmptyMechanism(const order_t order, const model_type_t model_type)
 {
-     VirtualMechanismInterface* vm_ptr = NULL;
+     VirtualMechanismInterfaceDim<Dim>* vm_ptr = NULL;
 
      switch(order)
      {
        case FIRST:
-         vm_ptr = SelectModel<VMP_1ord_t>(model_type);
+         vm_ptr = SelectModel<VirtualMechanismInterfaceFirstOrderDim<Dim> >(model_type);
          break;
        case SECOND:
-         vm_ptr = SelectModel<VMP_2ord_t>(model_type);
+         vm_ptr = SelectModel<VirtualMechanismInterfaceSecondOrderDim<Dim> >(model_type);
          break;
      }
      return vm_ptr;
 }
 
-template<typename ORDER>  VirtualMechanismInterface* VirtualMechanismFactory::SelectModel(const model_type_t model_type)
+template<typename ORDER> typename ORDER::interface_t* VirtualMechanismFactory::SelectModel(const model_type_t model_type)
 {
-    VirtualMechanismInterface* vm_ptr = NULL;
+    typename ORDER::interface_t* vm_ptr = NULL;
     switch(model_type)
     {
        case GMR:
@@ -147,4 +204,18 @@ template<typename ORDER>  VirtualMechanismInterface* VirtualMechanismFactory::Se
     return vm_ptr;
 }
 
+// Explicitly instantiate the fixed size builders
+template VirtualMechanismInterfaceDim<2>* VirtualMechanismFactory::Build<2>(const MatrixXd& data, const order_t order, const model_type_t model_type);
+template VirtualMechanismInterfaceDim<2>* VirtualMechanismFactory::Build<2>(const string model_name, const order_t order, const model_type_t model_type);
+template VirtualMechanismInterfaceDim<2>* VirtualMechanismFactory::Build<2>(const MatrixXd& data);
+template VirtualMechanismInterfaceDim<2>* VirtualMechanismFactory::Build<2>(const string model_name);
+template VirtualMechanismInterfaceDim<2>* VirtualMechanismFactory::Build<2>(const library::RecordView& record, const order_t order, const model_type_t model_type);
+template VirtualMechanismInterfaceDim<2>* VirtualMechanismFactory::Build<2>(const library::RecordView& record);
+template VirtualMechanismInterfaceDim<3>* VirtualMechanismFactory::Build<3>(const MatrixXd& data, const order_t order, const model_type_t model_type);
+template VirtualMechanismInterfaceDim<3>* VirtualMechanismFactory::Build<3>(const string model_name, const order_t order, const model_type_t model_type);
+template VirtualMechanismInterfaceDim<3>* VirtualMechanismFactory::Build<3>(const MatrixXd& data);
+template VirtualMechanismInterfaceDim<3>* VirtualMechanismFactory::Build<3>(const string model_name);
+template VirtualMechanismInterfaceDim<3>* VirtualMechanismFactory::Build<3>(const library::RecordView& record, const order_t order, const model_type_t model_type);
+template VirtualMechanismInterfaceDim<3>* VirtualMechanismFactory::Build<3>(const library::RecordView& record);
+
 } // namespace
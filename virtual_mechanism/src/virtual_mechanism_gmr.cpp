@@ -23,11 +23,13 @@
 
 #include "virtual_mechanism/virtual_mechanism_gmr.h"
 
+////////// STD
+#include <chrono>
+
 using namespace std;
 using namespace Eigen;
 using namespace tool_box;
 using namespace DmpBbo;
-using namespace tk;
 using namespace dtw;
 
 namespace virtual_mechanism
@@ -38,6 +40,7 @@ bool VirtualMechanismGmrNormalized<VM_t>::CreateModelFromData(const MatrixXd& da
 {
     VirtualMechanismGmr<VM_t>::CreateModelFromData(data);
     Normalize();
+    return true;
 }
 
 template<class VM_t>
@@ -52,6 +55,53 @@ bool VirtualMechanismGmrNormalized<VM_t>::CreateModelFromFile(const std::string
         return false;
 }
 
+template<class VM_t>
+bool VirtualMechanismGmrNormalized<VM_t>::CreateModelFromRecord(const library::RecordView& record)
+{
+    if(!VirtualMechanismGmr<VM_t>::CreateModelFromRecord(record))
+        return false;
+
+    // Use the saved knots if they have been created with the same configuration, otherwise normalize again
+    if(record.Has("phase_knots") && record.Get("phase_knots").rows() == n_points_splines_ && (!use_spline_xyz_ || record.Has("xyz_knots")))
+    {
+        const library::map_t phase_knots = record.Get("phase_knots");
+        const library::map_t abscisse_knots = record.Get("abscisse_knots");
+        phase_knots_.assign(phase_knots.data(),phase_knots.data()+n_points_splines_);
+        abscisse_knots_.assign(abscisse_knots.data(),abscisse_knots.data()+n_points_splines_);
+        xyz_knots_.clear();
+        if(use_spline_xyz_)
+        {
+            const library::map_t xyz_knots = record.Get("xyz_knots");
+            for(int j=0;j<VM_t::state_dim_;j++)
+                xyz_knots_.push_back(std::vector<double>(xyz_knots.col(j).data(),xyz_knots.col(j).data()+n_points_splines_));
+        }
+        CreateSplines();
+    }
+    else
+        Normalize();
+
+    return true;
+}
+
+template<class VM_t>
+bool VirtualMechanismGmrNormalized<VM_t>::SaveModelToRecord(library::Record& record)
+{
+    if(!VirtualMechanismGmr<VM_t>::SaveModelToRecord(record))
+        return false;
+
+    record.Add("phase_knots",Eigen::Map<const MatrixXd>(phase_knots_.data(),phase_knots_.size(),1));
+    record.Add("abscisse_knots",Eigen::Map<const MatrixXd>(abscisse_knots_.data(),abscisse_knots_.size(),1));
+    if(!xyz_knots_.empty())
+    {
+        MatrixXd xyz_knots(phase_knots_.size(),xyz_knots_.size());
+        for(size_t j=0;j<xyz_knots_.size();j++)
+            xyz_knots.col(j) = Eigen::Map<const VectorXd>(xyz_knots_[j].data(),xyz_knots_[j].size());
+        record.Add("xyz_knots",xyz_knots);
+    }
+
+    return true;
+}
+
 template <class VM_t>
 VirtualMechanismGmrNormalized<VM_t>::VirtualMechanismGmrNormalized(const std::string file_path):
     VirtualMechanismGmrNormalized()
@@ -84,6 +134,7 @@ VirtualMechanismGmrNormalized<VM_t>::VirtualMechanismGmrNormalized():
     z_ = 0.0;
     z_dot_ = 0.0;
     z_dot_ref_ = 0.1;
+    seg_phase_ = seg_phase_inv_ = seg_xyz_ = -1;
 }
 
 template <class VM_t>
@@ -92,25 +143,27 @@ VirtualMechanismGmrNormalized<VM_t>::VirtualMechanismGmrNormalized(const fa_t* c
     assert(fa!=NULL);
     assert(fa->isTrained());
     this->fa_ = dynamic_cast<fa_t*>(fa->clone());
+    this->CreateTable();
+    this->CreateMergeSummary();
     Normalize();
     VM_t::Init();
 }
 
 template<class VM_t>
-VirtualMechanismInterface* VirtualMechanismGmrNormalized<VM_t>::Clone()
+typename VM_t::interface_t* VirtualMechanismGmrNormalized<VM_t>::Clone()
 {
-    return new VirtualMechanismGmrNormalized<VM_t>(this->fa_);
+    // The splines are copied with the rest of the derived state, nothing is rebuilt
+    VirtualMechanismGmrNormalized<VM_t>* vm = new VirtualMechanismGmrNormalized<VM_t>(*this);
+    vm->CopyOwnedState();
+    return vm;
 }
 
 template <class VM_t>
 void VirtualMechanismGmrNormalized<VM_t>::Normalize()
 {
-    spline_phase_.clear(); // spline::clear()
-    spline_phase_inv_.clear(); // spline::clear()
-    splines_xyz_.clear(); // std::vector::clear()
-
-    std::vector<double> phase_for_spline(n_points_splines_);
-    std::vector<double> abscisse_for_spline(n_points_splines_);
+    phase_knots_.resize(n_points_splines_);
+    abscisse_knots_.resize(n_points_splines_);
+    xyz_knots_.clear();
 
     Eigen::MatrixXd input_phase(n_points_splines_,1);
     Eigen::MatrixXd output_position(n_points_splines_,VM_t::state_dim_);
@@ -119,55 +172,59 @@ void VirtualMechanismGmrNormalized<VM_t>::Normalize()
     input_phase.col(0) = VectorXd::LinSpaced(n_points_splines_, 0.0, 1.0);
 
     // Get xyz from GMR using a linspaced phase [0,1], preserve the rhythme
-    this->fa_->predict(input_phase,output_position);
+    VirtualMechanismGmr<VM_t>::ComputeStatesGivenPhases(input_phase,output_position);
     //fa_->predictDot(input_phase,output_position,output_position_dot);
 
+    for(int i=0;i<n_points_splines_;i++)
+        phase_knots_[i] = input_phase(i,0);
+
     if(use_spline_xyz_)
     {
-        vector<vector<double> > xyz(VM_t::state_dim_, vector<double>(n_points_splines_));
-        splines_xyz_.resize(VM_t::state_dim_);
+        xyz_knots_.assign(VM_t::state_dim_, vector<double>(n_points_splines_));
         // Copy to std vectors
         for(int i=0;i<n_points_splines_;i++)
-        {
-            phase_for_spline[i] = input_phase(i,0);
             for(int j=0;j<VM_t::state_dim_;j++)
-                xyz[j][i] = output_position(i,j);
-        }
-        for(int i=0;i<VM_t::state_dim_;i++)
-        {
-            splines_xyz_[i].set_points(phase_for_spline,xyz[i]);
-        }
-    }
-    else
-    {
-        for(int i=0;i<n_points_splines_;i++)
-            phase_for_spline[i] = input_phase(i,0);
+                xyz_knots_[j][i] = output_position(i,j);
     }
 
     // Compute the abscisse curviligne
-    abscisse_for_spline[0] = 0.0;
+    abscisse_knots_[0] = 0.0;
     //position_diff.row(0) = output_position.row(0);
     for(int i=0;i<position_diff.rows();i++)
     {
         position_diff.row(i) = output_position.row(i+1) - output_position.row(i);
-        abscisse_for_spline[i+1] = position_diff.row(i).norm() + abscisse_for_spline[i];
+        abscisse_knots_[i+1] = position_diff.row(i).norm() + abscisse_knots_[i];
     }
     // Normalize
-    for(int i=0;i<abscisse_for_spline.size();i++)
+    for(int i=0;i<abscisse_knots_.size();i++)
     {
-        abscisse_for_spline[i] = abscisse_for_spline[i]/abscisse_for_spline[n_points_splines_-1];
+        abscisse_knots_[i] = abscisse_knots_[i]/abscisse_knots_[n_points_splines_-1];
     }
 
-    //tool_box::WriteTxtFile("abscisse.txt",abscisse_for_spline);
+    //tool_box::WriteTxtFile("abscisse.txt",abscisse_knots_);
+
+    CreateSplines();
+}
+
+template <class VM_t>
+void VirtualMechanismGmrNormalized<VM_t>::CreateSplines()
+{
+    spline_phase_.Init(abscisse_knots_,phase_knots_); // z = f(s)
+    spline_phase_inv_.Init(phase_knots_,abscisse_knots_); // s = g(z)
 
-    spline_phase_.set_points(abscisse_for_spline,phase_for_spline); // set_points(x,y) ----> z = f(s)
-    spline_phase_inv_.set_points(phase_for_spline,abscisse_for_spline); // set_points(x,y) ----> s = g(z)
+    if(use_spline_xyz_)
+    {
+        MatrixXd xyz(n_points_splines_,VM_t::state_dim_);
+        for(int j=0;j<VM_t::state_dim_;j++)
+            xyz.col(j) = Eigen::Map<const VectorXd>(xyz_knots_[j].data(),n_points_splines_);
+        spline_xyz_.Init(Eigen::Map<const VectorXd>(phase_knots_.data(),n_points_splines_),xyz);
+    }
 }
 
 template<class VM_t>
 bool VirtualMechanismGmrNormalized<VM_t>::ReadConfig()
 {
-    YAML::Node main_node = CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+    YAML::Node main_node = GetYamlNodeFromPkgName(ROS_PKG_NAME);
     if (const YAML::Node& curr_node = main_node["gmr_normalized"])
     {
         curr_node["use_spline_xyz"] >> use_spline_xyz_;
@@ -201,7 +258,11 @@ void VirtualMechanismGmrNormalized<VM_t>::UpdateJacobian()
 
   z_dot_ref_ = 1.0/exec_time_;
 
-  z_dot_ = VM_t::fade_ *  z_dot_ref_ + (VM_t::fade_sys_.GetRef()-VM_t::fade_) * spline_phase_.compute_derivate(VM_t::phase_) * VM_t::phase_dot_; // FIXME constant value arbitrary
+  // abscisse (s) -> phase (z) and d(z)/d(s), a single evaluation for the tick
+  double z_s, dz_ds;
+  spline_phase_.Evaluate(VM_t::phase_,seg_phase_,&z_s,&dz_ds);
+
+  z_dot_ = VM_t::fade_ *  z_dot_ref_ + (VM_t::fade_sys_.GetRef()-VM_t::fade_) * dz_ds * VM_t::phase_dot_; // FIXME constant value arbitrary
 
   if(VM_t::active_)
   {
@@ -212,17 +273,19 @@ void VirtualMechanismGmrNormalized<VM_t>::UpdateJacobian()
   }
   else
   {
-      //z_dot_ = spline_phase_.compute_derivate(VM_t::phase_) * VM_t::phase_dot_;
-      z_ = spline_phase_(VM_t::phase_); // abscisse (s) -> phase (z)
+      //z_dot_ = dz_ds * VM_t::phase_dot_;
+      z_ = z_s; // abscisse (s) -> phase (z)
   }
 
   // HACKY THING
   // Compute the phase_dot_ref starting by the constant reference in z_dot
   // Ignore all the structure
   // Just out some stuff
-  VM_t::phase_dot_ref_ = spline_phase_inv_.compute_derivate(z_) * z_dot_ref_;
-  VM_t::phase_ddot_ref_ = spline_phase_inv_.compute_second_derivate(z_) * z_dot_ref_;
-  VM_t::phase_ref_ = spline_phase_inv_(z_);
+  double s_ref, ds_dz, d2s_dz2;
+  spline_phase_inv_.Evaluate(z_,seg_phase_inv_,&s_ref,&ds_dz,&d2s_dz2);
+  VM_t::phase_dot_ref_ = ds_dz * z_dot_ref_;
+  VM_t::phase_ddot_ref_ = d2s_dz2 * z_dot_ref_;
+  VM_t::phase_ref_ = s_ref;
 
   // Saturate z
   if(z_ > 1.0)
@@ -231,58 +294,90 @@ void VirtualMechanismGmrNormalized<VM_t>::UpdateJacobian()
     z_ = 0;
 
   this->fa_input_(0,0) = z_;
-  this->fa_->predictDot(this->fa_input_,this->fa_output_,this->fa_output_dot_,this->variance_); // We need this for the covariance
+  this->PredictDot(); // We need this for the covariance
   this->covariance_ = this->variance_.row(0).asDiagonal();
+  this->UpdateInvCov();
 
   if(!use_spline_xyz_) // Compute xyz and J(z) using GMR
   {
       Jz_ = this->fa_output_dot_.transpose(); // J(z)
-      VM_t::J_transp_ =  this->fa_output_dot_ * spline_phase_.compute_derivate(VM_t::phase_); // J(z) * d(z)/d(s) = J(s)
+      VM_t::J_transp_ =  this->fa_output_dot_ * dz_ds; // J(z) * d(z)/d(s) = J(s)
   }
   else // Compute xyz and J(z) using the spline
   {
-      for(int i=0;i<VM_t::state_dim_;i++)
-      {
-          this->fa_output_(0,i) = splines_xyz_[i](this->fa_input_(0,0));
-          Jz_(i,0) = splines_xyz_[i].compute_derivate(this->fa_input_(0,0));
-          VM_t::J_transp_(0,i) = Jz_(i,0) * spline_phase_.compute_derivate(VM_t::phase_);
-      }
+      spline_xyz_.Evaluate(this->fa_input_(0,0),seg_xyz_,this->fa_output_.data(),Jz_.data()); // All the coordinates at once
+      VM_t::J_transp_ = Jz_.transpose() * dz_ds;
   }
   VM_t::J_ = VM_t::J_transp_.transpose();
 }
 
 template <class VM_t>
-void VirtualMechanismGmrNormalized<VM_t>::ComputeStateGivenPhase(const double abscisse_in, VectorXd& state_out, VectorXd& state_out_dot, double& phase_out, double& phase_out_dot) // Not for rt
+void VirtualMechanismGmrNormalized<VM_t>::ComputeStateGivenPhase(const double abscisse_in, vector_t& state_out, vector_t& state_out_dot, double& phase_out, double& phase_out_dot) // Not for rt
 {
   assert(abscisse_in <= 1.0);
   assert(abscisse_in >= 0.0);
   assert(state_out.size() == VM_t::state_dim_);
   assert(state_out_dot.size() == VM_t::state_dim_);
-  MatrixXd fa_input, fa_output, fa_output_dot;
-  fa_input.resize(1,1);
-  fa_output.resize(1,VM_t::state_dim_);
-  fa_output_dot.resize(1,VM_t::state_dim_);
+  // Local buffers, the members are used by the real time update
+  MatrixXd fa_input(1,1);
 
-  fa_input(0,0) = spline_phase_(abscisse_in);
-  phase_out_dot = spline_phase_.compute_derivate(abscisse_in);
+  spline_phase_.Evaluate(abscisse_in,&fa_input(0,0),&phase_out_dot);
 
   if(!use_spline_xyz_)
   {
+      MatrixXd fa_output(1,VM_t::state_dim_), fa_output_dot(1,VM_t::state_dim_);
       this->fa_->predictDot(fa_input,fa_output,fa_output_dot);
       state_out = fa_output.transpose();
-      state_out_dot = fa_output_dot.transpose() * phase_out_dot;
+      state_out_dot.noalias() = fa_output_dot.transpose() * phase_out_dot;
   }
   else
-      for(int i=0;i<VM_t::state_dim_;i++)
-      {
-        state_out(i) =  splines_xyz_[i](fa_input(0,0));
-        state_out_dot(i) = splines_xyz_[i].compute_derivate(fa_input(0,0)) * phase_out_dot;
-      }
+  {
+      spline_xyz_.Evaluate(fa_input(0,0),state_out.data(),state_out_dot.data());
+      state_out_dot *= phase_out_dot;
+  }
 
   phase_out = fa_input(0,0);
 
 }
 
+template <class VM_t>
+void VirtualMechanismGmrNormalized<VM_t>::ComputeStatesGivenPhases(const MatrixXd& abscisses_in, MatrixXd& states_out, MatrixXd& states_dot_out, MatrixXd& phases_out, MatrixXd& phases_dot_out) // Not for rt
+{
+  const int n_points = abscisses_in.rows();
+  assert(abscisses_in.cols() == 1);
+  assert(states_out.rows() == n_points && states_out.cols() == VM_t::state_dim_);
+  assert(states_dot_out.rows() == n_points && states_dot_out.cols() == VM_t::state_dim_);
+  assert(phases_out.rows() == n_points && phases_out.cols() == 1);
+  assert(phases_dot_out.rows() == n_points && phases_dot_out.cols() == 1);
+
+  // With ordered abscisses the splines find the segments in O(1)
+  int seg = -1;
+  for(int i=0;i<n_points;i++)
+  {
+      assert(abscisses_in(i,0) <= 1.0);
+      assert(abscisses_in(i,0) >= 0.0);
+      spline_phase_.Evaluate(abscisses_in(i,0),seg,&phases_out(i,0),&phases_dot_out(i,0));
+  }
+
+  if(!use_spline_xyz_)
+  {
+      // All the phases in a single call
+      this->fa_->predictDot(phases_out,states_out,states_dot_out);
+      states_dot_out.array().colwise() *= phases_dot_out.col(0).array();
+  }
+  else
+  {
+      VectorXd state(VM_t::state_dim_), state_dot(VM_t::state_dim_);
+      seg = -1;
+      for(int i=0;i<n_points;i++)
+      {
+          spline_xyz_.Evaluate(phases_out(i,0),seg,state.data(),state_dot.data());
+          states_out.row(i) = state.transpose();
+          states_dot_out.row(i) = state_dot.transpose() * phases_dot_out(i,0);
+      }
+  }
+}
+
 template<class VM_t>
 void VirtualMechanismGmrNormalized<VM_t>::UpdateState()
 {
@@ -295,6 +390,30 @@ void VirtualMechanismGmrNormalized<VM_t>::UpdateStateDot()
     VM_t::state_dot_ = this->Jz_ * this->z_dot_; // Keep the velocities of the demonstrations
 }
 
+template<class VM_t>
+int VirtualMechanismGmrNormalized<VM_t>::getInstanceStateSize() const
+{
+    return VirtualMechanismGmr<VM_t>::getInstanceStateSize() + 2;
+}
+
+template<class VM_t>
+void VirtualMechanismGmrNormalized<VM_t>::SaveInstanceState(double* const instance_state) const
+{
+    VirtualMechanismGmr<VM_t>::SaveInstanceState(instance_state);
+    double* out = instance_state + VirtualMechanismGmr<VM_t>::getInstanceStateSize();
+    out[0] = z_;
+    out[1] = z_dot_;
+}
+
+template<class VM_t>
+void VirtualMechanismGmrNormalized<VM_t>::LoadInstanceState(const double* const instance_state)
+{
+    VirtualMechanismGmr<VM_t>::LoadInstanceState(instance_state);
+    const double* in = instance_state + VirtualMechanismGmr<VM_t>::getInstanceStateSize();
+    z_ = in[0];
+    z_dot_ = in[1];
+}
+
 template <class VM_t>
 bool VirtualMechanismGmr<VM_t>::SaveModelToFile(const string file_path)
 {
@@ -317,14 +436,20 @@ VirtualMechanismGmr<VM_t>::VirtualMechanismGmr(): VM_t()
     fa_output_.resize(1,VM_t::state_dim_);
     fa_output_dot_.resize(1,VM_t::state_dim_);
     variance_.resize(1,VM_t::state_dim_);
+    variance_dot_.resize(1,VM_t::state_dim_);
     covariance_.resize(VM_t::state_dim_,VM_t::state_dim_);
     covariance_inv_.resize(VM_t::state_dim_,VM_t::state_dim_);
     err_.resize(VM_t::state_dim_);
     variance_.fill(1.0);
     covariance_ = variance_.row(0).asDiagonal();
     covariance_inv_.fill(0.0);
+    UpdateInvCov();
     err_.fill(0.0);
+    variance_dot_.fill(0.0);
+    table_error_ = 0.0;
     fa_ = NULL;
+    responsability_ = 0.0;
+    recorded_refs_loaded_ = false;
 }
 
 template <class VM_t>
@@ -350,24 +475,67 @@ VirtualMechanismGmr<VM_t>::VirtualMechanismGmr(const fa_t* const fa) : VirtualMe
     assert(fa!=NULL);
     assert(fa->isTrained());
     fa_ = dynamic_cast<fa_t*>(fa->clone());
+    CreateTable();
+    CreateMergeSummary();
     VM_t::Init();
 }
 
 template<class VM_t>
-VirtualMechanismInterface* VirtualMechanismGmr<VM_t>::Clone()
+typename VM_t::interface_t* VirtualMechanismGmr<VM_t>::Clone()
 {
-    return new VirtualMechanismGmr<VM_t>(fa_);
+    // Member wise copy: the statistics of gmm_ are kept for the next updates, the tables, the merge summary,
+    // the recorded references and the kd-tree are copied instead of being rebuilt from the model
+    VirtualMechanismGmr<VM_t>* vm = new VirtualMechanismGmr<VM_t>(*this);
+    vm->CopyOwnedState();
+    return vm;
+}
+
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::CopyOwnedState()
+{
+    // After a member wise copy the pointers are still the ones of the original
+    if(fa_ != NULL)
+        fa_ = dynamic_cast<fa_t*>(fa_->clone());
+    if(VM_t::quaternion_)
+        VM_t::quaternion_.reset(new quaternion_t(*VM_t::quaternion_));
 }
 
 template<class VM_t>
 bool VirtualMechanismGmr<VM_t>::ReadConfig()
 {
-    YAML::Node main_node = CreateYamlNodeFromPkgName(ROS_PKG_NAME);
+    YAML::Node main_node = GetYamlNodeFromPkgName(ROS_PKG_NAME);
     if (const YAML::Node& curr_node = main_node["gmr"])
     {
         curr_node["n_gaussians"] >> n_gaussians_;
         curr_node["use_align"] >> use_align_;
+        curr_node["dtw_radius"] >> dtw_radius_;
+        curr_node["use_streaming_em"] >> use_streaming_em_;
+        std::string em_init;
+        int em_threads;
+        double em_history_weight;
+        curr_node["em_init"] >> em_init;
+        curr_node["em_restarts"] >> em_restarts_;
+        curr_node["em_threads"] >> em_threads;
+        curr_node["em_max_iter"] >> em_max_iter_;
+        curr_node["em_tol"] >> em_tol_;
+        curr_node["em_history_weight"] >> em_history_weight;
+        if(em_init != "slicing" && em_init != "kmeans++")
+            PRINT_WARNING("VirtualMechanismGmr: Unknown em_init "<<em_init<<", using slicing");
+        em_kmeans_init_ = (em_init == "kmeans++");
+        assert(em_restarts_ > 0);
+        assert(em_threads >= 0);
+        assert(em_max_iter_ > 0);
+        assert(em_tol_ >= 0.0);
+        if(em_threads == 0)
+            em_threads = std::max(static_cast<int>(boost::thread::hardware_concurrency()),1);
+        gmm_.SetNbThreads(em_threads);
+        gmm_.SetHistoryWeight(em_history_weight);
+        curr_node["use_table"] >> use_table_;
+        curr_node["n_points_table"] >> n_points_table_;
+        curr_node["n_points_summary"] >> n_points_summary_;
         assert(n_gaussians_ > 0);
+        assert(n_points_table_ > 1);
+        assert(n_points_summary_ >= 0);
         return true;
     }
     else
@@ -393,6 +561,9 @@ bool VirtualMechanismGmr<VM_t>::CreateModelFromData(const MatrixXd& data)
     assert(fa_->getExpectedInputDim() == 1);
     assert(fa_->getExpectedOutputDim() == VM_t::state_dim_);
 
+    CreateTable();
+    CreateMergeSummary();
+
     return true;
 }
 
@@ -405,12 +576,88 @@ bool VirtualMechanismGmr<VM_t>::CreateModelFromFile(const std::string file_path)
         fa_ = new fa_t(model_parameters_gmr);
         assert(fa_->getExpectedInputDim() == 1);
         assert(fa_->getExpectedOutputDim() == VM_t::state_dim_);
+        CreateTable();
+        CreateMergeSummary();
         return true;
     }
     else
         return false;
 }
 
+template<class VM_t>
+bool VirtualMechanismGmr<VM_t>::CreateModelFromRecord(const library::RecordView& record)
+{
+    if(!record.Has("state_dim") || !record.Has("gmr_parameters") || static_cast<int>(record.GetScalar("state_dim")) != VM_t::state_dim_)
+        return false;
+
+    // Create a model with the right sizes, then copy all its parameters at once
+    const library::map_t parameters = record.Get("gmr_parameters");
+    const int dim = VM_t::state_dim_;
+    const int n = parameters.size()/(3 + 2*dim + dim*dim); // prior, mean_x, mean_y, covar_x, covar_y, covar_y_x
+    if(n == 0 || parameters.cols() != 1)
+        return false;
+    std::vector<double> priors(n,1.0/n);
+    std::vector<VectorXd> means_x(n,VectorXd::Zero(1)), means_y(n,VectorXd::Zero(dim));
+    std::vector<MatrixXd> covars_x(n,MatrixXd::Identity(1,1)), covars_y(n,MatrixXd::Identity(dim,dim)), covars_y_x(n,MatrixXd::Zero(dim,1));
+    ModelParametersGMR* model_parameters_gmr = new ModelParametersGMR(priors,means_x,means_y,covars_x,covars_y,covars_y_x);
+    model_parameters_gmr->setParameterVectorAll(parameters);
+    delete fa_;
+    fa_ = new fa_t(model_parameters_gmr);
+    assert(fa_->getExpectedInputDim() == 1);
+    assert(fa_->getExpectedOutputDim() == VM_t::state_dim_);
+
+    // Use the saved tables if they have been created with the same configuration
+    if(use_table_ && record.Has("mean_table") && record.Get("mean_table").rows() == n_points_table_)
+    {
+        mean_table_.Init(record.Get("mean_table"),record.Get("mean_table_dot"));
+        variance_table_.Init(record.Get("variance_table"),record.Get("variance_table_dot"));
+        table_error_ = record.GetScalar("table_error");
+    }
+    else
+        CreateTable();
+    CreateMergeSummary();
+
+    if(record.Has("state_recorded") && record.Get("state_recorded").rows() == VM_t::n_points_discretization_
+       && record.Get("state_recorded").cols() == VM_t::state_dim_)
+    {
+        VM_t::state_recorded_ = record.Get("state_recorded");
+        VM_t::phase_recorded_ = record.Get("phase_recorded");
+        recorded_refs_loaded_ = true;
+    }
+
+    return true;
+}
+
+template<class VM_t>
+bool VirtualMechanismGmr<VM_t>::SaveModelToRecord(library::Record& record)
+{
+    if(fa_ == NULL || !fa_->isTrained())
+        return false;
+
+    const ModelParametersGMR* model_parameters_gmr = static_cast<const ModelParametersGMR*>(fa_->getModelParameters());
+    VectorXd parameters;
+    model_parameters_gmr->getParameterVectorAll(parameters);
+    record.Add("state_dim",VM_t::state_dim_);
+    record.Add("gmr_parameters",parameters);
+
+    if(!mean_table_.IsEmpty())
+    {
+        MatrixXd values, derivatives;
+        mean_table_.GetSamples(values,derivatives);
+        record.Add("mean_table",values);
+        record.Add("mean_table_dot",derivatives);
+        variance_table_.GetSamples(values,derivatives);
+        record.Add("variance_table",values);
+        record.Add("variance_table_dot",derivatives);
+        record.Add("table_error",table_error_);
+    }
+
+    record.Add("state_recorded",VM_t::state_recorded_);
+    record.Add("phase_recorded",VM_t::phase_recorded_);
+
+    return true;
+}
+
 template <class VM_t>
 VirtualMechanismGmr<VM_t>::~VirtualMechanismGmr()
 {
@@ -418,19 +665,36 @@ VirtualMechanismGmr<VM_t>::~VirtualMechanismGmr()
 }
 
 template<class VM_t>
-void VirtualMechanismGmr<VM_t>::ComputeStateGivenPhase(const double phase_in, VectorXd& state_out) // Not for rt
+void VirtualMechanismGmr<VM_t>::ComputeStateGivenPhase(const double phase_in, vector_t& state_out) // Not for rt
 {
   assert(phase_in <= 1.0);
   assert(phase_in >= 0.0);
   assert(state_out.size() == VM_t::state_dim_);
-  MatrixXd fa_input, fa_output;
-  fa_input.resize(1,1);
-  fa_output.resize(1,VM_t::state_dim_);
+  MatrixXd fa_input(1,1), fa_output(1,VM_t::state_dim_); // Local buffers, the members are used by the real time update
   fa_input(0,0) = phase_in;
   fa_->predict(fa_input,fa_output);
   state_out = fa_output.transpose();
 }
 
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::ComputeStatesGivenPhases(const MatrixXd& phases_in, MatrixXd& states_out) // Not for rt
+{
+  assert(phases_in.cols() == 1);
+  assert(states_out.rows() == phases_in.rows());
+  assert(states_out.cols() == VM_t::state_dim_);
+  fa_->predict(phases_in,states_out);
+}
+
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::ComputeStatesGivenPhases(const MatrixXd& phases_in, MatrixXd& states_out, MatrixXd& states_dot_out, MatrixXd& variances_out) // Not for rt
+{
+  assert(phases_in.cols() == 1);
+  assert(states_out.rows() == phases_in.rows() && states_out.cols() == VM_t::state_dim_);
+  assert(states_dot_out.rows() == phases_in.rows() && states_dot_out.cols() == VM_t::state_dim_);
+  assert(variances_out.rows() == phases_in.rows() && variances_out.cols() == VM_t::state_dim_);
+  fa_->predictDot(phases_in,states_out,states_dot_out,variances_out);
+}
+
 template<class VM_t>
 void VirtualMechanismGmr<VM_t>::ComputeInitialState() 
 {
@@ -448,9 +712,10 @@ void VirtualMechanismGmr<VM_t>::UpdateJacobian()
 {
   fa_input_(0,0) = VM_t::phase_; // Convert to Eigen Matrix
 
-  fa_->predictDot(fa_input_,fa_output_,fa_output_dot_,variance_);
+  PredictDot();
 
   covariance_ = variance_.row(0).asDiagonal();
+  UpdateInvCov();
 
   //covariance_ = variance_;
   
@@ -464,6 +729,110 @@ void VirtualMechanismGmr<VM_t>::UpdateState()
   VM_t::state_ = fa_output_.transpose();
 }
 
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::PredictDot()
+{
+  // Mean, its derivative and the variance given fa_input_
+  if(use_table_ && !mean_table_.IsEmpty())
+  {
+      mean_table_.Evaluate(fa_input_(0,0),fa_output_,fa_output_dot_);
+      variance_table_.Evaluate(fa_input_(0,0),variance_,variance_dot_);
+  }
+  else
+      fa_->predictDot(fa_input_,fa_output_,fa_output_dot_,variance_);
+}
+
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::CreateTable() // Not for rt
+{
+  if(!use_table_)
+      return;
+
+  assert(fa_ != NULL);
+
+  MatrixXd means(n_points_table_,VM_t::state_dim_), means_dot(n_points_table_,VM_t::state_dim_);
+  MatrixXd variances(n_points_table_,VM_t::state_dim_), variances_dot(n_points_table_,VM_t::state_dim_);
+  MatrixXd phase(n_points_table_,1);
+  phase.col(0) = VectorXd::LinSpaced(n_points_table_, 0.0, 1.0);
+
+  // Sample the exact model on the knots
+  ComputeStatesGivenPhases(phase,means,means_dot,variances);
+
+  // The model does not give the variance derivative, use finite differences
+  for(int i=0;i<n_points_table_;i++)
+  {
+      int prev = std::max(i-1,0);
+      int next = std::min(i+1,n_points_table_-1);
+      variances_dot.row(i) = (variances.row(next) - variances.row(prev))/(phase(next) - phase(prev));
+  }
+
+  mean_table_.Init(means,means_dot);
+  variance_table_.Init(variances,variances_dot);
+
+  // Estimate the error against the exact model inside each interval: the error of the Hermite interpolation
+  // is the largest in the middle with exact derivatives, at one third and two thirds from the derivatives errors
+  // (the finite differences of the variance)
+  static const double check_t[3] = {1.0/3.0, 0.5, 2.0/3.0};
+  const int n_intervals = n_points_table_-1;
+  const int n_check = 3 * n_intervals;
+  MatrixXd phase_check(n_check,1), output(n_check,VM_t::state_dim_), output_dot(n_check,VM_t::state_dim_), variance(n_check,VM_t::state_dim_);
+  MatrixXd output_table(1,VM_t::state_dim_), output_dot_table(1,VM_t::state_dim_);
+  MatrixXd variance_table(1,VM_t::state_dim_), variance_dot_table(1,VM_t::state_dim_);
+  for(int i=0;i<n_intervals;i++)
+      for(int k=0;k<3;k++)
+          phase_check(3*i+k,0) = phase(i,0) + check_t[k] * (phase(i+1,0) - phase(i,0));
+  ComputeStatesGivenPhases(phase_check,output,output_dot,variance);
+  double error_dot = 0.0;
+  double error_variance = 0.0;
+  table_error_ = 0.0;
+  for(int i=0;i<n_check;i++)
+  {
+      mean_table_.Evaluate(phase_check(i,0),output_table,output_dot_table);
+      variance_table_.Evaluate(phase_check(i,0),variance_table,variance_dot_table);
+      table_error_ = std::max(table_error_,(output.row(i) - output_table).cwiseAbs().maxCoeff());
+      error_dot = std::max(error_dot,(output_dot.row(i) - output_dot_table).cwiseAbs().maxCoeff());
+      error_variance = std::max(error_variance,(variance.row(i) - variance_table).cwiseAbs().maxCoeff());
+  }
+  table_error_ = std::max(table_error_,error_variance);
+
+  PRINT_INFO("GMR table with "<<n_points_table_<<" points, max error on the mean and the variance: "<<table_error_<<" on the derivative: "<<error_dot);
+}
+
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::CreateMergeSummary() // Not for rt
+{
+  merge_summary_.Clear();
+  if(n_points_summary_ == 0)
+      return;
+
+  if(gmm_.IsTrained())
+  {
+      // The components of the model: marginals of the (phase, position) gaussians over the position
+      const int n = gmm_.GetNbComponents();
+      std::vector<VectorXd> means(n);
+      std::vector<MatrixXd> covars(n);
+      for(int k=0;k<n;k++)
+      {
+          means[k] = gmm_.GetMeans()[k].tail(VM_t::state_dim_);
+          covars[k] = gmm_.GetCovars()[k].bottomRightCorner(VM_t::state_dim_,VM_t::state_dim_);
+      }
+      merge_summary_.Init(gmm_.GetPriors(),means,covars);
+      return;
+  }
+
+  // The parameters of a model trained or loaded by the function approximator are internal to it,
+  // the mixture is sampled along the guide: n_points_summary gaussians with the GMR mean and variance
+  assert(fa_ != NULL);
+
+  MatrixXd means(n_points_summary_,VM_t::state_dim_), means_dot(n_points_summary_,VM_t::state_dim_);
+  MatrixXd variances(n_points_summary_,VM_t::state_dim_);
+  MatrixXd phase(n_points_summary_,1);
+  phase.col(0) = VectorXd::LinSpaced(n_points_summary_, 0.0, 1.0);
+
+  ComputeStatesGivenPhases(phase,means,means_dot,variances);
+  merge_summary_.InitDiagonal(means,variances);
+}
+
 /*template<class VM_t>
 double VirtualMechanismGmr<VM_t>::PolynomScale(const VectorXd& pos, double w) //  0.001 [m]
 {
@@ -479,54 +848,54 @@ double VirtualMechanismGmr<VM_t>::PolynomScale(const VectorXd& pos, double w) //
 template<class VM_t>
 void VirtualMechanismGmr<VM_t>::UpdateInvCov()
 {
-  for (int i = 0; i<VM_t::state_dim_; i++) // NOTE We assume that is a diagonal matrix
-        covariance_inv_(i,i) = 1/(covariance_(i,i));
-        //covariance_inv_(i,i) = 1.0;
+  // NOTE We assume that is a diagonal matrix, the log of the normalization of the gaussian
+  // log(((2\pi)^N*|\Sigma|)^(-1/2)) is computed here once per update with a single log
+  double determinant_cov = 1.0;
+  for (int i = 0; i<VM_t::state_dim_; i++)
+  {
+    covariance_inv_(i,i) = 1/(covariance_(i,i));
+    determinant_cov *= covariance_(i,i);
+  }
+  log_norm_ = -0.5 * (VM_t::state_dim_ * std::log(2*M_PI) + std::log(determinant_cov));
 
   //covariance_inv_ = covariance_.inverse();
 }
 
 template<class VM_t>
-double VirtualMechanismGmr<VM_t>::ComputeProbability(const VectorXd& pos)
+double VirtualMechanismGmr<VM_t>::ComputeLogProbability(const vector_t& pos)
 {
-  UpdateInvCov();
-
   err_ = pos - VM_t::state_;
 
   // NOTE Since the covariance matrix is a diagonal matrix:
-  // output = exp(-0.5*err_.transpose()*covariance_inv_*err_);
+  // -0.5*err_.transpose()*covariance_inv_*err_
   // becomes:
-  double prob = 0.0;
-  double determinant_cov = 1.0;
-  for (int i = 0; i<VM_t::state_dim_; i++)
-  {
-    prob += err_(i)*err_(i)*covariance_inv_(i,i);
-    determinant_cov *= covariance_(i,i);
-  }
-
-  prob = exp(-0.5*prob);
-
-  //prob_ = exp(-0.5*err_.transpose()*covariance_inv_*err_);
-  //determinant_cov = covariance_inv_.determinant();
-
-  // For invertible matrices (which covar apparently was), det(A^-1) = 1/det(A)
-  // Hence the 1.0/covariance_inv_.determinant() below
-  //  ( (2\pi)^N*|\Sigma| )^(-1/2)
+  return log_norm_ - 0.5 * err_.cwiseAbs2().dot(covariance_inv_.diagonal());
+}
 
-  prob *= pow(pow(2*M_PI,VM_t::state_.size()) * determinant_cov,-0.5);
+template<class VM_t>
+double VirtualMechanismGmr<VM_t>::ComputeProbability(const vector_t& pos)
+{
+  return std::exp(ComputeLogProbability(pos));
+}
 
-  return prob;
+template<class VM_t>
+bool VirtualMechanismGmr<VM_t>::getLogDensity(double* const inv_variance, double& log_norm) const
+{
+  for (int i = 0; i<VM_t::state_dim_; i++)
+    inv_variance[i] = covariance_inv_(i,i);
+  log_norm = log_norm_;
+  return true;
 }
 
 template<class VM_t>
-double VirtualMechanismGmr<VM_t>::getScale(const VectorXd& pos, const double convergence_factor)
+double VirtualMechanismGmr<VM_t>::getScale(const vector_t& pos, const double convergence_factor)
 {
   return  std::exp(-convergence_factor*getDistance(pos));
   //return ComputeProbability(pos);
 }
 
 template<class VM_t>
-double VirtualMechanismGmr<VM_t>::getDistance(const VectorXd& pos)
+double VirtualMechanismGmr<VM_t>::getDistance(const vector_t& pos)
 {
   err_ = pos - VM_t::state_;
   return err_.norm();
@@ -550,7 +919,61 @@ void VirtualMechanismGmr<VM_t>::TrainModel(const MatrixXd& data)
     //phase.col(0) = VectorXd::LinSpaced(pos.rows(), 0.0, 1.0); // Time
     ComputeAbscisse(pos,phase); // Abscisse
   }
-  fa_->trainIncremental(phase,pos);
+  FitModel(phase,pos);
+}
+
+template<class VM_t>
+void VirtualMechanismGmr<VM_t>::FitModel(const MatrixXd& phase, const MatrixXd& pos)
+{
+  // A model loaded from file has no statistics, in this case use the function approximator training
+  if(use_streaming_em_ && (gmm_.IsTrained() || !fa_->isTrained()))
+  {
+      MatrixXd samples(phase.rows(),1+VM_t::state_dim_);
+      samples << phase, pos;
+
+      const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      int n_iter;
+      if(gmm_.IsTrained())
+          n_iter = gmm_.Update(samples,em_max_iter_,em_tol_); // Warm start from the current components
+      else
+      {
+          if(em_kmeans_init_)
+              gmm_.InitKMeansPlusPlus(samples,n_gaussians_);
+          else
+              gmm_.InitSlicing(samples,n_gaussians_);
+          n_iter = gmm_.TrainRestarts(samples,em_restarts_,0,em_max_iter_,em_tol_);
+      }
+      const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      delete fa_;
+      fa_ = new fa_t(CreateModelParameters());
+      responsability_ = fa_->computeResponsability(pos);
+
+      PRINT_INFO("GMM updated with "<<samples.rows()<<" samples in "<<n_iter<<" iterations and "<<elapsed<<" s, log likelihood "
+                 <<gmm_.GetLastLogLikelihood()<<", "<<gmm_.GetNbSamples()<<" samples learned");
+  }
+  else
+      fa_->trainIncremental(phase,pos);
+}
+
+template<class VM_t>
+ModelParametersGMR* VirtualMechanismGmr<VM_t>::CreateModelParameters() const
+{
+  // The first dimension of the gmm is the phase (input), the others are the position (output)
+  const int n = gmm_.GetNbComponents();
+  std::vector<VectorXd> means_x(n), means_y(n);
+  std::vector<MatrixXd> covars_x(n), covars_y(n), covars_y_x(n);
+  for(int k=0;k<n;k++)
+  {
+      const VectorXd& mean = gmm_.GetMeans()[k];
+      const MatrixXd& covar = gmm_.GetCovars()[k];
+      means_x[k] = mean.head(1);
+      means_y[k] = mean.tail(VM_t::state_dim_);
+      covars_x[k] = covar.topLeftCorner(1,1);
+      covars_y[k] = covar.bottomRightCorner(VM_t::state_dim_,VM_t::state_dim_);
+      covars_y_x[k] = covar.bottomLeftCorner(VM_t::state_dim_,1);
+  }
+  return new ModelParametersGMR(gmm_.GetPriors(),means_x,means_y,covars_x,covars_y,covars_y_x);
 }
 
 template<class VM_t>
@@ -563,7 +986,7 @@ void VirtualMechanismGmr<VM_t>::AlignUpdateModel(const MatrixXd& data)
     MatrixXd phase_ref(n_points,1);
     phase_ref.col(0) = VectorXd::LinSpaced(n_points, 0.0, 1.0);
 
-    this->fa_->predict(phase_ref,pos_ref);
+    ComputeStatesGivenPhases(phase_ref,pos_ref);
 
     // Extract the phase and the pos
     if(data.cols() == VM_t::state_dim_ + 1) // phase + pos
@@ -582,26 +1005,40 @@ void VirtualMechanismGmr<VM_t>::AlignUpdateModel(const MatrixXd& data)
     //std::string file_name = "/home/sybot/gennaro_output/phase_before.txt";
     //WriteTxtFile(file_name.c_str(),phase);
 
-    align_phase(phase,phase_ref,pos,pos_ref);
+    align_phase_fast(phase,phase_ref,pos,pos_ref,dtw_radius_);
 
     //file_name = "/home/sybot/gennaro_output/phase_after.txt";
     //WriteTxtFile(file_name.c_str(),phase);
 
-    fa_->trainIncremental(phase,pos);
+    FitModel(phase,pos);
 }
 
 template<class VM_t>
-double VirtualMechanismGmr<VM_t>::ComputeResponsability(const MatrixXd& pos)
+double VirtualMechanismGmr<VM_t>::ComputeResponsability(const MatrixXd& pos) const
 {
-    return fa_->computeResponsability(pos);
+    // The evaluation of the function approximator writes into its buffers,
+    // it is done on a copy owned by the caller so fa_ is never modified
+    boost::scoped_ptr<fa_t> fa(dynamic_cast<fa_t*>(fa_->clone()));
+    return fa->computeResponsability(pos);
 }
 
 template<class VM_t>
 double VirtualMechanismGmr<VM_t>::GetResponsability()
 {
+    if(use_streaming_em_ && gmm_.IsTrained())
+        return responsability_;
     return fa_->getCachedResponsability();
 }
 
+template<class VM_t>
+bool VirtualMechanismGmr<VM_t>::ComputeMergeScore(const MatrixXd& points, const VectorXd& weights, double& log_lik) const
+{
+    if(merge_summary_.IsEmpty() || points.cols() != VM_t::state_dim_)
+        return false;
+    log_lik = merge_summary_.LogLikelihood(points,weights);
+    return true;
+}
+
 template<class VM_t>
 void VirtualMechanismGmr<VM_t>::CreateRecordedRefs()
 {
@@ -609,12 +1046,20 @@ void VirtualMechanismGmr<VM_t>::CreateRecordedRefs()
     //VM_t::state_recorded_.resize(n_points,VM_t::state_dim_);
     //VM_t::phase_recorded_ = VectorXd::LinSpaced(n_points, 0.0, 1.0);
 
+    VM_t::tmp_dists_.resize(VM_t::n_points_discretization_);
+
+    // Loaded with the model, the next ones are computed again
+    if(recorded_refs_loaded_)
+    {
+        recorded_refs_loaded_ = false;
+        return;
+    }
+
     VM_t::state_recorded_.resize(VM_t::n_points_discretization_,VM_t::state_dim_);
     VM_t::phase_recorded_.resize(VM_t::n_points_discretization_,1);
-    VM_t::tmp_dists_.resize(VM_t::n_points_discretization_);
     VM_t::phase_recorded_.col(0) = VectorXd::LinSpaced(VM_t::n_points_discretization_, 0.0, 1.0);
 
-    fa_->predict(VM_t::phase_recorded_,VM_t::state_recorded_);
+    ComputeStatesGivenPhases(VM_t::phase_recorded_,VM_t::state_recorded_);
 }
 
 // Explicitly instantiate the templates, and its member definitions
@@ -622,4 +1067,13 @@ template class VirtualMechanismGmr<VirtualMechanismInterfaceFirstOrder>;
 template class VirtualMechanismGmr<VirtualMechanismInterfaceSecondOrder>;
 template class VirtualMechanismGmrNormalized<VirtualMechanismInterfaceFirstOrder>;
 template class VirtualMechanismGmrNormalized<VirtualMechanismInterfaceSecondOrder>;
+// Fixed size versions
+template class VirtualMechanismGmr<VirtualMechanismInterfaceFirstOrderDim<2> >;
+template class VirtualMechanismGmr<VirtualMechanismInterfaceSecondOrderDim<2> >;
+template class VirtualMechanismGmrNormalized<VirtualMechanismInterfaceFirstOrderDim<2> >;
+template class VirtualMechanismGmrNormalized<VirtualMechanismInterfaceSecondOrderDim<2> >;
+template class VirtualMechanismGmr<VirtualMechanismInterfaceFirstOrderDim<3> >;
+template class VirtualMechanismGmr<VirtualMechanismInterfaceSecondOrderDim<3> >;
+template class VirtualMechanismGmrNormalized<VirtualMechanismInterfaceFirstOrderDim<3> >;
+template class VirtualMechanismGmrNormalized<VirtualMechanismInterfaceSecondOrderDim<3> >;
 }
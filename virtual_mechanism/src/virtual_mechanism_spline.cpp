@@ -26,7 +26,6 @@
 using namespace std;
 using namespace Eigen;
 using namespace tool_box;
-using namespace tk;
 
 namespace virtual_mechanism
 {
@@ -39,25 +38,22 @@ bool VirtualMechanismSpline<VM_t>::LoadModelFromFile(const string file_path)
 
     int n_points = data.size();
 
-    vector<double> abscissa(n_points,0.0);
-    vector<double> phase(n_points,0.0);
-    vector<vector<double> > xyz(VM_t::state_dim_, std::vector<double>(n_points));
+    VectorXd abscissa(n_points);
+    VectorXd phase(n_points);
+    MatrixXd xyz(n_points,VM_t::state_dim_);
 
     for(int i=0;i<n_points;i++)
     {
-        abscissa[i] = data[i][0];
-        phase[i] =  data[i][1];
+        abscissa(i) = data[i][0];
+        phase(i) =  data[i][1];
         for(int j=0;j<VM_t::state_dim_;j++)
-            xyz[j][i] = data[i][j+2];
+            xyz(i,j) = data[i][j+2];
     }
 
-    splines_xyz_.resize(VM_t::state_dim_);
+    spline_xyz_.Init(phase,xyz);
 
-    for(int i=0;i<VM_t::state_dim_;i++)
-        splines_xyz_[i].set_points(phase,xyz[i]);
-
-    spline_phase_.set_points(abscissa,phase); // set_points(x,y) ----> z = f(s)
-    spline_phase_inv_.set_points(phase,abscissa); // set_points(x,y) ----> s = g(z)
+    spline_phase_.Init(abscissa,phase); // z = f(s)
+    spline_phase_inv_.Init(phase,abscissa); // s = g(z)
 
     return true;
 }
@@ -69,12 +65,15 @@ VirtualMechanismSpline<VM_t>::VirtualMechanismSpline(const string file_path):
     LoadModelFromFile(file_path);
 
     Jz_.resize(VM_t::state_dim_,1);
+    state_z_.resize(VM_t::state_dim_);
+    state_z_.fill(0.0);
     err_.resize(VM_t::state_dim_);
     err_.fill(0.0);
 
     z_ = 0.0;
     z_dot_ = 0.0;
     z_dot_ref_ = 0.1;
+    seg_phase_ = seg_phase_inv_ = seg_xyz_ = -1;
 }
 
 template <typename VM_t>
@@ -82,16 +81,22 @@ void VirtualMechanismSpline<VM_t>::UpdateJacobian()
 {
     z_dot_ref_ = 1.0/VM_t::exec_time_;
 
-    z_dot_ = VM_t::fade_ *  z_dot_ref_ + (VM_t::fade_sys_.GetRef()-VM_t::fade_) * spline_phase_.compute_derivate(VM_t::phase_) * VM_t::phase_dot_; // FIXME constant value arbitrary
+    // abscisse (s) -> phase (z) and d(z)/d(s), a single evaluation for the tick
+    double z_s, dz_ds;
+    spline_phase_.Evaluate(VM_t::phase_,seg_phase_,&z_s,&dz_ds);
+
+    z_dot_ = VM_t::fade_ *  z_dot_ref_ + (VM_t::fade_sys_.GetRef()-VM_t::fade_) * dz_ds * VM_t::phase_dot_; // FIXME constant value arbitrary
 
     if(VM_t::active_)
         z_ = z_dot_ * VM_t::dt_ + z_;
     else
-        z_ = spline_phase_(VM_t::phase_); // abscisse (s) -> phase (z)
+        z_ = z_s; // abscisse (s) -> phase (z)
 
-    VM_t::phase_dot_ref_ = spline_phase_inv_.compute_derivate(z_) * z_dot_ref_;
-    VM_t::phase_ddot_ref_ = spline_phase_inv_.compute_second_derivate(z_) * z_dot_ref_;
-    VM_t::phase_ref_ = spline_phase_inv_(z_);
+    double s_ref, ds_dz, d2s_dz2;
+    spline_phase_inv_.Evaluate(z_,seg_phase_inv_,&s_ref,&ds_dz,&d2s_dz2);
+    VM_t::phase_dot_ref_ = ds_dz * z_dot_ref_;
+    VM_t::phase_ddot_ref_ = d2s_dz2 * z_dot_ref_;
+    VM_t::phase_ref_ = s_ref;
 
     // Saturate z
     if(z_ > 1.0)
@@ -99,12 +104,9 @@ void VirtualMechanismSpline<VM_t>::UpdateJacobian()
     else if (z_ < 0.0)
       z_ = 0;
 
-    for(int i=0;i<VM_t::state_dim_;i++)
-    {
-        //this->fa_output_(0,i) = splines_xyz_[i](z_);
-        Jz_(i,0) = splines_xyz_[i].compute_derivate(z_);
-        VM_t::J_transp_(0,i) = Jz_(i,0) * spline_phase_.compute_derivate(VM_t::phase_);
-    }
+    // The state is evaluated with the jacobian, UpdateState uses it
+    spline_xyz_.Evaluate(z_,seg_xyz_,state_z_.data(),Jz_.data());
+    VM_t::J_transp_ = Jz_.transpose() * dz_ds;
 
     VM_t::J_ = VM_t::J_transp_.transpose();
 }
@@ -112,8 +114,7 @@ void VirtualMechanismSpline<VM_t>::UpdateJacobian()
 template<typename VM_t>
 void VirtualMechanismSpline<VM_t>::UpdateState()
 {
-    for(int i=0;i<VM_t::state_dim_;i++)
-        VM_t::state_(i) = splines_xyz_[i](z_);
+    VM_t::state_ = state_z_;
 }
 
 template<typename VM_t>
@@ -123,14 +124,67 @@ void VirtualMechanismSpline<VM_t>::UpdateStateDot()
 }
 
 template<class VM_t>
-void VirtualMechanismSpline<VM_t>::ComputeStateGivenPhase(const double phase_in, VectorXd& state_out)
+int VirtualMechanismSpline<VM_t>::getInstanceStateSize() const
+{
+    return VM_t::getInstanceStateSize() + 2;
+}
+
+template<class VM_t>
+void VirtualMechanismSpline<VM_t>::SaveInstanceState(double* const instance_state) const
+{
+    VM_t::SaveInstanceState(instance_state);
+    double* out = instance_state + VM_t::getInstanceStateSize();
+    out[0] = z_;
+    out[1] = z_dot_;
+}
+
+template<class VM_t>
+void VirtualMechanismSpline<VM_t>::LoadInstanceState(const double* const instance_state)
+{
+    VM_t::LoadInstanceState(instance_state);
+    const double* in = instance_state + VM_t::getInstanceStateSize();
+    z_ = in[0];
+    z_dot_ = in[1];
+}
+
+template<class VM_t>
+void VirtualMechanismSpline<VM_t>::ComputeStateGivenPhase(const double phase_in, vector_t& state_out)
 {
    assert(phase_in <= 1.0);
    assert(phase_in >= 0.0);
    assert(state_out.size() == VM_t::state_dim_);
 
-   for(int i=0;i<VM_t::state_dim_;i++)
-       state_out(i) = splines_xyz_[i](phase_in);
+   spline_xyz_.Evaluate(phase_in,state_out.data());
+}
+
+template<class VM_t>
+void VirtualMechanismSpline<VM_t>::ComputeStatesGivenPhases(const MatrixXd& phases_in, MatrixXd& states_out) // Not for rt
+{
+   assert(phases_in.cols() == 1);
+   assert(states_out.rows() == phases_in.rows());
+   assert(states_out.cols() == VM_t::state_dim_);
+
+   // With ordered phases the spline finds the segment in O(1)
+   VectorXd state(VM_t::state_dim_);
+   int seg = -1;
+   for(int i=0;i<phases_in.rows();i++)
+   {
+       assert(phases_in(i,0) <= 1.0);
+       assert(phases_in(i,0) >= 0.0);
+       spline_xyz_.Evaluate(phases_in(i,0),seg,state.data());
+       states_out.row(i) = state.transpose();
+   }
+}
+
+template<class VM_t>
+void VirtualMechanismSpline<VM_t>::CreateRecordedRefs()
+{
+    VM_t::state_recorded_.resize(VM_t::n_points_discretization_,VM_t::state_dim_);
+    VM_t::phase_recorded_.resize(VM_t::n_points_discretization_,1);
+    VM_t::tmp_dists_.resize(VM_t::n_points_discretization_);
+    VM_t::phase_recorded_.col(0) = VectorXd::LinSpaced(VM_t::n_points_discretization_, 0.0, 1.0);
+
+    ComputeStatesGivenPhases(VM_t::phase_recorded_,VM_t::state_recorded_);
 }
 
 /*template<class VM_t>
@@ -170,14 +224,14 @@ bool VirtualMechanismSpline<VM_t>::SaveModelToFile(const string file_path)
 }
 
 template<class VM_t>
-double VirtualMechanismSpline<VM_t>::getDistance(const VectorXd& pos)
+double VirtualMechanismSpline<VM_t>::getDistance(const vector_t& pos)
 {
   err_ = pos - VM_t::state_;
   return err_.norm();
 }
 
 template<class VM_t>
-double VirtualMechanismSpline<VM_t>::getScale(const VectorXd& pos, const double convergence_factor)
+double VirtualMechanismSpline<VM_t>::getScale(const vector_t& pos, const double convergence_factor)
 {
   return  std::exp(-convergence_factor*getDistance(pos));
 }
@@ -185,4 +239,9 @@ double VirtualMechanismSpline<VM_t>::getScale(const VectorXd& pos, const double
 // Explicitly instantiate the templates, and its member definitions
 template class VirtualMechanismSpline<VirtualMechanismInterfaceFirstOrder>;
 template class VirtualMechanismSpline<VirtualMechanismInterfaceSecondOrder>;
+// Fixed size versions
+template class VirtualMechanismSpline<VirtualMechanismInterfaceFirstOrderDim<2> >;
+template class VirtualMechanismSpline<VirtualMechanismInterfaceSecondOrderDim<2> >;
+template class VirtualMechanismSpline<VirtualMechanismInterfaceFirstOrderDim<3> >;
+template class VirtualMechanismSpline<VirtualMechanismInterfaceSecondOrderDim<3> >;
 }
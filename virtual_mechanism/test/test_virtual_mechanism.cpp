@@ -122,6 +122,36 @@ TEST(VirtualMechanismFactory, BuildDefault)
     EXPECT_NO_THROW(vm_ptr = vm_factory.Build(file_path));
 }
 
+TEST(VirtualMechanismFactory, BuildFixedSize)
+{
+    VirtualMechanismInterfaceDim<2>* vm_ptr = NULL;
+
+    int n_points = 50;
+    int test_dim = 2;
+    Eigen::MatrixXd data(n_points,test_dim); // No phase
+
+    for (int i=0; i<data.cols(); i++)
+        data.col(i) = Eigen::VectorXd::LinSpaced(n_points, 0.0, 1.0);
+
+    order = FIRST;
+    model_type = GMR;
+    EXPECT_NO_THROW(vm_ptr = vm_factory.Build<2>(data,order,model_type));
+    delete vm_ptr;
+    order = SECOND;
+    model_type = GMR_NORMALIZED;
+    EXPECT_NO_THROW(vm_ptr = vm_factory.Build<2>(file_path,order,model_type));
+
+    Eigen::Vector2d pos(0.5,0.5);
+    Eigen::Vector2d vel(0.0,0.0);
+    double dt = 0.001;
+
+    START_REAL_TIME_CRITICAL_CODE();
+    EXPECT_NO_THROW(vm_ptr->Update(pos,vel,dt,vm_ptr->getScale(pos)));
+    END_REAL_TIME_CRITICAL_CODE();
+
+    delete vm_ptr;
+}
+
 TEST(VirtualMechanismFactory, Clone)
 {
     VirtualMechanismInterface* vm_ptr = NULL;
@@ -195,6 +225,48 @@ TEST(VirtualMechanismFactory, Clone)
   }
   EXPECT_NO_THROW(vm2.getStateDot(state_dot));
 }*/
+
+TEST(VirtualMechanismSecondOrder, SemiImplicitIntegrator)
+{
+  typedef VirtualMechanismInterfaceSecondOrder VMP_2ord_t;
+  typedef VMP_2ord_t::phase_state_t phase_state_t;
+
+  // phase_ddot = (- damping * phase_dot + input)/inertia: phase_dot goes to input/damping with the time constant inertia/damping
+  const double inv_inertia = 1.0/0.1; // As in the config
+  const double damping = 5.0;
+  const double input = 2.0;
+  const double phase_dot_final = input/damping;
+
+  // At the nominal period, the same trajectory of RK4 within the first order error of the semi-implicit Euler (dt/time constant)
+  double dt = 0.001;
+  phase_state_t rk4 = phase_state_t::Zero();
+  phase_state_t symplectic = phase_state_t::Zero();
+  double max_error = 0.0;
+  for (int i=0;i<1000;i++)
+  {
+    VMP_2ord_t::Integrate(VMP_2ord_t::RK4,dt,inv_inertia,damping,input,rk4,rk4);
+    VMP_2ord_t::Integrate(VMP_2ord_t::SYMPLECTIC,dt,inv_inertia,damping,input,symplectic,symplectic);
+    max_error = std::max(max_error,(rk4 - symplectic).cwiseAbs().maxCoeff());
+  }
+  EXPECT_LT(max_error,dt * damping * inv_inertia * phase_dot_final);
+  EXPECT_NEAR(rk4(1),phase_dot_final,1e-9);
+  EXPECT_NEAR(symplectic(1),phase_dot_final,1e-9);
+
+  // With dt * damping/inertia = 5 RK4 diverges, the semi-implicit Euler still converges without oscillations
+  dt = 0.1;
+  rk4.setZero();
+  symplectic.setZero();
+  for (int i=0;i<100;i++)
+  {
+    VMP_2ord_t::Integrate(VMP_2ord_t::RK4,dt,inv_inertia,damping,input,rk4,rk4);
+    VMP_2ord_t::Integrate(VMP_2ord_t::SYMPLECTIC,dt,inv_inertia,damping,input,symplectic,symplectic);
+    EXPECT_GE(symplectic(1),0.0);
+    EXPECT_LE(symplectic(1),phase_dot_final);
+  }
+  EXPECT_GT(std::abs(rk4(1)),1e3 * phase_dot_final);
+  EXPECT_NEAR(symplectic(1),phase_dot_final,1e-9);
+}
+
 /*
 TEST(VirtualMechanismGmrTest, TestDtw)
 {
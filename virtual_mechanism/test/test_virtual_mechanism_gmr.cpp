@@ -41,6 +41,8 @@
 #include <fstream> 
 #include <iterator>
 #include <boost/concept_check.hpp>
+#include <boost/thread.hpp>
+#include <boost/filesystem.hpp>
 
 ////////// ROS
 #include <ros/ros.h>
@@ -152,6 +154,207 @@ TEST(VirtualMechanismGmrTest, GetMethods)
   EXPECT_NO_THROW(vm2.getStateDot(state_dot));
 }
 
+TEST(VirtualMechanismGmrTest, BatchEvaluation)
+{
+  VirtualMechanismGmr<VMP_1ord_t> vm1(file_path);
+  VirtualMechanismGmrNormalized<VMP_1ord_t> vm2(file_path);
+
+  int n_points = 100;
+  MatrixXd phases(n_points,1);
+  phases.col(0) = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd states(n_points,test_dim);
+  MatrixXd states_dot(n_points,test_dim);
+  MatrixXd variances(n_points,test_dim);
+  MatrixXd phases_out(n_points,1);
+  MatrixXd phases_dot_out(n_points,1);
+
+  Eigen::VectorXd state(test_dim);
+  Eigen::VectorXd state_dot(test_dim);
+  double phase_out, phase_dot_out;
+
+  // The batch evaluation has to give the same results of the single phase evaluation
+  EXPECT_NO_THROW(vm1.ComputeStatesGivenPhases(phases,states));
+  for (int i=0;i<n_points;i++)
+  {
+    vm1.ComputeStateGivenPhase(phases(i,0),state);
+    for (int j=0;j<test_dim;j++)
+      EXPECT_NEAR(states(i,j),state(j),1e-9);
+  }
+
+  EXPECT_NO_THROW(vm2.ComputeStatesGivenPhases(phases,states,states_dot,phases_out,phases_dot_out));
+  for (int i=0;i<n_points;i++)
+  {
+    vm2.ComputeStateGivenPhase(phases(i,0),state,state_dot,phase_out,phase_dot_out);
+    EXPECT_NEAR(phases_out(i,0),phase_out,1e-9);
+    EXPECT_NEAR(phases_dot_out(i,0),phase_dot_out,1e-9);
+    for (int j=0;j<test_dim;j++)
+    {
+      EXPECT_NEAR(states(i,j),state(j),1e-9);
+      EXPECT_NEAR(states_dot(i,j),state_dot(j),1e-9);
+    }
+  }
+}
+
+/// Gives access to the alignment configuration
+class AlignedGmr: public VirtualMechanismGmr<VMP_1ord_t>
+{
+  public:
+    inline int getDtwRadius() const {return dtw_radius_;}
+};
+
+TEST(VirtualMechanismGmrTest, DefaultAlignmentIsExact)
+{
+  // The multiresolution alignment is opt-in: with the default configuration
+  // AlignUpdateModel gives the alignment of the exact DTW on the full matrix
+  AlignedGmr vm;
+  EXPECT_EQ(vm.getDtwRadius(),-1);
+
+  int n_points = 200;
+  VectorXd t = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  VectorXd t_warped = t.array().pow(1.5);
+  MatrixXd sig1(n_points,test_dim);
+  MatrixXd sig2(n_points/2,test_dim);
+  sig1.col(0) = t;
+  sig1.col(1) = (2 * M_PI * t).array().sin();
+  for (int i=0; i<sig2.rows(); i++)
+  {
+    sig2(i,0) = t_warped(2*i);
+    sig2(i,1) = std::sin(2 * M_PI * t_warped(2*i));
+  }
+  MatrixXd phase_ref(sig2.rows(),1);
+  phase_ref.col(0) = VectorXd::LinSpaced(sig2.rows(), 0.0, 1.0);
+
+  MatrixXd phase(n_points,1), phase_exact(n_points,1);
+  dtw::align_phase_fast(phase,phase_ref,sig1,sig2,vm.getDtwRadius());
+  dtw::align_phase(phase_exact,phase_ref,sig1,sig2);
+  EXPECT_EQ(phase,phase_exact);
+
+  // The path of the exact alignment has the cost of the full matrix
+  MatrixXd D;
+  dtw::Dtw engine;
+  EXPECT_NEAR(engine.Compute(sig1,sig2),dtw::dtw(sig1,sig2,D),1e-9);
+}
+
+/// Gives access to the tables of the model
+class TabulatedGmr: public VirtualMechanismGmr<VMP_1ord_t>
+{
+  public:
+    TabulatedGmr(const std::string file_path, const int n_points_table):VirtualMechanismGmr<VMP_1ord_t>(file_path)
+    {
+      use_table_ = true;
+      n_points_table_ = n_points_table;
+      CreateTable();
+    }
+
+    void EvaluateTable(const double phase, MatrixXd& mean, MatrixXd& variance) const
+    {
+      MatrixXd mean_dot(1,mean.cols()), variance_dot(1,variance.cols());
+      mean_table_.Evaluate(phase,mean,mean_dot);
+      variance_table_.Evaluate(phase,variance,variance_dot);
+    }
+};
+
+TEST(VirtualMechanismGmrTest, TableErrorBound)
+{
+  // The error is estimated at few points of each interval, check it on a dense grid:
+  // mean and variance of the table within the stated error (no more than few percent above its estimate)
+  const int n_points_table[2] = {20, 200};
+  double prev_error = std::numeric_limits<double>::infinity();
+  for (int t=0;t<2;t++)
+  {
+    TabulatedGmr vm(file_path,n_points_table[t]);
+    const double bound = vm.getTableError();
+    EXPECT_GT(bound,0.0);
+    EXPECT_LT(bound,prev_error); // More points, smaller error
+    prev_error = bound;
+
+    int n_points = 10 * n_points_table[t] + 1;
+    MatrixXd phases(n_points,1);
+    phases.col(0) = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+    MatrixXd states(n_points,test_dim), states_dot(n_points,test_dim), variances(n_points,test_dim);
+    vm.ComputeStatesGivenPhases(phases,states,states_dot,variances); // Exact model
+    MatrixXd mean(1,test_dim), variance(1,test_dim);
+    double max_error = 0.0;
+    for (int i=0;i<n_points;i++)
+    {
+      vm.EvaluateTable(phases(i,0),mean,variance);
+      max_error = std::max(max_error,(states.row(i) - mean).cwiseAbs().maxCoeff());
+      max_error = std::max(max_error,(variances.row(i) - variance).cwiseAbs().maxCoeff());
+    }
+    EXPECT_LE(max_error,1.05 * bound + 1e-12);
+  }
+}
+
+TEST(VirtualMechanismGmrTest, LibraryLoadAndSave)
+{
+  VirtualMechanismGmr<VMP_1ord_t> vm1(file_path);
+  VirtualMechanismGmrNormalized<VMP_1ord_t> vm2(file_path);
+
+  std::vector<library::Record> records(2);
+  records[0].SetName("gmr");
+  records[1].SetName("gmr_normalized");
+  EXPECT_TRUE(vm1.SaveModelToRecord(records[0]));
+  EXPECT_TRUE(vm2.SaveModelToRecord(records[1]));
+  std::string library_path((boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("test_library_%%%%%%")).string());
+  EXPECT_TRUE(library::Write(library_path,records));
+
+  library::Library lib;
+  ASSERT_TRUE(lib.Open(library_path));
+  ASSERT_EQ(lib.GetNbRecords(),2);
+  EXPECT_EQ(lib.GetRecord(1).GetName(),"gmr_normalized");
+
+  VirtualMechanismGmr<VMP_1ord_t> vm1_lib;
+  VirtualMechanismGmrNormalized<VMP_1ord_t> vm2_lib;
+  EXPECT_TRUE(vm1_lib.CreateModelFromRecord(lib.GetRecord(0)));
+  EXPECT_TRUE(vm2_lib.CreateModelFromRecord(lib.GetRecord(1)));
+  vm1_lib.Init();
+  vm2_lib.Init();
+
+  // The guides from the library are the same as the ones from the text file
+  int n_points = 50;
+  MatrixXd phases(n_points,1);
+  phases.col(0) = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd states(n_points,test_dim), states_lib(n_points,test_dim);
+  MatrixXd states_dot(n_points,test_dim), states_dot_lib(n_points,test_dim);
+  MatrixXd phases_out(n_points,1), phases_dot_out(n_points,1);
+  vm1.ComputeStatesGivenPhases(phases,states);
+  vm1_lib.ComputeStatesGivenPhases(phases,states_lib);
+  EXPECT_LT((states - states_lib).cwiseAbs().maxCoeff(),1e-9);
+  vm2.ComputeStatesGivenPhases(phases,states,states_dot,phases_out,phases_dot_out);
+  vm2_lib.ComputeStatesGivenPhases(phases,states_lib,states_dot_lib,phases_out,phases_dot_out);
+  EXPECT_LT((states - states_lib).cwiseAbs().maxCoeff(),1e-9);
+  EXPECT_LT((states_dot - states_dot_lib).cwiseAbs().maxCoeff(),1e-9);
+  EXPECT_LT((vm1.getStateRecorded() - vm1_lib.getStateRecorded()).cwiseAbs().maxCoeff(),1e-12);
+
+  lib.Close();
+  boost::filesystem::remove(library_path);
+}
+
+TEST(VirtualMechanismGmrTest, Clone)
+{
+  VirtualMechanismGmrNormalized<VMP_1ord_t> vm(file_path);
+  boost::scoped_ptr<VMP_1ord_t::interface_t> vm_clone(vm.Clone());
+
+  // The clone copies the derived state of the guide instead of rebuilding it
+  int n_points = 50;
+  MatrixXd phases(n_points,1);
+  phases.col(0) = VectorXd::LinSpaced(n_points, 0.0, 1.0);
+  MatrixXd states(n_points,test_dim), states_clone(n_points,test_dim);
+  MatrixXd states_dot(n_points,test_dim), states_dot_clone(n_points,test_dim);
+  MatrixXd phases_out(n_points,1), phases_dot_out(n_points,1);
+  vm.ComputeStatesGivenPhases(phases,states,states_dot,phases_out,phases_dot_out);
+  dynamic_cast<VirtualMechanismGmrNormalized<VMP_1ord_t>&>(*vm_clone).ComputeStatesGivenPhases(phases,states_clone,states_dot_clone,phases_out,phases_dot_out);
+  EXPECT_EQ(states,states_clone);
+  EXPECT_EQ(states_dot,states_dot_clone);
+  EXPECT_EQ(vm.getStateRecorded(),vm_clone->getStateRecorded());
+
+  // They do not share the function approximator: the original is still valid without the clone
+  MatrixXd data = vm.getStateRecorded();
+  const double responsability = vm_clone->ComputeResponsability(data);
+  vm_clone.reset();
+  EXPECT_EQ(vm.ComputeResponsability(data),responsability);
+}
+
 TEST(VirtualMechanismGmrNormalizedTest, UpdateMethod)
 {
   VirtualMechanismGmrNormalized<VMP_1ord_t> vm1(file_path);